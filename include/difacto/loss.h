@@ -5,6 +5,8 @@
  */
 #ifndef DIFACTO_LOSS_H_
 #define DIFACTO_LOSS_H_
+#include <string.h>
+#include <stdint.h>
 #include <string>
 #include <vector>
 #include "./base.h"
@@ -12,6 +14,71 @@
 #include "dmlc/omp.h"
 #include "./sarray.h"
 namespace difacto {
+/**
+ * \brief a row major sparse matrix with 32-bit offsets and narrow indices
+ *
+ * it has the same layout as dmlc::RowBlock<I> except for the offset type, and
+ * reads less memory than dmlc::RowBlock<unsigned> in the sparse kernels. see
+ * TileStoreParam::compact_tiles
+ *
+ * \tparam I the index type, such as uint16_t
+ */
+template <typename I>
+struct CompactRowBlock {
+  /** \brief number of rows */
+  size_t size;
+  /** \brief the row offsets, with size+1 entries */
+  uint32_t const* offset;
+  /** \brief the labels */
+  dmlc::real_t const* label;
+  /** \brief the example weights, nullptr if all are 1 */
+  dmlc::real_t const* weight;
+  /** \brief the column indices */
+  I const* index;
+  /** \brief the values, nullptr if all are 1 */
+  dmlc::real_t const* value;
+};
+
+/**
+ * \brief the reusable buffers for the temporaries of a loss function
+ *
+ * a buffer grows but never shrinks, so a thread keeping one workspace
+ * allocates the temporaries only once. given the workspace a loss function is
+ * stateless, one loss can be called by any number of threads at the same time
+ * if each thread uses its own workspace. \ref Loss::CalcGrad may read results
+ * left by \ref Loss::Predict, so they should be called with the same
+ * workspace.
+ */
+class LossWorkspace {
+ public:
+  LossWorkspace() { }
+  ~LossWorkspace() { }
+  /**
+   * \brief returns the id-th buffer with length n
+   *
+   * the content is kept if the previous call with this id has the same type
+   * and length, otherwise it is undefined.
+   */
+  template <typename V>
+  SArray<V> Get(size_t id, size_t n) {
+    if (id >= buffers_.size()) buffers_.resize(id + 1);
+    buffers_[id].resize(n * sizeof(V));
+    return SArray<V>(buffers_[id]);
+  }
+  /**
+   * \brief returns the id-th buffer with length n, filled by 0
+   */
+  template <typename V>
+  SArray<V> GetZero(size_t id, size_t n) {
+    SArray<V> buf = Get<V>(id, n);
+    memset(buf.data(), 0, n * sizeof(V));
+    return buf;
+  }
+
+ private:
+  std::vector<SArray<char>> buffers_;
+};
+
 /**
  * \brief the basic class of a loss function
  */
@@ -40,10 +107,21 @@ class Loss {
    * @param data the data
    * @param param model weights
    * @return pred the predict results
+   * @param ws the workspace for temporaries, see \ref LossWorkspace
    */
   virtual void Predict(const dmlc::RowBlock<unsigned>& data,
                        const std::vector<SArray<char>>& param,
-                       SArray<real_t>* pred) = 0;
+                       SArray<real_t>* pred,
+                       LossWorkspace* ws) = 0;
+  /**
+   * \brief predict with the workspace owned by this loss, which is not thread
+   * safe
+   */
+  void Predict(const dmlc::RowBlock<unsigned>& data,
+               const std::vector<SArray<char>>& param,
+               SArray<real_t>* pred) {
+    Predict(data, param, pred, &workspace_);
+  }
   /**
    * \brief evaluate the loss
    *
@@ -51,16 +129,19 @@ class Loss {
    *
    * @param label label
    * @param pred prediction
+   * @param weight optional example weights
    *
    * @return the objective value
    */
   virtual real_t Evaluate(dmlc::real_t const* label,
-                          const SArray<real_t>& pred) const {
+                          const SArray<real_t>& pred,
+                          dmlc::real_t const* weight = nullptr) const {
     real_t objv = 0;
 #pragma omp parallel for reduction(+:objv) num_threads(nthreads_)
     for (size_t i = 0; i < pred.size(); ++i) {
       real_t y = label[i] > 0 ? 1 : -1;
-      objv += log(1 + exp(- y * pred[i]));
+      real_t w = weight ? weight[i] : 1;
+      objv += w * log(1 + exp(- y * pred[i]));
     }
     return objv;
   }
@@ -70,10 +151,70 @@ class Loss {
    * @param data the data
    * @param param model weights
    * @return grad the gradients
+   * @param ws the workspace used by the previous \ref Predict
    */
   virtual void CalcGrad(const dmlc::RowBlock<unsigned>& data,
                         const std::vector<SArray<char>>& param,
-                        SArray<real_t>* grad) = 0;
+                        SArray<real_t>* grad,
+                        LossWorkspace* ws) = 0;
+  /**
+   * \brief calculate gradient with the workspace owned by this loss, which is
+   * not thread safe
+   */
+  void CalcGrad(const dmlc::RowBlock<unsigned>& data,
+                const std::vector<SArray<char>>& param,
+                SArray<real_t>* grad) {
+    CalcGrad(data, param, grad, &workspace_);
+  }
+  /**
+   * \brief predict on a compact row block
+   *
+   * in default the block is converted into dmlc::RowBlock<unsigned>, a loss
+   * can override it to run the kernels on the compact block directly
+   */
+  virtual void Predict(const CompactRowBlock<uint16_t>& data,
+                       const std::vector<SArray<char>>& param,
+                       SArray<real_t>* pred,
+                       LossWorkspace* ws) {
+    std::vector<size_t> offset;
+    std::vector<unsigned> index;
+    Predict(Widen(data, &offset, &index), param, pred, ws);
+  }
+  /**
+   * \brief calculate gradient on a compact row block, see \ref Predict
+   */
+  virtual void CalcGrad(const CompactRowBlock<uint16_t>& data,
+                        const std::vector<SArray<char>>& param,
+                        SArray<real_t>* grad,
+                        LossWorkspace* ws) {
+    std::vector<size_t> offset;
+    std::vector<unsigned> index;
+    CalcGrad(Widen(data, &offset, &index), param, grad, ws);
+  }
+  /**
+   * \brief predict on a compact row block with 32-bit indices, see \ref
+   * Predict
+   */
+  virtual void Predict(const CompactRowBlock<unsigned>& data,
+                       const std::vector<SArray<char>>& param,
+                       SArray<real_t>* pred,
+                       LossWorkspace* ws) {
+    std::vector<size_t> offset;
+    std::vector<unsigned> index;
+    Predict(Widen(data, &offset, &index), param, pred, ws);
+  }
+  /**
+   * \brief calculate gradient on a compact row block with 32-bit indices, see
+   * \ref Predict
+   */
+  virtual void CalcGrad(const CompactRowBlock<unsigned>& data,
+                        const std::vector<SArray<char>>& param,
+                        SArray<real_t>* grad,
+                        LossWorkspace* ws) {
+    std::vector<size_t> offset;
+    std::vector<unsigned> index;
+    CalcGrad(Widen(data, &offset, &index), param, grad, ws);
+  }
   /**
    * \brief set the number of threads
    */
@@ -84,6 +225,27 @@ class Loss {
 
 
   int nthreads_;
+
+ protected:
+  /** \brief the workspace used by the overloads without a workspace */
+  LossWorkspace workspace_;
+
+ private:
+  template <typename I>
+  static dmlc::RowBlock<unsigned> Widen(const CompactRowBlock<I>& data,
+                                        std::vector<size_t>* offset,
+                                        std::vector<unsigned>* index) {
+    offset->assign(data.offset, data.offset + data.size + 1);
+    index->assign(data.index, data.index + data.offset[data.size]);
+    dmlc::RowBlock<unsigned> blk;
+    blk.size = data.size;
+    blk.offset = offset->data();
+    blk.label = data.label;
+    blk.weight = data.weight;
+    blk.index = index->data();
+    blk.value = data.value;
+    return blk;
+  }
 };
 }  // namespace difacto
 #endif  // DIFACTO_LOSS_H_
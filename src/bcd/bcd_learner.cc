@@ -6,6 +6,7 @@
 #include <cmath>
 #include "difacto/node_id.h"
 #include "reader/reader.h"
+#include "data/tile_cache.h"
 #include "loss/bin_class_metric.h"
 #include "./bcd_updater.h"
 namespace difacto {
@@ -17,17 +18,24 @@ KWArgs BCDLearner::Init(const KWArgs& kwargs) {
   // init param
   remain = param_.InitAllowUnknown(kwargs);
   // init updater
-  std::shared_ptr<Updater> updater(new BCDUpdater());
+  auto bcd_updater = new BCDUpdater();
+  std::shared_ptr<Updater> updater(bcd_updater);
   remain = updater->Init(remain);
+  V_dim_ = bcd_updater->param().V_dim;
+  if (V_dim_ > 0) {
+    remain.push_back(std::make_pair("V_dim", std::to_string(V_dim_)));
+  }
   // init model store
   model_store_ = Store::Create();
   model_store_->SetUpdater(updater);
   remain = model_store_->Init(remain);
   // init data stores
+  remain.push_back(std::make_pair("data_cache", param_.data_cache));
   tile_store_ = new TileStore();
   remain = tile_store_->Init(remain);
   // init loss
-  loss_ = Loss::Create("logit_delta", DEFAULT_NTHREADS);
+  remain.push_back(std::make_pair("fast_math", std::to_string(param_.fast_math)));
+  loss_ = Loss::Create(V_dim_ > 0 ? "fm_delta" : "logit_delta", DEFAULT_NTHREADS);
   remain = loss_->Init(remain);
   return remain;
 }
@@ -81,31 +89,69 @@ void BCDLearner::RunScheduler() {
     iter.feablks = feablks;
     std::vector<real_t> progress;
     IssueJobAndWait(NodeID::kWorkerGroup + NodeID::kServerGroup, iter, &progress);
+    AUCHistogram auc; auc.CopyFrom(progress.data() + 4);
+    progress[2] = auc.AUC();
     for (const auto& cb : epoch_end_callback_) {
       cb(epoch_, progress);
     }
     real_t cnt = progress[0];
     LL << "epoch: " << epoch_
        << ", objv: " << progress[1] / cnt
-       << ", auc: " << progress[2] / cnt
+       << ", auc: " << progress[2]
        << ", acc: " << progress[3] / cnt;
   }
 }
 
 
 void BCDLearner::PrepareData(std::vector<real_t>* fea_stats) {
+  bcd::FeaGroupStats stats(param_.num_feature_group_bits);
+  // the squared values are used by the diagonal hessian
+  tile_builder_ = new TileBuilder(tile_store_, DEFAULT_NTHREADS, true, true);
+  SArray<real_t> feacnts;
+
+  // reuse the tiles built by a previous run on the same data
+  std::unique_ptr<TileCache> cache;
+  if (param_.reuse_data_cache) {
+    int rank = model_store_->Rank(), nworkers = model_store_->NumWorkers();
+    std::stringstream args;
+    args << "bcd," << param_.data_in << "," << param_.data_val << ","
+         << param_.data_format << "," << param_.data_chunk_size << ","
+         << param_.num_feature_group_bits << "," << param_.neg_sampling << ","
+         << rank << "," << nworkers;
+    cache.reset(new TileCache(
+        param_.data_cache + "tiles_" + std::to_string(rank) + "_" +
+        std::to_string(nworkers),
+        TileCache::Signature(param_.data_in + ";" + param_.data_val,
+                             args.str())));
+    // counts = {ntrain_blks, nval_blks, the number of rows of each rowblk},
+    // and info = fea_stats
+    std::vector<uint64_t> counts;
+    if (cache->Load(tile_builder_, &feaids_, &feacnts, &counts, fea_stats)) {
+      ntrain_blks_ = counts[0];
+      nval_blks_ = counts[1];
+      for (size_t i = 2; i < counts.size(); ++i) {
+        size_t nrows = counts[i];
+        pred_.push_back(SArray<real_t>(nrows));
+        XV_.push_back(SArray<real_t>(nrows * V_dim_));
+      }
+      int t = model_store_->Push(
+          feaids_, Store::kFeaCount, feacnts, SArray<int>());
+      model_store_->Wait(t);
+      return;
+    }
+  }
+
   // read train data
   Reader train(param_.data_in, param_.data_format,
                model_store_->Rank(), model_store_->NumWorkers(),
-               param_.data_chunk_size);
-  bcd::FeaGroupStats stats(param_.num_feature_group_bits);
-  tile_builder_ = new TileBuilder(tile_store_, DEFAULT_NTHREADS, true);
-  SArray<real_t> feacnts;
+               param_.data_chunk_size, param_.data_num_readers,
+               param_.data_read_ahead, -1, param_.neg_sampling);
   while (train.Next()) {
     auto rowblk = train.Value();
     stats.Add(rowblk);
     tile_builder_->Add(rowblk, &feaids_, &feacnts);
     pred_.push_back(SArray<real_t>(rowblk.size));
+    XV_.push_back(SArray<real_t>(rowblk.size * V_dim_));
     ++ntrain_blks_;
   }
   // push the feature ids and feature counts to the servers
@@ -118,14 +164,23 @@ void BCDLearner::PrepareData(std::vector<real_t>* fea_stats) {
   if (param_.data_val.size()) {
     Reader val(param_.data_val, param_.data_format,
                model_store_->Rank(), model_store_->NumWorkers(),
-               param_.data_chunk_size);
+               param_.data_chunk_size, param_.data_num_readers,
+               param_.data_read_ahead);
     while (val.Next()) {
       auto rowblk = val.Value();
       tile_builder_->Add(rowblk);
       pred_.push_back(SArray<real_t>(rowblk.size));
+      XV_.push_back(SArray<real_t>(rowblk.size * V_dim_));
       ++nval_blks_;
     }
   }
+  if (cache) {
+    tile_builder_->Wait();
+    std::vector<uint64_t> counts = {static_cast<uint64_t>(ntrain_blks_),
+                                    static_cast<uint64_t>(nval_blks_)};
+    for (const auto& p : pred_) counts.push_back(p.size());
+    cache->Save(*tile_builder_, feaids_, feacnts, counts, *fea_stats);
+  }
 
   // wait the previous push finished
   model_store_->Wait(t);
@@ -166,6 +221,37 @@ void BCDLearner::BuildFeatureMap(const std::vector<Range>& feablk_ranges) {
     bcd::Delta::Init(feablk.feaids.size(), &feablk.delta);
     feablk.pos = pos[i];
   }
+  if (V_dim_ == 0) return;
+
+  // init V, which is the same as the servers, see bcd::InitV
+  real_t V_init_scale = std::static_pointer_cast<BCDUpdater>(
+      model_store_->updater())->param().V_init_scale;
+  int k = V_dim_ + 1;
+  for (auto& feablk : feablks_) {
+    size_t m = feablk.feaids.size();
+    feablk.weights.resize(m * k, 0);
+    for (size_t i = 0; i < m; ++i) {
+      bcd::InitV(feablk.feaids[i], V_dim_, V_init_scale,
+                 feablk.weights.data() + i * k + 1);
+    }
+  }
+
+  // init the prediction and XV by treating V as the change from 0
+  for (int d = 0; d < ntrain_blks_ + nval_blks_; ++d) {
+    for (size_t f = 0; f < feablks_.size(); ++f) {
+      Tile tile; tile_store_->Fetch(d, f, &tile);
+      SArray<int> w_pos(tile.colmap.size());
+      int pos_begin = feablks_[f].pos.begin;
+      for (size_t i = 0; i < w_pos.size(); ++i) {
+        int map = tile.colmap[i];
+        w_pos[i] = map < 0 ? -1 : (map - pos_begin) * k;
+      }
+      SArray<char> weights(feablks_[f].weights);
+      loss_->Predict(tile.data.GetBlock(),
+                     {weights, SArray<char>(w_pos), SArray<char>(XV_[d]), weights},
+                     &pred_[d], &grad_ws_);
+    }
+  }
 }
 
 void BCDLearner::IterateData(const std::vector<int>& feablks,
@@ -178,6 +264,7 @@ void BCDLearner::IterateData(const std::vector<int>& feablks,
     }
   }
 
+  auc_hist_.Clear();
   size_t nfeablk = feablks.size();
   int tau = 0;
   bcd::BlockTracker feablk_tracker(nfeablk);
@@ -191,6 +278,7 @@ void BCDLearner::IterateData(const std::vector<int>& feablks,
     if (i >= tau) feablk_tracker.Wait(i - tau);
   }
   for (int i = nfeablk - tau; i < nfeablk ; ++i) feablk_tracker.Wait(i);
+  if (progress->size()) auc_hist_.CopyTo(progress->data() + 4);
 }
 
 void BCDLearner::IterateFeablk(int blk_id,
@@ -200,8 +288,8 @@ void BCDLearner::IterateFeablk(int blk_id,
   auto& feablk = feablks_[blk_id];
   SArray<int> grad_offset = feablk.model_offset;
   for (int& o : grad_offset) o += o;  // it's ok to overwrite model_offset_[blk_id]
-  SArray<real_t> grad(
-      grad_offset.empty() ? feablk.feaids.size() * 2 : grad_offset.back());
+  SArray<real_t> grad(grad_offset.empty() ?
+                      feablk.feaids.size() * 2 * (V_dim_ + 1) : grad_offset.back());
   for (int i = 0; i < ntrain_blks_; ++i) {
     CalcGrad(i, blk_id, grad_offset, &grad);
   }
@@ -216,6 +304,13 @@ void BCDLearner::IterateFeablk(int blk_id,
     // the callback will be called when the pull is finished
     auto pull_callback = [this, blk_id, delta_w, delta_w_offset, progress, on_complete]() {
       feablks_[blk_id].model_offset = *delta_w_offset;
+      if (V_dim_ > 0) {
+        // update the local copy of the weights, then UpdtPred uses it
+        auto& weights = feablks_[blk_id].weights;
+        CHECK(delta_w_offset->empty());
+        CHECK_EQ(delta_w->size(), weights.size());
+        for (size_t i = 0; i < weights.size(); ++i) weights[i] += (*delta_w)[i];
+      }
       for (int i = 0; i < ntrain_blks_ + nval_blks_; ++i) {
         UpdtPred(i, blk_id, *delta_w_offset, *delta_w, progress);
       }
@@ -242,6 +337,7 @@ void BCDLearner::CalcGrad(int rowblk_id, int colblk_id,
   // build index
   size_t n = tile.colmap.size();
   bool no_os = grad_offset.empty();
+  int k = V_dim_ + 1;
   SArray<int> grad_pos(n);
   SArray<real_t> delta(n);
   auto& feablk = feablks_[colblk_id];
@@ -252,14 +348,27 @@ void BCDLearner::CalcGrad(int rowblk_id, int colblk_id,
       grad_pos[i] = -1;
     } else {
       map -= pos_begin; CHECK_GE(map, 0);
-      grad_pos[i] = no_os ? map * 2 : grad_offset[map] * 2;
+      grad_pos[i] = no_os ? map * 2 * k : grad_offset[map] * 2;
       delta[i] = feablk.delta[map];
     }
   }
 
   // calc grad
+  if (V_dim_ > 0) {
+    SArray<int> w_pos(n);
+    for (size_t i = 0; i < n; ++i) {
+      int map = tile.colmap[i];
+      w_pos[i] = map < 0 ? -1 : (map - pos_begin) * k;
+    }
+    loss_->CalcGrad(tile.data.GetBlock(), {SArray<char>(pred_[rowblk_id]),
+            SArray<char>(grad_pos), SArray<char>(XV_[rowblk_id]),
+            SArray<char>(feablk.weights), SArray<char>(w_pos),
+            SArray<char>(tile.xx_value)}, grad, &grad_ws_);
+    return;
+  }
   loss_->CalcGrad(tile.data.GetBlock(), {SArray<char>(pred_[rowblk_id]),
-          SArray<char>(grad_pos), SArray<char>(delta)}, grad);
+          SArray<char>(grad_pos), SArray<char>(delta),
+          SArray<char>(tile.xx_value)}, grad, &grad_ws_);
 }
 
 void BCDLearner::UpdtPred(int rowblk_id, int colblk_id,
@@ -282,34 +391,51 @@ void BCDLearner::UpdtPred(int rowblk_id, int colblk_id,
       w_pos[i] = -1;
     } else {
       map -= pos_begin; CHECK_GE(map, 0);
-      w_pos[i] = no_os ? map : delta_w_offset[map];
+      w_pos[i] = no_os ? map * (V_dim_ + 1) : delta_w_offset[map];
       bcd::Delta::Update(delta_w[w_pos[i]], &feablk.delta[map]);
     }
   }
 
-  // predict
-  loss_->Predict(tile.data.GetBlock(),
-                 {SArray<char>(delta_w), SArray<char>(w_pos)},
-                 &pred_[rowblk_id]);
+  // predict. it runs in the pull callbacks, which may overlap with CalcGrad
+  static thread_local LossWorkspace ws;
+  if (V_dim_ > 0) {
+    loss_->Predict(tile.data.GetBlock(),
+                   {SArray<char>(delta_w), SArray<char>(w_pos),
+                    SArray<char>(XV_[rowblk_id]), SArray<char>(feablk.weights)},
+                   &pred_[rowblk_id], &ws);
+  } else {
+    loss_->Predict(tile.data.GetBlock(),
+                   {SArray<char>(delta_w), SArray<char>(w_pos)},
+                   &pred_[rowblk_id], &ws);
+  }
 
   // evaluate
   if (!progress) return;
   CHECK_EQ(tile.data.label.size(), pred_[rowblk_id].size());
+  const auto& weight = tile.data.weight;
   BinClassMetric metric(tile.data.label.data(),
                         pred_[rowblk_id].data(),
-                        pred_[rowblk_id].size());
+                        pred_[rowblk_id].size(), DEFAULT_NTHREADS,
+                        param_.fast_math,
+                        weight.empty() ? nullptr : weight.data());
 
-  // value[0] : count
+  // value[0] : count, the sum of the weights if given
   // value[1] : objv
-  // value[2] : auc
+  // value[2] : auc, computed by the scheduler from the histogram
   // value[3] : acc
-  // value[4] : ...
+  // value[4] : ..., the AUCHistogram, copied by IterateData at the end
   auto& val = *progress;
-  if (val.empty()) val.resize(4);
-  val[0] += tile.data.label.size();
+  if (val.empty()) val.resize(4 + AUCHistogram::kVecSize);
+  if (weight.empty()) {
+    val[0] += tile.data.label.size();
+  } else {
+    for (auto w : weight) val[0] += w;
+  }
   val[1] += metric.LogitObjv();
-  val[2] += metric.AUC();
   val[3] += metric.Accuracy(.5);
+  auc_hist_.Add(
+      tile.data.label.data(), pred_[rowblk_id].data(), pred_[rowblk_id].size(),
+      DEFAULT_NTHREADS, weight.empty() ? nullptr : weight.data());
 }
 
 }  // namespace difacto
@@ -14,6 +14,8 @@
 #include "./bcd_param.h"
 #include "./bcd_utils.h"
 #include "loss/logit_loss_delta.h"
+#include "loss/fm_loss_delta.h"
+#include "loss/bin_class_metric.h"
 namespace difacto {
 
 class BCDLearner : public Learner {
@@ -93,6 +95,8 @@ class BCDLearner : public Learner {
   Store* model_store_ = nullptr;
   /** \brief the loss function */
   Loss* loss_ = nullptr;
+  /** \brief the loss workspace used by CalcGrad */
+  LossWorkspace grad_ws_;
   /** \brief data store */
   TileStore* tile_store_ = nullptr;
   TileBuilder* tile_builder_ = nullptr;
@@ -106,12 +110,20 @@ class BCDLearner : public Learner {
     Range pos;
     SArray<real_t> delta;
     SArray<int> model_offset;
+    /** \brief the local copy of [w, V] for FM, see \ref FMLossDelta */
+    SArray<real_t> weights;
   };
   std::vector<FeaBlk> feablks_;
 
   SArray<feaid_t> feaids_;
 
   std::vector<SArray<real_t>> pred_;
+  /** \brief the AUC histogram of the current data pass, see \ref UpdtPred */
+  AUCHistogram auc_hist_;
+  /** \brief X*V of each row block for FM */
+  std::vector<SArray<real_t>> XV_;
+  /** \brief the embedding dimension */
+  int V_dim_ = 0;
 
   std::vector<std::function<void(
       int epoch, const std::vector<real_t> & prog)>> epoch_end_callback_;
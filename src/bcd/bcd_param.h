@@ -16,6 +16,12 @@ struct BCDLearnerParam : public dmlc::Parameter<BCDLearnerParam> {
   std::string data_format;
   /** \brief the directory for the data chache */
   std::string data_cache;
+  /**
+   * \brief if nonzero, save the tiles built from the data into data_cache,
+   * and load them in the next runs on the unchanged data instead of parsing
+   * the data again
+   */
+  int reuse_data_cache;
   /** \brief the model output for a training task */
   std::string model_out;
   /** \brief the model input for warm start */
@@ -30,22 +36,43 @@ struct BCDLearnerParam : public dmlc::Parameter<BCDLearnerParam> {
   int random_block;
   /** \brief the number of heading bits used to encode the feature group, default is 12 */
   int num_feature_group_bits;
+  /**
+   * \brief the probability to keep a negative example of the training data,
+   * the kept ones are weighted by 1 / neg_sampling
+   */
   float neg_sampling;
+  /**
+   * \brief use the approximations in \ref fast_math for exp and log in the
+   * loss and in the objective of the progress, default is false
+   */
+  int fast_math;
   /** \brief the size of data in MB read each time for processing, in default 256 MB */
   int data_chunk_size;
+  /**
+   * \brief the number of sub-parts of a worker's data read at the same time,
+   * should be the same for all workers
+   */
+  int data_num_readers;
+  /** \brief the maximal number of data chunks parsed in advance */
+  int data_read_ahead;
 
   DMLC_DECLARE_PARAMETER(BCDLearnerParam) {
     DMLC_DECLARE_FIELD(data_format).set_default("libsvm");
     DMLC_DECLARE_FIELD(data_in);
     DMLC_DECLARE_FIELD(data_val).set_default("");
     DMLC_DECLARE_FIELD(data_cache).set_default("/tmp/difacto_bcd_");
+    DMLC_DECLARE_FIELD(reuse_data_cache).set_default(0);
     DMLC_DECLARE_FIELD(data_chunk_size).set_default(1<<28);
+    DMLC_DECLARE_FIELD(data_num_readers).set_range(1, 64).set_default(1);
+    DMLC_DECLARE_FIELD(data_read_ahead).set_range(1, 1024).set_default(8);
     DMLC_DECLARE_FIELD(model_out).set_default("");
     DMLC_DECLARE_FIELD(model_in).set_default("");
     DMLC_DECLARE_FIELD(loss).set_default("fm");
     DMLC_DECLARE_FIELD(max_num_epochs).set_default(20);
     DMLC_DECLARE_FIELD(random_block).set_default(1);
     DMLC_DECLARE_FIELD(num_feature_group_bits).set_default(0);
+    DMLC_DECLARE_FIELD(neg_sampling).set_range(0, 1).set_default(1);
+    DMLC_DECLARE_FIELD(fast_math).set_range(0, 1).set_default(0);
     DMLC_DECLARE_FIELD(block_ratio).set_default(4);
   }
 };
@@ -18,7 +18,8 @@
 namespace difacto {
 
 struct BCDUpdaterParam : public dmlc::Parameter<BCDUpdaterParam> {
-  int V_dim = 0;
+  /** \brief the embedding dimension, 0 means logistic regression */
+  int V_dim;
   int tail_feature_filter;
 
   /** \brief the l1 regularizer for :math:`w`: :math:`\lambda_1 |w|_1` */
@@ -27,12 +28,22 @@ struct BCDUpdaterParam : public dmlc::Parameter<BCDUpdaterParam> {
   float l2;
   /** \brief the learning rate :math:`\eta` (or :math:`\alpha`) for :math:`w` */
   float lr;
+  /** \brief the l2 regularizer for :math:`V`: :math:`\lambda_2 \|V_i\|_2^2` */
+  float V_l2;
+  /**
+   * \brief V is initialized by uniform distribution in
+   *   [-V_init_scale, +V_init_scale], see \ref bcd::InitV
+   */
+  float V_init_scale;
 
   DMLC_DECLARE_PARAMETER(BCDUpdaterParam) {
+    DMLC_DECLARE_FIELD(V_dim).set_range(0, 10000).set_default(0);
     DMLC_DECLARE_FIELD(tail_feature_filter).set_default(4);
     DMLC_DECLARE_FIELD(l1).set_default(1);
     DMLC_DECLARE_FIELD(l2).set_default(.01);
     DMLC_DECLARE_FIELD(lr).set_default(.9);
+    DMLC_DECLARE_FIELD(V_l2).set_default(.01);
+    DMLC_DECLARE_FIELD(V_init_scale).set_default(.01);
   }
 };
 
@@ -60,25 +71,10 @@ class BCDUpdater : public Updater {
       values->resize(feaids.size());
       KVMatch(feaids_, feacnt_, feaids, values);
     } else if (value_type == Store::kWeight) {
+      // every feature has V_dim+1 weights, so no offsets are needed
       if (weights_.empty()) InitWeights();
-      values->resize(feaids.size() * (param_.V_dim+1));
-      if (param_.V_dim == 0) {
-        KVMatch(feaids_, w_delta_, feaids, values);
-      } else {
-        offsets->resize(feaids.size());
-        SArray<int> pos; FindPosition(feaids_, feaids, &pos);
-        int *os = offsets->data(); os[0] = 0;
-        real_t* val = values->data();
-        for (size_t i = 0; i < pos.size(); ++i) {
-          CHECK_NE(pos[i], -1);
-          int start = offsets_[pos[i]+1];
-          int len = offsets_[pos[i]+1] - start;
-          os[1] = os[0] + len;
-          memcpy(val, w_delta_.data() + start, len * sizeof(real_t));
-          val += len; ++os;
-        }
-        values->resize(os[1]);
-      }
+      KVMatch(feaids_, w_delta_, feaids, values);
+      if (offsets) offsets->clear();
     } else {
       LOG(FATAL) << "...";
     }
@@ -96,7 +92,7 @@ class BCDUpdater : public Updater {
       if (weights_.empty()) InitWeights();
       SArray<int> pos; FindPosition(feaids_, feaids, &pos);
       if (offsets.empty()) {
-        int k = 2;
+        int k = 2 * (param_.V_dim + 1);
         CHECK_EQ(values.size(), feaids.size()*k);
         for (size_t i = 0; i < pos.size(); ++i) {
           CHECK_NE(pos[i], -1);
@@ -129,9 +125,13 @@ class BCDUpdater : public Updater {
     feacnt_.clear();
 
     // init weight
-    CHECK_EQ(param_.V_dim, 0);
-    weights_.resize(feaids_.size());
-    w_delta_.resize(feaids_.size());
+    int k = param_.V_dim + 1;
+    weights_.resize(feaids_.size() * k);
+    w_delta_.resize(feaids_.size() * k);
+    for (size_t i = 0; i < feaids_.size() && k > 1; ++i) {
+      bcd::InitV(feaids_[i], param_.V_dim, param_.V_init_scale,
+                 weights_.data() + i * k + 1);
+    }
     bcd::Delta::Init(feaids_.size(), &delta_);
   }
 
@@ -142,8 +142,9 @@ class BCDUpdater : public Updater {
     real_t g = grad[0];
     real_t g_pos = g + param_.l1, g_neg = g - param_.l1;
     real_t u = grad[1] / param_.lr + 1e-10;
-    int i = offsets_.size() ? offsets_[idx] : idx;
+    int i = offsets_.size() ? offsets_[idx] : idx * (param_.V_dim + 1);
     real_t w = weights_[i];
+    real_t max_d = delta_[idx];
     real_t d = - w;
 
     if (g_pos <= u * w) {
@@ -155,6 +156,18 @@ class BCDUpdater : public Updater {
     bcd::Delta::Update(d, &delta_[idx]);
     weights_[i] += d;
     w_delta_[i] = d;
+
+    // update V by the diagonal newton step with l2, within the same trust
+    // region as w
+    CHECK_EQ(grad_len, 2 * (param_.V_dim + 1));
+    for (int k = 1; k <= param_.V_dim; ++k) {
+      real_t V = weights_[i+k];
+      real_t gV = grad[2*k] + param_.V_l2 * V;
+      real_t uV = grad[2*k+1] / param_.lr + param_.V_l2 + 1e-10;
+      real_t dV = std::min(max_d, std::max(- max_d, - gV / uV));
+      weights_[i+k] += dV;
+      w_delta_[i+k] = dV;
+    }
   }
 
   BCDUpdaterParam param_;
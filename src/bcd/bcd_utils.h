@@ -143,6 +143,23 @@ class BlockTracker {
   std::vector<int> done_;
 };
 
+/**
+ * \brief init the embedding V of a feature uniformly in [-scale, +scale]
+ *
+ * the values only depend on the feature id, so a worker can compute the
+ * initial X*V without pulling V from the servers
+ */
+inline void InitV(feaid_t id, int V_dim, real_t scale, real_t* V) {
+  for (int k = 0; k < V_dim; ++k) {
+    // splitmix64
+    uint64_t z = id * static_cast<uint64_t>(V_dim) + k + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z = z ^ (z >> 31);
+    V[k] = (static_cast<real_t>(z >> 40) / (1 << 24) - .5) * 2 * scale;
+  }
+}
+
 class Delta {
  public:
   /**
@@ -0,0 +1,167 @@
+/**
+ * Copyright (c) 2015 by Contributors
+ */
+#ifndef DIFACTO_COMMON_CPU_DISPATCH_H_
+#define DIFACTO_COMMON_CPU_DISPATCH_H_
+#include <stdlib.h>
+#include <string>
+#include "dmlc/logging.h"
+namespace difacto {
+
+/**
+ * \brief the instruction set variants the numeric kernels are compiled for
+ */
+enum class ISA {
+  kGeneric = 0,
+  kAVX2 = 1,     // avx2 + fma
+  kAVX512 = 2    // avx512f + avx512vl
+};
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DIFACTO_CPU_DISPATCH 1
+// fp-contract=off stops fusing a*b+c into fma, so the elementwise results are
+// identical among variants. reductions also need a fixed order, see LaneSum.
+// no-trapping-math allows if-converting the branches in kernels such as
+// fast_math::Exp, so they can be vectorized. it changes no result since the fp
+// exceptions are never unmasked, but it only pays off with the wide variants,
+// so the generic one, also the fallback for old CPUs, keeps the default
+#define DIFACTO_KERNEL_OPTIMIZE \
+  optimize("fp-contract=off", "no-trapping-math"), flatten
+#define DIFACTO_TARGET_GENERIC __attribute__((optimize("fp-contract=off"), \
+                                              flatten))
+#define DIFACTO_TARGET_AVX2 __attribute__(( \
+  target("avx2,fma"), DIFACTO_KERNEL_OPTIMIZE))
+#define DIFACTO_TARGET_AVX512 __attribute__(( \
+  target("avx512f,avx512vl,avx2,fma"), DIFACTO_KERNEL_OPTIMIZE))
+#else
+#define DIFACTO_CPU_DISPATCH 0
+#define DIFACTO_TARGET_GENERIC
+#define DIFACTO_TARGET_AVX2
+#define DIFACTO_TARGET_AVX512
+#endif
+
+/**
+ * \brief return the best ISA supported by the running CPU
+ */
+inline ISA SupportedISA() {
+#if DIFACTO_CPU_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("avx512vl")) {
+    return ISA::kAVX512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return ISA::kAVX2;
+  }
+#endif
+  return ISA::kGeneric;
+}
+
+inline const char* ISAName(ISA isa) {
+  switch (isa) {
+    case ISA::kAVX512: return "avx512";
+    case ISA::kAVX2: return "avx2";
+    default: return "generic";
+  }
+}
+
+/**
+ * \brief the ISA used by \ref Dispatch
+ *
+ * in default it is \ref SupportedISA. one can force a lower variant by the
+ * environment variable DIFACTO_ISA, which is one of generic, avx2, and avx512.
+ */
+inline ISA& ActiveISA() {
+  static ISA isa = []() {
+    ISA best = SupportedISA();
+    const char* env = getenv("DIFACTO_ISA");
+    if (env == nullptr) return best;
+    std::string name(env);
+    ISA want = best;
+    if (name == "generic") {
+      want = ISA::kGeneric;
+    } else if (name == "avx2") {
+      want = ISA::kAVX2;
+    } else if (name == "avx512") {
+      want = ISA::kAVX512;
+    } else {
+      LOG(WARNING) << "unknown DIFACTO_ISA=" << name << ", use " << ISAName(best);
+    }
+    if (want > best) {
+      LOG(WARNING) << ISAName(want) << " is not supported by this CPU, use "
+                   << ISAName(best);
+      want = best;
+    }
+    return want;
+  }();
+  return isa;
+}
+
+/**
+ * \brief set the ISA used by \ref Dispatch, it is capped by \ref SupportedISA
+ */
+inline void SetISA(ISA isa) {
+  ISA best = SupportedISA();
+  ActiveISA() = isa > best ? best : isa;
+}
+
+template <typename F>
+DIFACTO_TARGET_GENERIC void RunGeneric(const F& kernel) { kernel(); }
+
+template <typename F>
+DIFACTO_TARGET_AVX2 void RunAVX2(const F& kernel) { kernel(); }
+
+template <typename F>
+DIFACTO_TARGET_AVX512 void RunAVX512(const F& kernel) { kernel(); }
+
+/**
+ * \brief run a kernel with the code generated for \ref ActiveISA
+ *
+ * the kernel is inlined into a function compiled for each ISA variant, so one
+ * binary runs with native vector width on mixed hardware without -march.
+ * the kernel should not contain omp pragmas, the outlined omp bodies are
+ * compiled for the generic ISA. call it inside the parallel region instead:
+ *
+ * \code
+ * #pragma omp parallel num_threads(nthreads)
+ * {
+ *   Range rg = Range(0, n).Segment(omp_get_thread_num(), omp_get_num_threads());
+ *   Dispatch([&]() { for (size_t i = rg.begin; i < rg.end; ++i) y[i] += x[i]; });
+ * }
+ * \endcode
+ */
+template <typename F>
+inline void Dispatch(const F& kernel) {
+  switch (ActiveISA()) {
+    case ISA::kAVX512: RunAVX512(kernel); return;
+    case ISA::kAVX2: RunAVX2(kernel); return;
+    default: RunGeneric(kernel); return;
+  }
+}
+
+/**
+ * \brief returns sum_{begin <= i < end} f(i) in an order independent of the ISA
+ *
+ * omp simd reductions sum with as many partial sums as the vector width, so
+ * the results differ among the ISA variants. here element i always goes to
+ * partial sum (i - begin) % kLanes, and the partial sums are added in order at
+ * the end. the fixed width inner loop is still vectorized inside \ref
+ * Dispatch.
+ */
+template <typename T, typename F>
+inline T LaneSum(size_t begin, size_t end, const F& f) {
+  const int kLanes = 16;
+  T lane[kLanes];
+  for (int k = 0; k < kLanes; ++k) lane[k] = 0;
+  size_t i = begin;
+  for (; i + kLanes <= end; i += kLanes) {
+    for (int k = 0; k < kLanes; ++k) lane[k] += f(i + k);
+  }
+  for (int k = 0; i < end; ++i, ++k) lane[k] += f(i);
+  T sum = 0;
+  for (int k = 0; k < kLanes; ++k) sum += lane[k];
+  return sum;
+}
+
+}  // namespace difacto
+#endif  // DIFACTO_COMMON_CPU_DISPATCH_H_
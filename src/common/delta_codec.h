@@ -0,0 +1,273 @@
+/**
+ * Copyright (c) 2015 by Contributors
+ */
+#ifndef DIFACTO_COMMON_DELTA_CODEC_H_
+#define DIFACTO_COMMON_DELTA_CODEC_H_
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include "dmlc/logging.h"
+#include "./cpu_dispatch.h"
+#if DIFACTO_CPU_DISPATCH
+#include <immintrin.h>
+#endif  // DIFACTO_CPU_DISPATCH
+namespace difacto {
+
+/**
+ * \brief compress a list of integers by delta encoding and bit packing
+ *
+ * the differences between adjacent integers are zigzag encoded, so both
+ * sorted and unsorted lists work, and then packed into blocks of \ref
+ * kBlockSize integers. each block starts with a byte of the bit width used by
+ * all integers in this block, followed by the packed bits. it works well for
+ * sorted indices and offsets, whose differences are small.
+ *
+ * \code
+ * std::string buf;
+ * DeltaCodec::Encode(idx.data(), idx.size(), &buf);
+ * DeltaCodec::Decode(buf.data(), idx.size(), out.data());
+ * \endcode
+ *
+ * \ref Pack skips the delta encoding for lists of small integers.
+ *
+ * if \ref ActiveISA is not generic, the blocks with at most \ref
+ * kMaxShuffleWidth bits are unpacked 8 integers at a time by an AVX2 kernel,
+ * which gathers the bytes of each integer by a shuffle and then aligns them by
+ * a per-lane shift. the wider blocks and the tails of blocks are unpacked one
+ * by one.
+ */
+class DeltaCodec {
+ public:
+  /** \brief the number of integers in a block */
+  static const int kBlockSize = 128;
+  /** \brief the decoder may read this number of bytes beyond the data */
+  static const int kPadding = 8;
+  /** \brief the maximal bit width unpacked by the vectorized kernel */
+  static const int kMaxShuffleWidth = 24;
+
+  /**
+   * \brief append the encoded integers into out
+   *
+   * @param data the integers, can be signed or unsigned with up to 64 bits
+   * @param n the number of integers
+   * @param out the output
+   */
+  template <typename T>
+  static void Encode(const T* data, size_t n, std::string* out) {
+    EncodeImpl<true>(data, n, out);
+  }
+
+  /**
+   * \brief decode n integers
+   *
+   * @param in the encoded data, which should be followed by at least \ref
+   * kPadding readable bytes
+   * @param n the number of integers
+   * @param data the output, should be pre-allocated
+   * @return the position after the encoded data
+   */
+  template <typename T>
+  static const char* Decode(const char* in, size_t n, T* data) {
+    return DecodeImpl<true>(in, n, data);
+  }
+
+  /**
+   * \brief append the bit packed integers into out without delta encoding,
+   * which suits small unsigned integers such as the gaps between sorted indices
+   */
+  template <typename T>
+  static void Pack(const T* data, size_t n, std::string* out) {
+    EncodeImpl<false>(data, n, out);
+  }
+
+  /**
+   * \brief unpack n integers written by \ref Pack, see \ref Decode
+   */
+  template <typename T>
+  static const char* Unpack(const char* in, size_t n, T* data) {
+    return DecodeImpl<false>(in, n, data);
+  }
+
+  /**
+   * \brief the maximal size of n encoded integers
+   */
+  static size_t MaxEncodedSize(size_t n) {
+    return (n + kBlockSize - 1) / kBlockSize + n * sizeof(uint64_t);
+  }
+
+ private:
+  template <bool kDelta, typename T>
+  static void EncodeImpl(const T* data, size_t n, std::string* out) {
+    uint64_t prev = 0;
+    uint64_t z[kBlockSize];
+    for (size_t i = 0; i < n; i += kBlockSize) {
+      int cnt = static_cast<int>(std::min(static_cast<size_t>(kBlockSize), n - i));
+      uint64_t bits = 0;
+      for (int j = 0; j < cnt; ++j) {
+        uint64_t v = Extend(data[i+j]);
+        z[j] = kDelta ? ZigZag(v - prev) : v;
+        prev = v;
+        bits |= z[j];
+      }
+      int width = 0;
+      while (width < 64 && (bits >> width)) ++width;
+      // the 64-bit window used by the decoder can hold at most 57 bits
+      if (width > 56) width = 64;
+      out->push_back(static_cast<char>(width));
+      if (width == 64) {
+        out->append(reinterpret_cast<const char*>(z), cnt * sizeof(uint64_t));
+        continue;
+      }
+      size_t begin = out->size();
+      out->resize(begin + (cnt * width + 7) / 8 + kPadding, 0);
+      char* p = &(*out)[begin];
+      for (int j = 0; j < cnt; ++j) {
+        size_t bit = static_cast<size_t>(j) * width;
+        uint64_t word;
+        memcpy(&word, p + (bit >> 3), 8);
+        word |= z[j] << (bit & 7);
+        memcpy(p + (bit >> 3), &word, 8);
+      }
+      out->resize(begin + (cnt * width + 7) / 8);
+    }
+  }
+
+  template <bool kDelta, typename T>
+  static const char* DecodeImpl(const char* in, size_t n, T* data) {
+    uint64_t prev = 0;
+    uint64_t buf[kBlockSize];
+    // 64-bit integers without delta encoding are unpacked in place
+    const bool inplace = !kDelta && sizeof(T) == sizeof(uint64_t);
+    for (size_t i = 0; i < n; i += kBlockSize) {
+      int cnt = static_cast<int>(std::min(static_cast<size_t>(kBlockSize), n - i));
+      int width = static_cast<unsigned char>(*in++);
+      uint64_t* z = inplace ? reinterpret_cast<uint64_t*>(data + i) : buf;
+      if (width == 64) {
+        memcpy(z, in, cnt * sizeof(uint64_t));
+        in += cnt * sizeof(uint64_t);
+      } else {
+        CHECK_LE(width, 56) << "corrupted data";
+        UnpackBlock(in, cnt, width, z);
+        in += (cnt * width + 7) / 8;
+      }
+      T* out = data + i;
+      if (kDelta) {
+        for (int j = 0; j < cnt; ++j) {
+          prev += UnZigZag(z[j]);
+          out[j] = static_cast<T>(prev);
+        }
+      } else if (!inplace) {
+        for (int j = 0; j < cnt; ++j) out[j] = static_cast<T>(z[j]);
+      }
+    }
+    return in;
+  }
+
+  static void UnpackBlock(const char* in, int cnt, int width, uint64_t* z) {
+    int j = 0;
+#if DIFACTO_CPU_DISPATCH
+    if (width > 0 && width <= kMaxShuffleWidth &&
+        ActiveISA() != ISA::kGeneric) {
+      j = UnpackShuffle(in, cnt, width, GetShuffleTable(), z);
+    }
+#endif  // DIFACTO_CPU_DISPATCH
+    uint64_t mask = (static_cast<uint64_t>(1) << width) - 1;
+    for (; j < cnt; ++j) {
+      size_t bit = static_cast<size_t>(j) * width;
+      uint64_t word;
+      memcpy(&word, in + (bit >> 3), 8);
+      z[j] = (word >> (bit & 7)) & mask;
+    }
+  }
+
+#if DIFACTO_CPU_DISPATCH
+  /**
+   * \brief the shuffle masks and shifts of each bit width
+   *
+   * 8 integers with w bits take exactly w bytes. integers 0-3 are gathered from
+   * the 16 bytes loaded at the group begin into the low 128-bit lane, and 4-7
+   * from the ones loaded at byte 4w/8 into the high lane, since the shuffle
+   * does not cross lanes. each integer then takes the 4 bytes containing its
+   * first bit, and is shifted right by the bit position within the first byte,
+   * which needs w <= 32 - 7.
+   */
+  struct ShuffleTable {
+    alignas(32) uint8_t shuffle[kMaxShuffleWidth + 1][32];
+    alignas(32) uint32_t shift[kMaxShuffleWidth + 1][8];
+  };
+
+  static const ShuffleTable& GetShuffleTable() {
+    static ShuffleTable table = []() {
+      ShuffleTable t;
+      memset(&t, 0, sizeof(t));
+      for (int w = 1; w <= kMaxShuffleWidth; ++w) {
+        for (int lane = 0; lane < 2; ++lane) {
+          int first_bit = (lane * 4 * w) & 7;
+          for (int k = 0; k < 4; ++k) {
+            int bit = first_bit + k * w;
+            for (int i = 0; i < 4; ++i) {
+              t.shuffle[w][lane * 16 + k * 4 + i] = (bit >> 3) + i;
+            }
+            t.shift[w][lane * 4 + k] = bit & 7;
+          }
+        }
+      }
+      return t;
+    }();
+    return table;
+  }
+
+  /**
+   * \brief unpack the integers of a block 8 at a time with AVX2
+   *
+   * it stops before the loads go beyond the block data plus \ref kPadding.
+   * @return the number of unpacked integers
+   */
+  DIFACTO_TARGET_AVX2 static int UnpackShuffle(
+      const char* in, int cnt, int width, const ShuffleTable& table,
+      uint64_t* z) {
+    const __m256i shuffle = _mm256_load_si256(
+        reinterpret_cast<const __m256i*>(table.shuffle[width]));
+    const __m256i shift = _mm256_load_si256(
+        reinterpret_cast<const __m256i*>(table.shift[width]));
+    const __m256i mask = _mm256_set1_epi32((1u << width) - 1);
+    int high = (4 * width) >> 3;
+    int readable = (cnt * width + 7) / 8 + kPadding;
+    int j = 0;
+    for (int pos = 0; j + 8 <= cnt && pos + high + 16 <= readable;
+         j += 8, pos += width) {
+      __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + pos));
+      __m128i hi = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(in + pos + high));
+      __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+      v = _mm256_shuffle_epi8(v, shuffle);
+      v = _mm256_and_si256(_mm256_srlv_epi32(v, shift), mask);
+      __m256i z0 = _mm256_cvtepu32_epi64(_mm256_castsi256_si128(v));
+      __m256i z1 = _mm256_cvtepu32_epi64(_mm256_extracti128_si256(v, 1));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(z + j), z0);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(z + j + 4), z1);
+    }
+    return j;
+  }
+#endif  // DIFACTO_CPU_DISPATCH
+
+  /** \brief sign extend signed integers, so that -1 is close to 0 */
+  template <typename T>
+  static uint64_t Extend(T v) {
+    return static_cast<uint64_t>(static_cast<int64_t>(v));
+  }
+  static uint64_t Extend(uint64_t v) { return v; }
+  static uint64_t Extend(uint32_t v) { return v; }
+  static uint64_t Extend(uint16_t v) { return v; }
+
+  static uint64_t ZigZag(uint64_t d) {
+    return (d << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(d) >> 63);
+  }
+  static uint64_t UnZigZag(uint64_t z) {
+    return (z >> 1) ^ (~(z & 1) + 1);
+  }
+};
+
+}  // namespace difacto
+#endif  // DIFACTO_COMMON_DELTA_CODEC_H_
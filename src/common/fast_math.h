@@ -0,0 +1,103 @@
+/**
+ * Copyright (c) 2015 by Contributors
+ */
+#ifndef DIFACTO_COMMON_FAST_MATH_H_
+#define DIFACTO_COMMON_FAST_MATH_H_
+#include <stdint.h>
+#include <string.h>
+namespace difacto {
+/**
+ * \brief branch free approximations of exp and log in single precision
+ *
+ * the polynomials are from cephes expf and logf. the relative error is within
+ * a few ulps for arguments in the range, which is enough for loss functions
+ * and metrics. being branch free, loops calling them are vectorized by the
+ * compiler inside \ref Dispatch, unlike std::exp and std::log.
+ */
+namespace fast_math {
+
+inline float AsFloat(int32_t i) { float f; memcpy(&f, &i, 4); return f; }
+inline int32_t AsInt(float f) { int32_t i; memcpy(&i, &f, 4); return i; }
+
+/**
+ * \brief exp(x), x is clipped into [-87, 88]
+ */
+inline float Exp(float x) {
+  x = x > 88.0f ? 88.0f : x;
+  x = x < -87.0f ? -87.0f : x;
+  // x = n * ln2 + r, |r| <= ln2 / 2
+  // round to nearest by adding and subtracting 1.5 * 2^23
+  float fn = (x * 1.44269504088896341f + 12582912.0f) - 12582912.0f;
+  int32_t n = static_cast<int32_t>(fn);
+  float r = x - fn * 0.693359375f;
+  r = r - fn * -2.12194440e-4f;
+  // exp(r)
+  float z = r * r;
+  float y = 1.9875691500e-4f;
+  y = y * r + 1.3981999507e-3f;
+  y = y * r + 8.3334519073e-3f;
+  y = y * r + 4.1665795894e-2f;
+  y = y * r + 1.6666665459e-1f;
+  y = y * r + 5.0000001201e-1f;
+  y = y * z + r + 1.0f;
+  // 2^n
+  return y * AsFloat((n + 127) << 23);
+}
+
+/**
+ * \brief log(x) for finite x > 0
+ */
+inline float Log(float x) {
+  // x = m * 2^e, m in [sqrt(.5), sqrt(2))
+  int32_t i = AsInt(x);
+  int32_t e = ((i >> 23) & 0xff) - 126;
+  float m = AsFloat((i & 0x807fffff) | 0x3f000000);  // in [.5, 1)
+  bool small = m < 0.707106781186547524f;
+  e = small ? e - 1 : e;
+  m = small ? m + m - 1.0f : m - 1.0f;
+  float fe = static_cast<float>(e);
+  // log(1+m)
+  float z = m * m;
+  float y = 7.0376836292e-2f;
+  y = y * m - 1.1514610310e-1f;
+  y = y * m + 1.1676998740e-1f;
+  y = y * m - 1.2420140846e-1f;
+  y = y * m + 1.4249322787e-1f;
+  y = y * m - 1.6668057665e-1f;
+  y = y * m + 2.0000714765e-1f;
+  y = y * m - 2.4999993993e-1f;
+  y = y * m + 3.3333331174e-1f;
+  y = y * m * z;
+  y += fe * -2.12194440e-4f;
+  y += -0.5f * z;
+  return m + y + fe * 0.693359375f;
+}
+
+/**
+ * \brief log(1 + x) for x >= 0, accurate for tiny x as well
+ */
+inline float Log1p(float x) {
+  float u = 1.0f + x;
+  float d = u - 1.0f;
+  // log(u) * x / (u - 1) cancels the rounding error of 1 + x
+  return d == 0 ? x : Log(u) * (x / d);
+}
+
+/**
+ * \brief 1 / (1 + exp(-x))
+ */
+inline float Sigmoid(float x) {
+  return 1.0f / (1.0f + Exp(-x));
+}
+
+/**
+ * \brief log(1 + exp(x)), computed as max(x, 0) + log(1 + exp(-|x|))
+ */
+inline float Log1pExp(float x) {
+  float a = x < 0 ? -x : x;
+  return (x > 0 ? x : 0) + Log1p(Exp(-a));
+}
+
+}  // namespace fast_math
+}  // namespace difacto
+#endif  // DIFACTO_COMMON_FAST_MATH_H_
@@ -9,6 +9,7 @@
 #include "dmlc/omp.h"
 #include "difacto/sarray.h"
 #include "./range.h"
+#include "./cpu_dispatch.h"
 namespace difacto {
 /**
  * \brief multi-thread sparse matrix dense matrix multiplication
@@ -18,8 +19,6 @@ namespace difacto {
  */
 class SpMM {
  public:
-  /** \brief row major sparse matrix */
-  using SpMat = dmlc::RowBlock<unsigned>;
   /**
    * \brief y = D * x
    * @param D n * m sparse matrix
@@ -28,10 +27,12 @@ class SpMM {
    * @param nthreads optional number of threads
    * @param x_pos optional, the position of x's rows
    * @param y_pos optional, the position of y's rows
+   * @tparam SpMat a row major sparse matrix with size, offset, index, and
+   * value, such as dmlc::RowBlock<unsigned> or CompactRowBlock<uint16_t>
    * @tparam Vec can be either std::vector<T> or SArray<T>
    * @tparam Pos can be either std::vector<int> or SArray<int>
    */
-  template<typename Vec, typename Pos = std::vector<int>>
+  template<typename SpMat, typename Vec, typename Pos = std::vector<int>>
   static void Times(const SpMat& D,
                     const Vec& x,
                     int k,
@@ -60,9 +61,11 @@ class SpMM {
    * @param x n * k length vector
    * @param y m * k length vector, should be pre-allocated
    * @param nthreads optional number of threads
+   * @tparam SpMat a row major sparse matrix with size, offset, index, and
+   * value, such as dmlc::RowBlock<unsigned> or CompactRowBlock<uint16_t>
    * @tparam Vec can be either std::vector<T> or SArray<T>
    */
-  template<typename Vec, typename Pos = std::vector<int>>
+  template<typename SpMat, typename Vec, typename Pos = std::vector<int>>
   static void TransTimes(const SpMat& D,
                          const Vec& x,
                          int k,
@@ -90,7 +93,7 @@ class SpMM {
   /**
    * \brief y += D * x, C pointer version
    */
-  template<typename V, typename I>
+  template<typename SpMat, typename V, typename I>
   static void Times(const SpMat& D,
                     V const* x,
                     V* y,
@@ -103,28 +106,30 @@ class SpMM {
       Range rg = Range(0, D.size).Segment(
           omp_get_thread_num(), omp_get_num_threads());
 
-      for (size_t i = rg.begin; i < rg.end; ++i) {
-        if (D.offset[i] == D.offset[i+1]) continue;
-        V* y_i = GetPtr(y, y_pos, i, k);
-        if (!y_i) continue;
-        for (size_t j = D.offset[i]; j < D.offset[i+1]; ++j) {
-          V const* x_j = GetPtr(x, x_pos, D.index[j], k);
-          if (!x_j) continue;
-          if (D.value) {
-            V v = D.value[j];
-            for (int l = 0; l < k; ++l) y_i[l] += x_j[l] * v;
-          } else {
-            for (int l = 0; l < k; ++l) y_i[l] += x_j[l];
+      Dispatch([&]() {
+          for (size_t i = rg.begin; i < rg.end; ++i) {
+            if (D.offset[i] == D.offset[i+1]) continue;
+            V* y_i = GetPtr(y, y_pos, i, k);
+            if (!y_i) continue;
+            for (size_t j = D.offset[i]; j < D.offset[i+1]; ++j) {
+              V const* x_j = GetPtr(x, x_pos, D.index[j], k);
+              if (!x_j) continue;
+              if (D.value) {
+                V v = D.value[j];
+                for (int l = 0; l < k; ++l) y_i[l] += x_j[l] * v;
+              } else {
+                for (int l = 0; l < k; ++l) y_i[l] += x_j[l];
+              }
+            }
           }
-        }
-      }
+        });
     }
   }
 
   /**
    * \brief y += D' * x, C pointer version
    */
-  template<typename V, typename I>
+  template<typename SpMat, typename V, typename I>
   static void TransTimes(const SpMat& D,
                          V const* x,
                          V* y,
@@ -138,23 +143,25 @@ class SpMM {
       Range rg = Range(0, ncols).Segment(
           omp_get_thread_num(), omp_get_num_threads());
 
-      for (size_t i = 0; i < D.size; ++i) {
-        if (D.offset[i] == D.offset[i+1]) continue;
-        V const* x_i = GetPtr(x, x_pos, i, k);
-        if (!x_i) continue;
-        for (size_t j = D.offset[i]; j < D.offset[i+1]; ++j) {
-          unsigned e = D.index[j];
-          if (!rg.Has(e)) continue;
-          V* y_j = GetPtr(y, y_pos, e, k);
-          if (!y_j) continue;
-          if (D.value) {
-            V v = D.value[j];
-            for (int l = 0; l < k; ++l) y_j[l] += x_i[l] * v;
-          } else {
-            for (int l = 0; l < k; ++l) y_j[l] += x_i[l];
+      Dispatch([&]() {
+          for (size_t i = 0; i < D.size; ++i) {
+            if (D.offset[i] == D.offset[i+1]) continue;
+            V const* x_i = GetPtr(x, x_pos, i, k);
+            if (!x_i) continue;
+            for (size_t j = D.offset[i]; j < D.offset[i+1]; ++j) {
+              size_t e = D.index[j];
+              if (!rg.Has(e)) continue;
+              V* y_j = GetPtr(y, y_pos, e, k);
+              if (!y_j) continue;
+              if (D.value) {
+                V v = D.value[j];
+                for (int l = 0; l < k; ++l) y_j[l] += x_i[l] * v;
+              } else {
+                for (int l = 0; l < k; ++l) y_j[l] += x_i[l];
+              }
+            }
           }
-        }
-      }
+        });
     }
   }
 
@@ -23,8 +23,10 @@ class SpMT {
    * \param Y sparse matrix in row major
    * \param X_ncols optional, number of columns in X
    * \param nt optional, number of threads
+   * \tparam SpMat the type of X, see \ref SpMV
    */
-  static void Transpose(const dmlc::RowBlock<unsigned>& X,
+  template <typename SpMat>
+  static void Transpose(const SpMat& X,
                         dmlc::data::RowBlockContainer<unsigned>* Y,
                         unsigned X_ncols = 0,
                         int nt = DEFAULT_NTHREADS) {
@@ -51,7 +53,7 @@ class SpMT {
       Range range = Range(0, X_ncols).Segment(
           omp_get_thread_num(), omp_get_num_threads());
       for (size_t i = 0; i < nnz; ++i) {
-        unsigned k = X.index[i];
+        size_t k = X.index[i];
         if (!range.Has(k)) continue;
         ++Y->offset[k+1];
       }
@@ -69,7 +71,7 @@ class SpMT {
       for (size_t i = 0; i < nrows; ++i) {
         if (X.offset[i] == X.offset[i+1]) continue;
         for (size_t j = X.offset[i]; j < X.offset[i+1]; ++j) {
-          unsigned k = X.index[j];
+          size_t k = X.index[j];
           if (!range.Has(k)) continue;
           if (X.value) {
             Y->value[Y->offset[k]] = X.value[j];
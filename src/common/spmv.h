@@ -8,6 +8,7 @@
 #include "dmlc/data.h"
 #include "dmlc/omp.h"
 #include "./range.h"
+#include "./cpu_dispatch.h"
 namespace difacto {
 
 /**
@@ -15,8 +16,6 @@ namespace difacto {
  */
 class SpMV {
  public:
-  /** \brief row major sparse matrix */
-  using SpMat = dmlc::RowBlock<unsigned>;
   /**
    * \brief y += D * x
    *
@@ -43,10 +42,12 @@ class SpMV {
    * @param nthreads optional, number of threads
    * @param x_pos optional, the position of x
    * @param y_pos optional, the position of y
+   * @tparam SpMat a row major sparse matrix with size, offset, index, and
+   * value, such as dmlc::RowBlock<unsigned> or CompactRowBlock<uint16_t>
    * @tparam Vec can be either std::vector<T> or SArray<T>
    * @tparam Pos can be either std::vector<int> or SArray<int>
    */
-  template<typename Vec, typename Pos = std::vector<int>>
+  template<typename SpMat, typename Vec, typename Pos = std::vector<int>>
   static void Times(const SpMat& D,
                     const Vec& x,
                     Vec* y,
@@ -76,10 +77,12 @@ class SpMV {
    * @param nthreads optional, number of threads
    * @param x_pos optional, the position of x
    * @param y_pos optional, the position of y
+   * @tparam SpMat a row major sparse matrix with size, offset, index, and
+   * value, such as dmlc::RowBlock<unsigned> or CompactRowBlock<uint16_t>
    * @tparam Vec can be either std::vector<T> or SArray<T>
    * @tparam Pos can be either std::vector<int> or SArray<int>
    */
-  template<typename Vec, typename Pos = std::vector<int>>
+  template<typename SpMat, typename Vec, typename Pos = std::vector<int>>
   static void TransTimes(const SpMat& D,
                          const Vec& x,
                          Vec* y,
@@ -104,7 +107,7 @@ class SpMV {
   /**
    * \brief y += D * x, C pointer version
    */
-  template<typename V, typename I>
+  template<typename SpMat, typename V, typename I>
   static void Times(const SpMat& D,
                     V const* x,
                     V* y,
@@ -116,27 +119,29 @@ class SpMV {
       Range rg = Range(0, D.size).Segment(
           omp_get_thread_num(), omp_get_num_threads());
 
-      for (size_t i = rg.begin; i < rg.end; ++i) {
-        if (D.offset[i] == D.offset[i+1]) continue;
-        V* y_i = GetPtr(y, y_pos, i);
-        if (!y_i) continue;
-        for (size_t j = D.offset[i]; j < D.offset[i+1]; ++j) {
-          V x_j = GetVal(x, x_pos, D.index[j]);
-          if (x_j == 0) continue;
-          if (D.value) {
-            *y_i += x_j * D.value[j];
-          } else {
-            *y_i += x_j;
+      Dispatch([&]() {
+          for (size_t i = rg.begin; i < rg.end; ++i) {
+            if (D.offset[i] == D.offset[i+1]) continue;
+            V* y_i = GetPtr(y, y_pos, i);
+            if (!y_i) continue;
+            for (size_t j = D.offset[i]; j < D.offset[i+1]; ++j) {
+              V x_j = GetVal(x, x_pos, D.index[j]);
+              if (x_j == 0) continue;
+              if (D.value) {
+                *y_i += x_j * D.value[j];
+              } else {
+                *y_i += x_j;
+              }
+            }
           }
-        }
-      }
+        });
     }
   }
 
   /**
    * \brief y += D' * x, C pointer version
    */
-  template<typename V, typename I>
+  template<typename SpMat, typename V, typename I>
   static void TransTimes(const SpMat& D,
                          V const* x,
                          V* y,
@@ -149,24 +154,26 @@ class SpMV {
       Range rg = Range(0, ncol).Segment(
           omp_get_thread_num(), omp_get_num_threads());
 
-      for (size_t i = 0; i < D.size; ++i) {
-        if (D.offset[i] == D.offset[i+1]) continue;
-        V x_i = GetVal(x, x_pos, i);
-        if (x_i == 0) continue;
-        for (size_t j = D.offset[i]; j < D.offset[i+1]; ++j) {
-          unsigned k = D.index[j];
-          if (rg.Has(k)) {
-            V* y_j = GetPtr(y, y_pos, k);
-            if (y_j) {
-              if (D.value) {
-                *y_j += x_i * D.value[j];
-              } else {
-                *y_j += x_i;
+      Dispatch([&]() {
+          for (size_t i = 0; i < D.size; ++i) {
+            if (D.offset[i] == D.offset[i+1]) continue;
+            V x_i = GetVal(x, x_pos, i);
+            if (x_i == 0) continue;
+            for (size_t j = D.offset[i]; j < D.offset[i+1]; ++j) {
+              size_t k = D.index[j];
+              if (rg.Has(k)) {
+                V* y_j = GetPtr(y, y_pos, k);
+                if (y_j) {
+                  if (D.value) {
+                    *y_j += x_i * D.value[j];
+                  } else {
+                    *y_j += x_i;
+                  }
+                }
               }
             }
           }
-        }
-      }
+        });
     }
   }
 
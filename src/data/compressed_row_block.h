@@ -10,42 +10,99 @@
 #endif  // DIFACTO_USE_LZ4
 #include <vector>
 #include <string>
+#include <utility>
+#include <algorithm>
 #include "data/row_block.h"
 #include "difacto/base.h"
+#include "common/delta_codec.h"
 namespace difacto {
 
 /**
  * \brief compress and decompress a row block
+ *
+ * the indices within each row are sorted, and then stored as the first index
+ * of each row, delta encoded among rows, and the gaps between the adjacent
+ * indices of a row, which are small and bit packed by \ref DeltaCodec. the
+ * offsets are delta encoded, the values are dropped if all are 1, otherwise
+ * compressed by lz4 if available.
+ *
+ * the header has a version byte after the magic number. the records written
+ * by the former versions, which compress the raw arrays by lz4, are still
+ * readable.
  */
 class CompressedRowBlock {
  public:
   template <typename IndexType>
   void Compress(dmlc::RowBlock<IndexType> blk, std::string* str) {
     str->clear();
-    str->reserve(MaxCompressionSize(blk));
     str_ = str;
 
-    int nrows = blk.size;
-    int nnz = blk.offset[nrows] - blk.offset[0];
-
-    if (blk.value) {
+    size_t nrows = blk.size;
+    size_t base = blk.offset[0];
+    size_t nnz = blk.offset[nrows] - base;
+    const IndexType* index = blk.index + base;
+    const real_t* value = blk.value ? blk.value + base : NULL;
+    if (value) {
       bool bin = true;
-      for (int i = 0; i < nnz; ++i) {
-        if (blk.value[i] != 1) {
+      for (size_t i = 0; i < nnz; ++i) {
+        if (value[i] != 1) {
           bin = false; break;
         }
       }
-      if (bin) blk.value = NULL;
+      if (bin) value = NULL;
+    }
+
+    // sort the indices within each row, then split them into the first index
+    // of each row and the gaps
+    std::vector<size_t> offset(nrows + 1, 0);
+    std::vector<IndexType> first, gaps;
+    std::vector<real_t> sorted_value;
+    first.reserve(nrows);
+    gaps.reserve(nnz);
+    if (value) sorted_value.reserve(nnz);
+    std::vector<std::pair<IndexType, real_t>> row;
+    for (size_t i = 0; i < nrows; ++i) {
+      size_t begin = blk.offset[i] - base, end = blk.offset[i+1] - base;
+      offset[i+1] = end;
+      if (begin == end) continue;
+      row.clear();
+      for (size_t j = begin; j < end; ++j) {
+        row.push_back(std::make_pair(index[j], value ? value[j] : 1));
+      }
+      std::stable_sort(row.begin(), row.end(),
+                       [](const std::pair<IndexType, real_t>& a,
+                          const std::pair<IndexType, real_t>& b) {
+                         return a.first < b.first;
+                       });
+      first.push_back(row[0].first);
+      for (size_t j = 1; j < row.size(); ++j) {
+        gaps.push_back(row[j].first - row[j-1].first);
+      }
+      if (value) {
+        for (const auto& e : row) sorted_value.push_back(e.second);
+      }
     }
 
-    Write(kMagicNumber);
+    Write(kMagicNumberV2);
+    str->push_back(static_cast<char>(kVersion));
     Write(sizeof(IndexType));
-    Write(nrows);
-    Compress((const char*)blk.label, nrows * sizeof(real_t));
-    Compress((const char*)blk.offset, (nrows+1) * sizeof(size_t));
-    Compress((const char*)blk.index, nnz * sizeof(IndexType));
-    Compress((const char*)blk.value, nnz * sizeof(real_t));
-    Compress((const char*)blk.weight, nrows * sizeof(real_t));
+    uint64_t header[2] = {nrows, nnz};
+    str->append(reinterpret_cast<const char*>(header), sizeof(header));
+    str->push_back((blk.label ? kHasLabel : 0) | (blk.weight ? kHasWeight : 0));
+    if (blk.label) {
+      str->append(reinterpret_cast<const char*>(blk.label),
+                  nrows * sizeof(real_t));
+    }
+    if (blk.weight) {
+      str->append(reinterpret_cast<const char*>(blk.weight),
+                  nrows * sizeof(real_t));
+    }
+    DeltaCodec::Encode(offset.data(), offset.size(), str);
+    DeltaCodec::Encode(first.data(), first.size(), str);
+    DeltaCodec::Pack(gaps.data(), gaps.size(), str);
+    CompressValue(sorted_value);
+    // the decoder may read beyond the data
+    str->append(DeltaCodec::kPadding, 0);
   }
 
   template <typename IndexType>
@@ -58,7 +115,64 @@ class CompressedRowBlock {
   void Decompress(char const* data, size_t size,
                   dmlc::data::RowBlockContainer<IndexType>* blk) {
     cdata_ = data; cur_len_ = 0; max_len_ = size;
-    CHECK_EQ(Read(), kMagicNumber) << "wrong data format";
+    int magic = Read();
+    if (magic == kMagicNumber) {
+      DecompressV0(blk);
+      return;
+    }
+    CHECK_EQ(magic, kMagicNumberV2) << "wrong data format";
+    CHECK_LT(cur_len_, max_len_);
+    int version = static_cast<unsigned char>(cdata_[cur_len_++]);
+    CHECK_EQ(version, kVersion) << "unknown version " << version;
+    CHECK_EQ(Read(), (int)sizeof(IndexType)) << "wrong indextype";
+    uint64_t header[2];
+    CHECK_LE(cur_len_ + sizeof(header) + 1, max_len_);
+    memcpy(header, cdata_ + cur_len_, sizeof(header));
+    cur_len_ += sizeof(header);
+    size_t nrows = header[0], nnz = header[1];
+    int flags = cdata_[cur_len_++];
+    if (flags & kHasLabel) ReadRaw(&blk->label, nrows);
+    if (flags & kHasWeight) ReadRaw(&blk->weight, nrows);
+
+    // the offsets
+    CHECK_LE(cur_len_ + DeltaCodec::kPadding, max_len_);
+    const char* p = cdata_ + cur_len_;
+    blk->offset.resize(nrows + 1);
+    p = DeltaCodec::Decode(p, nrows + 1, blk->offset.data());
+    CHECK_EQ(blk->offset[nrows], nnz) << "corrupted data";
+    size_t nfirst = 0;
+    for (size_t i = 0; i < nrows; ++i) {
+      if (blk->offset[i] != blk->offset[i+1]) ++nfirst;
+    }
+
+    // the indices, unpack the gaps into the tail of index and then accumulate
+    // them row by row
+    std::vector<IndexType> first(nfirst);
+    p = DeltaCodec::Decode(p, nfirst, first.data());
+    blk->index.resize(nnz);
+    IndexType* index = blk->index.data();
+    IndexType* gaps = index + nfirst;
+    p = DeltaCodec::Unpack(p, nnz - nfirst, gaps);
+    CHECK_LE(static_cast<size_t>(p - cdata_), max_len_) << "corrupted data";
+    for (size_t i = 0, k = 0; i < nrows; ++i) {
+      size_t begin = blk->offset[i], end = blk->offset[i+1];
+      if (begin == end) continue;
+      IndexType v = first[k++];
+      index[begin] = v;
+      // gaps[j-k] is behind index[j], so it is read before being overwritten
+      for (size_t j = begin + 1; j < end; ++j) {
+        v += gaps[j - k];
+        index[j] = v;
+      }
+    }
+    cur_len_ = p - cdata_;
+    DecompressValue(nnz, &blk->value);
+  }
+
+ private:
+  /** \brief the records written before the version byte was added */
+  template <typename IndexType>
+  void DecompressV0(dmlc::data::RowBlockContainer<IndexType>* blk) {
     CHECK_EQ(Read(), (int)sizeof(IndexType)) << "wrong indextype";
 
     int nrows = Read();
@@ -72,40 +186,59 @@ class CompressedRowBlock {
     Decompress(&blk->weight, nrows);
   }
 
- private:
-  template <typename IndexType>
-  size_t MaxCompressionSize(dmlc::RowBlock<IndexType> blk) {
+  void CompressValue(const std::vector<real_t>& value) {
+    if (value.empty()) {
+      str_->push_back(kNone);
+      return;
+    }
+    size_t raw_size = value.size() * sizeof(real_t);
+    const char* raw = reinterpret_cast<const char*>(value.data());
 #if DIFACTO_USE_LZ4
-    int nrows = blk.size;
-    int nnz = blk.offset[nrows] - blk.offset[0];
-    size_t size = 6 * sizeof(int)  // size
-                  + LZ4_compressBound((nrows+1)*sizeof(size_t));  // offset
-    if (blk.label) size += LZ4_compressBound(nrows*sizeof(size_t));
-    if (blk.index) size += LZ4_compressBound(nnz*sizeof(IndexType));
-    if (blk.value) size += LZ4_compressBound(nnz*sizeof(real_t));
-    if (blk.weight) size += LZ4_compressBound(nrows*sizeof(real_t));
-    return size;
-#else
-    LOG(FATAL) << "compile with USE_LZ4=1";
-    return 0;
-#endif
+    std::vector<char> dst(LZ4_compressBound(raw_size));
+    int size = LZ4_compress_default(raw, dst.data(), raw_size, dst.size());
+    if (size > 0 && static_cast<size_t>(size) < raw_size) {
+      str_->push_back(kLZ4);
+      Write(size);
+      str_->append(dst.data(), size);
+      return;
+    }
+#endif  // DIFACTO_USE_LZ4
+    str_->push_back(kRaw);
+    str_->append(raw, raw_size);
   }
 
-  void Compress(const char* data, size_t size) {
+  void DecompressValue(size_t nnz, std::vector<real_t>* value) {
+    CHECK_LT(cur_len_, max_len_);
+    int type = cdata_[cur_len_++];
+    if (type == kNone) return;
+    if (type == kRaw) {
+      ReadRaw(value, nnz);
+      return;
+    }
+    CHECK_EQ(type, kLZ4) << "corrupted data";
 #if DIFACTO_USE_LZ4
-    if (data == NULL) { Write(0); return; }
-    int dst_size = LZ4_compressBound(size);
-    char *dst = new char[dst_size];
-    int actual_size = LZ4_compress_default(data, dst, size, dst_size);
-    CHECK_NE(actual_size, 0);
-
-    Write(actual_size);
-    str_->append(dst, actual_size);
+    int cp_size = Read();
+    CHECK_LE(cur_len_ + cp_size, max_len_);
+    value->resize(nnz);
+    int dst_size = nnz * sizeof(real_t);
+    CHECK_EQ(dst_size, LZ4_decompress_safe(
+        cdata_ + cur_len_, reinterpret_cast<char*>(value->data()), cp_size,
+        dst_size));
+    cur_len_ += cp_size;
 #else
     LOG(FATAL) << "compile with USE_LZ4=1";
 #endif
   }
 
+  template <typename T>
+  void ReadRaw(std::vector<T>* dst, size_t len) {
+    CHECK_LE(cur_len_ + len * sizeof(T), max_len_);
+    dst->resize(len);
+    if (len) memcpy(dst->data(), cdata_ + cur_len_, len * sizeof(T));
+    cur_len_ += len * sizeof(T);
+  }
+
+ private:
   template <typename T>
   void Decompress(std::vector<T>* dst, int len) {
 #if DIFACTO_USE_LZ4
@@ -139,6 +272,11 @@ class CompressedRowBlock {
   char const* cdata_;
   size_t max_len_, cur_len_;
   static const int kMagicNumber = 1196140743;
+  static const int kMagicNumberV2 = 1196140744;
+  /** \brief increase it whenever the layout changes */
+  static const int kVersion = 1;
+  enum { kHasLabel = 1, kHasWeight = 2 };
+  enum { kNone = 0, kRaw = 1, kLZ4 = 2 };
 };
 
 }  // namespace difacto
@@ -26,11 +26,24 @@ class DataStore {
   /**
    * \brief create a data store
    *
-   * @param store_prefix , such as /tmp/store_. If not specified, then keep all
-   * things in memory
-   * @param max_mem_capacity  in default no limits
+   * @param cache_prefix the prefix of the files, such as /tmp/store_. If not
+   * specified, then keep all things in memory
+   * @param max_mem_capacity the maximal memory in bytes, in default no limits
+   * @param use_mmap if true, back data by memory mapped files under
+   * cache_prefix and leave the residency to the page cache, max_mem_capacity
+   * is then ignored
    */
-  DataStore() { store_ = new DataStoreMemory(); }
+  explicit DataStore(const std::string& cache_prefix = "",
+                     size_t max_mem_capacity = 0,
+                     bool use_mmap = false) {
+    if (use_mmap && !cache_prefix.empty()) {
+      store_ = new DataStoreMmap(cache_prefix);
+    } else if (cache_prefix.empty() || max_mem_capacity == 0) {
+      store_ = new DataStoreMemory();
+    } else {
+      store_ = new DataStoreDisk(cache_prefix, max_mem_capacity);
+    }
+  }
   /** \brief deconstructor */
   virtual ~DataStore() { delete store_; }
   /**
@@ -79,7 +92,7 @@ class DataStore {
   template <typename V>
   void Fetch(const std::string& key, SArray<V>* data, Range range = Range::All()) {
     auto char_range = GetCharRange(key, range);
-    CHECK_EQ(data_meta_[key].type_code, typeid(V).hash_code());
+    CHECK_EQ(meta(key).type_code, typeid(V).hash_code());
     SArray<char> char_data;
     if (char_range.Valid()) store_->Fetch(key, char_range, &char_data);
     *CHECK_NOTNULL(data) = char_data;
@@ -104,11 +117,12 @@ class DataStore {
   /**
    * \brief return the data size of a key
    **/
-  size_t size(const std::string& key) const {
-    auto it = data_meta_.find(key);
-    CHECK(it != data_meta_.end()) << "key " << key << " dosen't exist";
-    return it->second.data_size;
-  }
+  size_t size(const std::string& key) const { return meta(key).data_size; }
+  /**
+   * \brief returns true if all data are kept in memory, so a fetched data can
+   * be hold without costing extra memory
+   */
+  bool InMemory() const { return store_->InMemory(); }
   /**
    * \brief load meta data
    */
@@ -138,16 +152,6 @@ class DataStore {
   }
 
  private:
-  inline Range GetCharRange(const std::string& key, Range range) {
-    if (range.Size() == 0) return range;
-    CHECK(range.Valid());
-    size_t siz = size(key);
-    if (siz == 0) return Range(0, 0);
-    if (range == Range::All()) range = Range(0, siz);
-    CHECK_LE(range.end, siz);
-    return range * data_meta_[key].type_size;
-  }
-
   struct DataMeta {
     /** \brief data size */
     size_t data_size;
@@ -156,6 +160,23 @@ class DataStore {
     /** \brief sizeof(type) */
     size_t type_size;
   };
+
+  /** \brief find the meta data, it is safe to call concurrently */
+  inline const DataMeta& meta(const std::string& key) const {
+    auto it = data_meta_.find(key);
+    CHECK(it != data_meta_.end()) << "key " << key << " dosen't exist";
+    return it->second;
+  }
+
+  inline Range GetCharRange(const std::string& key, Range range) const {
+    if (range.Size() == 0) return range;
+    CHECK(range.Valid());
+    const auto& m = meta(key);
+    if (m.data_size == 0) return Range(0, 0);
+    if (range == Range::All()) range = Range(0, m.data_size);
+    CHECK_LE(range.end, m.data_size);
+    return range * m.type_size;
+  }
   std::unordered_map<std::string, DataMeta> data_meta_;
   DataStoreImpl* store_;
   const std::string meta_header_ = "data_store_meta";
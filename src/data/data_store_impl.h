@@ -3,12 +3,27 @@
  */
 #ifndef DIFACTO_DATA_DATA_STORE_IMPL_H_
 #define DIFACTO_DATA_DATA_STORE_IMPL_H_
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <algorithm>
 #include <queue>
+#include <list>
+#include <atomic>
+#include <memory>
+#include <vector>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <string>
 #include <functional>
 #include <unordered_map>
+#include <unordered_set>
+#include "dmlc/io.h"
+#include "dmlc/logging.h"
 #include "common/range.h"
 #include "difacto/sarray.h"
 namespace difacto {
@@ -47,6 +62,11 @@ class DataStoreImpl {
    * \param key the unique key of the data
    */
   virtual void Remove(const std::string& key) = 0;
+
+  /**
+   * \brief returns true if all data are kept in memory
+   */
+  virtual bool InMemory() const { return false; }
 };
 
 /**
@@ -66,6 +86,7 @@ class DataStoreMemory : public DataStoreImpl {
   }
   void Prefetch(const std::string& key, Range range) override { }
   void Remove(const std::string& key) override { store_.erase(key); }
+  bool InMemory() const override { return true; }
 
  private:
   std::unordered_map<std::string, SArray<char>> store_;
@@ -73,13 +94,471 @@ class DataStoreMemory : public DataStoreImpl {
 
 /**
  * \brief write data back to disk if exeeds the maximal memory capacity
+ *
+ * every data is kept in memory until the total size exceeds the capacity,
+ * then the least recently used ones are written into files and released. a
+ * background thread loads the data given by \ref Prefetch, so the reading is
+ * overlapped with the computation on previously fetched data.
+ *
+ * the files are written without holding the lock, so a large write does not
+ * block the fetching of other data. the memory of a released data is actually
+ * freed once all SArray returned by \ref Fetch are gone, and it is counted
+ * into the memory usage until then.
  */
 class DataStoreDisk : public DataStoreImpl {
  public:
+  /**
+   * @param cache_prefix the prefix of the files, such as /tmp/difacto_
+   * @param max_mem_capacity the maximal memory capacity in bytes
+   */
   DataStoreDisk(const std::string& cache_prefix,
-                size_t max_mem_capacity) {
+                size_t max_mem_capacity)
+      : prefix_(cache_prefix + std::to_string(getpid()) + "_"),
+        capacity_(max_mem_capacity) {
+    prefetch_thr_ = std::thread([this]() { PrefetchLoop(); });
+  }
+  virtual ~DataStoreDisk() {
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      done_ = true;
+    }
+    prefetch_cond_.notify_all();
+    prefetch_thr_.join();
+    for (const auto& it : blobs_) {
+      if (it.second.on_disk) remove(Filename(it.first).c_str());
+    }
+  }
+
+  void Store(const std::string& key, const SArray<char>& data) override {
+    std::unique_lock<std::mutex> lk(mu_);
+    WaitLoading(key, &lk);
+    auto& blob = blobs_[key];
+    if (blob.on_disk) {
+      remove(Filename(key).c_str());
+      blob.on_disk = false;
+    }
+    if (blob.data.size()) {
+      mem_size_ -= blob.data.size();
+      lru_.erase(blob.lru);
+    }
+    blob.size = data.size();
+    blob.data = data;
+    Insert(key, &blob);
+    Evict(&lk);
+  }
+
+  void Fetch(const std::string& key, Range range, SArray<char>* data) override {
+    std::unique_lock<std::mutex> lk(mu_);
+    while (true) {
+      WaitLoading(key, &lk);
+      auto it = blobs_.find(key);
+      CHECK(it != blobs_.end()) << "key " << key << " doesn't exist";
+      auto& blob = it->second;
+      if (blob.data.empty() && blob.size) {
+        // not prefetched, read it now. check again since the lock is released
+        // while reading
+        Load(key, &lk);
+        continue;
+      }
+      if (blob.size) {
+        lru_.erase(blob.lru);
+        blob.lru = lru_.insert(lru_.end(), key);
+      }
+      *CHECK_NOTNULL(data) = blob.data.segment(range.begin, range.end);
+      return;
+    }
+  }
+
+  void Prefetch(const std::string& key, Range range) override {
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      auto it = blobs_.find(key);
+      if (it == blobs_.end() || it->second.data.size() ||
+          it->second.size == 0 || loading_.count(key)) return;
+      prefetch_queue_.push(key);
+    }
+    prefetch_cond_.notify_one();
+  }
+
+  void Remove(const std::string& key) override {
+    std::unique_lock<std::mutex> lk(mu_);
+    WaitLoading(key, &lk);
+    auto it = blobs_.find(key);
+    if (it == blobs_.end()) return;
+    if (it->second.data.size()) {
+      mem_size_ -= it->second.data.size();
+      lru_.erase(it->second.lru);
+    }
+    if (it->second.on_disk) remove(Filename(key).c_str());
+    blobs_.erase(it);
   }
-  virtual ~DataStoreDisk() { }
+
+ private:
+  struct Blob {
+    /** \brief the data if in memory, otherwise empty */
+    SArray<char> data;
+    /** \brief the data size in bytes */
+    size_t size = 0;
+    /** \brief whether or not a copy is in the file */
+    bool on_disk = false;
+    /** \brief the position in lru_ if in memory */
+    std::list<std::string>::iterator lru;
+  };
+
+  std::string Filename(const std::string& key) const { return prefix_ + key; }
+
+  /** \brief mark blob as the most recently used, requires mu_ */
+  void Insert(const std::string& key, Blob* blob) {
+    if (blob->data.empty()) return;
+    mem_size_ += blob->data.size();
+    blob->lru = lru_.insert(lru_.end(), key);
+  }
+
+  /**
+   * \brief release the least recently used data until within the capacity,
+   * requires mu_ locked by lk
+   *
+   * the victims are picked with the lock, and the ones not in files yet are
+   * written without the lock. they are marked as loading meanwhile, so
+   * \ref Fetch waits for them.
+   *
+   * the released data still used by the fetched arrays are not freed by
+   * evicting more, so they count at most half of the capacity. otherwise the
+   * resident data would be evicted down to a single one and read again and
+   * again while the callers hold the arrays.
+   */
+  void Evict(std::unique_lock<std::mutex>* lk) {
+    for (auto it = released_.begin(); it != released_.end(); ) {
+      if (it->first.expired()) {
+        pinned_size_ -= it->second;
+        it = released_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    size_t budget = capacity_ - std::min(pinned_size_, capacity_ / 2);
+    std::vector<std::pair<std::string, SArray<char>>> writes;
+    while (mem_size_ > budget && lru_.size() > 1) {
+      auto key = lru_.front(); lru_.pop_front();
+      auto& blob = blobs_[key];
+      mem_size_ -= blob.data.size();
+      if (blob.on_disk) {
+        Release(&blob.data);
+      } else {
+        writes.push_back(std::make_pair(key, blob.data));
+        blob.data.clear();
+        loading_.insert(key);
+      }
+    }
+    if (writes.empty()) return;
+
+    lk->unlock();
+    for (const auto& w : writes) {
+      // the data is immutable once stored, so it is written only once
+      std::unique_ptr<dmlc::Stream> fo(
+          dmlc::Stream::Create(Filename(w.first).c_str(), "w"));
+      fo->Write(w.second.data(), w.second.size());
+    }
+    lk->lock();
+    for (auto& w : writes) {
+      blobs_[w.first].on_disk = true;
+      loading_.erase(w.first);
+      Release(&w.second);
+    }
+    loaded_cond_.notify_all();
+  }
+
+  /**
+   * \brief clear data, whose memory is counted by released_ and pinned_size_
+   * if it is still used by the fetched arrays, requires mu_
+   */
+  void Release(SArray<char>* data) {
+    if (data->ptr().use_count() > 1) {
+      pinned_size_ += data->size();
+      released_.push_back(std::make_pair(
+          std::weak_ptr<char>(data->ptr()), data->size()));
+    }
+    data->clear();
+  }
+
+  /** \brief read a data from the file, requires mu_ locked by lk */
+  void Load(const std::string& key, std::unique_lock<std::mutex>* lk) {
+    size_t size = blobs_[key].size;
+    loading_.insert(key);
+    lk->unlock();
+    SArray<char> data(size);
+    std::unique_ptr<dmlc::Stream> fi(
+        dmlc::Stream::Create(Filename(key).c_str(), "r"));
+    CHECK_EQ(fi->Read(data.data(), size), size) << "failed to read " << key;
+    lk->lock();
+    loading_.erase(key);
+    auto& blob = blobs_[key];
+    blob.data = data;
+    Insert(key, &blob);
+    loaded_cond_.notify_all();
+    Evict(lk);
+  }
+
+  /** \brief wait until the key is not being loaded */
+  void WaitLoading(const std::string& key, std::unique_lock<std::mutex>* lk) {
+    loaded_cond_.wait(*lk, [this, &key]() { return loading_.count(key) == 0; });
+  }
+
+  void PrefetchLoop() {
+    std::unique_lock<std::mutex> lk(mu_);
+    while (true) {
+      prefetch_cond_.wait(lk, [this]() {
+          return done_ || !prefetch_queue_.empty(); });
+      if (done_) break;
+      auto key = prefetch_queue_.front(); prefetch_queue_.pop();
+      auto it = blobs_.find(key);
+      if (it == blobs_.end() || it->second.data.size() ||
+          loading_.count(key)) continue;
+      Load(key, &lk);
+    }
+  }
+
+  std::string prefix_;
+  size_t capacity_;
+  /** \brief the bytes of the data in memory */
+  size_t mem_size_ = 0;
+  /** \brief the bytes of the released data still used, see \ref Release */
+  size_t pinned_size_ = 0;
+  std::unordered_map<std::string, Blob> blobs_;
+  /** \brief keys of the data in memory, from the least recently used */
+  std::list<std::string> lru_;
+  /** \brief the released data still used by fetched arrays, and the sizes */
+  std::list<std::pair<std::weak_ptr<char>, size_t>> released_;
+  /** \brief keys being read from files */
+  std::unordered_set<std::string> loading_;
+  std::queue<std::string> prefetch_queue_;
+  bool done_ = false;
+  std::mutex mu_;
+  std::condition_variable prefetch_cond_, loaded_cond_;
+  std::thread prefetch_thr_;
+};
+
+/**
+ * \brief back each data with a memory mapped file
+ *
+ * \ref Store writes the data into a local file and then maps it, so the
+ * memory is owned by the page cache rather than the process. \ref Fetch
+ * returns a view into the mapping without copy, \ref Prefetch advises the
+ * kernel to read the pages ahead, and the pages of a data are advised to be
+ * dropped once the last fetched view of it is released.
+ *
+ * \ref Fetch and \ref Prefetch look up the mappings in a per-thread cache,
+ * which is invalidated by \ref Store and \ref Remove. so they are lock free
+ * once the data are stored.
+ *
+ * the file of a data is named by the hash and the size of its content under
+ * cache_prefix, and each process hard links it under its own name. so
+ * processes on the same machine storing the same data, such as the tiles of
+ * the same input, write it only once and map the same physical pages. the
+ * content is compared before sharing, so a hash collision only costs a
+ * private copy. the shared name is removed with the last process using it.
+ */
+class DataStoreMmap : public DataStoreImpl {
+ public:
+  /**
+   * @param cache_prefix the prefix of the local files, such as /tmp/difacto_
+   */
+  explicit DataStoreMmap(const std::string& cache_prefix)
+      : prefix_(cache_prefix),
+        own_prefix_(cache_prefix + std::to_string(getpid()) + "_") {
+    static std::atomic<int> num_stores(0);
+    uid_ = num_stores++;
+  }
+  virtual ~DataStoreMmap() {
+    for (const auto& it : maps_) Unlink(*it.second);
+  }
+
+  void Store(const std::string& key, const SArray<char>& data) override {
+    // a new file for each store, so existing mappings of the previous data are
+    // still valid
+    static std::atomic<uint64_t> seq(0);
+    std::shared_ptr<Region> region(new Region());
+    auto& blob = *region;
+    size_t size = data.size();
+    if (size) {
+      blob.own = own_prefix_ + std::to_string(seq++);
+      blob.shared = prefix_ + "shared_" + Signature(data);
+      if (link(blob.shared.c_str(), blob.own.c_str()) == 0) {
+        struct stat st;
+        if (stat(blob.own.c_str(), &st) == 0 &&
+            static_cast<size_t>(st.st_size) == size) {
+          blob.data = Map(blob.own, size);
+        }
+        if (blob.data.empty() ||
+            memcmp(blob.data.data(), data.data(), size) != 0) {
+          unlink(blob.own.c_str());
+          blob.data.clear();
+          blob.shared.clear();
+        }
+      }
+      if (blob.data.empty()) {
+        Write(blob.own, data);
+        // fails if another process has just shared the same data, then this
+        // copy is private
+        if (blob.shared.size() &&
+            link(blob.own.c_str(), blob.shared.c_str()) != 0) {
+          blob.shared.clear();
+        }
+        blob.data = Map(blob.own, size);
+      }
+    }
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = maps_.find(key);
+    if (it != maps_.end()) Unlink(*it->second);
+    maps_[key] = region;
+    ++version_;
+  }
+
+  void Fetch(const std::string& key, Range range, SArray<char>* data) override {
+    auto region = Get(key);
+    char* begin = region->data.data() + range.begin;
+    // keep the mapping alive, and advise to drop the pages once no view is
+    // used. a view fetched meanwhile only refaults the pages from the file
+    ++region->users;
+    CHECK_NOTNULL(data)->reset(begin, range.Size(), [region](char*) {
+        if (--region->users == 0 && region->data.size()) {
+          madvise(region->data.data(), region->data.size(), MADV_DONTNEED);
+        }
+      });
+  }
+
+  void Prefetch(const std::string& key, Range range) override {
+    const auto& mapped = Get(key)->data;
+    Range pages = PageRange(mapped.data(), mapped.data() + range.begin,
+                            range.Size());
+    madvise(mapped.data() + pages.begin, pages.Size(), MADV_WILLNEED);
+  }
+
+  void Remove(const std::string& key) override {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = maps_.find(key);
+    if (it == maps_.end()) return;
+    Unlink(*it->second);
+    maps_.erase(it);
+    ++version_;
+  }
+
+ private:
+  struct Region {
+    /** \brief the mapping */
+    SArray<char> data;
+    /** \brief the file name of this process */
+    std::string own;
+    /** \brief the file name shared by processes, empty if not shared */
+    std::string shared;
+    /** \brief the number of fetched views in use */
+    std::atomic<int> users{0};
+  };
+
+  /** \brief returns the mapping of a key, locks only on a cache miss */
+  std::shared_ptr<Region> Get(const std::string& key) {
+    struct Cache {
+      int store = -1;
+      uint64_t version = 0;
+      std::unordered_map<std::string, std::weak_ptr<Region>> regions;
+    };
+    static thread_local Cache cache;
+    uint64_t version = version_.load(std::memory_order_acquire);
+    if (cache.store != uid_ || cache.version != version) {
+      cache.regions.clear();
+      cache.store = uid_;
+      cache.version = version;
+    }
+    auto it = cache.regions.find(key);
+    if (it != cache.regions.end()) {
+      auto region = it->second.lock();
+      if (region) return region;
+    }
+    std::lock_guard<std::mutex> lk(mu_);
+    auto jt = maps_.find(key);
+    CHECK(jt != maps_.end()) << "key " << key << " doesn't exist";
+    cache.regions[key] = jt->second;
+    return jt->second;
+  }
+
+  /**
+   * \brief remove the files of a region, the shared one is removed if no other
+   * process links it. the mapping is still valid
+   */
+  static void Unlink(const Region& blob) {
+    if (blob.own.size()) unlink(blob.own.c_str());
+    struct stat st;
+    if (blob.shared.size() && stat(blob.shared.c_str(), &st) == 0 &&
+        st.st_nlink == 1) {
+      unlink(blob.shared.c_str());
+    }
+  }
+
+  /** \brief returns the hash and the size of data as a file name */
+  static std::string Signature(const SArray<char>& data) {
+    // FNV-1a over 8-byte words, the collisions are checked by the caller
+    const uint64_t prime = 1099511628211ULL;
+    uint64_t h = 14695981039346656037ULL;
+    size_t n = data.size() / 8;
+    for (size_t i = 0; i < n; ++i) {
+      uint64_t w; memcpy(&w, data.data() + i * 8, 8);
+      h = (h ^ w) * prime;
+    }
+    for (size_t i = n * 8; i < data.size(); ++i) {
+      h = (h ^ static_cast<uint8_t>(data[i])) * prime;
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%016llx_%llu",
+             static_cast<unsigned long long>(h),
+             static_cast<unsigned long long>(data.size()));
+    return std::string(buf);
+  }
+
+  /** \brief write data into a new file */
+  static void Write(const std::string& filename, const SArray<char>& data) {
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    CHECK_GE(fd, 0) << "failed to open " << filename;
+    for (size_t n = 0; n < data.size(); ) {
+      ssize_t ret = write(fd, data.data() + n, data.size() - n);
+      CHECK_GT(ret, 0) << "failed to write " << filename;
+      n += ret;
+    }
+    close(fd);
+  }
+
+  /** \brief map a file read only, it is unmapped when the array is released */
+  static SArray<char> Map(const std::string& filename, size_t size) {
+    SArray<char> mapped;
+    if (size == 0) return mapped;
+    int fd = open(filename.c_str(), O_RDONLY);
+    CHECK_GE(fd, 0) << "failed to open " << filename;
+    void* ptr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    CHECK(ptr != MAP_FAILED) << "failed to mmap " << filename;
+    mapped.reset(static_cast<char*>(ptr), size,
+                 [size](char* p) { munmap(p, size); });
+    return mapped;
+  }
+
+  /**
+   * \brief returns the range, relative to the page aligned base, of the pages
+   * overlapping with [p, p + size)
+   */
+  static Range PageRange(const char* base, const char* p, size_t size) {
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    size_t begin = p - base, end = begin + size;
+    begin = begin / page * page;
+    end = (end + page - 1) / page * page;
+    return begin < end ? Range(begin, end) : Range(0, 0);
+  }
+
+  std::string prefix_, own_prefix_;
+  std::unordered_map<std::string, std::shared_ptr<Region>> maps_;
+  /** \brief increased by every change of maps_, see \ref Get */
+  std::atomic<uint64_t> version_{0};
+  /** \brief the unique id of this store, used by the per-thread cache */
+  int uid_;
+  std::mutex mu_;
 };
 
 }  // namespace difacto
@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) 2015 by Contributors
+ */
+#ifndef DIFACTO_DATA_DIRECT_INDEX_H_
+#define DIFACTO_DATA_DIRECT_INDEX_H_
+#include <vector>
+#include "difacto/base.h"
+#include "difacto/sarray.h"
+#include "dmlc/omp.h"
+#include "./shared_row_block_container.h"
+namespace difacto {
+
+/**
+ * \brief rewrite the column indices of a localized rowblock so that they point
+ * directly to the weight positions
+ *
+ * the kernels such as \ref SpMV read a weight by x[x_pos[D.index[j]]], which
+ * is a double indirection in the innermost loop. once the positions are known,
+ * we can replace D.index[j] by x_pos[D.index[j]], then the kernels can read
+ * x[D.index[j]] without x_pos.
+ *
+ * nonzero entries whose w position is -1 are dropped.
+ *
+ * \code
+ * data.index = {0, 2, 1, 2}, w_pos = {0, -1, 3}, V_pos = {1, -1, -1}
+ * out.index  = {0, 3, 3},    V_index = {1, -1, -1}
+ * \endcode
+ *
+ * @param data the localized rowblock, data.offset[0] should be 0
+ * @param w_pos the w position of each column, -1 means not exists. if empty,
+ * then data is returned without change
+ * @param V_pos optional, the V position of each column, -1 means not exists
+ * @param out the rowblock with index rewritten, it shares label, weight, and
+ * (if no entry is dropped) offset and value with data
+ * @param V_index returns the V position of each nonzero entry in out if V_pos
+ * is not empty, -1 means not exists
+ * @param nthreads number of threads
+ */
+inline void DirectIndex(const SharedRowBlockContainer<unsigned>& data,
+                        const SArray<int>& w_pos,
+                        const SArray<int>& V_pos,
+                        SharedRowBlockContainer<unsigned>* out,
+                        SArray<int>* V_index,
+                        int nthreads = DEFAULT_NTHREADS) {
+  CHECK_NOTNULL(out);
+  CHECK_NOTNULL(V_index)->clear();
+  if (w_pos.empty()) {
+    *out = data; return;
+  }
+  CHECK_EQ(data.offset.front(), 0);
+  bool has_V = !V_pos.empty();
+  if (has_V) CHECK_EQ(V_pos.size(), w_pos.size());
+  size_t nrows = data.offset.size() - 1;
+  size_t nnz = data.index.size();
+  unsigned const* idx = data.index.data();
+
+  bool dropped = false;
+  for (size_t j = 0; j < nnz; ++j) {
+    if (w_pos[idx[j]] == -1) { dropped = true; break; }
+  }
+
+  out->label = data.label;
+  out->weight = data.weight;
+  if (!dropped) {
+    out->offset = data.offset;
+    out->value = data.value;
+    out->index.resize(nnz);
+    if (has_V) V_index->resize(nnz);
+    unsigned* oidx = out->index.data();
+    int* vidx = V_index->data();
+#pragma omp parallel for num_threads(nthreads)
+    for (size_t j = 0; j < nnz; ++j) {
+      oidx[j] = static_cast<unsigned>(w_pos[idx[j]]);
+      if (has_V) vidx[j] = V_pos[idx[j]];
+    }
+    return;
+  }
+
+  // compact the rowblock
+  out->offset.resize(nrows + 1);
+  out->index.clear(); out->index.reserve(nnz);
+  out->value.clear();
+  bool has_value = !data.value.empty();
+  if (has_value) out->value.reserve(nnz);
+  if (has_V) V_index->reserve(nnz);
+  out->offset[0] = 0;
+  for (size_t i = 0; i < nrows; ++i) {
+    for (size_t j = data.offset[i]; j < data.offset[i+1]; ++j) {
+      int p = w_pos[idx[j]];
+      if (p == -1) continue;
+      out->index.push_back(static_cast<unsigned>(p));
+      if (has_value) out->value.push_back(data.value[j]);
+      if (has_V) V_index->push_back(V_pos[idx[j]]);
+    }
+    out->offset[i+1] = out->index.size();
+  }
+}
+
+}  // namespace difacto
+#endif  // DIFACTO_DATA_DIRECT_INDEX_H_
@@ -99,6 +99,12 @@ void Localizer::RemapIndex(
     o->label.resize(blk.size);
     memcpy(o->label.data(), blk.label, blk.size*sizeof(*blk.label));
   }
+  if (blk.weight) {
+    o->weight.resize(blk.size);
+    memcpy(o->weight.data(), blk.weight, blk.size*sizeof(*blk.weight));
+  } else {
+    o->weight.clear();
+  }
   o->max_index = idx_dict.size() - 1;
 }
 
@@ -5,6 +5,7 @@
 #define DIFACTO_DATA_TILE_BUILDER_H_
 #include <vector>
 #include <mutex>
+#include "dmlc/omp.h"
 #include "common/kv_union.h"
 #include "common/spmt.h"
 #include "data/localizer.h"
@@ -16,9 +17,20 @@ namespace difacto {
  */
 class TileBuilder {
  public:
-  TileBuilder(TileStore* store, int nthreads, bool allow_multi_columns = false) {
+  /**
+   * \brief constructor
+   *
+   * @param store the tile store
+   * @param nthreads number of threads
+   * @param allow_multi_columns store the transposed data to slice column blocks
+   * @param store_xx_value store the squared values for the losses using X.*X,
+   * see \ref Tile
+   */
+  TileBuilder(TileStore* store, int nthreads, bool allow_multi_columns = false,
+              bool store_xx_value = false) {
     store_ = store;
     multicol_ = allow_multi_columns;
+    store_xx_ = store_xx_value;
     int blk_nthreads = nthreads > 20 ? 4 : 2;
     if (nthreads > blk_nthreads) {
       nthreads_ = blk_nthreads;
@@ -29,6 +41,7 @@ class TileBuilder {
     }
   }
   ~TileBuilder() { delete pool_; }
+  friend class TileCache;
 
   /**
    * \brief add a raw rowblk to the store
@@ -92,17 +105,25 @@ class TileBuilder {
         SArray<size_t> offset;
         store_->data_->Fetch(key+"offset", &offset);
         CHECK_EQ(offset.size(), colmap.size()+1);
+        // rewrite the offsets to be relative to each tile, so the offsets of a
+        // tile start from 0 and can be fetched without copy
+        SArray<size_t> tile_offset;
         for (auto p : pos) {
           TileStore::Meta c;
           c.colmap = p;
-          c.offset = Range(p.begin, p.end+1);
+          c.offset = Range(tile_offset.size(), tile_offset.size()+p.Size()+1);
           c.index = Range(offset[p.begin], offset[p.end]);
+          for (size_t j = p.begin; j <= p.end; ++j) {
+            tile_offset.push_back(offset[j] - offset[p.begin]);
+          }
           store_->meta_[i].push_back(c);
         }
+        store_->data_->Store(key+"offset", tile_offset);
       }
       // clear
       blk_feaids_[i].clear();
     }
+    store_->BuildIndex();
     if (feapos) FindPosition(feaids, feablk_range, feapos);
   }
 
@@ -154,11 +175,12 @@ class TileBuilder {
       delete compacted;
       SharedRowBlockContainer<unsigned> data(&transposed);
       data.label.CopyFrom(rowblk.label, rowblk.size);
-      store_->Store(id, data);
+      if (rowblk.weight) data.weight.CopyFrom(rowblk.weight, rowblk.size);
+      store_->Store(id, data, Square(data.value));
       delete transposed;
     } else {
       SharedRowBlockContainer<unsigned> data(&compacted);
-      store_->Store(id, data);
+      store_->Store(id, data, Square(data.value));
       delete compacted;
     }
 
@@ -174,10 +196,22 @@ class TileBuilder {
     CHECK_EQ(sids.size(), scnts.size());
     KVUnion(sids, scnts, feaids, feacnts);
   }
+  /**
+   * \brief returns value .* value if store_xx_ is set, and empty otherwise
+   */
+  SArray<dmlc::real_t> Square(const SArray<dmlc::real_t>& value) {
+    SArray<dmlc::real_t> xx;
+    if (!store_xx_ || value.empty()) return xx;
+    xx.resize(value.size());
+#pragma omp parallel for num_threads(nthreads_)
+    for (size_t i = 0; i < value.size(); ++i) xx[i] = value[i] * value[i];
+    return xx;
+  }
   std::vector<SArray<feaid_t>> blk_feaids_;
   TileStore* store_;
   int nthreads_;
   bool multicol_;
+  bool store_xx_;
   ThreadPool* pool_ = nullptr;
   std::mutex mu_;
 };
@@ -0,0 +1,219 @@
+/**
+ *  Copyright (c) 2015 by Contributors
+ */
+#ifndef DIFACTO_DATA_TILE_CACHE_H_
+#define DIFACTO_DATA_TILE_CACHE_H_
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <sstream>
+#include "dmlc/io.h"
+#include "dmlc/logging.h"
+#include "io/filesys.h"
+#include "difacto/base.h"
+#include "difacto/sarray.h"
+#include "./tile_builder.h"
+namespace difacto {
+/**
+ * \brief save the rowblocks added into a \ref TileBuilder to a file, so the
+ * next run on the same data can load them instead of parsing, localizing and
+ * transposing the data again
+ *
+ * the file contains a version, a signature, and then the data. the signature
+ * consists of the sizes and modification times of the input files together
+ * with the arguments affecting the tiles, a cache with a different version or
+ * signature is ignored.
+ *
+ * \code
+ * TileCache cache(filename, TileCache::Signature(data_in, args));
+ * if (!cache.Load(&builder, &feaids, &feacnts, &counts, &info)) {
+ *   // read data and add into builder
+ *   builder.Wait();
+ *   cache.Save(builder, feaids, feacnts, counts, info);
+ * }
+ * \endcode
+ */
+class TileCache {
+ public:
+  /**
+   * @param filename the cache file
+   * @param signature the signature of the data, see \ref Signature
+   */
+  TileCache(const std::string& filename, const std::string& signature)
+      : filename_(filename), signature_(signature) { }
+
+  /**
+   * \brief returns a signature of the input files and args
+   *
+   * @param uri the input, such as the data_in of a learner. it can be a file, a
+   * directory, or a list of them separated by ';'
+   * @param args the arguments affecting the tiles, such as the data format
+   */
+  static std::string Signature(const std::string& uri,
+                               const std::string& args) {
+    std::stringstream ss;
+    ss << args;
+    std::stringstream uris(uri);
+    std::string path;
+    while (std::getline(uris, path, ';')) {
+      if (path.empty()) continue;
+      dmlc::io::URI path_uri(path.c_str());
+      auto fs = dmlc::io::FileSystem::GetInstance(path_uri.protocol);
+      std::vector<dmlc::io::FileInfo> files;
+      auto info = fs->GetPathInfo(path_uri);
+      if (info.type == dmlc::io::kDirectory) {
+        fs->ListDirectory(path_uri, &files);
+      } else {
+        files.push_back(info);
+      }
+      for (const auto& f : files) {
+        if (f.type == dmlc::io::kDirectory) continue;
+        // the modification time is only available for local files
+        struct stat st;
+        long mtime = stat(f.path.name.c_str(), &st) == 0 ? st.st_mtime : 0;
+        ss << "|" << f.path.str() << "," << f.size << "," << mtime;
+      }
+    }
+    return ss.str();
+  }
+
+  /**
+   * \brief load the cache if it is valid
+   *
+   * @param builder the builder to add the cached rowblocks into, it should be
+   * empty
+   * @param feaids the feature ids saved with the rowblocks
+   * @param feacnts the feature counts saved with the rowblocks
+   * @param counts the integers saved with the rowblocks, such as the number
+   * of rows of each rowblock
+   * @param info the other numbers saved with the rowblocks
+   * @return false if the cache does not exist or is stale
+   */
+  bool Load(TileBuilder* builder,
+            SArray<feaid_t>* feaids,
+            SArray<real_t>* feacnts,
+            std::vector<uint64_t>* counts,
+            std::vector<real_t>* info) {
+    std::unique_ptr<dmlc::Stream> fi(
+        dmlc::Stream::Create(filename_.c_str(), "r", true));
+    if (!fi) return false;
+    std::string magic, signature;
+    int version = 0;
+    if (!fi->Read(&magic) || magic != kMagic ||
+        fi->Read(&version, sizeof(version)) != sizeof(version) ||
+        version != kVersion ||
+        !fi->Read(&signature) || signature != signature_) {
+      LOG(INFO) << "ignore the stale data cache " << filename_;
+      return false;
+    }
+    uint64_t nblks = 0;
+    CHECK_EQ(fi->Read(&nblks, sizeof(nblks)), sizeof(nblks));
+    CHECK(builder->blk_feaids_.empty());
+    builder->blk_feaids_.resize(nblks);
+    for (uint64_t i = 0; i < nblks; ++i) {
+      SharedRowBlockContainer<unsigned> data;
+      SArray<real_t> xx_value;
+      ReadArray(fi.get(), &data.label);
+      ReadArray(fi.get(), &data.weight);
+      ReadArray(fi.get(), &data.offset);
+      ReadArray(fi.get(), &data.index);
+      ReadArray(fi.get(), &data.value);
+      ReadArray(fi.get(), &xx_value);
+      ReadArray(fi.get(), &builder->blk_feaids_[i]);
+      builder->store_->Store(i, data, xx_value);
+    }
+    ReadArray(fi.get(), CHECK_NOTNULL(feaids));
+    ReadArray(fi.get(), CHECK_NOTNULL(feacnts));
+    CHECK(fi->Read(CHECK_NOTNULL(counts)));
+    CHECK(fi->Read(CHECK_NOTNULL(info)));
+    LOG(INFO) << "loaded " << nblks << " rowblocks from " << filename_;
+    return true;
+  }
+
+  /**
+   * \brief save the rowblocks added into a builder
+   *
+   * the cache is written into a temporary file first, so a concurrent or
+   * failed run never leaves a partial cache
+   *
+   * @param builder the builder, all added rowblocks should be finished
+   * @param feaids the feature ids
+   * @param feacnts the feature counts
+   * @param counts the integers, they are kept exactly unlike in info
+   * @param info the other numbers
+   */
+  void Save(const TileBuilder& builder,
+            const SArray<feaid_t>& feaids,
+            const SArray<real_t>& feacnts,
+            const std::vector<uint64_t>& counts,
+            const std::vector<real_t>& info) {
+    std::string tmp = filename_ + ".tmp" + std::to_string(getpid());
+    {
+      std::unique_ptr<dmlc::Stream> fo(
+          dmlc::Stream::Create(tmp.c_str(), "w"));
+      fo->Write(std::string(kMagic));
+      int version = kVersion;
+      fo->Write(&version, sizeof(version));
+      fo->Write(signature_);
+      uint64_t nblks = builder.blk_feaids_.size();
+      fo->Write(&nblks, sizeof(nblks));
+      auto store = builder.store_->data_;
+      for (uint64_t i = 0; i < nblks; ++i) {
+        auto key = std::to_string(i) + "_";
+        SharedRowBlockContainer<unsigned> data;
+        SArray<real_t> xx_value;
+        store->Fetch(key+"label", &data.label);
+        store->Fetch(key+"weight", &data.weight);
+        store->Fetch(key+"offset", &data.offset);
+        store->Fetch(key+"index", &data.index);
+        store->Fetch(key+"value", &data.value);
+        store->Fetch(key+"xx_value", &xx_value);
+        WriteArray(data.label, fo.get());
+        WriteArray(data.weight, fo.get());
+        WriteArray(data.offset, fo.get());
+        WriteArray(data.index, fo.get());
+        WriteArray(data.value, fo.get());
+        WriteArray(xx_value, fo.get());
+        WriteArray(builder.blk_feaids_[i], fo.get());
+      }
+      WriteArray(feaids, fo.get());
+      WriteArray(feacnts, fo.get());
+      fo->Write(counts);
+      fo->Write(info);
+    }
+    if (rename(tmp.c_str(), filename_.c_str()) != 0) {
+      LOG(WARNING) << "failed to write the data cache " << filename_;
+      remove(tmp.c_str());
+    }
+  }
+
+ private:
+  template <typename V>
+  static void WriteArray(const SArray<V>& data, dmlc::Stream* fo) {
+    uint64_t size = data.size();
+    fo->Write(&size, sizeof(size));
+    if (size) fo->Write(data.data(), size * sizeof(V));
+  }
+
+  template <typename V>
+  static void ReadArray(dmlc::Stream* fi, SArray<V>* data) {
+    uint64_t size = 0;
+    CHECK_EQ(fi->Read(&size, sizeof(size)), sizeof(size));
+    data->resize(size);
+    if (size) {
+      CHECK_EQ(fi->Read(data->data(), size * sizeof(V)), size * sizeof(V));
+    }
+  }
+
+  /** \brief increase it whenever the layout changes */
+  static const int kVersion = 3;
+  static constexpr const char* kMagic = "difacto_tile_cache";
+  std::string filename_;
+  std::string signature_;
+};
+
+}  // namespace difacto
+#endif  // DIFACTO_DATA_TILE_CACHE_H_
@@ -0,0 +1,9 @@
+/**
+ * Copyright (c) 2015 by Contributors
+ */
+#include "./tile_store.h"
+namespace difacto {
+
+DMLC_REGISTER_PARAMETER(TileStoreParam);
+
+}  // namespace difacto
@@ -3,11 +3,19 @@
  */
 #ifndef DIFACTO_DATA_TILE_STORE_H_
 #define DIFACTO_DATA_TILE_STORE_H_
+#if DIFACTO_USE_LZ4
+#include <lz4.h>
+#endif  // DIFACTO_USE_LZ4
 #include <string>
 #include <vector>
 #include <mutex>
+#include <atomic>
+#include <limits>
+#include <algorithm>
 #include "dmlc/data.h"
+#include "dmlc/parameter.h"
 #include "difacto/sarray.h"
+#include "common/delta_codec.h"
 #include "./shared_row_block_container.h"
 #include "./data_store.h"
 namespace difacto {
@@ -34,42 +42,128 @@ struct Tile {
   SArray<int> colmap;
   /** \brief the transposed data to make slice efficient */
   SharedRowBlockContainer<unsigned> data;
+  /**
+   * \brief the squared values data.value .* data.value, empty if data is
+   * binary or the squared values are not stored
+   */
+  SArray<dmlc::real_t> xx_value;
+  /**
+   * \brief the 32-bit offsets replacing data.offset, set by TileStore::Fetch
+   * only if compact is requested and the offsets are stored in 32 bits, see
+   * TileStoreParam::compact_tiles
+   */
+  SArray<uint32_t> offset32;
+  /**
+   * \brief the 16-bit indices replacing data.index, set only together with
+   * offset32 and if the indices are stored in 16 bits
+   */
+  SArray<uint16_t> index16;
 };
 
 class TileBuilder;
 
+struct TileStoreParam : public dmlc::Parameter<TileStoreParam> {
+  /**
+   * \brief the prefix of the files for the tiles spilled to disk, such as
+   * /tmp/difacto_. the tiles are kept in memory if empty
+   */
+  std::string data_cache;
+  /**
+   * \brief the maximal memory in MB used by the tiles, the least recently used
+   * tiles are spilled to disk if exceeds. 0 means no limit
+   */
+  size_t max_mem_capacity;
+  /**
+   * \brief if true, back tiles by memory mapped files under data_cache, which
+   * should be on a local disk, and let the page cache handle the residency.
+   * the processes on a machine with the same data_cache share the same tiles
+   */
+  bool data_cache_mmap;
+  /**
+   * \brief if true, keep the in-memory tiles compressed, and decompress a tile
+   * when fetching it. the indices, offsets and colmap are delta encoded and
+   * bit packed, the values are dropped if all are 1, otherwise compressed by
+   * lz4 if available.
+   */
+  bool compress_tiles;
+  /**
+   * \brief if true, store a in-memory tile with 32-bit offsets if they fit,
+   * and independently 16-bit indices if they fit. ignored if compress_tiles is
+   * set
+   */
+  bool compact_tiles;
+  DMLC_DECLARE_PARAMETER(TileStoreParam) {
+    DMLC_DECLARE_FIELD(data_cache).set_default("");
+    DMLC_DECLARE_FIELD(max_mem_capacity).set_default(0);
+    DMLC_DECLARE_FIELD(data_cache_mmap).set_default(false);
+    DMLC_DECLARE_FIELD(compress_tiles).set_default(false);
+    DMLC_DECLARE_FIELD(compact_tiles).set_default(false);
+  }
+};
+
 /**
  * \brief thread safe
+ *
+ * the tiles are immutable once built by \ref TileBuilder. if the data are kept
+ * in memory, the tiles of each rowblock are then indexed by the rowblock id,
+ * and \ref Fetch only takes segments of the stored arrays. it is then lock
+ * free and allocation free, unless one of the following applies
+ *
+ * - compress_tiles is set: \ref Fetch decompresses a tile into the buffers of
+ *   a small per-thread cache of recently decoded tiles, which allocates on a
+ *   cache miss.
+ * - compact_tiles is set: \ref Fetch returns the narrow offsets and indices
+ *   to the callers asking for them, but copies them into wide arrays for the
+ *   others, and for the compact callers if only the indices were narrowed.
+ *
+ * if the data are spilled to disk, \ref Fetch goes through \ref DataStore and
+ * allocates the keys. the disk backend then takes a lock, and reads a blob
+ * into a new buffer if it is not resident. the mmap backend looks up the
+ * mapped regions without a lock once its per-thread cache is warm, but still
+ * allocates the reference counts of the returned arrays.
  */
 class TileStore {
  public:
-  TileStore() { }
+  TileStore() {
+    static std::atomic<int> num_stores(0);
+    uid_ = num_stores++;
+  }
   ~TileStore() { delete data_; }
   friend class TileBuilder;
+  friend class TileCache;
 
   KWArgs Init(const KWArgs& kwargs) {
-    data_ = new DataStore();
-    return kwargs;
+    auto remain = param_.InitAllowUnknown(kwargs);
+    data_ = new DataStore(param_.data_cache,
+                          param_.max_mem_capacity << 20,
+                          param_.data_cache_mmap);
+    return remain;
   }
   /**
    * \brief store a shared rowblock container into the store (no memory copy)
    * @param rowblk_id rowblock id
    * @param data the rowblock container
+   * @param xx_value optional, the squared values of data
    */
   void Store(int rowblk_id,
-             const SharedRowBlockContainer<unsigned>& data) {
+             const SharedRowBlockContainer<unsigned>& data,
+             const SArray<dmlc::real_t>& xx_value = SArray<dmlc::real_t>()) {
+    if (xx_value.size()) CHECK_EQ(xx_value.size(), data.value.size());
     std::lock_guard<std::mutex> lk(mu_);
     auto key = std::to_string(rowblk_id) + "_";
     data_->Store(key+"label", data.label);
+    data_->Store(key+"weight", data.weight);
     data_->Store(key+"offset", data.offset);
     data_->Store(key+"index", data.index);
     data_->Store(key+"value", data.value);
+    data_->Store(key+"xx_value", xx_value);
   }
 
   /**
    * \brief store a the column map of a row block into the store (no memory copy)
    */
   void Store(int rowblk_id, const SArray<int>& colmap) {
+    std::lock_guard<std::mutex> lk(mu_);
     data_->Store(std::to_string(rowblk_id) + "_colmap", colmap);
   }
 
@@ -80,14 +174,16 @@ class TileStore {
    * @param colblk_id
    */
   void Prefetch(int rowblk_id, int colblk_id) {
-    std::lock_guard<std::mutex> lk(mu_);
+    if (!blobs_.empty() || !ctiles_.empty()) return;
     auto key = std::to_string(rowblk_id) + "_";
-    auto rg = meta_[rowblk_id][colblk_id];
+    const auto& rg = meta_[rowblk_id][colblk_id];
     data_->Prefetch(key+"label");
+    data_->Prefetch(key+"weight");
     data_->Prefetch(key+"colmap", rg.colmap);
     data_->Prefetch(key+"offset", rg.offset);
     data_->Prefetch(key+"index", rg.index);
     data_->Prefetch(key+"value", rg.index);
+    data_->Prefetch(key+"xx_value", rg.index);
   }
 
   /**
@@ -96,25 +192,56 @@ class TileStore {
    * @param rowblk_id
    * @param colblk_id
    * @param tile
+   * @param compact if true, return the tile in Tile::offset32 and
+   * Tile::index16 instead of data.offset and data.index if it is stored
+   * compactly
    */
-  void Fetch(int rowblk_id, int colblk_id, Tile* tile) {
-    std::lock_guard<std::mutex> lk(mu_);
+  void Fetch(int rowblk_id, int colblk_id, Tile* tile,
+             bool compact = false) const {
     auto& data = CHECK_NOTNULL(tile)->data;
+    const auto& rg = meta_[rowblk_id][colblk_id];
+    tile->offset32.clear();
+    tile->index16.clear();
+    if (!ctiles_.empty()) {
+      Decompress(rowblk_id, colblk_id, tile);
+      return;
+    }
+    if (!blobs_.empty()) {
+      const auto& blob = blobs_[rowblk_id];
+      data.label = blob.label;
+      data.weight = blob.weight;
+      tile->colmap = Segment(blob.colmap, rg.colmap);
+      // a compact tile needs the narrow offsets, the indices in either width
+      // then go with them
+      if (compact && !blob.offset32.empty()) {
+        tile->offset32 = Segment(blob.offset32, rg.offset);
+        data.offset.clear();
+      } else if (blob.offset32.empty()) {
+        data.offset = Segment(blob.offset, rg.offset);
+      } else {
+        Widen(Segment(blob.offset32, rg.offset), &data.offset);
+      }
+      if (!tile->offset32.empty() && !blob.index16.empty()) {
+        tile->index16 = Segment(blob.index16, rg.index);
+        data.index.clear();
+      } else if (blob.index16.empty()) {
+        data.index = Segment(blob.index, rg.index);
+      } else {
+        Widen(Segment(blob.index16, rg.index), &data.index);
+      }
+      data.value = Segment(blob.value, rg.index);
+      tile->xx_value = Segment(blob.xx_value, rg.index);
+      return;
+    }
     auto key = std::to_string(rowblk_id) + "_";
-    auto rg = meta_[rowblk_id][colblk_id];
     data_->Fetch(key+"label", &data.label);
+    data_->Fetch(key+"weight", &data.weight);
     data_->Fetch(key+"colmap", &tile->colmap, rg.colmap);
+    // the offsets are relative to each tile, see TileBuilder::BuildColmap
     data_->Fetch(key+"offset", &data.offset, rg.offset);
-    if (rg.offset.begin != 0) {
-      // force to start from 0
-      SArray<size_t> offset; offset.CopyFrom(data.offset);
-      for (size_t i = 0; i < offset.size(); ++i) {
-        offset[i] -= data.offset[0];
-      }
-      data.offset = offset;
-    }
     data_->Fetch(key+"index", &data.index, rg.index);
     data_->Fetch(key+"value", &data.value, rg.index);
+    data_->Fetch(key+"xx_value", &tile->xx_value, rg.index);
   }
 
   /**
@@ -155,12 +282,274 @@ class TileStore {
     }
   }
 
+  /**
+   * \brief copy from into the narrow type if all values fit
+   * @return false if some value does not fit, then to is unchanged
+   */
+  template <typename V, typename W>
+  static bool Narrow(const SArray<W>& from, SArray<V>* to) {
+    W max = 0;
+    for (W x : from) max = std::max(max, x);
+    if (max > std::numeric_limits<V>::max()) return false;
+    to->resize(from.size());
+    for (size_t i = 0; i < from.size(); ++i) (*to)[i] = static_cast<V>(from[i]);
+    return true;
+  }
+
  private:
-  std::mutex mu_;
-  DataStore* data_ = nullptr;
   /** \brief meta data for a rowblk */
   struct Meta { Range colmap; Range offset; Range index; };
+  /** \brief the whole data of a rowblk */
+  struct Blobs {
+    SArray<dmlc::real_t> label;
+    SArray<dmlc::real_t> weight;
+    SArray<int> colmap;
+    SArray<size_t> offset;
+    SArray<unsigned> index;
+    SArray<dmlc::real_t> value;
+    SArray<dmlc::real_t> xx_value;
+    /** \brief offset and index in narrow types, see \ref Compact */
+    SArray<uint32_t> offset32;
+    SArray<uint16_t> index16;
+  };
+  /** \brief a compressed tile, see \ref Compress */
+  struct CompressedTile {
+    enum ValueType { kNone, kOnes, kRaw, kLZ4 };
+    /** \brief the encoded colmap, offset, and index, and then the values */
+    std::string data;
+    /** \brief the sizes of colmap, offset, and index */
+    size_t ncols = 0, noffset = 0, nnz = 0;
+    ValueType value_type = kNone;
+    /** \brief whether or not the squared values exist */
+    bool has_xx = false;
+  };
+
+  /**
+   * \brief index the data of every rowblk if they are in memory, called once
+   * all tiles are built
+   */
+  void BuildIndex() {
+    blobs_.clear();
+    if (!data_->InMemory()) return;
+    std::vector<Blobs> blobs(meta_.size());
+    for (size_t i = 0; i < meta_.size(); ++i) {
+      auto key = std::to_string(i) + "_";
+      auto& blob = blobs[i];
+      data_->Fetch(key+"label", &blob.label);
+      data_->Fetch(key+"weight", &blob.weight);
+      data_->Fetch(key+"colmap", &blob.colmap);
+      data_->Fetch(key+"offset", &blob.offset);
+      data_->Fetch(key+"index", &blob.index);
+      data_->Fetch(key+"value", &blob.value);
+      data_->Fetch(key+"xx_value", &blob.xx_value);
+    }
+    if (param_.compress_tiles) {
+      Compress(blobs);
+    } else {
+      if (param_.compact_tiles) Compact(&blobs);
+      blobs_.swap(blobs);
+    }
+  }
+
+  /**
+   * \brief narrow the offsets and the indices of each rowblk independently if
+   * they fit, and release the raw data
+   */
+  void Compact(std::vector<Blobs>* blobs) {
+    size_t raw_size = 0, size = 0;
+    for (size_t i = 0; i < blobs->size(); ++i) {
+      auto& blob = (*blobs)[i];
+      auto key = std::to_string(i) + "_";
+      raw_size += blob.offset.size() * sizeof(size_t) +
+                  blob.index.size() * sizeof(unsigned);
+      // the offsets are relative to each tile, so they are bounded by the nnz
+      // of a tile
+      if (Narrow(blob.offset, &blob.offset32)) {
+        blob.offset = SArray<size_t>();
+        data_->Remove(key + "offset");
+      }
+      if (Narrow(blob.index, &blob.index16)) {
+        blob.index = SArray<unsigned>();
+        data_->Remove(key + "index");
+      }
+      size += blob.offset.size() * sizeof(size_t) +
+              blob.index.size() * sizeof(unsigned) +
+              blob.offset32.size() * sizeof(uint32_t) +
+              blob.index16.size() * sizeof(uint16_t);
+    }
+    LOG(INFO) << "compacted offsets and indices from "
+              << (raw_size >> 20) << " MB to " << (size >> 20) << " MB";
+  }
+
+  template <typename V, typename W>
+  static void Widen(const SArray<V>& from, SArray<W>* to) {
+    to->resize(from.size());
+    for (size_t i = 0; i < from.size(); ++i) (*to)[i] = from[i];
+  }
+
+  /**
+   * \brief compress all tiles and release the raw data except for labels and
+   * weights
+   */
+  void Compress(const std::vector<Blobs>& blobs) {
+    size_t raw_size = 0, size = 0;
+    ctiles_.resize(meta_.size());
+    label_.resize(meta_.size());
+    weight_.resize(meta_.size());
+    for (size_t i = 0; i < meta_.size(); ++i) {
+      const auto& blob = blobs[i];
+      label_[i] = blob.label;
+      weight_[i] = blob.weight;
+      raw_size += blob.colmap.size() * sizeof(int) +
+                  blob.offset.size() * sizeof(size_t) +
+                  blob.index.size() * sizeof(unsigned) +
+                  (blob.value.size() + blob.xx_value.size()) * sizeof(dmlc::real_t);
+      for (const auto& rg : meta_[i]) {
+        CompressedTile ct;
+        auto colmap = Segment(blob.colmap, rg.colmap);
+        auto offset = Segment(blob.offset, rg.offset);
+        auto index = Segment(blob.index, rg.index);
+        auto value = Segment(blob.value, rg.index);
+        ct.ncols = colmap.size();
+        ct.noffset = offset.size();
+        ct.nnz = index.size();
+        ct.has_xx = !blob.xx_value.empty();
+        DeltaCodec::Encode(colmap.data(), colmap.size(), &ct.data);
+        DeltaCodec::Encode(offset.data(), offset.size(), &ct.data);
+        DeltaCodec::Encode(index.data(), index.size(), &ct.data);
+        EncodeValue(value, &ct);
+        ct.data.append(DeltaCodec::kPadding, 0);
+        ct.data.shrink_to_fit();
+        size += ct.data.size();
+        ctiles_[i].push_back(std::move(ct));
+      }
+      auto key = std::to_string(i) + "_";
+      for (const char* name : {"colmap", "offset", "index", "value", "xx_value"}) {
+        data_->Remove(key + name);
+      }
+    }
+    LOG(INFO) << "compressed tiles from " << (raw_size >> 20) << " MB to "
+              << (size >> 20) << " MB";
+  }
+
+  void EncodeValue(const SArray<dmlc::real_t>& value, CompressedTile* ct) {
+    if (value.empty()) return;
+    bool ones = true;
+    for (auto v : value) if (v != 1) { ones = false; break; }
+    if (ones) {
+      ct->value_type = CompressedTile::kOnes;
+      return;
+    }
+    size_t raw_size = value.size() * sizeof(dmlc::real_t);
+    const char* raw = reinterpret_cast<const char*>(value.data());
+#if DIFACTO_USE_LZ4
+    std::vector<char> dst(LZ4_compressBound(raw_size));
+    int size = LZ4_compress_default(raw, dst.data(), raw_size, dst.size());
+    if (size > 0 && static_cast<size_t>(size) < raw_size) {
+      ct->value_type = CompressedTile::kLZ4;
+      ct->data.append(dst.data(), size);
+      return;
+    }
+#endif  // DIFACTO_USE_LZ4
+    ct->value_type = CompressedTile::kRaw;
+    ct->data.append(raw, raw_size);
+  }
+
+  /** \brief decompress a tile, reusing the buffers of a per-thread cache */
+  void Decompress(int rowblk_id, int colblk_id, Tile* tile) const {
+    struct Entry {
+      int store = -1, rowblk = -1, colblk = -1;
+      size_t last_used = 0;
+      Tile tile;
+    };
+    static const int kCacheSize = 4;
+    static thread_local Entry cache[kCacheSize];
+    static thread_local size_t clock = 0;
+
+    // return a cached one if hit, otherwise decode into the least recently
+    // used entry
+    Entry* entry = &cache[0];
+    for (auto& e : cache) {
+      if (e.store == uid_ && e.rowblk == rowblk_id && e.colblk == colblk_id) {
+        entry = &e; break;
+      }
+      if (e.last_used < entry->last_used) entry = &e;
+    }
+    entry->last_used = ++clock;
+    if (!(entry->store == uid_ && entry->rowblk == rowblk_id &&
+          entry->colblk == colblk_id)) {
+      entry->store = uid_; entry->rowblk = rowblk_id; entry->colblk = colblk_id;
+      Decode(ctiles_[rowblk_id][colblk_id], &entry->tile);
+    }
+    *tile = entry->tile;
+    tile->data.label = label_[rowblk_id];
+    tile->data.weight = weight_[rowblk_id];
+  }
+
+  static void Decode(const CompressedTile& ct, Tile* tile) {
+    auto& data = tile->data;
+    // the buffers are reused only if no one else holds them
+    Reuse(&tile->colmap, ct.ncols);
+    Reuse(&data.offset, ct.noffset);
+    Reuse(&data.index, ct.nnz);
+    const char* p = ct.data.data();
+    p = DeltaCodec::Decode(p, ct.ncols, tile->colmap.data());
+    p = DeltaCodec::Decode(p, ct.noffset, data.offset.data());
+    p = DeltaCodec::Decode(p, ct.nnz, data.index.data());
+
+    size_t nval = ct.value_type == CompressedTile::kNone ||
+                  ct.value_type == CompressedTile::kOnes ? 0 : ct.nnz;
+    Reuse(&data.value, nval);
+    Reuse(&tile->xx_value, ct.has_xx ? nval : 0);
+    if (nval == 0) return;
+    size_t raw_size = nval * sizeof(dmlc::real_t);
+    char* raw = reinterpret_cast<char*>(data.value.data());
+    if (ct.value_type == CompressedTile::kRaw) {
+      memcpy(raw, p, raw_size);
+    } else {
+#if DIFACTO_USE_LZ4
+      size_t size = ct.data.size() - DeltaCodec::kPadding - (p - ct.data.data());
+      CHECK_EQ(LZ4_decompress_safe(p, raw, size, raw_size),
+               static_cast<int>(raw_size));
+#else
+      LOG(FATAL) << "compile with USE_LZ4=1";
+#endif  // DIFACTO_USE_LZ4
+    }
+    if (ct.has_xx) {
+      for (size_t i = 0; i < nval; ++i) {
+        tile->xx_value[i] = data.value[i] * data.value[i];
+      }
+    }
+  }
+
+  /** \brief resize data, and allocate a new buffer if data is shared */
+  template <typename V>
+  static void Reuse(SArray<V>* data, size_t size) {
+    if (data->ptr().use_count() > 1) *data = SArray<V>();
+    data->resize(size);
+  }
+
+  /** \brief returns data[range], or empty if data is empty */
+  template <typename V>
+  static SArray<V> Segment(const SArray<V>& data, Range range) {
+    if (data.empty()) return SArray<V>();
+    return data.segment(range.begin, range.end);
+  }
+
+  std::mutex mu_;
+  TileStoreParam param_;
+  DataStore* data_ = nullptr;
   std::vector<std::vector<Meta>> meta_;  // row x col
+  /** \brief rowblk id -> blobs, empty if the data are not in memory */
+  std::vector<Blobs> blobs_;
+  /** \brief compressed tiles, row x col, empty if not compress_tiles */
+  std::vector<std::vector<CompressedTile>> ctiles_;
+  /** \brief rowblk id -> labels, used with ctiles_ */
+  std::vector<SArray<dmlc::real_t>> label_;
+  /** \brief rowblk id -> weights, used with ctiles_ */
+  std::vector<SArray<dmlc::real_t>> weight_;
+  /** \brief the unique id of this store, used by the per-thread cache */
+  int uid_;
 
   const std::string meta_header_ = "tile_store_meta";
   const std::string meta_format_ =
@@ -5,6 +5,8 @@
 #include "./lbfgs_utils.h"
 #include "difacto/node_id.h"
 #include "loss/bin_class_metric.h"
+#include "data/direct_index.h"
+#include "data/tile_cache.h"
 #include "reader/reader.h"
 namespace difacto {
 
@@ -73,10 +75,10 @@ void LBFGSLearner::RunScheduler() {
                     Job::kEvaluate, {}, &eval);
     lbfgs::Progress prog; prog.ParseFromVector(eval);
     prog.objv = new_objv;
-    prog.auc /= ntrain;
+    prog.auc = prog.auc_hist.AUC();
     LOG(INFO) << " - training AUC = " << prog.auc;
     if (nval > 0) {
-      prog.val_auc /= nval;
+      prog.val_auc = prog.val_auc_hist.AUC();
       LOG(INFO) << " - validation AUC = " << prog.val_auc;
     }
     for (const auto& cb : epoch_end_callback_) cb(k, prog);
@@ -144,14 +146,49 @@ void LBFGSLearner::Process(const std::string& args, std::string* rets) {
 }
 
 void LBFGSLearner::PrepareData(std::vector<real_t>* rets) {
-  // read train data
   size_t chunk_size = static_cast<size_t>(param_.data_chunk_size * 1024 * 1024);
+  // FMLoss needs X.*X for V, except with direct_index where it is fused
+  bool store_xx = GetUpdater()->param().V_dim > 0 && !param_.direct_index;
+  tile_builder_ = new TileBuilder(tile_store_, nthreads_, false, store_xx);
+  SArray<real_t> feacnts;
+
+  // reuse the tiles built by a previous run on the same data
+  std::unique_ptr<TileCache> cache;
+  if (param_.reuse_data_cache) {
+    int rank = model_store_->Rank(), nworkers = model_store_->NumWorkers();
+    std::stringstream args;
+    args << "lbfgs," << param_.data_in << "," << param_.data_val << ","
+         << param_.data_format << "," << chunk_size << "," << store_xx << ","
+         << rank << "," << nworkers;
+    cache.reset(new TileCache(
+        param_.data_cache + "tiles_" + std::to_string(rank) + "_" +
+        std::to_string(nworkers),
+        TileCache::Signature(param_.data_in + ";" + param_.data_val,
+                             args.str())));
+    // counts = rets + the number of rows of each rowblk
+    std::vector<uint64_t> counts;
+    std::vector<real_t> info;
+    if (cache->Load(tile_builder_, &feaids_, &feacnts, &counts, &info)) {
+      rets->assign(counts.begin(), counts.begin() + 6);
+      ntrain_blks_ = counts[1];
+      nval_blks_ = counts[4];
+      for (size_t i = 6; i < counts.size(); ++i) {
+        pred_.push_back(SArray<real_t>(counts[i]));
+      }
+      int t = model_store_->Push(
+          feaids_, Store::kFeaCount, feacnts, SArray<int>());
+      model_store_->Wait(t);
+      return;
+    }
+  }
+
+  // read train data
   Reader train(param_.data_in, param_.data_format,
                model_store_->Rank(), model_store_->NumWorkers(),
-               chunk_size);
+               chunk_size, param_.data_num_readers, param_.data_read_ahead);
+  // nrows, nblks, and nnz of the train and then the validation data
+  std::vector<uint64_t> counts(6);
   size_t nrows = 0, nnz = 0;
-  tile_builder_ = new TileBuilder(tile_store_, nthreads_);
-  SArray<real_t> feacnts;
   while (train.Next()) {
     auto rowblk = train.Value();
     nrows += rowblk.size;
@@ -160,10 +197,9 @@ void LBFGSLearner::PrepareData(std::vector<real_t>* rets) {
     pred_.push_back(SArray<real_t>(rowblk.size));
     ++ntrain_blks_;
   }
-  rets->resize(6);
-  (*rets)[0] = nrows;
-  (*rets)[1] = ntrain_blks_;
-  (*rets)[2] = nnz;
+  counts[0] = nrows;
+  counts[1] = ntrain_blks_;
+  counts[2] = nnz;
 
   tile_builder_->Wait();
   // push the feature ids and feature counts to the servers
@@ -175,7 +211,7 @@ void LBFGSLearner::PrepareData(std::vector<real_t>* rets) {
     nrows = 0; nnz = 0;
     Reader val(param_.data_val, param_.data_format,
                model_store_->Rank(), model_store_->NumWorkers(),
-               chunk_size);
+               chunk_size, param_.data_num_readers, param_.data_read_ahead);
     while (val.Next()) {
       auto rowblk = val.Value();
       nrows += rowblk.size;
@@ -184,11 +220,16 @@ void LBFGSLearner::PrepareData(std::vector<real_t>* rets) {
       pred_.push_back(SArray<real_t>(rowblk.size));
       ++nval_blks_;
     }
-    (*rets)[3] = nrows;
-    (*rets)[4] = nval_blks_;
-    (*rets)[5] = nnz;
+    counts[3] = nrows;
+    counts[4] = nval_blks_;
+    counts[5] = nnz;
   }
+  rets->assign(counts.begin(), counts.end());
   tile_builder_->Wait();
+  if (cache) {
+    for (const auto& p : pred_) counts.push_back(p.size());
+    cache->Save(*tile_builder_, feaids_, feacnts, counts, {});
+  }
   // wait the previous push finished
   model_store_->Wait(t);
 }
@@ -215,6 +256,33 @@ real_t LBFGSLearner::InitWorker() {
       feaids_, Store::kWeight, &weights_, &model_lens_);
   model_store_->Wait(t);
 
+  // model_lens_ are fixed from now on, so do the index rewriting once
+  if (param_.direct_index) {
+    int nblks = ntrain_blks_ + nval_blks_;
+    direct_data_.resize(nblks);
+    direct_V_index_.resize(nblks);
+    size_t extra = 0;
+    for (int i = 0; i < nblks; ++i) {
+      {
+        Tile tile; tile_store_->Fetch(i, 0, &tile);
+        SArray<int> w_pos, V_pos;
+        GetPos(model_lens_, tile.colmap, &w_pos, &V_pos);
+        if (GetUpdater()->param().V_dim == 0) V_pos.clear();
+        DirectIndex(tile.data, w_pos, V_pos, &direct_data_[i],
+                    &direct_V_index_[i], nthreads_);
+      }
+      // the arrays still shared with the tile store cost nothing extra
+      const auto& d = direct_data_[i];
+      extra += OwnedBytes(d.label) + OwnedBytes(d.weight) +
+               OwnedBytes(d.offset) + OwnedBytes(d.index) +
+               OwnedBytes(d.value) + OwnedBytes(direct_V_index_[i]);
+      CHECK_LE(extra >> 20, static_cast<size_t>(param_.direct_index_max_mem))
+          << "direct_index needs more than " << param_.direct_index_max_mem
+          << " MB, increase direct_index_max_mem or set direct_index=0";
+    }
+    LOG(INFO) << "direct_index uses " << (extra >> 20) << " MB extra memory";
+  }
+
   return CalcGrad(weights_, model_lens_, &grads_);
 }
 
@@ -238,8 +306,10 @@ real_t LBFGSLearner::CalcGrad(const SArray<real_t>& w_val,
                               const SArray<int>& w_len,
                               SArray<real_t>* grad) {
   // create thread pool
-  for (int i = 0; i < ntrain_blks_; ++i) {
-    tile_store_->Prefetch(i, 0);
+  if (direct_data_.empty()) {
+    for (int i = 0; i < ntrain_blks_; ++i) {
+      tile_store_->Prefetch(i, 0);
+    }
   }
   int pool_size = nthreads_ / blk_nthreads_;
   ThreadPool pool(pool_size, pool_size);
@@ -248,28 +318,31 @@ real_t LBFGSLearner::CalcGrad(const SArray<real_t>& w_val,
   grad->resize(n); memset(grad->data(), 0, sizeof(real_t)*n);
   grads[0] = *grad;
   for (int p = 1; p < pool_size; ++p) grads[p].resize(n);
-  std::vector<real_t> objv(pool_size), auc(pool_size);
+  std::vector<real_t> objv(pool_size);
+  std::vector<AUCHistogram> auc(pool_size);
 
   // two-level parallel
   for (int i = 0; i < ntrain_blks_; ++i) {
     pool.Add([this, i, &w_len, &w_val, &grads, &objv, &auc](int tid) {
         // prepare data
-        Tile tile; tile_store_->Fetch(i, 0, &tile);
-        auto data = tile.data.GetBlock();
+        Tile tile;
         SArray<int> w_pos, V_pos;
-        GetPos(w_len, tile.colmap, &w_pos, &V_pos);
+        GetBlock(i, w_len, &tile, &w_pos, &V_pos);
+        auto label = tile.data.label.data();
+        auto weight = tile.data.weight.empty() ? nullptr : tile.data.weight.data();
         memset(pred_[i].data(), 0, pred_[i].size()*sizeof(real_t));
         std::vector<SArray<char>> param = {
-          SArray<char>(w_val), SArray<char>(w_pos), SArray<char>(V_pos)};
+          SArray<char>(w_val), SArray<char>(w_pos), SArray<char>(V_pos),
+          SArray<char>(tile.xx_value)};
 
         // calc
-        auto loss = loss_[tid];
-        loss->Predict(data, param, &pred_[i]);
-        param.push_back(SArray<char>(pred_[i]));
-        loss->CalcGrad(data, param, &(grads[tid]));
-        objv[tid] += loss->Evaluate(data.label, pred_[i]);
-        BinClassMetric metric(data.label, pred_[i].data(), pred_[i].size(), blk_nthreads_);
-        auc[tid] += metric.AUC();
+        auto ws = &loss_ws_[tid];
+        LossPredict(tile, param, &pred_[i], ws);
+        param.insert(param.begin() + 3, SArray<char>(pred_[i]));
+        LossCalcGrad(tile, param, &(grads[tid]), ws);
+        objv[tid] += loss_->Evaluate(label, pred_[i], weight);
+        auc[tid].Add(label, pred_[i].data(), pred_[i].size(), blk_nthreads_,
+                     weight);
       });
   }
   pool.Wait();
@@ -277,12 +350,12 @@ real_t LBFGSLearner::CalcGrad(const SArray<real_t>& w_val,
   // merge results
   for (int i = 1; i < pool_size; ++i) {
     objv[0] += objv[i];
-    auc[0] += auc[i];
+    auc[0].Merge(auc[i]);
     for (size_t j = 0; j < n; ++j) {
       grads[0][j] += grads[i][j];
     }
   }
-  prog_.auc = auc[0];
+  prog_.auc_hist = auc[0];
   *grad = grads[0];
   if (param_.gamma != 1) {
     for (real_t& g : *grad) g = (g > 0 ? 1 : -1) * pow(fabs(g), param_.gamma);
@@ -293,23 +366,25 @@ real_t LBFGSLearner::CalcGrad(const SArray<real_t>& w_val,
 void LBFGSLearner::Evaluate(lbfgs::Progress* prog) {
   int pool_size = nthreads_ / blk_nthreads_;
   ThreadPool pool(pool_size, pool_size);
-  std::vector<real_t> val_auc(pool_size);
+  std::vector<AUCHistogram> val_auc(pool_size);
   // validation data
   for (int i = ntrain_blks_; i < ntrain_blks_ + nval_blks_; ++i) {
     pool.Add([this, i, &val_auc](int tid) {
         // prepare data
-        Tile tile; tile_store_->Fetch(i, 0, &tile);
-        auto data = tile.data.GetBlock();
+        Tile tile;
         SArray<int> w_pos, V_pos;
-        GetPos(model_lens_, tile.colmap, &w_pos, &V_pos);
+        GetBlock(i, model_lens_, &tile, &w_pos, &V_pos);
         memset(pred_[i].data(), 0, pred_[i].size()*sizeof(real_t));
         std::vector<SArray<char>> param = {
-          SArray<char>(weights_), SArray<char>(w_pos), SArray<char>(V_pos)};
+          SArray<char>(weights_), SArray<char>(w_pos), SArray<char>(V_pos),
+          SArray<char>(tile.xx_value)};
 
         // calc
-        loss_[tid]->Predict(data, param, &pred_[i]);
-        BinClassMetric metric(data.label, pred_[i].data(), pred_[i].size(), blk_nthreads_);
-        val_auc[tid] += metric.AUC();
+        LossPredict(tile, param, &pred_[i], &loss_ws_[tid]);
+        val_auc[tid].Add(tile.data.label.data(), pred_[i].data(),
+                         pred_[i].size(), blk_nthreads_,
+                         tile.data.weight.empty() ? nullptr :
+                         tile.data.weight.data());
       });
   }
   pool.Wait();
@@ -317,9 +392,59 @@ void LBFGSLearner::Evaluate(lbfgs::Progress* prog) {
   // merge results
   *prog = prog_;
   for (int i = 1; i < pool_size; ++i) {
-    val_auc[0] += val_auc[i];
+    val_auc[0].Merge(val_auc[i]);
   }
-  prog->val_auc = val_auc[0];
+  prog->val_auc_hist = val_auc[0];
+}
+
+void LBFGSLearner::GetBlock(int i, const SArray<int>& len, Tile* tile,
+                            SArray<int>* w_pos, SArray<int>* V_pos) const {
+  if (direct_data_.size()) {
+    tile->data = direct_data_[i];
+    w_pos->clear();
+    *V_pos = direct_V_index_[i];
+    tile->xx_value.clear();
+    return;
+  }
+  tile_store_->Fetch(i, 0, tile, true);
+  GetPos(len, tile->colmap, w_pos, V_pos);
+}
+
+void LBFGSLearner::LossPredict(const Tile& tile,
+                               const std::vector<SArray<char>>& param,
+                               SArray<real_t>* pred, LossWorkspace* ws) const {
+  if (tile.offset32.empty()) {
+    loss_->Predict(tile.data.GetBlock(), param, pred, ws);
+  } else if (tile.index16.empty()) {
+    loss_->Predict(GetCompactBlock(tile, tile.data.index), param, pred, ws);
+  } else {
+    loss_->Predict(GetCompactBlock(tile, tile.index16), param, pred, ws);
+  }
+}
+
+void LBFGSLearner::LossCalcGrad(const Tile& tile,
+                                const std::vector<SArray<char>>& param,
+                                SArray<real_t>* grad, LossWorkspace* ws) const {
+  if (tile.offset32.empty()) {
+    loss_->CalcGrad(tile.data.GetBlock(), param, grad, ws);
+  } else if (tile.index16.empty()) {
+    loss_->CalcGrad(GetCompactBlock(tile, tile.data.index), param, grad, ws);
+  } else {
+    loss_->CalcGrad(GetCompactBlock(tile, tile.index16), param, grad, ws);
+  }
+}
+
+template <typename I>
+CompactRowBlock<I> LBFGSLearner::GetCompactBlock(const Tile& tile,
+                                                 const SArray<I>& index) {
+  CompactRowBlock<I> blk;
+  blk.size = tile.offset32.size() - 1;
+  blk.offset = tile.offset32.data();
+  blk.label = tile.data.label.empty() ? nullptr : tile.data.label.data();
+  blk.weight = tile.data.weight.empty() ? nullptr : tile.data.weight.data();
+  blk.index = index.data();
+  blk.value = tile.data.value.empty() ? nullptr : tile.data.value.data();
+  return blk;
 }
 
 void LBFGSLearner::GetPos(const SArray<int>& len, const SArray<int>& colmap,
@@ -357,15 +482,19 @@ KWArgs LBFGSLearner::Init(const KWArgs& kwargs) {
   model_store_->SetUpdater(std::shared_ptr<Updater>(updater));
   remain = model_store_->Init(remain);
   // init data stores
+  remain.push_back(std::make_pair("data_cache", param_.data_cache));
   tile_store_ = new TileStore();
   remain = tile_store_->Init(remain);
-  // init loss
-  KWArgs last;
-  for (int i = 0; i < nthreads_ / blk_nthreads_; ++i) {
-    loss_.push_back(Loss::Create(param_.loss, blk_nthreads_));
-    last = loss_.back()->Init(remain);
+  // init loss, it is shared by all pool threads
+  if (param_.direct_index) {
+    // only FMLoss reads the direct indexed data
+    CHECK_EQ(param_.loss, "fm") << "direct_index requires loss=fm";
+    remain.push_back(std::make_pair("direct_index", "1"));
   }
-  return last;
+  loss_ = Loss::Create(param_.loss, blk_nthreads_);
+  remain = loss_->Init(remain);
+  loss_ws_.resize(nthreads_ / blk_nthreads_);
+  return remain;
 }
 
 }  // namespace difacto
@@ -23,7 +23,7 @@ class LBFGSLearner : public Learner {
   virtual ~LBFGSLearner() {
     delete model_store_;
     delete tile_store_;
-    for (auto l : loss_) delete l;
+    delete loss_;
   }
   KWArgs Init(const KWArgs& kwargs) override;
 
@@ -83,6 +83,34 @@ class LBFGSLearner : public Learner {
 
   void GetPos(const SArray<int>& len, const SArray<int>& colmap,
               SArray<int>* w_pos, SArray<int>* V_pos) const;
+  /**
+   * \brief get the i-th data block with the positions to feed into the loss
+   *
+   * return the cached direct indexed block if param_.direct_index is set,
+   * otherwise fetch the tile from tile_store_, in the compact form if it is
+   * stored compactly
+   */
+  void GetBlock(int i, const SArray<int>& len, Tile* tile,
+                SArray<int>* w_pos, SArray<int>* V_pos) const;
+  /**
+   * \brief call loss_->Predict on a tile returned by \ref GetBlock
+   */
+  void LossPredict(const Tile& tile, const std::vector<SArray<char>>& param,
+                   SArray<real_t>* pred, LossWorkspace* ws) const;
+  /**
+   * \brief call loss_->CalcGrad on a tile returned by \ref GetBlock
+   */
+  void LossCalcGrad(const Tile& tile, const std::vector<SArray<char>>& param,
+                    SArray<real_t>* grad, LossWorkspace* ws) const;
+  /** \brief the compact block of a tile with the narrow offsets and index */
+  template <typename I>
+  static CompactRowBlock<I> GetCompactBlock(const Tile& tile,
+                                            const SArray<I>& index);
+  /** \brief the bytes of data if no one else holds it */
+  template <typename V>
+  static size_t OwnedBytes(const SArray<V>& data) {
+    return data.ptr().use_count() > 1 ? 0 : data.size() * sizeof(V);
+  }
 
 
   LBFGSLearnerParam param_;
@@ -97,12 +125,17 @@ class LBFGSLearner : public Learner {
   /** \brief data store */
   TileStore* tile_store_ = nullptr;
   TileBuilder* tile_builder_ = nullptr;
+  /** \brief the direct indexed blocks, see \ref DirectIndex */
+  std::vector<SharedRowBlockContainer<unsigned>> direct_data_;
+  std::vector<SArray<int>> direct_V_index_;
 
   /** \brief the model store*/
   Store* model_store_ = nullptr;
 
   /** \brief the loss function */
-  std::vector<Loss*> loss_;
+  Loss* loss_ = nullptr;
+  /** \brief the workspace of the loss for each pool thread */
+  std::vector<LossWorkspace> loss_ws_;
   std::vector<SArray<real_t>> pred_;
 
   real_t alpha_;
@@ -16,6 +16,12 @@ struct LBFGSLearnerParam : public dmlc::Parameter<LBFGSLearnerParam> {
   std::string data_format;
   /** \brief the directory for the data chache */
   std::string data_cache;
+  /**
+   * \brief if nonzero, save the tiles built from the data into data_cache,
+   * and load them in the next runs on the unchanged data instead of parsing
+   * the data again
+   */
+  int reuse_data_cache;
   /** \brief the model output */
   std::string model_out;
   /** \brief the model input for warm start */
@@ -28,6 +34,13 @@ struct LBFGSLearnerParam : public dmlc::Parameter<LBFGSLearnerParam> {
   int min_num_epochs;
   /** \brief the size of data in MB read each time for processing, in default 256 MB */
   real_t data_chunk_size;
+  /**
+   * \brief the number of sub-parts of a worker's data read at the same time,
+   * should be the same for all workers
+   */
+  int data_num_readers;
+  /** \brief the maximal number of data chunks parsed in advance */
+  int data_read_ahead;
 
   /** \brief stop if (objv_new - objv_old) / obj_old < threshold */
   real_t stop_rel_objv;
@@ -47,13 +60,27 @@ struct LBFGSLearnerParam : public dmlc::Parameter<LBFGSLearnerParam> {
   int max_num_linesearchs;
 
   int num_threads;
+  /**
+   * \brief rewrite the column indices of the data into weight positions once
+   * after initialization and keep them in memory, so the loss reads weights
+   * without the position arrays. the rewritten blocks share the labels,
+   * weights, offsets and values with the tiles in memory, and add 4 bytes per
+   * nonzero entry for the indices and another 4 for the V positions if V_dim >
+   * 0. with a disk data cache they hold the whole data instead.
+   */
+  int direct_index;
+  /** \brief the max extra memory in MB used by direct_index */
+  int direct_index_max_mem;
 
   DMLC_DECLARE_PARAMETER(LBFGSLearnerParam) {
     DMLC_DECLARE_FIELD(data_in);
     DMLC_DECLARE_FIELD(data_val).set_default("");
     DMLC_DECLARE_FIELD(data_format).set_default("libsvm");
     DMLC_DECLARE_FIELD(data_cache).set_default("/tmp/difacto_lbfgs_");
+    DMLC_DECLARE_FIELD(reuse_data_cache).set_default(0);
     DMLC_DECLARE_FIELD(data_chunk_size).set_default(256);
+    DMLC_DECLARE_FIELD(data_num_readers).set_range(1, 64).set_default(1);
+    DMLC_DECLARE_FIELD(data_read_ahead).set_range(1, 1024).set_default(8);
     DMLC_DECLARE_FIELD(model_out).set_default("");
     DMLC_DECLARE_FIELD(model_in).set_default("");
     DMLC_DECLARE_FIELD(loss).set_default("fm");
@@ -70,6 +97,8 @@ struct LBFGSLearnerParam : public dmlc::Parameter<LBFGSLearnerParam> {
     DMLC_DECLARE_FIELD(stop_rel_objv).set_default(1e-5);
     DMLC_DECLARE_FIELD(stop_val_auc).set_default(1e-5);
     DMLC_DECLARE_FIELD(num_threads).set_default(0);
+    DMLC_DECLARE_FIELD(direct_index).set_default(0);
+    DMLC_DECLARE_FIELD(direct_index_max_mem).set_default(2048);
   }
 };
 
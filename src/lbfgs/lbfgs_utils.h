@@ -9,6 +9,9 @@
 #include "dmlc/omp.h"
 #include "difacto/base.h"
 #include "difacto/sarray.h"
+#include "common/range.h"
+#include "common/cpu_dispatch.h"
+#include "loss/bin_class_metric.h"
 namespace difacto {
 namespace lbfgs {
 
@@ -42,19 +45,28 @@ struct Job {
 };
 
 struct Progress {
-  real_t objv;  // objective value on training data
-  real_t auc;   // auc on tarining data
-  real_t val_auc;  // auc on evaluation data
-  real_t nnz_w;  // number of nonzero entries in the model
+  real_t objv = 0;  // objective value on training data
+  real_t auc = 0;   // auc on tarining data
+  real_t val_auc = 0;  // auc on evaluation data
+  real_t nnz_w = 0;  // number of nonzero entries in the model
+  AUCHistogram auc_hist;  // to compute auc
+  AUCHistogram val_auc_hist;  // to compute val_auc
 
+  /** \brief the vector is merged over nodes by summation */
   void SerializeToVector(std::vector<real_t>* vec) const {
-    vec->resize(sizeof(Progress)/sizeof(real_t));
-    memcpy(vec->data(), reinterpret_cast<char const*>(this), sizeof(Progress));
+    vec->resize(4 + 2 * AUCHistogram::kVecSize);
+    real_t* v = vec->data();
+    v[0] = objv; v[1] = auc; v[2] = val_auc; v[3] = nnz_w;
+    auc_hist.CopyTo(v + 4);
+    val_auc_hist.CopyTo(v + 4 + AUCHistogram::kVecSize);
   }
 
   void ParseFromVector(const std::vector<real_t>& vec) {
-    CHECK_EQ(sizeof(Progress), vec.size()*sizeof(real_t));
-    memcpy(reinterpret_cast<char*>(this), vec.data(), sizeof(Progress));
+    CHECK_EQ(vec.size(), 4 + 2 * AUCHistogram::kVecSize);
+    const real_t* v = vec.data();
+    objv = v[0]; auc = v[1]; val_auc = v[2]; nnz_w = v[3];
+    auc_hist.CopyFrom(v + 4);
+    val_auc_hist.CopyFrom(v + 4 + AUCHistogram::kVecSize);
   }
 };
 
@@ -64,13 +76,25 @@ struct Progress {
 inline double Inner(const SArray<real_t>& a,
                     const SArray<real_t>& b,
                     int nthreads = DEFAULT_NTHREADS) {
-  double res = 0;
   CHECK_EQ(a.size(), b.size());
   real_t const *ap = a.data();
   real_t const *bp = b.data();
-#pragma omp parallel for reduction(+:res) num_threads(nthreads)
-  for (size_t i = 0; i < a.size(); ++i) res += ap[i] * bp[i];
-  return res;
+  // sum the per-thread results in order, so the result only depends on
+  // nthreads, not on the ISA
+  std::vector<double> res(nthreads, 0);
+#pragma omp parallel num_threads(nthreads)
+  {
+    int t = omp_get_thread_num();
+    Range rg = Range(0, a.size()).Segment(t, omp_get_num_threads());
+    Dispatch([&]() {
+        res[t] = LaneSum<double>(rg.begin, rg.end, [ap, bp](size_t i) {
+            return static_cast<double>(ap[i] * bp[i]);
+          });
+      });
+  }
+  double sum = 0;
+  for (double r : res) sum += r;
+  return sum;
 }
 
 /**
@@ -83,12 +107,17 @@ inline void Add(real_t x, const SArray<real_t>& a,
   if (x == 0) return;
   real_t const *ap = a.data();
   real_t *bp = b->data();
-  if (x == 1) {
-#pragma omp parallel for num_threads(nthreads)
-    for (size_t i = 0; i < a.size(); ++i) bp[i] += ap[i];
-  } else {
-#pragma omp parallel for num_threads(nthreads)
-    for (size_t i = 0; i < a.size(); ++i) bp[i] += x * ap[i];
+#pragma omp parallel num_threads(nthreads)
+  {
+    Range rg = Range(0, a.size()).Segment(
+        omp_get_thread_num(), omp_get_num_threads());
+    Dispatch([&]() {
+        if (x == 1) {
+          for (size_t i = rg.begin; i < rg.end; ++i) bp[i] += ap[i];
+        } else {
+          for (size_t i = rg.begin; i < rg.end; ++i) bp[i] += x * ap[i];
+        }
+      });
   }
 }
 
@@ -98,8 +127,14 @@ inline void Add(real_t x, const SArray<real_t>& a,
 inline void Times(real_t x, SArray<real_t>* a, int nthreads = DEFAULT_NTHREADS) {
   if (x == 1) return;
   real_t *ap = a->data();
-#pragma omp parallel for num_threads(nthreads)
-  for (size_t i = 0; i < a->size(); ++i) ap[i] *= x;
+#pragma omp parallel num_threads(nthreads)
+  {
+    Range rg = Range(0, a->size()).Segment(
+        omp_get_thread_num(), omp_get_num_threads());
+    Dispatch([&]() {
+        for (size_t i = rg.begin; i < rg.end; ++i) ap[i] *= x;
+      });
+  }
 }
 
 
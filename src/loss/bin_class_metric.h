@@ -4,16 +4,168 @@
 #ifndef DIFACTO_LOSS_BIN_CLASS_METRIC_H_
 #define DIFACTO_LOSS_BIN_CLASS_METRIC_H_
 #include <algorithm>
+#include <cmath>
 #include <vector>
+#include <string.h>
 #include "difacto/base.h"
 #include "dmlc/logging.h"
 #include "dmlc/omp.h"
 #include "difacto/sarray.h"
+#include "common/range.h"
+#include "common/cpu_dispatch.h"
+#include "common/fast_math.h"
 namespace difacto {
 
+/**
+ * \brief streaming AUC by the histograms of the predictions of positive and
+ * negative examples
+ *
+ * unlike \ref BinClassMetric::AUC, it needs O(n) time without sorting, and
+ * histograms can be merged over batches, threads, and machines by summation,
+ * so the AUC is for all examples rather than averaged over batches.
+ *
+ * predictions are clipped into [-kMaxPred, kMaxPred] and then put into
+ * kNumBins even bins. examples in the same bin are treated as ties, so the
+ * error is bounded by the fraction of (positive, negative) pairs falling into
+ * the same bin.
+ *
+ * use \ref CopyTo and \ref CopyFrom to send it within a real_t vector, which
+ * is merged by summation, such as the progress of \ref BCDLearner. the counts
+ * survive the summation in float exactly, up to a resolution of 2^-kFracBits
+ * for the weighted counts.
+ */
+struct AUCHistogram {
+  static const int kNumBins = 1024;
+  static constexpr real_t kMaxPred = 20;
+  /**
+   * \brief the number of positive examples in each bin. it is double, since
+   * a float count stops increasing at 2^24
+   */
+  double pos[kNumBins];
+  /** \brief the number of negative examples in each bin */
+  double neg[kNumBins];
+
+  AUCHistogram() { Clear(); }
+
+  void Clear() {
+    memset(pos, 0, sizeof(pos));
+    memset(neg, 0, sizeof(neg));
+  }
+  /**
+   * \brief add n examples, each of which counts weight[i] times if weight is
+   * given
+   */
+  void Add(const dmlc::real_t* const label, const real_t* const predict,
+           size_t n, int nthreads = DEFAULT_NTHREADS,
+           const dmlc::real_t* const weight = nullptr) {
+    if (n < 10000) nthreads = 1;
+#pragma omp parallel num_threads(nthreads)
+    {
+      Range rg = Range(0, n).Segment(
+          omp_get_thread_num(), omp_get_num_threads());
+      AUCHistogram local;
+      for (size_t i = rg.begin; i < rg.end; ++i) {
+        int b = Bin(predict[i]);
+        double w = weight ? weight[i] : 1;
+        if (label[i] > 0) {
+          local.pos[b] += w;
+        } else {
+          local.neg[b] += w;
+        }
+      }
+#pragma omp critical
+      Merge(local);
+    }
+  }
+
+  /**
+   * \brief a count is sent as the kDigits base-2^kDigitBits digits of
+   * count * 2^kFracBits rounded, each of which is a small integer in a real_t.
+   * summing the digits in float is exact for up to 2^(24-kDigitBits) nodes,
+   * unlike summing the counts themselves, which stops at 2^24
+   */
+  static const int kDigitBits = 12;
+  static const int kDigits = 4;
+  static const int kFracBits = 8;
+  /** \brief the number of real_t values used by \ref CopyTo */
+  static const int kVecSize = 2 * kNumBins * kDigits;
+  /** \brief encode the counts into vec[0, kVecSize) */
+  void CopyTo(real_t* vec) const {
+    for (int i = 0; i < kNumBins; ++i) {
+      Encode(pos[i], vec + i, 2 * kNumBins);
+      Encode(neg[i], vec + kNumBins + i, 2 * kNumBins);
+    }
+  }
+  /**
+   * \brief decode the counts from vec[0, kVecSize), which may be the sum of
+   * several vectors filled by \ref CopyTo
+   */
+  void CopyFrom(const real_t* vec) {
+    for (int i = 0; i < kNumBins; ++i) {
+      pos[i] = Decode(vec + i, 2 * kNumBins);
+      neg[i] = Decode(vec + kNumBins + i, 2 * kNumBins);
+    }
+  }
+
+  void Merge(const AUCHistogram& other) {
+    for (int i = 0; i < kNumBins; ++i) {
+      pos[i] += other.pos[i];
+      neg[i] += other.neg[i];
+    }
+  }
+  /**
+   * \brief the number of examples
+   */
+  double Count() const {
+    double cnt = 0;
+    for (int i = 0; i < kNumBins; ++i) cnt += pos[i] + neg[i];
+    return cnt;
+  }
+  /**
+   * \brief the AUC, which is 1 if there is only a single class
+   */
+  real_t AUC() const {
+    double area = 0, cum_neg = 0, cum_pos = 0;
+    for (int i = 0; i < kNumBins; ++i) {
+      area += pos[i] * (cum_neg + .5 * neg[i]);
+      cum_neg += neg[i];
+      cum_pos += pos[i];
+    }
+    if (cum_pos == 0 || cum_neg == 0) return 1;
+    return area / (cum_pos * cum_neg);
+  }
+
+  static void Encode(double count, real_t* digit, int stride) {
+    CHECK_LT(count, std::ldexp(1.0, kDigits * kDigitBits - kFracBits));
+    uint64_t x = static_cast<uint64_t>(std::ldexp(count, kFracBits) + .5);
+    for (int d = 0; d < kDigits; ++d) {
+      digit[d * stride] = static_cast<real_t>(x & ((1 << kDigitBits) - 1));
+      x >>= kDigitBits;
+    }
+  }
+
+  static double Decode(const real_t* digit, int stride) {
+    double count = 0;
+    for (int d = kDigits - 1; d >= 0; --d) {
+      count = std::ldexp(count, kDigitBits) + digit[d * stride];
+    }
+    return std::ldexp(count, - kFracBits);
+  }
+
+  static int Bin(real_t predict) {
+    real_t m = kMaxPred;
+    real_t p = predict > m ? m : (predict < -m ? -m : predict);
+    int b = static_cast<int>((p + m) * (kNumBins / (2 * m)));
+    return b < kNumBins ? b : kNumBins - 1;
+  }
+};
+
 /**
  * \brief binary classificatoin metrics
  * all metrics are not divided by num_examples
+ *
+ * if the example weights are given, an example counts weight[i] times, and
+ * num_examples is the sum of the weights
  */
 class BinClassMetric {
  public:
@@ -24,77 +176,139 @@ class BinClassMetric {
    * @param predict predict vector
    * @param n length
    * @param nthreads num threads
+   * @param fast_math use the approximations in \ref fast_math for exp and log
+   * in \ref LogLoss and \ref LogitObjv
+   * @param weight optional example weights
    */
   BinClassMetric(const dmlc::real_t* const label,
                  const real_t* const predict,
-                 size_t n, int nthreads = DEFAULT_NTHREADS)
-      : label_(label), predict_(predict), size_(n), nt_(nthreads) { }
+                 size_t n, int nthreads = DEFAULT_NTHREADS,
+                 bool fast_math = false,
+                 const dmlc::real_t* const weight = nullptr)
+      : label_(label), predict_(predict), weight_(weight), size_(n),
+        nt_(nthreads), fast_math_(fast_math) { }
 
   ~BinClassMetric() { }
 
   real_t AUC() {
     size_t n = size_;
-    struct Entry { dmlc::real_t label; real_t predict; };
+    struct Entry { dmlc::real_t label; real_t predict; dmlc::real_t weight; };
     std::vector<Entry> buff(n);
+    real_t total = 0;
     for (size_t i = 0; i < n; ++i) {
       buff[i].label = label_[i];
       buff[i].predict = predict_[i];
+      buff[i].weight = weight_ ? weight_[i] : 1;
+      total += buff[i].weight;
     }
     std::sort(buff.data(), buff.data()+n,  [](const Entry& a, const Entry&b) {
         return a.predict < b.predict; });
     real_t area = 0, cum_tp = 0;
     for (size_t i = 0; i < n; ++i) {
       if (buff[i].label > 0) {
-        cum_tp += 1;
+        cum_tp += buff[i].weight;
       } else {
-        area += cum_tp;
+        area += cum_tp * buff[i].weight;
       }
     }
-    if (cum_tp == 0 || cum_tp == n) return 1;
-    area /= cum_tp * (n - cum_tp);
-    return (area < 0.5 ? 1 - area : area) * n;
+    if (cum_tp == 0 || cum_tp == total) return 1;
+    area /= cum_tp * (total - cum_tp);
+    return (area < 0.5 ? 1 - area : area) * total;
   }
 
   real_t Accuracy(real_t threshold) {
-    real_t correct = 0;
+    real_t correct = 0, total = 0;
     size_t n = size_;
-#pragma omp parallel for reduction(+:correct) num_threads(nt_)
+#pragma omp parallel for reduction(+:correct, total) num_threads(nt_)
     for (size_t i = 0; i < n; ++i) {
+      real_t w = weight_ ? weight_[i] : 1;
+      total += w;
       if ((label_[i] > 0 && predict_[i] > threshold) ||
           (label_[i] <= 0 && predict_[i] <= threshold))
-        correct += 1;
+        correct += w;
     }
-    return correct > 0.5 * n ? correct : n - correct;
+    return correct > 0.5 * total ? correct : total - correct;
   }
 
   real_t LogLoss() {
     real_t loss = 0;
     size_t n = size_;
+    if (fast_math_) {
+      // log(p) = - log(1 + exp(-pred)), log(1-p) = - log(1 + exp(pred))
+      const real_t min_logp = std::log(1e-10);
+      Reduce([min_logp](dmlc::real_t label, real_t pred) {
+          real_t logp = - fast_math::Log1pExp(- pred);
+          logp = logp < min_logp ? min_logp : logp;
+          return label > 0 ? logp : - fast_math::Log1pExp(pred);
+        }, &loss);
+      return - loss;
+    }
 #pragma omp parallel for reduction(+:loss) num_threads(nt_)
     for (size_t i = 0; i < n; ++i) {
       real_t y = label_[i] > 0;
       real_t p = 1 / (1 + exp(- predict_[i]));
       p = p < 1e-10 ? 1e-10 : p;
-      loss += y * log(p) + (1 - y) * log(1 - p);
+      real_t w = weight_ ? weight_[i] : 1;
+      loss += w * (y * log(p) + (1 - y) * log(1 - p));
     }
     return - loss;
   }
 
   real_t LogitObjv() {
     real_t objv = 0;
+    if (fast_math_) {
+      Reduce([](dmlc::real_t label, real_t pred) {
+          real_t y = label > 0 ? 1 : -1;
+          return fast_math::Log1pExp(- y * pred);
+        }, &objv);
+      return objv;
+    }
 #pragma omp parallel for reduction(+:objv) num_threads(nt_)
     for (size_t i = 0; i < size_; ++i) {
       real_t y = label_[i] > 0 ? 1 : -1;
-      objv += log(1 + exp(- y * predict_[i]));
+      real_t w = weight_ ? weight_[i] : 1;
+      objv += w * log(1 + exp(- y * predict_[i]));
     }
     return objv;
   }
 
  private:
+  /**
+   * \brief res = sum_i weight[i] * op(label[i], predict[i]), vectorized by
+   * \ref Dispatch. the result is identical among the ISA variants, see \ref
+   * LaneSum
+   */
+  template <typename Op>
+  void Reduce(const Op& op, real_t* res) {
+    std::vector<real_t> sum(nt_, 0);
+    const dmlc::real_t* label = label_;
+    const real_t* predict = predict_;
+    const dmlc::real_t* weight = weight_;
+#pragma omp parallel num_threads(nt_)
+    {
+      int t = omp_get_thread_num();
+      Range rg = Range(0, size_).Segment(t, omp_get_num_threads());
+      Dispatch([&]() {
+          if (weight) {
+            sum[t] = LaneSum<real_t>(rg.begin, rg.end, [&](size_t i) {
+                return weight[i] * op(label[i], predict[i]);
+              });
+          } else {
+            sum[t] = LaneSum<real_t>(rg.begin, rg.end, [&](size_t i) {
+                return op(label[i], predict[i]);
+              });
+          }
+        });
+    }
+    for (real_t s : sum) *res += s;
+  }
+
   dmlc::real_t const* label_;
   real_t const* predict_;
+  dmlc::real_t const* weight_;
   size_t size_;
   int nt_;
+  bool fast_math_;
 };
 
 }  // namespace difacto
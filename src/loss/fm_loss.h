@@ -11,6 +11,8 @@
 #include "difacto/loss.h"
 #include "common/spmv.h"
 #include "common/spmm.h"
+#include "common/range.h"
+#include "common/cpu_dispatch.h"
 #include "./logit_loss.h"
 namespace difacto {
 /**
@@ -21,8 +23,17 @@ struct FMLossParam : public dmlc::Parameter<FMLossParam> {
    * \brief the embedding dimension
    */
   int V_dim;
+  /** \brief use the approximated exp, see \ref LogitLossParam */
+  int fast_math;
+  /**
+   * \brief whether data.index has been rewritten into weight positions by
+   * \ref DirectIndex, then the V positions are given for each nonzero entry
+   */
+  int direct_index;
   DMLC_DECLARE_PARAMETER(FMLossParam) {
     DMLC_DECLARE_FIELD(V_dim).set_range(0, 10000);
+    DMLC_DECLARE_FIELD(fast_math).set_range(0, 1).set_default(0);
+    DMLC_DECLARE_FIELD(direct_index).set_range(0, 1).set_default(0);
   }
 };
 /**
@@ -49,26 +60,39 @@ class FMLoss : public Loss {
    * @param data the data
    * @param param input parameters
    * - param[0], real_t vector, the weights
-   * - param[1], int vector, the w positions
-   * - param[2], int vector, the V positions
+   * - param[1], int vector, the w positions. empty if data.index already
+   *   points to the w positions
+   * - param[2], int vector, the V positions of each column, or of each nonzero
+   *   entry if direct_index is set, see \ref FMLossParam
+   * - param[3], optional real_t vector, the squared values data.value .*
+   *   data.value, see \ref Tile. it is computed if empty or not given
    * @param pred predict output, should be pre-allocated
+   * @param ws the workspace, X*V and X.*X are kept in it for \ref CalcGrad
    */
   void Predict(const dmlc::RowBlock<unsigned>& data,
                const std::vector<SArray<char>>& param,
-               SArray<real_t>* pred) override {
-    CHECK_EQ(param.size(), 3);
+               SArray<real_t>* pred,
+               LossWorkspace* ws) override {
+    CHECK_GE(param.size(), 3); CHECK_LE(param.size(), 4);
     Predict(data,
             SArray<real_t>(param[0]),
             SArray<int>(param[1]),
             SArray<int>(param[2]),
-            pred);
+            pred,
+            param.size() == 4 ? SArray<dmlc::real_t>(param[3]) :
+            SArray<dmlc::real_t>(),
+            ws);
   }
+  using Loss::Predict;
 
   void Predict(const dmlc::RowBlock<unsigned>& data,
                const SArray<real_t>& weights,
                const SArray<int>& w_pos,
                const SArray<int>& V_pos,
-               SArray<real_t>* pred) {
+               SArray<real_t>* pred,
+               const SArray<dmlc::real_t>& xx_value = SArray<dmlc::real_t>(),
+               LossWorkspace* ws = nullptr) {
+    if (ws == nullptr) ws = &workspace_;
     // pred = X * w
     SArray<real_t> w = weights;
     SpMV::Times(data, w, pred, nthreads_, w_pos, {});
@@ -77,22 +101,20 @@ class FMLoss : public Loss {
     if (V_dim == 0) return;
     SArray<real_t> V = weights;
 
-    // XV_ = X*V
-    XV_.clear();
-    XV_.resize(data.size * V_dim, 0);
-    SpMM::Times(data, V, V_dim, &XV_, nthreads_, V_pos);
+    // XV = X*V
+    auto XV = ws->GetZero<real_t>(kXV, data.size * V_dim);
+    if (param_.direct_index) {
+      PredictDirect(data, V, V_pos, XV, pred);
+      return;
+    }
+    SpMM::Times(data, V, V_dim, &XV, nthreads_, V_pos);
 
     // XX = X.*X
     auto XX = data;
-    if (XX.value) {
-      XX_.clear();
-      XX_.CopyFrom(XX.value+XX.offset[0], XX.offset[XX.size] - XX.offset[0]);
-      for (auto& v : XX_) v *= v;
-      XX.value = XX_.data();
-    }
+    if (XX.value) XX.value = Square(data, xx_value, ws);
 
-    // VV = V*V
-    SArray<real_t> VV(V.size());
+    // VV = V*V, only the V positions are used
+    auto VV = ws->Get<real_t>(kVV, V.size());
 #pragma omp parallel for num_threads(nthreads_)
     for (size_t i = 0; i < V_pos.size(); ++i) {
       int p = V_pos[i];
@@ -101,13 +123,13 @@ class FMLoss : public Loss {
     }
 
     // XXVV = XX*VV
-    SArray<real_t> XXVV(XV_.size());
+    auto XXVV = ws->GetZero<real_t>(kXXVV, XV.size());
     SpMM::Times(XX, VV, V_dim, &XXVV, nthreads_, V_pos);
 
     // py += .5 * sum((V.XV).^2 - xxvv)
 #pragma omp parallel for num_threads(nthreads_)
     for (size_t i = 0; i < pred->size(); ++i) {
-      real_t* t = XV_.data() + i * V_dim;
+      real_t* t = XV.data() + i * V_dim;
       real_t* tt = XXVV.data() + i * V_dim;
       real_t s = 0;
       for (int j = 0; j < V_dim; ++j) s += t[j] * t[j] - tt[j];
@@ -128,37 +150,44 @@ class FMLoss : public Loss {
    * @param data the data
    * @param param input parameters
    * - param[0], real_t vector, the weights
-   * - param[1], int vector, the w positions
-   * - param[2], int vector, the V positions
+   * - param[1], int vector, the w positions, see \ref Predict
+   * - param[2], int vector, the V positions, see \ref Predict
    * - param[3], real_t vector, the predict output
+   * - param[4], optional real_t vector, the squared values, see \ref Predict
    * @param grad the results
+   * @param ws the workspace used by \ref Predict
    */
   void CalcGrad(const dmlc::RowBlock<unsigned>& data,
                 const std::vector<SArray<char>>& param,
-                SArray<real_t>* grad) override {
-    CHECK_EQ(param.size(), 4);
+                SArray<real_t>* grad,
+                LossWorkspace* ws) override {
+    CHECK_GE(param.size(), 4); CHECK_LE(param.size(), 5);
     CalcGrad(data,
              SArray<real_t>(param[0]),
              SArray<int>(param[1]),
              SArray<int>(param[2]),
              SArray<real_t>(param[3]),
-             grad);
+             grad,
+             param.size() == 5 ? SArray<dmlc::real_t>(param[4]) :
+             SArray<dmlc::real_t>(),
+             ws);
   }
+  using Loss::CalcGrad;
 
   void CalcGrad(const dmlc::RowBlock<unsigned>& data,
                 const SArray<real_t>& weights,
                 const SArray<int>& w_pos,
                 const SArray<int>& V_pos,
                 const SArray<real_t>& pred,
-                SArray<real_t>* grad) {
+                SArray<real_t>* grad,
+                const SArray<dmlc::real_t>& xx_value = SArray<dmlc::real_t>(),
+                LossWorkspace* ws = nullptr) {
+    if (ws == nullptr) ws = &workspace_;
     // p = ...
-    SArray<real_t> p; p.CopyFrom(pred);
-    CHECK_EQ(p.size(), data.size);
-#pragma omp parallel for num_threads(nthreads_)
-    for (size_t i = 0; i < p.size(); ++i) {
-      real_t y = data.label[i] > 0 ? 1 : -1;
-      p[i] = - y / (1 + std::exp(y * p[i]));
-    }
+    CHECK_EQ(pred.size(), data.size);
+    auto p = ws->Get<real_t>(kP, pred.size());
+    memcpy(p.data(), pred.data(), pred.size() * sizeof(real_t));
+    LogitLossGrad(data.label, data.weight, &p, param_.fast_math, nthreads_);
 
     // grad_w = ...
     SpMV::TransTimes(data, p, grad, nthreads_, {}, w_pos);
@@ -167,14 +196,20 @@ class FMLoss : public Loss {
     int V_dim = param_.V_dim;
     if (V_dim == 0) return;
     SArray<real_t> V = weights;
+    // XV = X*V, computed by Predict
+    auto XV = ws->Get<real_t>(kXV, data.size * V_dim);
+    if (param_.direct_index) {
+      CalcGradDirect(data, V, V_pos, XV, p, grad);
+      return;
+    }
 
-    // XXp = (X.*X)'*p
+    // XXp = (X.*X)'*p, X.*X is computed by Predict if not given
     auto XX = data;
     if (XX.value) {
-      CHECK_EQ(XX_.size(), XX.offset[XX.size] - XX.offset[0]);
-      XX.value = XX_.data();
+      XX.value = xx_value.empty() ? ws->Get<dmlc::real_t>(
+          kXX, XX.offset[XX.size]).data() : xx_value.data();
     }
-    SArray<real_t> XXp(V_pos.size());
+    auto XXp = ws->GetZero<real_t>(kXXp, V_pos.size());
     SpMV::TransTimes(XX, p, &XXp, nthreads_);
 
     // grad_u -= diag(XXp) * V,
@@ -187,20 +222,119 @@ class FMLoss : public Loss {
       }
     }
 
-    // XV_ = diag(p) * X * V
-    CHECK_EQ(XV_.size(), data.size * V_dim);
+    // XV = diag(p) * X * V
 #pragma omp parallel for num_threads(nthreads_)
     for (size_t i = 0; i < p.size(); ++i) {
-      for (int j = 0; j < V_dim; ++j) XV_[i*V_dim+j] *= p[i];
+      for (int j = 0; j < V_dim; ++j) XV[i*V_dim+j] *= p[i];
     }
 
     // grad_u += X' * diag(p) * X * V
-    SpMM::TransTimes(data, XV_, V_dim, grad, nthreads_, {}, V_pos);
+    SpMM::TransTimes(data, XV, V_dim, grad, nthreads_, {}, V_pos);
   }
 
  private:
-  SArray<real_t> XV_;
-  SArray<dmlc::real_t> XX_;
+  /** \brief the buffer ids in the workspace */
+  enum { kXV, kXX, kVV, kXXVV, kP, kXXp };
+  /**
+   * \brief returns the values of X.*X, which is xx_value if not empty,
+   * otherwise computed into the workspace. it is indexed as data.value
+   */
+  dmlc::real_t const* Square(const dmlc::RowBlock<unsigned>& data,
+                             const SArray<dmlc::real_t>& xx_value,
+                             LossWorkspace* ws) {
+    size_t end = data.offset[data.size];
+    if (xx_value.size()) {
+      CHECK_GE(xx_value.size(), end);
+      return xx_value.data();
+    }
+    auto xx = ws->Get<dmlc::real_t>(kXX, end);
+    for (size_t i = data.offset[0]; i < end; ++i) {
+      xx[i] = data.value[i] * data.value[i];
+    }
+    return xx.data();
+  }
+  /**
+   * \brief the V part of \ref Predict, where data.index has been rewritten
+   * into weight positions and V_index[j] is the V position of the j-th
+   * nonzero entry
+   *
+   * XV = X*V and (X.*X)*(V.*V) are computed in a single pass
+   */
+  void PredictDirect(const dmlc::RowBlock<unsigned>& data,
+                     const SArray<real_t>& V,
+                     const SArray<int>& V_index,
+                     SArray<real_t> XV,
+                     SArray<real_t>* pred) {
+    int V_dim = param_.V_dim;
+    CHECK_EQ(V_index.size(), data.offset[data.size]);
+#pragma omp parallel num_threads(nthreads_)
+    {
+      Range rg = Range(0, data.size).Segment(
+          omp_get_thread_num(), omp_get_num_threads());
+      Dispatch([&]() {
+          for (size_t i = rg.begin; i < rg.end; ++i) {
+            real_t* t = XV.data() + i * V_dim;
+            real_t tt = 0;
+            for (size_t j = data.offset[i]; j < data.offset[i+1]; ++j) {
+              int p = V_index[j];
+              if (p < 0) continue;
+              real_t const* V_j = V.data() + p;
+              real_t x = data.value ? data.value[j] : 1;
+              real_t vv = 0;
+              for (int k = 0; k < V_dim; ++k) {
+                t[k] += x * V_j[k];
+                vv += V_j[k] * V_j[k];
+              }
+              tt += x * x * vv;
+            }
+            real_t s = 0;
+            for (int k = 0; k < V_dim; ++k) s += t[k] * t[k];
+            (*pred)[i] += .5 * (s - tt);
+          }
+        });
+    }
+
+    // projection
+    for (auto& p : *pred) p = p > 20 ? 20 : (p < -20 ? -20 : p);
+  }
+
+  /**
+   * \brief the V part of \ref CalcGrad with the same input as \ref
+   * PredictDirect
+   *
+   * grad_u = sum_i x_i * p_i * (XV_i - x_i * V)
+   */
+  void CalcGradDirect(const dmlc::RowBlock<unsigned>& data,
+                      const SArray<real_t>& V,
+                      const SArray<int>& V_index,
+                      const SArray<real_t>& XV,
+                      const SArray<real_t>& p,
+                      SArray<real_t>* grad) {
+    int V_dim = param_.V_dim;
+    CHECK_EQ(V_index.size(), data.offset[data.size]);
+    CHECK_EQ(XV.size(), data.size * V_dim);
+    real_t* g = grad->data();
+#pragma omp parallel num_threads(nthreads_)
+    {
+      Range rg = Range(0, grad->size()).Segment(
+          omp_get_thread_num(), omp_get_num_threads());
+      Dispatch([&]() {
+          for (size_t i = 0; i < data.size; ++i) {
+            real_t const* t = XV.data() + i * V_dim;
+            for (size_t j = data.offset[i]; j < data.offset[i+1]; ++j) {
+              int k = V_index[j];
+              if (k < 0 || !rg.Has(k)) continue;
+              real_t x = data.value ? data.value[j] : 1;
+              real_t xp = x * p[i];
+              real_t const* V_j = V.data() + k;
+              for (int l = 0; l < V_dim; ++l) g[k+l] += xp * (t[l] - x * V_j[l]);
+            }
+          }
+        });
+    }
+  }
+
+ protected:
   FMLossParam param_;
 };
 
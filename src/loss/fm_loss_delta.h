@@ -5,12 +5,23 @@
 #define DIFACTO_LOSS_FM_LOSS_DELTA_H_
 #include <vector>
 #include "difacto/sarray.h"
+#include "common/range.h"
 #include "./fm_loss.h"
 namespace difacto {
 
 /**
- * \brief the FM loss, different to \ref FMLoss, \ref FMLossDelta is feeded with
- * delta weight, and tranpose of X, each time
+ * \brief the FM loss, specialized for block coordinate descent
+ *
+ * different to \ref FMLoss, \ref FMLossDelta is feeded with X' (the transpose
+ * of X) on a block of features and the delta weights each time. besides the
+ * prediction, the caller keeps XV = X*V for each row block, which is updated
+ * by \ref Predict, so an update only touches the nonzero entries of the
+ * changed features.
+ *
+ * the weights of a feature are stored as [w, V_1, ..., V_{V_dim}], and the
+ * gradients as [g_w, h_w, g_V1, h_V1, ...], where h is the diagonal hessian.
+ * since the prediction is linear on a single V_jk, h_V is the Gauss-Newton
+ * approximation, which is exact for the loss.
  */
 class FMLossDelta : public FMLoss {
  public:
@@ -20,39 +31,169 @@ class FMLossDelta : public FMLoss {
   virtual ~FMLossDelta() { }
 
   KWArgs Init(const KWArgs& kwargs) override {
-    return kwargs;
+    return FMLoss::Init(kwargs);
   }
 
   /**
+   * \brief compute the gradients and the diagonal hessian
+   *
+   * p = - y ./ (1 + exp (y .* pred)), h = p .* (- y - p)
+   *
+   * for feature j and example i, let d_ijk = x_ij * (XV_ik - x_ij * V_jk), then
+   * g_w = sum_i x_ij p_i, h_w = sum_i x_ij^2 h_i,
+   * g_Vk = sum_i d_ijk p_i, h_Vk = sum_i d_ijk^2 h_i
+   *
    * @param data X', the transpose of X
    * @param param parameters
-   * - param[0], real_t, previous predict
-   * - param[1], int, param[1][i] is the length of the gradient on the i-th feature
-   *   and sum(param[2]) = length(grad)
-   * - param[2], real_t, the prediction (results of \ref Predict)
-   * @param grad output gradient
+   * - param[0], real_t vector, the prediction
+   * - param[1], int vector, the gradient position of each row of X', -1 means
+   *   skipped. the gradient has length 2 * (V_dim + 1)
+   * - param[2], real_t vector, XV, the length is V_dim * pred.size()
+   * - param[3], real_t vector, the current weights
+   * - param[4], int vector, the weight position of each row of X', -1 means
+   *   not exists
+   * - param[5], optional real_t vector, the squared values, see \ref Tile
+   * @param grad output gradient, the results are added into it
+   * @param ws the workspace
    */
   void CalcGrad(const dmlc::RowBlock<unsigned>& data,
                 const std::vector<SArray<char>>& param,
-                SArray<real_t>* grad) override {
-    // TODO(mli)
+                SArray<real_t>* grad,
+                LossWorkspace* ws) override {
+    CHECK_GE(param.size(), 5); CHECK_LE(param.size(), 6);
+    SArray<real_t> pred(param[0]);
+    SArray<int> grad_pos(param[1]);
+    SArray<real_t> XV(param[2]);
+    SArray<real_t> weights(param[3]);
+    SArray<int> w_pos(param[4]);
+    SArray<dmlc::real_t> xx_value;
+    if (param.size() == 6) xx_value = SArray<dmlc::real_t>(param[5]);
+    int V_dim = param_.V_dim;
+    CHECK_EQ(grad_pos.size(), data.size);
+    CHECK_EQ(w_pos.size(), data.size);
+    CHECK_EQ(XV.size(), pred.size() * V_dim);
+    if (data.value && xx_value.size()) {
+      CHECK_GE(xx_value.size(), data.offset[data.size]);
+    }
+
+    // p = ..., h = ...
+    auto p = CHECK_NOTNULL(ws)->Get<real_t>(kP, pred.size());
+    memcpy(p.data(), pred.data(), pred.size() * sizeof(real_t));
+    LogitLossGrad(data.label, nullptr, &p, param_.fast_math, nthreads_);
+    auto h = ws->Get<real_t>(kH, pred.size());
+#pragma omp parallel for num_threads(nthreads_)
+    for (size_t i = 0; i < p.size(); ++i) {
+      real_t y = data.label[i] > 0 ? 1 : -1;
+      real_t w = data.weight ? data.weight[i] : 1;
+      h[i] = - w * p[i] * (y + p[i]);
+      p[i] *= w;
+    }
+
+    // each row of X' writes its own gradient
+#pragma omp parallel for num_threads(nthreads_)
+    for (size_t r = 0; r < data.size; ++r) {
+      if (grad_pos[r] < 0) continue;
+      real_t* g = grad->data() + grad_pos[r];
+      real_t const* V = w_pos[r] < 0 ? nullptr : weights.data() + w_pos[r] + 1;
+      for (size_t j = data.offset[r]; j < data.offset[r+1]; ++j) {
+        unsigned i = data.index[j];
+        real_t x = data.value ? data.value[j] : 1;
+        real_t xx = xx_value.size() ? xx_value[j] : x * x;
+        g[0] += x * p[i];
+        g[1] += xx * h[i];
+        if (V == nullptr) continue;
+        real_t const* t = XV.data() + i * V_dim;
+        for (int k = 0; k < V_dim; ++k) {
+          real_t d = x * (t[k] - x * V[k]);
+          g[2+2*k] += d * p[i];
+          g[3+2*k] += d * d * h[i];
+        }
+      }
+    }
   }
 
   /**
+   * \brief update the prediction and XV given the delta weights
+   *
+   *  pred += X * delta_w + .5 * sum(XV'.^2 - XV.^2, 2)
+   *          - .5 * (X.*X) * sum(V'.^2 - V.^2, 2)
+   *  XV' = XV + X * delta_V
+   *
+   * where V' = V + delta_V is the new V
+   *
    * @param data X', the transpose of X
    * @param param parameters
-   * - param[0], real_t, previous predict
-   * - param[1], real_t, delta weight, namely new_w - old_w
-   * - param[2], int, param[2][i] is the length of delta_w[i].
-   *   and sum(param[2]) = length(delta_w)
-   * @param pred output prediction, it may overwrite param[0]
+   * - param[0], real_t vector, the delta weights, namely new_w - old_w
+   * - param[1], int vector, the weight position of each row of X' in
+   *   param[0] and param[3], -1 means not exists
+   * - param[2], real_t vector, XV, it is updated in place
+   * - param[3], real_t vector, the new weights
+   * @param pred the prediction, it is updated in place
+   * @param ws the workspace
    */
   void Predict(const dmlc::RowBlock<unsigned>& data,
                const std::vector<SArray<char>>& param,
-               SArray<real_t>* pred) override {
-    *CHECK_NOTNULL(pred) = param[0];
-    FMLoss::Predict(data, {param[1], param[2]}, pred);
+               SArray<real_t>* pred,
+               LossWorkspace* ws) override {
+    CHECK_EQ(param.size(), 4);
+    SArray<real_t> delta_w(param[0]);
+    SArray<int> w_pos(param[1]);
+    SArray<real_t> XV(param[2]);
+    SArray<real_t> weights(param[3]);
+    int V_dim = param_.V_dim;
+    size_t n = CHECK_NOTNULL(pred)->size();
+    CHECK_EQ(w_pos.size(), data.size);
+    CHECK_EQ(XV.size(), n * V_dim);
+    CHECK_EQ(delta_w.size(), weights.size());
+
+    // |XV_i|^2 before the update
+    auto s = CHECK_NOTNULL(ws)->Get<real_t>(kS, n);
+#pragma omp parallel for num_threads(nthreads_)
+    for (size_t i = 0; i < n; ++i) {
+      real_t const* t = XV.data() + i * V_dim;
+      real_t ss = 0;
+      for (int k = 0; k < V_dim; ++k) ss += t[k] * t[k];
+      s[i] = ss;
+    }
+
+    // scatter the changes, each thread owns a range of examples
+#pragma omp parallel num_threads(nthreads_)
+    {
+      Range rg = Range(0, n).Segment(
+          omp_get_thread_num(), omp_get_num_threads());
+      for (size_t r = 0; r < data.size; ++r) {
+        if (w_pos[r] < 0) continue;
+        real_t const* dw = delta_w.data() + w_pos[r];
+        real_t const* V = weights.data() + w_pos[r];
+        // |V'|^2 - |V|^2 = dV * (2 V' - dV)
+        real_t dvv = 0;
+        for (int k = 1; k <= V_dim; ++k) dvv += dw[k] * (2 * V[k] - dw[k]);
+        for (size_t j = data.offset[r]; j < data.offset[r+1]; ++j) {
+          unsigned i = data.index[j];
+          if (!rg.Has(i)) continue;
+          real_t x = data.value ? data.value[j] : 1;
+          (*pred)[i] += x * dw[0] - .5 * x * x * dvv;
+          real_t* t = XV.data() + i * V_dim;
+          for (int k = 0; k < V_dim; ++k) t[k] += x * dw[k+1];
+        }
+      }
+    }
+
+    // add the change of |XV_i|^2
+#pragma omp parallel for num_threads(nthreads_)
+    for (size_t i = 0; i < n; ++i) {
+      real_t const* t = XV.data() + i * V_dim;
+      real_t ss = 0;
+      for (int k = 0; k < V_dim; ++k) ss += t[k] * t[k];
+      (*pred)[i] += .5 * (ss - s[i]);
+    }
   }
+  using FMLoss::Predict;
+  using FMLoss::CalcGrad;
+
+ private:
+  /** \brief the buffer ids in the workspace */
+  enum { kP, kH, kS };
 };
 }  // namespace difacto
 
@@ -10,8 +10,63 @@
 #include "dmlc/data.h"
 #include "dmlc/omp.h"
 #include "common/spmv.h"
+#include "common/range.h"
+#include "common/cpu_dispatch.h"
+#include "common/fast_math.h"
 namespace difacto {
 
+/**
+ * \brief p = - w .* y ./ (1 + exp(y .* p)), the derivative of the weighted
+ * logistic loss on the prediction p
+ *
+ * @param label the labels y
+ * @param weight the example weights w, nullptr if all are 1
+ * @param p the prediction input and the derivative output
+ * @param fast_math use \ref fast_math::Sigmoid rather than std::exp
+ * @param nthreads number of threads
+ */
+inline void LogitLossGrad(dmlc::real_t const* label, dmlc::real_t const* weight,
+                          SArray<real_t>* p, bool fast_math, int nthreads) {
+  CHECK_NOTNULL(label);
+  real_t* pp = p->data();
+  if (!fast_math) {
+#pragma omp parallel for num_threads(nthreads)
+    for (size_t i = 0; i < p->size(); ++i) {
+      real_t y = label[i] > 0 ? 1 : -1;
+      pp[i] = - y / (1 + std::exp(y * pp[i]));
+    }
+  } else {
+#pragma omp parallel num_threads(nthreads)
+    {
+      Range rg = Range(0, p->size()).Segment(
+          omp_get_thread_num(), omp_get_num_threads());
+      Dispatch([&]() {
+          for (size_t i = rg.begin; i < rg.end; ++i) {
+            real_t y = label[i] > 0 ? 1 : -1;
+            pp[i] = - y * fast_math::Sigmoid(- y * pp[i]);
+          }
+        });
+    }
+  }
+  if (!weight) return;
+#pragma omp parallel for num_threads(nthreads)
+  for (size_t i = 0; i < p->size(); ++i) pp[i] *= weight[i];
+}
+
+/**
+ * \brief parameters for \ref LogitLoss
+ */
+struct LogitLossParam : public dmlc::Parameter<LogitLossParam> {
+  /**
+   * \brief use the vectorized approximations in \ref fast_math for exp,
+   * whose relative error is within 1e-6
+   */
+  int fast_math;
+  DMLC_DECLARE_PARAMETER(LogitLossParam) {
+    DMLC_DECLARE_FIELD(fast_math).set_range(0, 1).set_default(0);
+  }
+};
+
 /**
  * \brief the logistic loss
  *
@@ -24,7 +79,7 @@ class LogitLoss : public Loss {
   virtual ~LogitLoss() {}
 
   KWArgs Init(const KWArgs& kwargs) override {
-    return kwargs;
+    return param_.InitAllowUnknown(kwargs);
   }
 
   /**
@@ -37,15 +92,13 @@ class LogitLoss : public Loss {
    * - param[0], real_t vector, the weights
    * - param[1], optional int vector, the weight positions
    * @param pred predict output, should be pre-allocated
+   * @param ws not used
    */
   void Predict(const dmlc::RowBlock<unsigned>& data,
                const std::vector<SArray<char>>& param,
-               SArray<real_t>* pred) override {
-    int psize = param.size();
-    CHECK_GE(psize, 1); CHECK_LE(psize, 2);
-    SArray<real_t> w(param[0]);
-    SArray<int> w_pos = psize == 2 ? SArray<int>(param[1]) : SArray<int>();
-    SpMV::Times(data, w, pred, nthreads_, w_pos, {});
+               SArray<real_t>* pred,
+               LossWorkspace* ws) override {
+    PredictImpl(data, param, pred);
   }
 
   /*!
@@ -59,26 +112,83 @@ class LogitLoss : public Loss {
    * - param[0], real_t vector, the predict output
    * - param[1], optional int vector, the gradient positions
    * @param grad the results, should be pre-allocated
+   * @param ws the workspace
    */
   void CalcGrad(const dmlc::RowBlock<unsigned>& data,
                 const std::vector<SArray<char>>& param,
-                SArray<real_t>* grad) override {
+                SArray<real_t>* grad,
+                LossWorkspace* ws) override {
+    CalcGradImpl(data, param, grad, ws);
+  }
+
+  /** \brief run the kernels on the compact block directly */
+  void Predict(const CompactRowBlock<uint16_t>& data,
+               const std::vector<SArray<char>>& param,
+               SArray<real_t>* pred,
+               LossWorkspace* ws) override {
+    PredictImpl(data, param, pred);
+  }
+
+  /** \brief run the kernels on the compact block directly */
+  void CalcGrad(const CompactRowBlock<uint16_t>& data,
+                const std::vector<SArray<char>>& param,
+                SArray<real_t>* grad,
+                LossWorkspace* ws) override {
+    CalcGradImpl(data, param, grad, ws);
+  }
+
+  /** \brief run the kernels on the compact block directly */
+  void Predict(const CompactRowBlock<unsigned>& data,
+               const std::vector<SArray<char>>& param,
+               SArray<real_t>* pred,
+               LossWorkspace* ws) override {
+    PredictImpl(data, param, pred);
+  }
+
+  /** \brief run the kernels on the compact block directly */
+  void CalcGrad(const CompactRowBlock<unsigned>& data,
+                const std::vector<SArray<char>>& param,
+                SArray<real_t>* grad,
+                LossWorkspace* ws) override {
+    CalcGradImpl(data, param, grad, ws);
+  }
+  using Loss::Predict;
+  using Loss::CalcGrad;
+
+ private:
+  template <typename SpMat>
+  void PredictImpl(const SpMat& data,
+                   const std::vector<SArray<char>>& param,
+                   SArray<real_t>* pred) {
+    int psize = param.size();
+    CHECK_GE(psize, 1); CHECK_LE(psize, 2);
+    SArray<real_t> w(param[0]);
+    SArray<int> w_pos = psize == 2 ? SArray<int>(param[1]) : SArray<int>();
+    SpMV::Times(data, w, pred, nthreads_, w_pos, {});
+  }
+
+  template <typename SpMat>
+  void CalcGradImpl(const SpMat& data,
+                    const std::vector<SArray<char>>& param,
+                    SArray<real_t>* grad,
+                    LossWorkspace* ws) {
     int psize = param.size();
     CHECK_GE(psize, 1);
     CHECK_LE(psize, 2);
-    SArray<real_t> p; p.CopyFrom(SArray<real_t>(param[0]));
+    SArray<real_t> pred(param[0]);
+    auto p = CHECK_NOTNULL(ws)->Get<real_t>(kP, pred.size());
+    memcpy(p.data(), pred.data(), pred.size() * sizeof(real_t));
     SArray<int> grad_pos = psize == 2 ? SArray<int>(param[1]) : SArray<int>();
     // p = ...
-    CHECK_NOTNULL(data.label);
-#pragma omp parallel for num_threads(nthreads_)
-    for (size_t i = 0; i < p.size(); ++i) {
-      real_t y = data.label[i] > 0 ? 1 : -1;
-      p[i] = - y / (1 + std::exp(y * p[i]));
-    }
+    LogitLossGrad(data.label, data.weight, &p, param_.fast_math, nthreads_);
 
     // grad += ...
     SpMV::TransTimes(data, p, grad, nthreads_, {}, grad_pos);
   }
+
+  /** \brief the buffer ids in the workspace */
+  enum { kP };
+  LogitLossParam param_;
 };
 
 }  // namespace difacto
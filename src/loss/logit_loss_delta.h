@@ -9,6 +9,7 @@
 #include "difacto/sarray.h"
 #include "common/range.h"
 #include "common/spmv.h"
+#include "./logit_loss.h"
 #include "dmlc/omp.h"
 #include "dmlc/logging.h"
 namespace difacto {
@@ -24,8 +25,11 @@ struct LogitLossDeltaParam : public dmlc::Parameter<LogitLossDeltaParam> {
    * 2 : the upper bound of the diagnal hession
    */
   int compute_hession;
+  /** \brief use the approximated exp, see \ref LogitLossParam */
+  int fast_math;
   DMLC_DECLARE_PARAMETER(LogitLossDeltaParam) {
     DMLC_DECLARE_FIELD(compute_hession).set_range(0, 2).set_default(1);
+    DMLC_DECLARE_FIELD(fast_math).set_range(0, 1).set_default(0);
   }
 };
 
@@ -59,10 +63,12 @@ class LogitLossDelta : public Loss {
    * - param[1], real_t vector, the delta weight, namely new_w - old_w
    * - param[2], optional int vector, the weight positions
    * @param pred predict output, should be pre-allocated
+   * @param ws not used
    */
   void Predict(const dmlc::RowBlock<unsigned>& data,
                const std::vector<SArray<char>>& param,
-               SArray<real_t>* pred) override {
+               SArray<real_t>* pred,
+               LossWorkspace* ws) override {
     int psize = param.size();
     CHECK_GE(psize, 1); CHECK_LE(psize, 2);
     SArray<real_t> delta_w(param[0]);
@@ -75,9 +81,9 @@ class LogitLossDelta : public Loss {
    *
    * tau = 1 / (1 + exp(y .* pred))
    * first order grad
-   *    f'(w) =  - X' * (tau .* y)
+   *    f'(w) =  - X' * (tau .* y .* c), where c is the example weights
    * diagnal second order grad :
-   *    f''(w) = (X.*X)' * (tau .* (1-tau))
+   *    f''(w) = (X.*X)' * (tau .* (1-tau) .* c)
    *
    * @param data X', the transpose of X
    * @param param input parameters
@@ -85,42 +91,54 @@ class LogitLossDelta : public Loss {
    * - param[1], optional int vector, the gradient positions
    * - param[2], optional real_t vectorreal_t, the delta needed if
    *   compute_diag_hession == 2
+   * - param[3], optional real_t vector, the squared values data.value .*
+   *   data.value, see \ref Tile. it is computed if empty or not given
    * @param grad gradient output, should be preallocated
+   * @param ws the workspace
    */
   void CalcGrad(const dmlc::RowBlock<unsigned>& data,
                 const std::vector<SArray<char>>& param,
-                SArray<real_t>* grad) override {
+                SArray<real_t>* grad,
+                LossWorkspace* ws) override {
     int psize = param.size();
     CHECK_GE(psize, 1);
-    CHECK_LE(psize, 3);
+    CHECK_LE(psize, 4);
     if (grad->empty()) return;
 
     // p = ...
-    SArray<real_t> p; p.CopyFrom(SArray<real_t>(param[0]));
-    CHECK_NOTNULL(data.label);
+    SArray<real_t> pred(param[0]);
+    auto p = CHECK_NOTNULL(ws)->Get<real_t>(kP, pred.size());
+    memcpy(p.data(), pred.data(), pred.size() * sizeof(real_t));
+    LogitLossGrad(data.label, nullptr, &p, param_.fast_math, nthreads_);
+    // the weighted p for the gradient, the hessian needs the unweighted one
+    auto wp = p;
+    if (data.weight) {
+      wp = ws->Get<real_t>(kWP, p.size());
 #pragma omp parallel for num_threads(nthreads_)
-    for (size_t i = 0; i < p.size(); ++i) {
-      real_t y = data.label[i] > 0 ? 1 : -1;
-      p[i] = - y / (1 + std::exp(y * p[i]));
+      for (size_t i = 0; i < p.size(); ++i) wp[i] = p[i] * data.weight[i];
     }
 
     // grad = ...
     SArray<int> grad_pos = psize > 1 ? SArray<int>(param[1]) : SArray<int>();
     if (param_.compute_hession != 0) CHECK(!grad_pos.empty());
-    SpMV::Times(data, p, grad, nthreads_, {}, grad_pos);
+    SpMV::Times(data, wp, grad, nthreads_, {}, grad_pos);
     if (param_.compute_hession == 0) return;
 
     // h = ...
-    SArray<int> h_pos; h_pos.CopyFrom(grad_pos);
+    auto h_pos = ws->Get<int>(kHPos, grad_pos.size());
     for (size_t i = 0; i < h_pos.size(); ++i) {
-      if (h_pos[i] >= 0) ++h_pos[i];
+      h_pos[i] = grad_pos[i] >= 0 ? grad_pos[i] + 1 : grad_pos[i];
     }
 
     // compute X .* X
     dmlc::RowBlock<unsigned> XX = data;
     SArray<dmlc::real_t> xx_value;
-    if (data.value) {
-      xx_value.resize(data.offset[data.size]);
+    if (psize == 4) xx_value = SArray<dmlc::real_t>(param[3]);
+    if (data.value && xx_value.size()) {
+      CHECK_GE(xx_value.size(), data.offset[data.size]);
+      XX.value = xx_value.data();
+    } else if (data.value) {
+      xx_value = ws->Get<dmlc::real_t>(kXX, data.offset[data.size]);
       for (size_t i = data.offset[0]; i < data.offset[data.size]; ++i) {
         xx_value[i] = data.value[i] * data.value[i];
       }
@@ -131,7 +149,8 @@ class LogitLossDelta : public Loss {
 #pragma omp parallel for num_threads(nthreads_)
     for (size_t i = 0; i < p.size(); ++i) {
       real_t y = data.label[i] > 0 ? 1 : -1;
-      p[i] = - p[i] * (y + p[i]);
+      real_t w = data.weight ? data.weight[i] : 1;
+      p[i] = - w * p[i] * (y + p[i]);
     }
 
     if (param_.compute_hession == 1) {
@@ -145,8 +164,12 @@ class LogitLossDelta : public Loss {
       LOG(FATAL) << "...";
     }
   }
+  using Loss::Predict;
+  using Loss::CalcGrad;
 
  private:
+  /** \brief the buffer ids in the workspace */
+  enum { kP, kHPos, kXX, kWP };
   LogitLossDeltaParam param_;
 };
 
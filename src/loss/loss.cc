@@ -3,12 +3,14 @@
  */
 #include "difacto/loss.h"
 #include "./fm_loss.h"
+#include "./fm_loss_delta.h"
 #include "./logit_loss_delta.h"
 #include "./logit_loss.h"
 namespace difacto {
 
 DMLC_REGISTER_PARAMETER(FMLossParam);
 DMLC_REGISTER_PARAMETER(LogitLossDeltaParam);
+DMLC_REGISTER_PARAMETER(LogitLossParam);
 
 Loss* Loss::Create(const std::string& type, int nthreads) {
   Loss* loss = nullptr;
@@ -18,6 +20,8 @@ Loss* Loss::Create(const std::string& type, int nthreads) {
     loss = new LogitLoss();
   } else if (type == "logit_delta") {
     loss = new LogitLossDelta();
+  } else if (type == "fm_delta") {
+    loss = new FMLossDelta();
   } else {
     LOG(FATAL) << "unknown loss type";
   }
@@ -5,89 +5,72 @@
  */
 #ifndef DIFACTO_READER_ADFEA_PARSER_H_
 #define DIFACTO_READER_ADFEA_PARSER_H_
-#include <limits>
-#include <vector>
 #include "difacto/base.h"
-#include "data/row_block.h"
-#include "data/parser.h"
-#include "data/strtonum.h"
+#include "./text_parser.h"
 namespace difacto {
 
 /**
  * \brief adfea ctr dataset
  * the top 10 bits store the feature group id
  */
-class AdfeaParser : public dmlc::data::ParserImpl<feaid_t> {
+class AdfeaParser : public TextParser {
  public:
-  explicit AdfeaParser(dmlc::InputSplit *source)
-      : bytes_read_(0), source_(source) { }
-  virtual ~AdfeaParser() {
-    delete source_;
-  }
-
-  void BeforeFirst(void) override {
-    source_->BeforeFirst();
-  }
-  size_t BytesRead(void) const override {
-    return bytes_read_;
-  }
-  bool ParseNext(
-      std::vector<dmlc::data::RowBlockContainer<feaid_t> > *data) override {
-    using dmlc::data::isspace;
-    using dmlc::data::isdigit;
-    using dmlc::data::strtoull;
-
-    dmlc::InputSplit::Blob chunk;
-
-    if (!source_->NextChunk(&chunk)) return false;
+  /**
+   * @param source the input
+   * @param nthreads the number of parsing threads, 0 means half of the cores
+   */
+  explicit AdfeaParser(dmlc::InputSplit *source, int nthreads = 0)
+      : TextParser(source, nthreads) { }
+  virtual ~AdfeaParser() { }
 
-    CHECK_NE(chunk.size, 0);
-    bytes_read_ += chunk.size;
-    data->resize(1);
-    dmlc::data::RowBlockContainer<feaid_t>& blk = (*data)[0];
-    blk.Clear();
+ protected:
+  void ParseBlock(char *begin, char *end, NegSampler* sampler,
+                  dmlc::data::RowBlockContainer<feaid_t>* blk) const override {
+    const char *p = begin;
     int i = 0;
-    char *p = reinterpret_cast<char*>(chunk.dptr);
-    char *end = p + chunk.size;
-
-    while (isspace(*p) && p != end) ++p;
+    // whether or not the last example is not ended yet
+    bool open = false;
+    p = SkipSpace(p, end);
     while (p != end) {
-      char *head = p;
-      while (isdigit(*p) && p != end) ++p;
+      const char *head = p;
+      uint64_t idx;
+      p = ParseUInt(p, end, &idx);
       CHECK_NE(head, p);
 
-      if (*p == ':') {
-        ++p;
-        feaid_t idx = strtoull(head, NULL, 10);
-        feaid_t gid = strtoull(p, NULL, 10);
-        blk.index.push_back(EncodeFeaGrpID(idx, gid, 12));
-        while (isdigit(*p) && p != end) ++p;
+      if (p != end && *p == ':') {
+        uint64_t gid;
+        p = ParseUInt(p + 1, end, &gid);
+        blk->index.push_back(EncodeFeaGrpID(idx, gid, 12));
       } else {
         // skip the lineid and the first count
         if (i == 2) {
           i = 0;
-          if (blk.label.size() != 0) {
-            blk.offset.push_back(blk.index.size());
+          if (open) blk->offset.push_back(blk->index.size());
+          real_t label = *head == '1';
+          open = sampler->Keep(label);
+          if (open) {
+            blk->label.push_back(label);
+            if (sampler->Enabled()) blk->weight.push_back(sampler->Weight(label));
+          } else {
+            // skip the features
+            p = FindEndLine(const_cast<char*>(p), end);
           }
-          blk.label.push_back(*head == '1');
         } else {
           ++i;
         }
       }
-
-      while (isspace(*p) && p != end) ++p;
-    }
-    if (blk.label.size() != 0) {
-      blk.offset.push_back(blk.index.size());
+      p = SkipSpace(p, end);
     }
-    return true;
+    if (open) blk->offset.push_back(blk->index.size());
   }
 
  private:
-  // number of bytes readed
-  size_t bytes_read_;
-  // source split that provides the data
-  dmlc::InputSplit *source_;
+  static const char* SkipSpace(const char* p, const char* end) {
+    while (p != end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+      ++p;
+    }
+    return p;
+  }
 };
 
 }  // namespace difacto
@@ -8,26 +8,29 @@ BatchReader::BatchReader(
     const std::string& uri, const std::string& format,
     unsigned part_index, unsigned num_parts,
     unsigned batch_size, unsigned shuffle_buf_size,
-    float neg_sampling) {
+    float neg_sampling, int chunk_size,
+    int num_readers, int read_ahead, int seed) {
   batch_size_   = batch_size;
   shuf_buf_    = shuffle_buf_size;
-  neg_sampling_ = neg_sampling;
   start_        = 0;
   end_          = 0;
-  seed_         = 0;
+  rng_.seed(seed < 0 ? part_index : seed * num_parts + part_index);
   if (shuf_buf_) {
     CHECK_GE(shuf_buf_, batch_size_);
     buf_reader_ = new BatchReader(
-        uri, format, part_index, num_parts, shuf_buf_);
+        uri, format, part_index, num_parts, shuf_buf_, 0, neg_sampling,
+        chunk_size, num_readers, read_ahead, seed);
     reader_ = NULL;
   } else {
     buf_reader_ = NULL;
-    reader_ = new Reader(uri, format, part_index, num_parts, 1<<26);
+    reader_ = new Reader(uri, format, part_index, num_parts, chunk_size,
+                         num_readers, read_ahead, seed, neg_sampling);
   }
 }
 
 bool BatchReader::Next() {
   batch_.Clear();
+  bool binary = true;
   while (batch_.offset.size() < batch_size_ + 1) {
     if (start_ == end_) {
       if (shuf_buf_ == 0) {
@@ -42,34 +45,33 @@ bool BatchReader::Next() {
           rdp_.resize(in_blk_.size);
           for (size_t i = 0; i < in_blk_.size; ++i) rdp_[i] = i;
         }
-        std::random_shuffle(rdp_.begin(), rdp_.end());
+        // permute the rows of the buffer, which is a slice of the parsed
+        // block if possible
+        std::shuffle(rdp_.begin(), rdp_.end(), rng_);
       }
       start_ = 0;
       end_ = in_blk_.size;
+      in_binary_ = IsBinary(in_blk_);
     }
 
     size_t len = std::min(end_ - start_, batch_size_ + 1 - batch_.offset.size());
-    if (shuf_buf_ == 0 && neg_sampling_ == 1.0) {
+    binary = binary && in_binary_;
+    if (shuf_buf_ == 0) {
+      if (batch_.offset.size() == 1 && len == batch_size_) {
+        // the whole batch is inside in_blk_, no need to copy
+        Slice(start_, len);
+        start_ += len;
+        return true;
+      }
       Push(start_, len);
     } else {
       for (size_t i = start_; i < start_ + len; ++i) {
-        int j = rdp_[i];
-        // downsampling
-        float p = static_cast<float>(rand_r(&seed_)) /
-                  static_cast<float>(RAND_MAX);
-        if (neg_sampling_ < 1.0 &&
-            in_blk_.label[j] <= 0 &&
-            p > 1 - neg_sampling_) {
-          continue;
-        }
-        batch_.Push(in_blk_[j]);
+        batch_.Push(in_blk_[rdp_[i]]);
       }
     }
     start_ += len;
   }
 
-  bool binary =  true;
-  for (auto f : batch_.value) if (f != 1) { binary = false; break; }
   if (binary) batch_.value.clear();
 
   out_blk_ = batch_.GetBlock();
@@ -81,7 +83,7 @@ void BatchReader::Push(size_t pos, size_t len) {
   if (!len) return;
   CHECK_LE(pos + len, in_blk_.size);
   dmlc::RowBlock<feaid_t> slice;
-  slice.weight = NULL;
+  slice.weight  = in_blk_.weight ? in_blk_.weight + pos : NULL;
   slice.size = len;
   slice.offset  = in_blk_.offset + pos;
   slice.label   = in_blk_.label  + pos;
@@ -94,4 +96,31 @@ void BatchReader::Push(size_t pos, size_t len) {
   batch_.Push(slice);
 }
 
+void BatchReader::Slice(size_t pos, size_t len) {
+  CHECK_LE(pos + len, in_blk_.size);
+  // rebase the offsets to 0, which is cheap comparing to copy the data
+  size_t base = in_blk_.offset[pos];
+  slice_offset_.resize(len + 1);
+  for (size_t i = 0; i <= len; ++i) {
+    slice_offset_[i] = in_blk_.offset[pos + i] - base;
+  }
+  out_blk_.weight = in_blk_.weight ? in_blk_.weight + pos : NULL;
+  out_blk_.size   = len;
+  out_blk_.offset = slice_offset_.data();
+  out_blk_.label  = in_blk_.label + pos;
+  out_blk_.index  = in_blk_.index + base;
+  if (in_blk_.value && !in_binary_) {
+    out_blk_.value = in_blk_.value + base;
+  } else {
+    out_blk_.value = NULL;
+  }
+}
+
+bool BatchReader::IsBinary(const dmlc::RowBlock<feaid_t>& blk) {
+  if (!blk.value) return true;
+  size_t nnz = blk.offset[blk.size] - blk.offset[0];
+  for (size_t i = 0; i < nnz; ++i) if (blk.value[i] != 1) return false;
+  return true;
+}
+
 }  // namespace difacto
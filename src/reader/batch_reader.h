@@ -3,6 +3,7 @@
  */
 #ifndef DIFACTO_READER_BATCH_READER_H_
 #define DIFACTO_READER_BATCH_READER_H_
+#include <random>
 #include <string>
 #include <vector>
 #include "difacto/base.h"
@@ -26,7 +27,15 @@ class BatchReader : public Reader {
    * @param batch_size the batch size.
    * @param shuffle_size if nonzero, then the batch is randomly picked from a buffer with
    * shuffle_buf_size examples
-   * @param neg_sampling the probability to pickup a negative sample (label <= 0)
+   * @param neg_sampling the probability to pickup a negative sample (label <= 0),
+   * see \ref Reader
+   * @param chunk_size the chunk size in bytes read each time
+   * @param num_readers the number of sub-parts read at the same time, see \ref
+   * Reader
+   * @param read_ahead the maximal number of chunks parsed in advance
+   * @param seed if non-negative, the rec data with index files is read in a
+   * random order given by the seed, see \ref Reader. it also seeds the
+   * shuffling within the buffer
    */
   BatchReader(const std::string& uri,
             const std::string& format,
@@ -34,7 +43,11 @@ class BatchReader : public Reader {
             unsigned num_parts,
             unsigned batch_size,
             unsigned shuffle_buf_size = 0,
-            float neg_sampling = 1.0);
+            float neg_sampling = 1.0,
+            int chunk_size = 1<<26,
+            int num_readers = 1,
+            int read_ahead = 8,
+            int seed = -1);
 
   virtual ~BatchReader() {
     delete reader_;
@@ -59,20 +72,31 @@ class BatchReader : public Reader {
    * \brief batch_.push(in_blk_(pos:pos+len))
    */
   void Push(size_t pos, size_t len);
+  /**
+   * \brief out_blk_ = in_blk_(pos:pos+len) without copying the data
+   */
+  void Slice(size_t pos, size_t len);
+  /**
+   * \brief return true if all values in blk are 1
+   */
+  static bool IsBinary(const dmlc::RowBlock<feaid_t>& blk);
 
   unsigned batch_size_, shuf_buf_;
 
   Reader *reader_;
   BatchReader* buf_reader_;
 
-  float neg_sampling_;
   size_t start_, end_;
   dmlc::RowBlock<feaid_t> in_blk_, out_blk_;
   dmlc::data::RowBlockContainer<feaid_t> batch_;
+  /** \brief whether in_blk_ is binary, computed once per block */
+  bool in_binary_ = true;
+  /** \brief the offsets of out_blk_ when it is a slice of in_blk_ */
+  std::vector<size_t> slice_offset_;
 
   // random pertubation
   std::vector<unsigned> rdp_;
-  unsigned int seed_;
+  std::mt19937 rng_;
 };
 
 }  // namespace difacto
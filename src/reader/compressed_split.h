@@ -0,0 +1,481 @@
+/**
+ * Copyright (c) 2015 by Contributors
+ * @file   compressed_split.h
+ * @brief  read gzip and lz4 compressed text files
+ */
+#ifndef DIFACTO_READER_COMPRESSED_SPLIT_H_
+#define DIFACTO_READER_COMPRESSED_SPLIT_H_
+#include <string.h>
+#include <string>
+#include <initializer_list>
+#include <vector>
+#include <list>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <condition_variable>
+#if DIFACTO_USE_ZLIB
+#include <zlib.h>
+#endif  // DIFACTO_USE_ZLIB
+#if DIFACTO_USE_LZ4
+#include <lz4.h>
+#endif  // DIFACTO_USE_LZ4
+#include "dmlc/io.h"
+#include "dmlc/omp.h"
+#include "dmlc/logging.h"
+#include "io/filesys.h"
+#include "./match_file.h"
+namespace difacto {
+
+/**
+ * \brief an input split of compressed text files, such as .gz and .lz4
+ *
+ * the files are decompressed by a background thread into chunks ending at line
+ * boundaries, which are passed to the parser without temporary files.
+ *
+ * - the lz4 frames with independent blocks (the default of the lz4 tool), and
+ *   the bgzip-style gzip files, whose members record their sizes, are
+ *   decompressed block-parallel by multiple threads
+ * - other gzip files, including the multi-member ones whose member boundaries
+ *   are unknown before decoding, and the lz4 frames with linked blocks are
+ *   decompressed by the background thread alone
+ *
+ * the files are detected by their magic numbers, so uncompressed files are
+ * also accepted. a file cannot be split, so the files rather than the bytes are
+ * partitioned.
+ */
+class CompressedSplit : public dmlc::InputSplit {
+ public:
+  /**
+   * @param uri a file, a directory, or a list of them separated by ';'
+   * @param part_index the i-th part to read
+   * @param num_parts partition the files into several parts
+   * @param nthreads the number of decompressing threads, 0 means half of the
+   * cores
+   */
+  CompressedSplit(const std::string& uri, unsigned part_index,
+                  unsigned num_parts, int nthreads = 0) {
+    nthreads_ = nthreads > 0 ? nthreads : std::max(omp_get_num_procs() / 2, 1);
+    std::vector<dmlc::io::FileInfo> files;
+    ListFiles(uri, &files);
+    // assign a file to the part containing its first byte
+    size_t total = 0, pos = 0;
+    for (const auto& f : files) total += f.size;
+    for (const auto& f : files) {
+      size_t part = total ? pos * num_parts / total : 0;
+      if (part == part_index) files_.push_back(f.path.str());
+      pos += f.size;
+    }
+#if !DIFACTO_USE_ZLIB
+    for (const auto& f : files) {
+      CHECK(!HasSuffix(f.path.name, {".gz", ".bgz"}))
+          << "install the zlib header and compile with USE_ZLIB=1 to read "
+          << f.path.str();
+    }
+#endif  // DIFACTO_USE_ZLIB
+  }
+
+  virtual ~CompressedSplit() { Stop(); }
+
+  /**
+   * \brief returns true if the uri contains a file with the suffix .gz, .bgz,
+   * or .lz4
+   */
+  static bool Match(const std::string& uri) {
+    std::vector<dmlc::io::FileInfo> files;
+    ListFiles(uri, &files);
+    for (const auto& f : files) {
+      if (HasSuffix(f.path.name, {".gz", ".bgz", ".lz4"})) return true;
+    }
+    return false;
+  }
+
+  void HintChunkSize(size_t chunk_size) override {
+    chunk_size_ = std::max(chunk_size, static_cast<size_t>(1 << 20));
+  }
+
+  void BeforeFirst() override { Stop(); }
+
+  bool NextChunk(Blob* out) override {
+    if (!thread_) {
+      done_ = false;
+      stop_ = false;
+      thread_ = std::unique_ptr<std::thread>(new std::thread([this]() { Run(); }));
+    }
+    std::unique_lock<std::mutex> lk(mu_);
+    cond_.wait(lk, [this]{ return !queue_.empty() || done_; });
+    if (queue_.empty()) return false;
+    chunk_ = std::move(queue_.front());
+    queue_.pop_front();
+    cond_.notify_all();
+    out->dptr = &chunk_[0];
+    out->size = chunk_.size();
+    return true;
+  }
+
+  bool NextRecord(Blob* out) override {
+    LOG(FATAL) << "CompressedSplit only supports NextChunk";
+    return false;
+  }
+
+ private:
+  static bool HasSuffix(const std::string& name,
+                        std::initializer_list<const char*> suffixes) {
+    for (const char* s : suffixes) {
+      size_t n = strlen(s);
+      if (name.size() >= n && name.compare(name.size() - n, n, s) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /** \brief the number of decompressed chunks buffered */
+  static const size_t kCapacity = 2;
+
+  /** \brief reads a stream with a few bytes put back */
+  class Input {
+   public:
+    explicit Input(dmlc::Stream* stream) : stream_(stream) { }
+    /** \brief read at most n bytes, returns the number of bytes read */
+    size_t Read(void* dst, size_t n) {
+      char* p = static_cast<char*>(dst);
+      size_t m = std::min(n, back_.size());
+      memcpy(p, back_.data(), m);
+      back_.erase(0, m);
+      while (m < n) {
+        size_t k = stream_->Read(p + m, n - m);
+        if (k == 0) break;
+        m += k;
+      }
+      return m;
+    }
+    /** \brief put the bytes back, which will be read first */
+    void PutBack(const char* p, size_t n) { back_.insert(0, p, n); }
+
+   private:
+    std::unique_ptr<dmlc::Stream> stream_;
+    std::string back_;
+  };
+
+  /** \brief decompress all files, runs in the background thread */
+  void Run() {
+    for (const auto& file : files_) {
+      Input in(dmlc::Stream::Create(file.c_str(), "r"));
+      unsigned char magic[4] = {0};
+      size_t n = in.Read(magic, 4);
+      in.PutBack(reinterpret_cast<char*>(magic), n);
+      if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        ReadGzip(file, &in);
+      } else if (n == 4 && magic[0] == 0x04 && magic[1] == 0x22 &&
+                 magic[2] == 0x4d && magic[3] == 0x18) {
+        ReadLZ4(file, &in);
+      } else {
+        ReadPlain(&in);
+      }
+      if (stop_) break;
+      // do not join the last line with the next file
+      if (buf_.size() && buf_.back() != '\n') buf_.push_back('\n');
+    }
+    if (buf_.size()) Push(buf_.size());
+    std::lock_guard<std::mutex> lk(mu_);
+    done_ = true;
+    cond_.notify_all();
+  }
+
+  void ReadPlain(Input* in) {
+    const size_t kStep = 1 << 20;
+    while (!stop_) {
+      size_t size = buf_.size();
+      buf_.resize(size + kStep);
+      size_t n = in->Read(&buf_[size], kStep);
+      buf_.resize(size + n);
+      if (n == 0) break;
+      Cut();
+    }
+  }
+
+  void ReadGzip(const std::string& file, Input* in) {
+#if DIFACTO_USE_ZLIB
+    // a bgzip member has an extra field BC with its size
+    unsigned char head[12];
+    size_t n = in->Read(head, 12);
+    bool bgzip = false;
+    if (n == 12 && (head[3] & 4)) {
+      std::string extra(head[10] | (head[11] << 8), 0);
+      size_t m = in->Read(&extra[0], extra.size());
+      in->PutBack(extra.data(), m);
+      bgzip = BlockSize(extra.data(), m) > 0;
+    }
+    in->PutBack(reinterpret_cast<char*>(head), n);
+    if (bgzip) {
+      ReadBGzip(file, in);
+      return;
+    }
+    // decompress the members one by one
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    CHECK_EQ(inflateInit2(&z, 15 + 32), Z_OK);
+    std::vector<char> src(1 << 20);
+    const size_t kStep = 1 << 20;
+    bool eof = false;
+    while (!stop_) {
+      if (z.avail_in == 0) {
+        size_t k = in->Read(src.data(), src.size());
+        if (k == 0) break;
+        z.next_in = reinterpret_cast<Bytef*>(src.data());
+        z.avail_in = k;
+      }
+      if (eof) {
+        // the next member
+        CHECK_EQ(inflateReset(&z), Z_OK);
+        eof = false;
+      }
+      size_t size = buf_.size();
+      buf_.resize(size + kStep);
+      z.next_out = reinterpret_cast<Bytef*>(&buf_[size]);
+      z.avail_out = kStep;
+      int ret = inflate(&z, Z_NO_FLUSH);
+      buf_.resize(size + kStep - z.avail_out);
+      CHECK(ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR)
+          << "failed to decompress " << file << ": " << (z.msg ? z.msg : "");
+      eof = ret == Z_STREAM_END;
+      Cut();
+    }
+    inflateEnd(&z);
+#else
+    LOG(FATAL) << "install the zlib header and compile with USE_ZLIB=1 to read "
+               << file;
+#endif  // DIFACTO_USE_ZLIB
+  }
+
+#if DIFACTO_USE_ZLIB
+  /**
+   * \brief returns the member size given by the BC field of a bgzip member, or
+   * 0 if not found
+   */
+  static size_t BlockSize(const char* extra, size_t len) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(extra);
+    for (size_t i = 0; i + 4 <= len; ) {
+      size_t slen = p[i+2] | (p[i+3] << 8);
+      if (p[i] == 'B' && p[i+1] == 'C' && slen == 2 && i + 6 <= len) {
+        return (p[i+4] | (p[i+5] << 8)) + 1;
+      }
+      i += 4 + slen;
+    }
+    return 0;
+  }
+
+  /**
+   * \brief read a batch of bgzip members, and decompress them in parallel
+   * directly into buf_, whose sizes are given by the member footers
+   */
+  void ReadBGzip(const std::string& file, Input* in) {
+    std::vector<std::string> members;
+    std::vector<size_t> offset;
+    while (!stop_) {
+      members.clear();
+      offset.assign(1, buf_.size());
+      while (offset.back() - offset[0] < chunk_size_) {
+        unsigned char head[12];
+        size_t n = in->Read(head, 12);
+        if (n == 0) break;
+        CHECK(n == 12 && head[0] == 0x1f && head[1] == 0x8b && (head[3] & 4))
+            << file << " mixes bgzip and other gzip members";
+        size_t xlen = head[10] | (head[11] << 8);
+        std::string member(12 + xlen, 0);
+        memcpy(&member[0], head, 12);
+        CHECK_EQ(in->Read(&member[12], xlen), xlen);
+        size_t bsize = BlockSize(&member[12], xlen);
+        CHECK_GT(bsize, 12 + xlen + 8) << "corrupted bgzip member in " << file;
+        member.resize(bsize);
+        CHECK_EQ(in->Read(&member[12 + xlen], bsize - 12 - xlen), bsize - 12 - xlen)
+            << "truncated " << file;
+        const unsigned char* isize =
+            reinterpret_cast<const unsigned char*>(member.data()) + bsize - 4;
+        offset.push_back(offset.back() + (isize[0] | (isize[1] << 8) |
+                                          (isize[2] << 16) |
+                                          (static_cast<size_t>(isize[3]) << 24)));
+        members.push_back(std::move(member));
+      }
+      if (members.empty()) break;
+      buf_.resize(offset.back());
+      int nmembers = static_cast<int>(members.size());
+      bool ok = true;
+#pragma omp parallel for num_threads(nthreads_) reduction(&&:ok)
+      for (int i = 0; i < nmembers; ++i) {
+        z_stream z;
+        memset(&z, 0, sizeof(z));
+        inflateInit2(&z, 15 + 16);
+        z.next_in = reinterpret_cast<Bytef*>(&members[i][0]);
+        z.avail_in = members[i].size();
+        z.next_out = reinterpret_cast<Bytef*>(&buf_[offset[i]]);
+        z.avail_out = offset[i+1] - offset[i];
+        if (inflate(&z, Z_FINISH) != Z_STREAM_END || z.avail_out != 0) ok = false;
+        inflateEnd(&z);
+      }
+      CHECK(ok) << "failed to decompress " << file;
+      Cut();
+    }
+  }
+#endif  // DIFACTO_USE_ZLIB
+
+  void ReadLZ4(const std::string& file, Input* in) {
+#if DIFACTO_USE_LZ4
+    std::vector<std::string> blocks, outs;
+    std::string hist;
+    while (!stop_) {
+      // the frame header
+      unsigned char head[7];
+      size_t n = in->Read(head, 4);
+      if (n == 0) break;
+      CHECK_EQ(n, 4) << "truncated " << file;
+      uint32_t magic = head[0] | (head[1] << 8) | (head[2] << 16) |
+                       (static_cast<uint32_t>(head[3]) << 24);
+      if ((magic & 0xFFFFFFF0) == 0x184D2A50) {
+        // a skippable frame
+        CHECK_EQ(in->Read(head, 4), 4);
+        std::string skip(head[0] | (head[1] << 8) | (head[2] << 16) |
+                         (static_cast<size_t>(head[3]) << 24), 0);
+        CHECK_EQ(in->Read(&skip[0], skip.size()), skip.size());
+        continue;
+      }
+      CHECK_EQ(magic, 0x184D2204) << file << " is not a lz4 frame";
+      CHECK_EQ(in->Read(head, 2), 2);
+      int flag = head[0], bd = head[1];
+      CHECK_EQ(flag >> 6, 1) << "unknown lz4 frame version in " << file;
+      CHECK((flag & 1) == 0) << "lz4 dictionary is not supported";
+      bool independent = flag & 0x20;
+      bool block_checksum = flag & 0x10;
+      bool content_size = flag & 0x08;
+      bool content_checksum = flag & 0x04;
+      int max_block = 1 << (8 + 2 * ((bd >> 4) & 7));
+      std::string skip((content_size ? 8 : 0) + 1, 0);
+      CHECK_EQ(in->Read(&skip[0], skip.size()), skip.size());
+
+      // the blocks, whose checksums are not verified
+      bool end = false;
+      hist.clear();
+      while (!end && !stop_) {
+        blocks.clear();
+        while (blocks.size() * max_block < chunk_size_) {
+          CHECK_EQ(in->Read(head, 4), 4) << "truncated " << file;
+          uint32_t size = head[0] | (head[1] << 8) | (head[2] << 16) |
+                          (static_cast<uint32_t>(head[3]) << 24);
+          if (size == 0) {
+            end = true;
+            break;
+          }
+          // the highest bit means uncompressed
+          std::string blk(1 + (size & 0x7FFFFFFF), 0);
+          blk[0] = size >> 31;
+          CHECK_EQ(in->Read(&blk[1], blk.size() - 1), blk.size() - 1)
+              << "truncated " << file;
+          if (block_checksum) CHECK_EQ(in->Read(head, 4), 4);
+          blocks.push_back(std::move(blk));
+        }
+        int nblks = static_cast<int>(blocks.size());
+        if (independent) {
+          outs.resize(std::max(outs.size(), blocks.size()));
+          bool ok = true;
+#pragma omp parallel for num_threads(nthreads_) reduction(&&:ok)
+          for (int i = 0; i < nblks; ++i) {
+            if (!DecodeLZ4Block(blocks[i], max_block, &outs[i], 0)) ok = false;
+          }
+          CHECK(ok) << "failed to decompress " << file;
+          for (int i = 0; i < nblks; ++i) buf_.append(outs[i]);
+        } else {
+          // a block may refer to the previous 64KB
+          for (int i = 0; i < nblks; ++i) {
+            size_t size = hist.size();
+            CHECK(DecodeLZ4Block(blocks[i], max_block, &hist, 64 << 10))
+                << "failed to decompress " << file;
+            buf_.append(hist, size, std::string::npos);
+            if (hist.size() > (4 << 20)) hist.erase(0, hist.size() - (64 << 10));
+          }
+        }
+        Cut();
+      }
+      if (content_checksum) CHECK_EQ(in->Read(head, 4), 4);
+    }
+#else
+    LOG(FATAL) << "compile with USE_LZ4=1 to read " << file;
+#endif  // DIFACTO_USE_LZ4
+  }
+
+#if DIFACTO_USE_LZ4
+  /**
+   * \brief decode a block, whose first byte is 1 if it is not compressed, and
+   * append the results into out, the last dict bytes of which can be referred
+   */
+  static bool DecodeLZ4Block(const std::string& blk, int max_block,
+                             std::string* out, size_t dict) {
+    if (dict == 0) out->clear();
+    if (blk[0]) {
+      out->append(blk, 1, std::string::npos);
+      return true;
+    }
+    size_t size = out->size();
+    dict = std::min(dict, size);
+    out->resize(size + max_block);
+    int n = LZ4_decompress_safe_usingDict(
+        blk.data() + 1, &(*out)[size], static_cast<int>(blk.size() - 1),
+        max_block, out->data() + size - dict, static_cast<int>(dict));
+    out->resize(size + std::max(n, 0));
+    return n >= 0;
+  }
+#endif  // DIFACTO_USE_LZ4
+
+  /**
+   * \brief push the complete lines in buf_ as a chunk if it is large enough
+   */
+  void Cut() {
+    if (buf_.size() < chunk_size_) return;
+    size_t cut = buf_.find_last_of('\n');
+    if (cut != std::string::npos) Push(cut + 1);
+  }
+
+  /** \brief push the first n bytes of buf_ */
+  void Push(size_t n) {
+    std::string rest = buf_.substr(n);
+    buf_.resize(n);
+    std::unique_lock<std::mutex> lk(mu_);
+    cond_.wait(lk, [this]{ return queue_.size() < kCapacity || stop_; });
+    if (!stop_) queue_.push_back(std::move(buf_));
+    cond_.notify_all();
+    buf_ = std::move(rest);
+  }
+
+  /** \brief stop the background thread, and clear the buffers */
+  void Stop() {
+    if (!thread_) return;
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+    thread_->join();
+    thread_.reset();
+    queue_.clear();
+    buf_.clear();
+  }
+
+  int nthreads_;
+  size_t chunk_size_ = 64 << 20;
+  std::vector<std::string> files_;
+  // the decompressed data not pushed yet
+  std::string buf_;
+  // the chunk returned by NextChunk
+  std::string chunk_;
+  std::list<std::string> queue_;
+  bool done_ = false;
+  std::atomic<bool> stop_{false};
+  std::unique_ptr<std::thread> thread_;
+  std::mutex mu_;
+  std::condition_variable cond_;
+};
+
+}  // namespace difacto
+#endif  // DIFACTO_READER_COMPRESSED_SPLIT_H_
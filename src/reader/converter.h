@@ -3,10 +3,19 @@
  */
 #ifndef DIFACTO_READER_CONVERTER_H_
 #define DIFACTO_READER_CONVERTER_H_
+#include <stdio.h>
+#include <cmath>
 #include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <algorithm>
 #include "dmlc/parameter.h"
+#include "dmlc/omp.h"
 #include "reader/reader.h"
 #include "dmlc/io.h"
+#include "dmlc/recordio.h"
+#include "common/thread_pool.h"
 namespace difacto {
 
 struct ConverterParam : public dmlc::Parameter<ConverterParam> {
@@ -26,6 +35,8 @@ struct ConverterParam : public dmlc::Parameter<ConverterParam> {
    * the default value -1 means no splitting
    */
   int part_size;
+  /** \brief the number of converting threads, 0 means the number of cores */
+  int num_threads;
   DMLC_DECLARE_PARAMETER(ConverterParam) {
     DMLC_DECLARE_FIELD(data_in);
     DMLC_DECLARE_FIELD(data_format);
@@ -33,10 +44,15 @@ struct ConverterParam : public dmlc::Parameter<ConverterParam> {
     DMLC_DECLARE_FIELD(data_out_format);
     DMLC_DECLARE_FIELD(part_size).set_default(-1);
     DMLC_DECLARE_FIELD(chunk_size).set_default(512);
+    DMLC_DECLARE_FIELD(num_threads).set_default(0);
   };
 };
 /**
  * \brief data converter
+ *
+ * the blocks are read in batches, and each batch is formatted or compressed by
+ * multiple threads. the results are written in order by a writer thread, so
+ * the writing of a batch overlaps with the processing of the next one.
  */
 class Converter {
  public:
@@ -46,81 +62,160 @@ class Converter {
   }
 
   void Run() {
-    using namespace dmlc;
-    using namespace dmlc::data;
     int chunk_size = param_.chunk_size * 1024 * 1024;
     Reader in(param_.data_in, param_.data_format, 0, 1, chunk_size);
+    int nthreads = param_.num_threads > 0 ? param_.num_threads :
+                   std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
 
     LOG(INFO) << "reading data from " << param_.data_in
               << " in " << param_.data_format << " format";
+    auto out_format = param_.data_out_format;
+    CHECK(out_format == "libsvm" || out_format == "rec")
+        << "unknow output format: " << out_format;
 
-    int ipart = 0;
-    size_t limit = static_cast<size_t>(-1);
-    size_t part_size = static_cast<size_t>(param_.part_size);
-    size_t nwrite = limit;
-    Stream *out = nullptr;
-    RecordIOWriter* rec_writer = nullptr;
-    ostream* libsvm_writer = nullptr;
-
+    // at most two batches are waiting for writing
+    ThreadPool writer(1, 2);
+    std::vector<dmlc::data::RowBlockContainer<feaid_t>> batch(nthreads);
     size_t nrows = 0;
-    while (in.Next()) {
-      auto out_format = param_.data_out_format;
-      if (nwrite == limit || nwrite / 1000000 >= part_size) {
-        if (nwrite != limit) {
-          LOG(INFO) << "done. written " << nwrite << " bytes";
-        }
-        auto outfile = param_.data_out;
-        if (part_size != limit) {
-          outfile += "-part_" + std::to_string(ipart++);
-        }
-        delete libsvm_writer; libsvm_writer = nullptr;
-        delete rec_writer; rec_writer = nullptr;
-        delete out; out = CHECK_NOTNULL(Stream::Create(outfile.c_str(), "wb"));
-        nwrite = 0;
-
-        LOG(INFO) << "wrting data to " << outfile
-                  << " in " << out_format << " format";
+    bool more = true;
+    while (more) {
+      int n = 0;
+      while (n < nthreads && (more = in.Next())) {
+        batch[n].Clear();
+        batch[n].Push(in.Value());
+        ++n;
+      }
+      if (n == 0) break;
+      auto strs = std::make_shared<std::vector<std::string>>(n);
+#pragma omp parallel for num_threads(nthreads)
+      for (int i = 0; i < n; ++i) {
         if (out_format == "libsvm") {
-          libsvm_writer = new ostream(out);
-        } else if (out_format == "rec") {
-          rec_writer = new RecordIOWriter(out);
+          FormatLibSVM(batch[i].GetBlock(), &(*strs)[i]);
         } else {
-          LOG(FATAL) << "unknow output format: " << out_format;
+          CompressedRowBlock cblk;
+          cblk.Compress(batch[i].GetBlock(), &(*strs)[i]);
         }
       }
-      if (out_format == "libsvm") {
-        auto blk = in.Value();
-        for (size_t i = 0; i < blk.size; ++i) {
-          *libsvm_writer << blk.label[i] << " ";
-          for (size_t j = blk.offset[i]; j < blk.offset[i+1]; ++j) {
-            *libsvm_writer << blk.index[j];
-            if (blk.value) *libsvm_writer << ":" << blk.value[j];
-            *libsvm_writer << " ";
-          }
-          *libsvm_writer << "\n";
+      for (int i = 0; i < n; ++i) nrows += batch[i].Size();
+      writer.Add([this, strs, nrows](int tid) {
+          for (const auto& str : *strs) Write(str);
+          LOG(INFO) << "written " << nrows << " examples in " << nwrite_ << " bytes";
+        });
+    }
+    writer.Wait();
+    Close();
+    LOG(INFO) << "done. written " << nwrite_ << " bytes";
+  }
+
+ private:
+  /** \brief write a formatted or compressed block, starts a new part if needed */
+  void Write(const std::string& str) {
+    using namespace dmlc;
+    size_t limit = static_cast<size_t>(-1);
+    size_t part_size = static_cast<size_t>(param_.part_size);
+    auto out_format = param_.data_out_format;
+    if (out_ == nullptr || nwrite_ / 1000000 >= part_size) {
+      if (out_ != nullptr) {
+        LOG(INFO) << "done. written " << nwrite_ << " bytes";
+      }
+      Close();
+      outfile_ = param_.data_out;
+      if (part_size != limit) {
+        outfile_ += "-part_" + std::to_string(ipart_++);
+      }
+      out_ = CHECK_NOTNULL(Stream::Create(outfile_.c_str(), "wb"));
+      nwrite_ = 0;
+
+      LOG(INFO) << "wrting data to " << outfile_
+                << " in " << out_format << " format";
+      if (out_format == "rec") {
+        rec_writer_ = new RecordIOWriter(out_);
+        seek_out_ = dynamic_cast<SeekStream*>(out_);
+        if (!seek_out_) {
+          LOG(WARNING) << "no index file is written for " << outfile_
+                       << ", which is not seekable";
         }
-        nwrite = libsvm_writer->bytes_written();
-      } else if (out_format == "rec") {
-        std::string str;
-        CompressedRowBlock cblk;
-        cblk.Compress(in.Value(), &str);
-        rec_writer->WriteRecord(str);
-        nwrite += str.size();
-      } else {
-        LOG(FATAL) << "unknow output format: " << out_format;
       }
+    }
+    if (rec_writer_) {
+      size_t begin = seek_out_ ? seek_out_->Tell() : 0;
+      rec_writer_->WriteRecord(str);
+      if (seek_out_) {
+        index_ += std::to_string(begin) + '\t' +
+                  std::to_string(seek_out_->Tell() - begin) + '\n';
+      }
+    } else {
+      out_->Write(str.data(), str.size());
+    }
+    nwrite_ += str.size();
+  }
 
-      nrows += in.Value().size;
-      LOG(INFO) << "written " << nrows << " examples in " << nwrite << " bytes";
+  /**
+   * \brief close the current part, and write the index file "part.idx" of rec
+   * data, which has a line "offset \t length" for each record
+   */
+  void Close() {
+    if (seek_out_) {
+      std::unique_ptr<dmlc::Stream> idx(CHECK_NOTNULL(
+          dmlc::Stream::Create((outfile_ + ".idx").c_str(), "wb")));
+      idx->Write(index_.data(), index_.size());
     }
-    delete libsvm_writer;
-    delete rec_writer;
-    delete out;
-    LOG(INFO) << "done. written " << nwrite << " bytes";
+    delete rec_writer_; rec_writer_ = nullptr;
+    delete out_; out_ = nullptr;
+    seek_out_ = nullptr;
+    index_.clear();
+  }
+
+  /** \brief format a block in libsvm */
+  static void FormatLibSVM(const dmlc::RowBlock<feaid_t>& blk, std::string* str) {
+    str->clear();
+    char buf[32];
+    for (size_t i = 0; i < blk.size; ++i) {
+      str->append(buf, FormatReal(blk.label[i], buf));
+      str->push_back(' ');
+      for (size_t j = blk.offset[i]; j < blk.offset[i+1]; ++j) {
+        str->append(buf, FormatUInt(blk.index[j], buf));
+        if (blk.value) {
+          str->push_back(':');
+          str->append(buf, FormatReal(blk.value[j], buf));
+        }
+        str->push_back(' ');
+      }
+      str->push_back('\n');
+    }
+  }
+
+  /** \brief write the decimal digits of v into buf, returns the length */
+  static int FormatUInt(uint64_t v, char* buf) {
+    char tmp[24];
+    int n = 0;
+    do { tmp[n++] = '0' + v % 10; v /= 10; } while (v);
+    for (int i = 0; i < n; ++i) buf[i] = tmp[n - 1 - i];
+    return n;
+  }
+
+  /**
+   * \brief write v into buf in the same format as std::ostream, returns the
+   * length. small integers, such as labels and binary values, skip printf
+   */
+  static int FormatReal(real_t v, char* buf) {
+    if (v > -1e6 && v < 1e6 && v == static_cast<int>(v)) {
+      if (!std::signbit(v)) return FormatUInt(static_cast<uint64_t>(v), buf);
+      buf[0] = '-';
+      return FormatUInt(static_cast<uint64_t>(-v), buf + 1) + 1;
+    }
+    return snprintf(buf, 32, "%g", v);
   }
 
- private:
   ConverterParam param_;
+  dmlc::Stream* out_ = nullptr;
+  dmlc::RecordIOWriter* rec_writer_ = nullptr;
+  /** \brief out_ if it is seekable, for writing the index of rec data */
+  dmlc::SeekStream* seek_out_ = nullptr;
+  std::string outfile_, index_;
+  /** \brief the bytes written into the current part */
+  size_t nwrite_ = 0;
+  int ipart_ = 0;
 };
 
 }  // namespace difacto
@@ -6,19 +6,39 @@
 #ifndef DIFACTO_READER_CRB_PARSER_H_
 #define DIFACTO_READER_CRB_PARSER_H_
 #include <vector>
+#include <algorithm>
 #include "data/parser.h"
 #include "dmlc/recordio.h"
+#include "dmlc/omp.h"
+#include "dmlc/timer.h"
 #include "data/compressed_row_block.h"
+#include "./neg_sampler.h"
 namespace difacto {
 /**
  * \brief compressed row block parser
+ *
+ * it reads a chunk of records a time, and decodes them by multiple threads,
+ * each of which decodes the records in a part of the chunk. the decoded blocks
+ * are returned in the order of the records. the reading ahead is done by the
+ * dmlc::data::ThreadedParser wrapping this parser, whose queue is bounded.
  */
 class CRBParser : public dmlc::data::ParserImpl<feaid_t> {
  public:
-  explicit CRBParser(dmlc::InputSplit *source)
+  /**
+   * @param source the input
+   * @param nthreads the number of decoding threads, 0 means half of the cores
+   */
+  explicit CRBParser(dmlc::InputSplit *source, int nthreads = 0)
       : bytes_read_(0), source_(source) {
+    nthreads_ = nthreads > 0 ? nthreads : std::max(omp_get_num_procs() / 2, 1);
+    parts_.resize(nthreads_);
   }
   virtual ~CRBParser() {
+    if (decode_time_ > 0) {
+      LOG(INFO) << "decoded " << (bytes_read_ >> 20) << " MB rec data by "
+                << nthreads_ << " threads at "
+                << (bytes_read_ >> 20) / decode_time_ << " MB/sec";
+    }
     delete source_;
   }
   void BeforeFirst(void) override {
@@ -27,23 +47,97 @@ class CRBParser : public dmlc::data::ParserImpl<feaid_t> {
   size_t BytesRead(void) const override {
     return bytes_read_;
   }
+  /** \brief see \ref TextParser::SetNegSampling */
+  void SetNegSampling(real_t rate, unsigned seed) {
+    neg_sampling_ = rate;
+    seed_ = seed;
+  }
   bool ParseNext(
       std::vector<dmlc::data::RowBlockContainer<feaid_t> > *data) override {
-    dmlc::InputSplit::Blob rec;
-    if (!source_->NextRecord(&rec)) return false;
-    CHECK_NE(rec.size, 0);
-    bytes_read_ += rec.size;
-    data->resize(1); (*data)[0].Clear();
-    CompressedRowBlock crb;
-    crb.Decompress((char const*)rec.dptr, rec.size, &(*data)[0]);
+    dmlc::InputSplit::Blob chunk;
+    if (!source_->NextChunk(&chunk)) return false;
+    CHECK_NE(chunk.size, 0);
+    bytes_read_ += chunk.size;
+    double start = dmlc::GetTime();
+    std::vector<size_t> nblks(nthreads_);
+    uint64_t seed = (static_cast<uint64_t>(seed_) << 32) + num_chunks_++;
+#pragma omp parallel num_threads(nthreads_)
+    {
+      int tid = omp_get_thread_num();
+      NegSampler sampler(neg_sampling_, seed * nthreads_ + tid);
+      dmlc::RecordIOChunkReader reader(chunk, tid, omp_get_num_threads());
+      dmlc::InputSplit::Blob rec;
+      auto& part = parts_[tid];
+      size_t n = 0;
+      while (reader.NextRecord(&rec)) {
+        if (n == part.size()) part.resize(n + 1);
+        auto& blk = part[n++];
+        blk.Clear();
+        CompressedRowBlock crb;
+        crb.Decompress((char const*)rec.dptr, rec.size, &blk);
+        if (sampler.Enabled()) Sample(&sampler, &blk);
+      }
+      nblks[tid] = n;
+    }
+    // swap the blocks out, so the containers returned by the consumer are
+    // reused by the next chunk
+    size_t total = 0;
+    for (size_t n : nblks) total += n;
+    data->resize(total);
+    size_t k = 0;
+    for (int i = 0; i < nthreads_; ++i) {
+      for (size_t j = 0; j < nblks[i]; ++j) std::swap((*data)[k++], parts_[i][j]);
+    }
+    decode_time_ += dmlc::GetTime() - start;
     return true;
   }
 
  private:
+  /** \brief remove the examples dropped by sampler in place, and set the weights */
+  static void Sample(NegSampler* sampler,
+                     dmlc::data::RowBlockContainer<feaid_t>* blk) {
+    size_t nrows = blk->label.size();
+    bool has_value = !blk->value.empty();
+    bool has_weight = !blk->weight.empty();
+    blk->weight.resize(nrows, 1);
+    size_t n = 0, nnz = 0;
+    for (size_t i = 0; i < nrows; ++i) {
+      real_t label = blk->label[i];
+      if (!sampler->Keep(label)) continue;
+      // offset[n+1] <= offset[i+1], so the data not moved yet is not
+      // overwritten
+      size_t begin = blk->offset[i], end = blk->offset[i+1];
+      std::copy(blk->index.begin() + begin, blk->index.begin() + end,
+                blk->index.begin() + nnz);
+      if (has_value) {
+        std::copy(blk->value.begin() + begin, blk->value.begin() + end,
+                  blk->value.begin() + nnz);
+      }
+      nnz += end - begin;
+      blk->label[n] = label;
+      blk->weight[n] = (has_weight ? blk->weight[i] : 1) * sampler->Weight(label);
+      blk->offset[++n] = nnz;
+    }
+    blk->label.resize(n);
+    blk->weight.resize(n);
+    blk->offset.resize(n + 1);
+    blk->index.resize(nnz);
+    if (has_value) blk->value.resize(nnz);
+  }
+
   // number of bytes readed
   size_t bytes_read_;
   // source split that provides the data
   dmlc::InputSplit *source_;
+  int nthreads_;
+  // the blocks decoded by each thread
+  std::vector<std::vector<dmlc::data::RowBlockContainer<feaid_t>>> parts_;
+  // the seconds spent on decoding
+  double decode_time_ = 0;
+  real_t neg_sampling_ = 1;
+  unsigned seed_ = 0;
+  // the number of chunks parsed, which seeds the samplers
+  uint64_t num_chunks_ = 0;
 };
 }  // namespace difacto
 #endif  // DIFACTO_READER_CRB_PARSER_H_
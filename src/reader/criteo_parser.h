@@ -9,11 +9,9 @@
 #if DIFACTO_USE_CITY
 #include <city.h>
 #endif  // DIFACTO_USE_CITY
-#include <vector>
+#include <string.h>
 #include "difacto/base.h"
-#include "data/row_block.h"
-#include "data/parser.h"
-#include "data/strtonum.h"
+#include "./text_parser.h"
 namespace difacto {
 
 /**
@@ -21,96 +19,120 @@ namespace difacto {
  * The columns are tab separeted with the following schema:
  *  <label> <integer feature 1> ... <integer feature 13>
  *  <categorical feature 1> ... <categorical feature 26>
+ *
+ * the delimiters are found 8 bytes a time.
  */
-class CriteoParser : public dmlc::data::ParserImpl<feaid_t> {
+class CriteoParser : public TextParser {
  public:
-  explicit CriteoParser(dmlc::InputSplit *source, bool is_train)
-      : bytes_read_(0), source_(source), is_train_(is_train) {
-  }
-  virtual ~CriteoParser() {
-    delete source_;
-  }
-
-  void BeforeFirst(void) override {
-    source_->BeforeFirst();
-  }
-  size_t BytesRead(void) const override {
-    return bytes_read_;
-  }
-  bool ParseNext(
-      std::vector<dmlc::data::RowBlockContainer<feaid_t> > *data) override {
-    dmlc::InputSplit::Blob chunk;
-    if (!source_->NextChunk(&chunk)) return false;
+  /**
+   * @param source the input
+   * @param is_train whether or not the first column is the label
+   * @param nthreads the number of parsing threads, 0 means half of the cores
+   */
+  explicit CriteoParser(dmlc::InputSplit *source, bool is_train,
+                        int nthreads = 0)
+      : TextParser(source, nthreads), is_train_(is_train) { }
+  virtual ~CriteoParser() { }
 
-    CHECK_NE(chunk.size, 0);
-    bytes_read_ += chunk.size;
-    char *p = reinterpret_cast<char*>(chunk.dptr);
-    char *end = p + chunk.size;
-    data->resize(1);
-    dmlc::data::RowBlockContainer<feaid_t>& blk = (*data)[0];
-    blk.Clear();
-    char *pp = p;
+ protected:
+  void ParseBlock(char *p, char *end, NegSampler* sampler,
+                  dmlc::data::RowBlockContainer<feaid_t>* blk) const override {
     while (p != end) {
-      while (*p == '\r' || *p == '\n') ++p;
+      while (p != end && (*p == '\r' || *p == '\n')) ++p;
       if (p == end) break;
-
-      // parse label
-      if (is_train_) {
-        pp = Find(p, end, '\t');
-        CHECK_NE(p, pp) << "no label.., try criteo_test";
-        blk.label.push_back(atof(p));
-        p = pp + 1;
-      } else {
-        blk.label.push_back(0);
-      }
-
-      // parse inter feature
-      for (feaid_t i = 0; i < 13; ++i) {
-        pp = Find(p, end, '\t');
-        CHECK_NOTNULL(pp);
-        if (pp > p) {
-          blk.index.push_back(EncodeFeaGrpID(Hash(p, pp-p), i, 12));
-        }
-        p = pp + 1;
-      }
-
-      // parse categorty feature
-      for (int i = 0; i < 26; ++i) {
-        if (p == end) break;
-        if (isspace(*p)) { ++p; continue; }
-        pp = p + 8; CHECK(isspace(*pp)) << i << " " << end - p << " " << *p;
-        size_t len = pp - p;
-        if (len) {
-          blk.index.push_back(EncodeFeaGrpID(Hash(p, len), i+13, 12));
+      if (!is_train_) blk->label.push_back(0);
+      // col -1 is the label, 0-12 are the integer features, and then 13-38
+      // are the categorical features
+      int col = is_train_ ? -1 : 0;
+      bool eol = false, keep = true;
+      while (!eol) {
+        char *pp = FindDelim(p, end);
+        eol = pp == end || *pp == '\n';
+        char *q = pp;
+        if (q > p && *(q-1) == '\r') --q;
+        if (col == -1) {
+          CHECK_NE(p, q) << "no label.., try criteo_test";
+          real_t label;
+          ParseReal(p, q, &label);
+          if (!sampler->Keep(label)) {
+            // skip the features
+            pp = FindEndLine(pp, end);
+            p = pp == end ? end : pp + 1;
+            keep = false;
+            break;
+          }
+          blk->label.push_back(label);
+          if (sampler->Enabled()) blk->weight.push_back(sampler->Weight(label));
+        } else if (q > p && col < 39) {
+          blk->index.push_back(EncodeFeaGrpID(Hash(p, q - p), col, 12));
         }
-        p = pp + 1;
-        if (*pp == '\n' || *pp == '\r') break;
+        ++col;
+        p = pp == end ? end : pp + 1;
       }
-      blk.offset.push_back(blk.index.size());
+      if (keep) blk->offset.push_back(blk->index.size());
     }
-    return true;
   }
 
- private:
-  inline feaid_t Hash(const char* p, size_t len) {
+  static feaid_t Hash(const char* p, size_t len) {
 #if DIFACTO_USE_CITY
     return CityHash64(p, len);
 #else
-    LOG(FATAL) << "compile with USE_CITY=1";
-    return 0;
+    return MurmurHash64A(p, len);
 #endif  // DIFACTO_USE_CITY
   }
 
-  // implement strchr
-  inline char* Find(char* p, char* end, int c) {
-    while (p != end && *p != c) ++p;
+  /**
+   * \brief the 64-bit MurmurHash2 by Austin Appleby, which is in the public
+   * domain
+   */
+  static uint64_t MurmurHash64A(const char* p, size_t len) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = 0x8445d61a4e774912ULL ^ (len * m);
+    const char* end = p + (len & ~static_cast<size_t>(7));
+    for (; p != end; p += 8) {
+      uint64_t k;
+      memcpy(&k, p, 8);
+      k *= m; k ^= k >> r; k *= m;
+      h ^= k; h *= m;
+    }
+    switch (len & 7) {
+      case 7: h ^= static_cast<uint64_t>(static_cast<unsigned char>(p[6])) << 48;
+      case 6: h ^= static_cast<uint64_t>(static_cast<unsigned char>(p[5])) << 40;
+      case 5: h ^= static_cast<uint64_t>(static_cast<unsigned char>(p[4])) << 32;
+      case 4: h ^= static_cast<uint64_t>(static_cast<unsigned char>(p[3])) << 24;
+      case 3: h ^= static_cast<uint64_t>(static_cast<unsigned char>(p[2])) << 16;
+      case 2: h ^= static_cast<uint64_t>(static_cast<unsigned char>(p[1])) << 8;
+      case 1: h ^= static_cast<uint64_t>(static_cast<unsigned char>(p[0]));
+        h *= m;
+    }
+    h ^= h >> r; h *= m; h ^= h >> r;
+    return h;
+  }
+
+  /**
+   * \brief returns the first tab or newline in [p, end), or end if not found
+   *
+   * it tests 8 bytes a time: a byte of w ^ c is 0 iff the byte is c, and the
+   * lowest byte with the high bit set in (x - 0x01..) & ~x is the first 0 byte
+   * of x
+   */
+  static char* FindDelim(char* p, char* end) {
+    const uint64_t kOnes = 0x0101010101010101ULL;
+    const uint64_t kHighs = 0x8080808080808080ULL;
+    const uint64_t kTabs = kOnes * '\t', kNewlines = kOnes * '\n';
+    for (; end - p >= 8; p += 8) {
+      uint64_t w;
+      memcpy(&w, p, 8);
+      uint64_t t = w ^ kTabs, n = w ^ kNewlines;
+      uint64_t mask = (((t - kOnes) & ~t) | ((n - kOnes) & ~n)) & kHighs;
+      if (mask) return p + (__builtin_ctzll(mask) >> 3);
+    }
+    while (p != end && *p != '\t' && *p != '\n') ++p;
     return p;
   }
 
-  // number of bytes readed
-  size_t bytes_read_;
-  // source split that provides the data
-  dmlc::InputSplit *source_;
+ private:
   bool is_train_;
 };
 
@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) 2015 by Contributors
+ * @file   libsvm_parser.h
+ * @brief  parse libsvm data format
+ */
+#ifndef DIFACTO_READER_LIBSVM_PARSER_H_
+#define DIFACTO_READER_LIBSVM_PARSER_H_
+#include "difacto/base.h"
+#include "./text_parser.h"
+namespace difacto {
+
+/**
+ * \brief libsvm dataset, each line is
+ *  <label> <index>[:<value>] <index>[:<value>] ...
+ *
+ * the values are stored only if they are given, as dmlc::data::LibSVMParser
+ * does. the numbers are parsed in place without calling strtoull and strtof.
+ */
+class LibSVMParser : public TextParser {
+ public:
+  /**
+   * @param source the input
+   * @param nthreads the number of parsing threads, 0 means half of the cores
+   */
+  explicit LibSVMParser(dmlc::InputSplit *source, int nthreads = 0)
+      : TextParser(source, nthreads) { }
+  virtual ~LibSVMParser() { }
+
+ protected:
+  void ParseBlock(char *begin, char *end, NegSampler* sampler,
+                  dmlc::data::RowBlockContainer<feaid_t>* blk) const override {
+    char *p = begin;
+    while (p != end) {
+      while (p != end && IsSpace(*p)) ++p;
+      if (p == end) break;
+      char *lend = FindEndLine(p, end);
+      real_t label;
+      const char *q = ParseReal(p, lend, &label);
+      if (!sampler->Keep(label)) {
+        p = lend;
+        continue;
+      }
+      blk->label.push_back(label);
+      if (sampler->Enabled()) blk->weight.push_back(sampler->Weight(label));
+      q = SkipToken(q, lend);
+      while (q != lend) {
+        uint64_t idx;
+        const char *r = ParseUInt(q, lend, &idx);
+        if (r != q) {
+          blk->index.push_back(idx);
+          if (r != lend && *r == ':') {
+            real_t val;
+            r = ParseReal(r + 1, lend, &val);
+            blk->value.push_back(val);
+          }
+        }
+        q = SkipToken(r, lend);
+      }
+      blk->offset.push_back(blk->index.size());
+      p = lend;
+    }
+    CHECK(blk->value.empty() || blk->value.size() == blk->index.size())
+        << "some but not all features have values";
+  }
+
+ private:
+  static bool IsSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+  }
+
+  /** \brief skip the rest of the current token and the following spaces */
+  static const char* SkipToken(const char* p, const char* end) {
+    while (p != end && !IsSpace(*p)) ++p;
+    while (p != end && IsSpace(*p)) ++p;
+    return p;
+  }
+};
+
+}  // namespace difacto
+#endif  // DIFACTO_READER_LIBSVM_PARSER_H_
@@ -0,0 +1,412 @@
+/**
+ * Copyright (c) 2015 by Contributors
+ * @file   local_split.h
+ * @brief  read local files with several large reads in flight
+ */
+#ifndef DIFACTO_READER_LOCAL_SPLIT_H_
+#define DIFACTO_READER_LOCAL_SPLIT_H_
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <algorithm>
+#include <condition_variable>
+#include "dmlc/io.h"
+#include "dmlc/logging.h"
+#include "dmlc/recordio.h"
+#include "common/thread_pool.h"
+namespace difacto {
+
+/**
+ * \brief an input split of local files, which is used for file:// uris
+ *
+ * unlike dmlc's splits, which do one blocking buffered read a time, it keeps
+ * several chunks being read, each by several aligned preads issued by a thread
+ * pool, so it can saturate a NVMe disk. a chunk is returned without copying,
+ * only the partial record at its end is moved to the front of the next chunk.
+ *
+ * with direct_io, the files are opened with O_DIRECT to bypass the page cache,
+ * which saves the memory for one-pass data. if O_DIRECT is not supported, the
+ * pages are dropped after reading instead.
+ *
+ * the chunks being read or consumed take at most max_buffer_size bytes, plus
+ * the space kept for the partial records. the number of chunks is reduced to
+ * fit, but at least two are needed, one being consumed and one being read, so
+ * a larger chunk size hint is capped to half of max_buffer_size.
+ *
+ * the data are partitioned in the same way as dmlc::InputSplit. a chunk never
+ * crosses files.
+ */
+class LocalSplit : public dmlc::InputSplit {
+ public:
+  /**
+   * @param path a file, a directory, or a list of them separated by ';'
+   * @param part_index the i-th part to read
+   * @param num_parts partition the data into several parts
+   * @param recordio true for recordio files, false for text files
+   * @param direct_io whether or not to bypass the page cache
+   * @param num_buffers the maximal number of chunks being read or consumed
+   * @param num_io_threads the number of reads issued at the same time
+   * @param max_buffer_size the memory budget of the chunks in bytes
+   */
+  LocalSplit(const std::string& path, unsigned part_index, unsigned num_parts,
+             bool recordio, bool direct_io = false, int num_buffers = 4,
+             int num_io_threads = 4, size_t max_buffer_size = 256 << 20)
+      : recordio_(recordio), direct_io_(direct_io),
+        max_buffer_size_(std::max(max_buffer_size, 2 * kAlign)) {
+    CHECK_GT(num_buffers, 1);
+    chunk_size_ = RoundUp(std::min(chunk_size_, max_buffer_size_ / 2));
+    InitFiles(path);
+    buffers_.resize(num_buffers);
+    for (auto& b : buffers_) b.reset(new Buffer());
+    pool_.reset(new ThreadPool(num_io_threads));
+    ResetPartition(part_index, num_parts);
+  }
+
+  virtual ~LocalSplit() {
+    pool_.reset();
+    for (int fd : fds_) if (fd >= 0) close(fd);
+  }
+
+  void HintChunkSize(size_t chunk_size) override {
+    chunk_size = std::min(chunk_size, max_buffer_size_ / 2);
+    chunk_size_ = chunk_size ? RoundUp(chunk_size) : kAlign;
+    if (!started_) BeforeFirst();
+  }
+
+  size_t GetTotalSize() override { return file_offset_.back(); }
+
+  void ResetPartition(unsigned part_index, unsigned num_parts) override {
+    size_t total = file_offset_.back();
+    size_t align = recordio_ ? 4 : 1;
+    size_t nstep = (total + num_parts - 1) / num_parts;
+    nstep = (nstep + align - 1) / align * align;
+    begin_ = std::min(nstep * part_index, total);
+    end_ = std::min(nstep * (part_index + 1), total);
+    if (begin_ != end_) {
+      end_ = SeekRecordBegin(end_);
+      begin_ = SeekRecordBegin(begin_);
+    }
+    BeforeFirst();
+  }
+
+  void BeforeFirst() override {
+    if (pool_) pool_->Wait();
+    inflight_.clear();
+    free_.clear();
+    size_t n = std::min(buffers_.size(), max_buffer_size_ / chunk_size_);
+    for (size_t i = 0; i < std::max(n, static_cast<size_t>(2)); ++i) {
+      free_.push_back(buffers_[i].get());
+    }
+    cur_ = nullptr;
+    left_ = nullptr;
+    left_size_ = 0;
+    next_ = begin_;
+    started_ = false;
+  }
+
+  bool NextChunk(Blob* out) override {
+    if (!started_) {
+      started_ = true;
+      Issue();
+    }
+    while (!inflight_.empty()) {
+      Buffer* b = inflight_.front();
+      inflight_.pop_front();
+      {
+        std::unique_lock<std::mutex> lk(mu_);
+        cond_.wait(lk, [b]{ return b->pending == 0; });
+      }
+      // move the partial record left by the previous chunk to the front
+      if (left_size_ > static_cast<size_t>(b->data - b->mem)) Grow(b, left_size_);
+      char* begin = b->data - left_size_;
+      if (left_size_) memcpy(begin, left_, left_size_);
+      char* end = b->data + b->size;
+      if (cur_) {
+        free_.push_back(cur_);
+        Issue();
+      }
+      cur_ = b;
+      char* cut = b->last ? end : FindLastRecordBegin(begin, end);
+      left_ = cut;
+      left_size_ = end - cut;
+      if (cut != begin) {
+        out->dptr = begin;
+        out->size = cut - begin;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool NextRecord(Blob* out) override {
+    LOG(FATAL) << "LocalSplit only supports NextChunk";
+    return false;
+  }
+
+ private:
+  /** \brief the alignment of the file offsets, lengths and buffers for O_DIRECT */
+  static const size_t kAlign = 4096;
+  /** \brief the size of a single pread */
+  static const size_t kIOSize = 4 << 20;
+
+  struct Buffer {
+    ~Buffer() { free(mem); }
+    // the aligned memory, with some space before data for the partial record
+    char* mem = nullptr;
+    size_t capacity = 0;
+    size_t headroom = kHeadroom;
+    char* data = nullptr;
+    size_t size = 0;
+    // whether or not it ends a file or the partition
+    bool last = false;
+    // the number of preads not finished
+    int pending = 0;
+  };
+
+  static size_t RoundUp(size_t n) { return (n + kAlign - 1) / kAlign * kAlign; }
+
+  /** \brief issue the reads of the next chunks into the free buffers */
+  void Issue() {
+    while (!free_.empty() && next_ < end_) {
+      size_t f = std::upper_bound(file_offset_.begin(), file_offset_.end(), next_)
+                 - file_offset_.begin() - 1;
+      size_t len = std::min(chunk_size_, std::min(end_, file_offset_[f+1]) - next_);
+      size_t off = next_ - file_offset_[f];
+      size_t aligned = off / kAlign * kAlign;
+      size_t total = RoundUp(off + len) - aligned;
+
+      Buffer* b = free_.back();
+      free_.pop_back();
+      if (b->capacity < b->headroom + total) {
+        free(b->mem);
+        CHECK_EQ(posix_memalign(reinterpret_cast<void**>(&b->mem), kAlign,
+                                b->headroom + total), 0);
+        b->capacity = b->headroom + total;
+      }
+      char* dst = b->mem + b->headroom;
+      b->data = dst + (off - aligned);
+      b->size = len;
+      next_ += len;
+      b->last = next_ == file_offset_[f+1] || next_ == end_;
+      b->pending = static_cast<int>((total + kIOSize - 1) / kIOSize);
+      inflight_.push_back(b);
+
+      size_t need = off + len;
+      int fd = Open(f);
+      for (size_t p = 0; p < total; p += kIOSize) {
+        size_t n = total - p < kIOSize ? total - p : kIOSize;
+        size_t pos = aligned + p;
+        pool_->Add([this, b, fd, dst, p, n, pos, need](int tid) {
+            size_t nread = 0;
+            while (nread < n) {
+              ssize_t ret = pread(fd, dst + p + nread, n - nread, pos + nread);
+              CHECK_GE(ret, 0) << "failed to read: " << strerror(errno);
+              if (ret == 0) break;
+              nread += ret;
+            }
+            CHECK_GE(pos + nread, std::min(pos + n, need))
+                << "unexpected end of file";
+            if (drop_pages_) posix_fadvise(fd, pos, n, POSIX_FADV_DONTNEED);
+            std::lock_guard<std::mutex> lk(mu_);
+            --b->pending;
+            cond_.notify_all();
+          });
+      }
+    }
+  }
+
+  /**
+   * \brief make the space before the data of b at least n bytes, which only
+   * happens for records longer than the headroom
+   */
+  void Grow(Buffer* b, size_t n) {
+    size_t headroom = RoundUp(n);
+    size_t size = b->capacity - b->headroom;
+    char* mem;
+    CHECK_EQ(posix_memalign(reinterpret_cast<void**>(&mem), kAlign,
+                            headroom + size), 0);
+    // keep the offset within an aligned block, so the alignment of the data
+    // is unchanged
+    size_t shift = b->data - b->mem - b->headroom;
+    memcpy(mem + headroom + shift, b->data, b->size);
+    free(b->mem);
+    b->mem = mem;
+    b->capacity = headroom + size;
+    b->headroom = headroom;
+    b->data = mem + headroom + shift;
+  }
+
+  /**
+   * \brief returns the begin of the last record in [begin, end), or begin if
+   * not found
+   */
+  char* FindLastRecordBegin(char* begin, char* end) const {
+    if (recordio_) {
+      CHECK_EQ(reinterpret_cast<size_t>(begin) & 3, 0);
+      CHECK_EQ(reinterpret_cast<size_t>(end) & 3, 0);
+      uint32_t* pbegin = reinterpret_cast<uint32_t*>(begin);
+      uint32_t* p = reinterpret_cast<uint32_t*>(end);
+      if (p < pbegin + 2) return begin;
+      for (p -= 2; p != pbegin; --p) {
+        if (p[0] == dmlc::RecordIOWriter::kMagic) {
+          uint32_t cflag = dmlc::RecordIOWriter::DecodeFlag(p[1]);
+          if (cflag == 0 || cflag == 1) return reinterpret_cast<char*>(p);
+        }
+      }
+      return begin;
+    }
+    for (char* p = end; p != begin; --p) {
+      if (*(p-1) == '\n' || *(p-1) == '\r') return p;
+    }
+    return begin;
+  }
+
+  /**
+   * \brief returns the begin of the first record at or after the global
+   * offset pos, as dmlc's SeekRecordBegin
+   */
+  size_t SeekRecordBegin(size_t pos) {
+    size_t f = std::upper_bound(file_offset_.begin(), file_offset_.end(), pos)
+               - file_offset_.begin() - 1;
+    if (f + 1 == file_offset_.size() || pos == file_offset_[f]) return pos;
+    int fd = open(files_[f].c_str(), O_RDONLY);
+    CHECK_GE(fd, 0) << "failed to open " << files_[f] << ": " << strerror(errno);
+    std::shared_ptr<void> closer(nullptr, [fd](void*) { close(fd); });
+    size_t off = pos - file_offset_[f], size = file_offset_[f+1] - file_offset_[f];
+    std::vector<char> buf(64 << 10);
+    size_t n = 0, i = 0;
+    auto next = [&](char* c) {
+      if (i == n) {
+        if (off >= size) return false;
+        ssize_t ret = pread(fd, buf.data(), buf.size(), off);
+        CHECK_GT(ret, 0) << "failed to read " << files_[f];
+        n = ret;
+        i = 0;
+        off += ret;
+      }
+      *c = buf[i++];
+      return true;
+    };
+    size_t nstep = 0;
+    char c;
+    if (recordio_) {
+      uint32_t v, lrec;
+      while (true) {
+        char* pv = reinterpret_cast<char*>(&v);
+        bool ok = true;
+        for (int k = 0; k < 4 && ok; ++k) ok = next(pv + k);
+        if (!ok) return pos + nstep;
+        nstep += 4;
+        if (v == dmlc::RecordIOWriter::kMagic) {
+          char* pl = reinterpret_cast<char*>(&lrec);
+          for (int k = 0; k < 4; ++k) CHECK(next(pl + k)) << "invalid record io format";
+          nstep += 4;
+          uint32_t cflag = dmlc::RecordIOWriter::DecodeFlag(lrec);
+          if (cflag == 0 || cflag == 1) return pos + nstep - 8;
+        }
+      }
+    }
+    // skip the rest of the line and the following newlines
+    while (true) {
+      if (!next(&c)) return pos + nstep;
+      ++nstep;
+      if (c == '\n' || c == '\r') break;
+    }
+    while (next(&c) && (c == '\n' || c == '\r')) ++nstep;
+    return pos + nstep;
+  }
+
+  /** \brief list the files, and compute their offsets in the concatenated data */
+  void InitFiles(const std::string& path) {
+    size_t begin = 0;
+    while (begin <= path.size()) {
+      size_t end = std::min(path.find(';', begin), path.size());
+      std::string p = path.substr(begin, end - begin);
+      begin = end + 1;
+      if (p.empty()) continue;
+      struct stat st;
+      CHECK_EQ(stat(p.c_str(), &st), 0) << "failed to open " << p;
+      if (S_ISDIR(st.st_mode)) {
+        std::vector<std::string> names;
+        DIR* dir = opendir(p.c_str());
+        CHECK(dir) << "failed to open " << p;
+        while (struct dirent* ent = readdir(dir)) {
+          std::string name = p + "/" + ent->d_name;
+          if (stat(name.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            names.push_back(name);
+          }
+        }
+        closedir(dir);
+        std::sort(names.begin(), names.end());
+        for (const auto& n : names) files_.push_back(n);
+      } else {
+        files_.push_back(p);
+      }
+    }
+    CHECK(!files_.empty()) << "no file is found in " << path;
+    file_offset_.push_back(0);
+    for (const auto& f : files_) {
+      struct stat st;
+      CHECK_EQ(stat(f.c_str(), &st), 0) << "failed to open " << f;
+      file_offset_.push_back(file_offset_.back() + st.st_size);
+    }
+    fds_.resize(files_.size(), -1);
+  }
+
+  /** \brief returns the file descriptor of the f-th file */
+  int Open(size_t f) {
+    if (fds_[f] >= 0) return fds_[f];
+    int fd = -1;
+#ifdef O_DIRECT
+    if (direct_io_) fd = open(files_[f].c_str(), O_RDONLY | O_DIRECT);
+#endif  // O_DIRECT
+    if (fd < 0) {
+      fd = open(files_[f].c_str(), O_RDONLY);
+      CHECK_GE(fd, 0) << "failed to open " << files_[f] << ": " << strerror(errno);
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+      drop_pages_ = direct_io_;
+    }
+    fds_[f] = fd;
+    return fd;
+  }
+
+  /** \brief the default space before the data for the partial record */
+  static const size_t kHeadroom = 1 << 20;
+
+  bool recordio_;
+  bool direct_io_;
+  bool drop_pages_ = false;
+  size_t max_buffer_size_;
+  size_t chunk_size_ = 8 << 20;
+
+  std::vector<std::string> files_;
+  std::vector<size_t> file_offset_;
+  std::vector<int> fds_;
+  // the partition, and the offset of the next read
+  size_t begin_, end_, next_;
+  bool started_ = false;
+
+  std::vector<std::unique_ptr<Buffer>> buffers_;
+  std::deque<Buffer*> inflight_;
+  std::vector<Buffer*> free_;
+  // the buffer of the last returned chunk, and the partial record in it
+  Buffer* cur_ = nullptr;
+  char* left_ = nullptr;
+  size_t left_size_ = 0;
+
+  std::unique_ptr<ThreadPool> pool_;
+  std::mutex mu_;
+  std::condition_variable cond_;
+};
+
+}  // namespace difacto
+#endif  // DIFACTO_READER_LOCAL_SPLIT_H_
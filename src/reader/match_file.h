@@ -4,6 +4,7 @@
 #ifndef DIFACTO_READER_MATCH_FILE_H_
 #define DIFACTO_READER_MATCH_FILE_H_
 #include <regex.h>
+#include <algorithm>
 #include <vector>
 #include <string>
 #include "io/filesys.h"
@@ -29,7 +30,7 @@ inline void MatchFile(const std::string& pattern,
   dmlc::io::URI path_uri(path.c_str());
   dmlc::io::FileSystem *fs =
       dmlc::io::FileSystem::GetInstance(path_uri.protocol);
-  std::vector<io::FileInfo> info;
+  std::vector<dmlc::io::FileInfo> info;
   fs->ListDirectory(path_uri, &info);
 
   // store all matached files
@@ -53,5 +54,35 @@ inline void MatchFile(const std::string& pattern,
   }
 }
 
+/**
+ * \brief list the files in the uri
+ *
+ * @param uri a file, a directory, or a list of them separated by ';'
+ * @param files the files found
+ */
+inline void ListFiles(const std::string& uri,
+                      std::vector<dmlc::io::FileInfo>* files) {
+  size_t begin = 0;
+  while (begin <= uri.size()) {
+    size_t end = std::min(uri.find(';', begin), uri.size());
+    std::string path = uri.substr(begin, end - begin);
+    begin = end + 1;
+    if (path.empty()) continue;
+    dmlc::io::URI path_uri(path.c_str());
+    dmlc::io::FileSystem *fs =
+        dmlc::io::FileSystem::GetInstance(path_uri.protocol);
+    auto info = fs->GetPathInfo(path_uri);
+    if (info.type == dmlc::io::kDirectory) {
+      std::vector<dmlc::io::FileInfo> dir;
+      fs->ListDirectory(info.path, &dir);
+      for (const auto& f : dir) {
+        if (f.type == dmlc::io::kFile) files->push_back(f);
+      }
+    } else {
+      files->push_back(info);
+    }
+  }
+}
+
 }  // namespace difacto
 #endif  // DIFACTO_READER_MATCH_FILE_H_
@@ -0,0 +1,56 @@
+/**
+ * Copyright (c) 2015 by Contributors
+ * @file   neg_sampler.h
+ * @brief  down sample the negative examples while parsing
+ */
+#ifndef DIFACTO_READER_NEG_SAMPLER_H_
+#define DIFACTO_READER_NEG_SAMPLER_H_
+#include <stdint.h>
+#include "difacto/base.h"
+namespace difacto {
+
+/**
+ * \brief keeps a negative example (label <= 0) with a given probability
+ *
+ * the parsers decide right after reading the label, so a dropped example is
+ * skipped without parsing its features. a kept negative example has weight
+ * 1/rate, so the losses are unbiased. a sampler is cheap to create, each
+ * parsing thread uses its own one.
+ */
+class NegSampler {
+ public:
+  /**
+   * @param rate the probability to keep a negative example, 1 means no sampling
+   * @param seed the random seed
+   */
+  explicit NegSampler(real_t rate = 1, uint64_t seed = 0)
+      : rate_(rate), weight_(rate > 0 ? 1 / rate : 0) {
+    // the state of xorshift cannot be 0
+    state_ = seed * 0x9E3779B97F4A7C15ULL + 0x2545F4914F6CDD1DULL;
+    if (state_ == 0) state_ = 1;
+    threshold_ = static_cast<uint64_t>(
+        static_cast<double>(rate) * static_cast<double>(1ULL << 32));
+  }
+
+  /** \brief whether or not sampling is enabled */
+  bool Enabled() const { return rate_ < 1; }
+
+  /** \brief returns true if the example with the label is kept */
+  bool Keep(real_t label) {
+    if (label > 0 || !Enabled()) return true;
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return ((state_ * 0x2545F4914F6CDD1DULL) >> 32) < threshold_;
+  }
+
+  /** \brief the weight of a kept example */
+  real_t Weight(real_t label) const { return label > 0 ? 1 : weight_; }
+
+ private:
+  real_t rate_, weight_;
+  uint64_t state_, threshold_;
+};
+
+}  // namespace difacto
+#endif  // DIFACTO_READER_NEG_SAMPLER_H_
@@ -4,54 +4,209 @@
 #ifndef DIFACTO_READER_READER_H_
 #define DIFACTO_READER_READER_H_
 #include <string>
+#include <vector>
+#include <list>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
 #include "difacto/base.h"
 #include "dmlc/data.h"
 #include "data/parser.h"
-#include "data/libsvm_parser.h"
 #include "./adfea_parser.h"
+#include "./compressed_split.h"
 #include "./crb_parser.h"
 #include "./criteo_parser.h"
+#include "./libsvm_parser.h"
+#include "./local_split.h"
+#include "./rec_index_split.h"
 namespace difacto {
 /**
  * \brief a reader reads a chunk of data with roughly same size a time
+ *
+ * the chunks are parsed in background threads. a reader can split its part
+ * into several sub-parts, which are read and parsed at the same time and whose
+ * blocks are interleaved, so a single reader can saturate the disk bandwidth.
  */
 class Reader {
  public:
-  Reader() { parser_ = nullptr; }
+  Reader() { }
+  /**
+   * \brief create a reader
+   *
+   * @param uri filename. the local files given by file:// are read by \ref
+   * LocalSplit, the text files compressed by gzip or lz4 are read by \ref
+   * CompressedSplit, and the rec files with index files are read by \ref
+   * RecIndexSplit
+   * @param format the data format, support libsvm, criteo, criteo_test, adfea,
+   * and rec
+   * @param part_index the i-th part to read
+   * @param num_parts partition the file into serveral parts
+   * @param chunk_size_hint the chunk size in bytes
+   * @param num_readers the number of sub-parts read at the same time. the
+   * blocks are returned in the order they are parsed if greater than 1. all
+   * parts should use the same value, so that the sub-parts cover the data
+   * exactly once
+   * @param read_ahead the maximal number of chunks parsed in advance
+   * @param seed if non-negative, the records of rec data with index files are
+   * read in a random order given by the seed, which should be the same for all
+   * parts
+   * @param neg_sampling the probability to keep a negative example (label <=
+   * 0). the examples are dropped by the parsers, and the kept ones are
+   * weighted, see \ref NegSampler
+   */
   Reader(const std::string& uri,
          const std::string& format,
          int part_index,
          int num_parts,
-         int chunk_size_hint) {
-    char const* c_uri = uri.c_str();
-    dmlc::InputSplit* input = dmlc::InputSplit::Create(
-        c_uri, part_index, num_parts, format == "rec" ? "recordio" : "text");
-    input->HintChunkSize(chunk_size_hint);
-
-    if (format == "libsvm") {
-      parser_ = new dmlc::data::LibSVMParser<feaid_t>(input, 1);
-    } else if (format == "criteo") {
-      parser_ = new CriteoParser(input, true);
-    } else if (format == "criteo_test") {
-      parser_ = new CriteoParser(input, false);
-    } else if (format ==  "adfea") {
-      parser_ = new AdfeaParser(input);
-    } else if (format == "rec") {
-      parser_ = new CRBParser(input);
-    } else {
-      LOG(FATAL) << "unknown format " << format;
+         int chunk_size_hint,
+         int num_readers = 1,
+         int read_ahead = 8,
+         int seed = -1,
+         real_t neg_sampling = 1) {
+    CHECK_GT(num_readers, 0);
+    CHECK_GT(read_ahead, 0);
+    CHECK(neg_sampling > 0 && neg_sampling <= 1);
+    capacity_ = read_ahead;
+    neg_sampling_ = neg_sampling;
+    // the samplers of different parts and epochs use different seeds
+    sampling_seed_ = ((seed < 0 ? 0 : seed) * num_parts + part_index) * num_readers;
+    // share the parsing threads among the sub-parts
+    int nthreads = std::max(omp_get_num_procs() / 2 / num_readers, 1);
+    bool compressed = format != "rec" && CompressedSplit::Match(uri);
+    bool indexed = format == "rec" && RecIndexSplit::Match(uri);
+    for (int i = 0; i < num_readers; ++i) {
+      unsigned part = part_index * num_readers + i;
+      unsigned nparts = num_parts * num_readers;
+      dmlc::InputSplit* input;
+      if (compressed) {
+        input = new CompressedSplit(uri, part, nparts, nthreads);
+      } else if (indexed) {
+        input = new RecIndexSplit(uri, part, nparts, seed);
+      } else if (uri.compare(0, 7, "file://") == 0) {
+        // set DIFACTO_DIRECT_IO=1 to bypass the page cache, and
+        // DIFACTO_READ_BUFFER_MB to change the memory budget of the chunks
+        // being read by each sub-reader, which is 256 MB in default
+        const char* direct = getenv("DIFACTO_DIRECT_IO");
+        const char* budget = getenv("DIFACTO_READ_BUFFER_MB");
+        size_t max_buffer_size = budget ? static_cast<size_t>(atoi(budget)) << 20
+                                        : 256 << 20;
+        input = new LocalSplit(uri.substr(7), part, nparts, format == "rec",
+                               direct && atoi(direct), 4, 4, max_buffer_size);
+      } else {
+        input = dmlc::InputSplit::Create(
+            uri.c_str(), part, nparts, format == "rec" ? "recordio" : "text");
+      }
+      input->HintChunkSize(chunk_size_hint);
+
+      if (format == "libsvm") {
+        Start(new LibSVMParser(input, nthreads));
+      } else if (format == "criteo") {
+        Start(new CriteoParser(input, true, nthreads));
+      } else if (format == "criteo_test") {
+        Start(new CriteoParser(input, false, nthreads));
+      } else if (format ==  "adfea") {
+        Start(new AdfeaParser(input, nthreads));
+      } else if (format == "rec") {
+        Start(new CRBParser(input, nthreads));
+      } else {
+        LOG(FATAL) << "unknown format " << format;
+      }
     }
-    parser_ = new dmlc::data::ThreadedParser<feaid_t>(parser_);
   }
 
-  virtual ~Reader() { delete parser_; }
+  virtual ~Reader() {
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      done_ = true;
+    }
+    cond_.notify_all();
+    for (auto& t : threads_) t.join();
+    for (auto c : ready_) delete c;
+    for (auto c : free_) delete c;
+    delete chunk_;
+  }
 
-  virtual bool Next() { return parser_->Next(); }
+  virtual bool Next() {
+    while (true) {
+      for (; chunk_ && pos_ < chunk_->size(); ++pos_) {
+        const auto& blk = (*chunk_)[pos_];
+        if (blk.Size() != 0) {
+          block_ = blk.GetBlock();
+          ++pos_;
+          return true;
+        }
+      }
+      std::unique_lock<std::mutex> lk(mu_);
+      // recycle the containers
+      if (chunk_) free_.push_back(chunk_);
+      chunk_ = nullptr;
+      cond_.wait(lk, [this]{ return !ready_.empty() || num_running_ == 0; });
+      if (ready_.empty()) return false;
+      chunk_ = ready_.front();
+      ready_.pop_front();
+      pos_ = 0;
+      cond_.notify_all();
+    }
+  }
 
-  virtual const dmlc::RowBlock<feaid_t>& Value() const { return parser_->Value(); }
+  virtual const dmlc::RowBlock<feaid_t>& Value() const { return block_; }
 
  private:
-  dmlc::data::ParserImpl<feaid_t>* parser_;
+  typedef std::vector<dmlc::data::RowBlockContainer<feaid_t>> Chunk;
+
+  /**
+   * \brief start a thread parsing the chunks, at most capacity_ chunks are
+   * parsed or being parsed but not consumed
+   */
+  template <typename Parser>
+  void Start(Parser* parser) {
+    parser->SetNegSampling(neg_sampling_, sampling_seed_ + threads_.size());
+    ++num_running_;
+    threads_.push_back(std::thread([this, parser]() {
+          std::unique_lock<std::mutex> lk(mu_);
+          while (true) {
+            cond_.wait(lk, [this]{
+                return done_ || ready_.size() + num_parsing_ < capacity_; });
+            if (done_) break;
+            Chunk* chunk = free_.empty() ? new Chunk() : free_.back();
+            if (!free_.empty()) free_.pop_back();
+            ++num_parsing_;
+            lk.unlock();
+            bool ok = parser->ParseNext(chunk);
+            lk.lock();
+            --num_parsing_;
+            if (ok) {
+              ready_.push_back(chunk);
+            } else {
+              free_.push_back(chunk);
+              break;
+            }
+            cond_.notify_all();
+          }
+          --num_running_;
+          cond_.notify_all();
+          lk.unlock();
+          delete parser;
+        }));
+  }
+
+  dmlc::RowBlock<feaid_t> block_;
+  // the chunk being consumed, and the position of the next block in it
+  Chunk* chunk_ = nullptr;
+  size_t pos_ = 0;
+  // the parsed chunks, and the consumed chunks which are reused
+  std::list<Chunk*> ready_;
+  std::vector<Chunk*> free_;
+  size_t capacity_ = 0;
+  int num_parsing_ = 0;
+  int num_running_ = 0;
+  bool done_ = false;
+  real_t neg_sampling_ = 1;
+  unsigned sampling_seed_ = 0;
+  std::mutex mu_;
+  std::condition_variable cond_;
+  std::vector<std::thread> threads_;
 };
 
 }  // namespace difacto
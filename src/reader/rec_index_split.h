@@ -0,0 +1,166 @@
+/**
+ * Copyright (c) 2015 by Contributors
+ * @file   rec_index_split.h
+ * @brief  read the records of rec data in a random order by index files
+ */
+#ifndef DIFACTO_READER_REC_INDEX_SPLIT_H_
+#define DIFACTO_READER_REC_INDEX_SPLIT_H_
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <random>
+#include <algorithm>
+#include "dmlc/io.h"
+#include "dmlc/logging.h"
+#include "io/filesys.h"
+#include "./match_file.h"
+namespace difacto {
+
+/**
+ * \brief an input split of rec data whose files have index files
+ *
+ * the index of file "abc" is "abc.idx", which has a line "offset \t length"
+ * for each record, see \ref Converter. the records rather than the bytes are
+ * partitioned, so a part can read whole records with random access.
+ *
+ * if a seed is given, then the records of all files are visited in a random
+ * permutation determined by the seed. all parts should use the same seed so
+ * that they cover the data exactly once, and use a different seed for each
+ * epoch to change the order.
+ */
+class RecIndexSplit : public dmlc::InputSplit {
+ public:
+  /**
+   * @param uri a file, a directory, or a list of them separated by ';'
+   * @param part_index the i-th part to read
+   * @param num_parts partition the records into several parts
+   * @param seed if non-negative, shuffle the records by this seed
+   */
+  RecIndexSplit(const std::string& uri, unsigned part_index,
+                unsigned num_parts, int seed = -1) {
+    std::vector<dmlc::io::FileInfo> files;
+    ListFiles(uri, &files);
+    for (const auto& f : files) {
+      if (IsIndex(f.path.name)) continue;
+      files_.push_back(f.path.str());
+      ReadIndex(files_.size() - 1);
+    }
+    if (seed >= 0) {
+      std::mt19937 rng(seed);
+      std::shuffle(recs_.begin(), recs_.end(), rng);
+    }
+    size_t n = recs_.size();
+    begin_ = n * part_index / num_parts;
+    end_ = n * (part_index + 1) / num_parts;
+    pos_ = begin_;
+    streams_.resize(files_.size());
+  }
+
+  virtual ~RecIndexSplit() { }
+
+  /**
+   * \brief returns true if every file in the uri has an index file
+   */
+  static bool Match(const std::string& uri) {
+    std::vector<dmlc::io::FileInfo> files;
+    ListFiles(uri, &files);
+    bool found = false;
+    for (const auto& f : files) {
+      if (IsIndex(f.path.name)) continue;
+      std::string idx = f.path.str() + ".idx";
+      std::unique_ptr<dmlc::Stream> in(
+          dmlc::Stream::Create(idx.c_str(), "r", true));
+      if (!in) return false;
+      found = true;
+    }
+    return found;
+  }
+
+  void HintChunkSize(size_t chunk_size) override { chunk_size_ = chunk_size; }
+
+  void BeforeFirst() override { pos_ = begin_; }
+
+  /**
+   * \brief read whole records until the chunk size is reached, at least one
+   * record is read
+   */
+  bool NextChunk(Blob* out) override {
+    if (pos_ == end_) return false;
+    chunk_.clear();
+    while (pos_ < end_ && (chunk_.empty() || chunk_.size() < chunk_size_)) {
+      Read(recs_[pos_++]);
+    }
+    out->dptr = &chunk_[0];
+    out->size = chunk_.size();
+    return true;
+  }
+
+  bool NextRecord(Blob* out) override {
+    LOG(FATAL) << "RecIndexSplit only supports NextChunk";
+    return false;
+  }
+
+ private:
+  /** \brief the position of a record */
+  struct Record {
+    size_t file;
+    size_t offset;
+    size_t length;
+  };
+
+  static bool IsIndex(const std::string& name) {
+    return name.size() >= 4 && name.compare(name.size() - 4, 4, ".idx") == 0;
+  }
+
+  /** \brief append the records of the i-th file */
+  void ReadIndex(size_t i) {
+    std::string idx = files_[i] + ".idx";
+    std::unique_ptr<dmlc::Stream> in(dmlc::Stream::Create(idx.c_str(), "r"));
+    std::string str;
+    char buf[1 << 16];
+    for (size_t n; (n = in->Read(buf, sizeof(buf))) > 0; ) str.append(buf, n);
+    const char* p = str.c_str();
+    char* end;
+    while (true) {
+      Record rec;
+      rec.file = i;
+      rec.offset = strtoull(p, &end, 10);
+      if (end == p) break;
+      p = end;
+      rec.length = strtoull(p, &end, 10);
+      CHECK(end != p) << "invalid index file " << idx;
+      p = end;
+      recs_.push_back(rec);
+    }
+  }
+
+  /** \brief append the record to chunk_ */
+  void Read(const Record& rec) {
+    auto& stream = streams_[rec.file];
+    if (!stream) {
+      stream.reset(dmlc::SeekStream::CreateForRead(files_[rec.file].c_str()));
+    }
+    size_t n = chunk_.size();
+    chunk_.resize(n + rec.length);
+    stream->Seek(rec.offset);
+    for (size_t m = 0; m < rec.length; ) {
+      size_t k = stream->Read(&chunk_[n + m], rec.length - m);
+      CHECK_GT(k, 0) << "failed to read " << files_[rec.file]
+                     << " at " << rec.offset + m;
+      m += k;
+    }
+  }
+
+  size_t chunk_size_ = 64 << 20;
+  std::vector<std::string> files_;
+  std::vector<std::unique_ptr<dmlc::SeekStream>> streams_;
+  std::vector<Record> recs_;
+  // the records [begin_, end_) of recs_ are read by this part
+  size_t begin_, end_, pos_;
+  // the chunk returned by NextChunk
+  std::string chunk_;
+};
+
+}  // namespace difacto
+#endif  // DIFACTO_READER_REC_INDEX_SPLIT_H_
@@ -0,0 +1,231 @@
+/**
+ * Copyright (c) 2015 by Contributors
+ * @file   text_parser.h
+ * @brief  the base class of the text format parsers
+ */
+#ifndef DIFACTO_READER_TEXT_PARSER_H_
+#define DIFACTO_READER_TEXT_PARSER_H_
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#include "difacto/base.h"
+#include "data/row_block.h"
+#include "data/parser.h"
+#include "dmlc/omp.h"
+#include "./neg_sampler.h"
+namespace difacto {
+
+/**
+ * \brief the base class of the parsers of line based text formats
+ *
+ * a chunk is split at line boundaries, and the parts are parsed by \ref
+ * ParseBlock in parallel, as dmlc::data::TextParserBase does. it also provides
+ * the number parsers, which read 8 digits a time.
+ *
+ * the negative examples can be down sampled by \ref NegSampler, the dropped
+ * lines are skipped right after their labels are parsed.
+ */
+class TextParser : public dmlc::data::ParserImpl<feaid_t> {
+ public:
+  /**
+   * @param source the input
+   * @param nthreads the number of parsing threads, 0 means half of the cores
+   */
+  explicit TextParser(dmlc::InputSplit *source, int nthreads = 0)
+      : bytes_read_(0), source_(source) {
+    nthreads_ = nthreads > 0 ? nthreads : std::max(omp_get_num_procs() / 2, 1);
+  }
+  virtual ~TextParser() {
+    delete source_;
+  }
+
+  void BeforeFirst(void) override {
+    source_->BeforeFirst();
+  }
+  size_t BytesRead(void) const override {
+    return bytes_read_;
+  }
+  /**
+   * \brief keep a negative example with probability rate, the kept examples
+   * are weighted, see \ref NegSampler
+   */
+  void SetNegSampling(real_t rate, unsigned seed) {
+    neg_sampling_ = rate;
+    seed_ = seed;
+  }
+  bool ParseNext(
+      std::vector<dmlc::data::RowBlockContainer<feaid_t> > *data) override {
+    dmlc::InputSplit::Blob chunk;
+    if (!source_->NextChunk(&chunk)) return false;
+
+    CHECK_NE(chunk.size, 0);
+    bytes_read_ += chunk.size;
+    char *head = reinterpret_cast<char*>(chunk.dptr);
+    data->resize(nthreads_);
+    int nparts = nthreads_;
+    uint64_t seed = (static_cast<uint64_t>(seed_) << 32) + num_chunks_++;
+#pragma omp parallel num_threads(nthreads_)
+    {
+      int tid = omp_get_thread_num();
+      int nthreads = omp_get_num_threads();
+      if (tid == 0) nparts = nthreads;
+      size_t nstep = (chunk.size + nthreads - 1) / nthreads;
+      size_t sbegin = std::min(tid * nstep, chunk.size);
+      size_t send = std::min((tid + 1) * nstep, chunk.size);
+      char *pbegin = BackFindEndLine(head + sbegin, head);
+      char *pend = tid + 1 == nthreads ?
+                   head + send : BackFindEndLine(head + send, head);
+      auto& blk = (*data)[tid];
+      blk.Clear();
+      NegSampler sampler(neg_sampling_, seed * nthreads + tid);
+      ParseBlock(pbegin, pend, &sampler, &blk);
+    }
+    data->resize(nparts);
+    return true;
+  }
+
+  /**
+   * \brief parse an unsigned integer
+   *
+   * @param p the begin
+   * @param end the end
+   * @param v the result, 0 if there is no digit
+   * @return the position after the digits
+   */
+  static const char* ParseUInt(const char* p, const char* end, uint64_t* v) {
+    uint64_t x = 0;
+    for (; end - p >= 8; p += 8) {
+      uint64_t w;
+      memcpy(&w, p, 8);
+      if (!IsEightDigits(w)) break;
+      x = x * 100000000 + EightDigits(w);
+    }
+    for (; p != end; ++p) {
+      unsigned d = static_cast<unsigned char>(*p) - '0';
+      if (d > 9) break;
+      x = x * 10 + d;
+    }
+    *v = x;
+    return p;
+  }
+
+  /**
+   * \brief parse a real number such as -1.5e3, see \ref ParseUInt
+   *
+   * the numbers with at most 19 significant digits and a decimal exponent
+   * within [-22, 22] are computed exactly in double, others fall back to
+   * strtod
+   */
+  static const char* ParseReal(const char* p, const char* end, real_t* v) {
+    static const double kPow10[] = {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+      1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const char* begin = p;
+    bool neg = false;
+    if (p != end && (*p == '-' || *p == '+')) neg = *p++ == '-';
+    uint64_t m = 0;
+    int exp10 = 0, ndigits = 0;
+    const char* digits = p;
+    for (; p != end; ++p) {
+      unsigned d = static_cast<unsigned char>(*p) - '0';
+      if (d > 9) break;
+      if (ndigits < 19) {
+        m = m * 10 + d;
+        ndigits += m != 0;
+      } else {
+        ++exp10;
+      }
+    }
+    if (p != end && *p == '.') {
+      for (++p; p != end; ++p) {
+        unsigned d = static_cast<unsigned char>(*p) - '0';
+        if (d > 9) break;
+        if (ndigits < 19) {
+          m = m * 10 + d;
+          ndigits += m != 0;
+          --exp10;
+        }
+      }
+    }
+    bool fast = p != digits && !(p == digits + 1 && *digits == '.');
+    if (fast && p != end && (*p == 'e' || *p == 'E')) {
+      const char* q = p + 1;
+      bool eneg = false;
+      if (q != end && (*q == '-' || *q == '+')) eneg = *q++ == '-';
+      uint64_t e = 0;
+      const char* r = ParseUInt(q, end, &e);
+      if (r == q || e > 1000) {
+        fast = false;
+      } else {
+        exp10 += eneg ? -static_cast<int>(e) : static_cast<int>(e);
+        p = r;
+      }
+    }
+    if (!fast || m > (static_cast<uint64_t>(1) << 53) ||
+        exp10 < -22 || exp10 > 22) {
+      // nan, inf, or numbers not exact in the fast path
+      char* q;
+      *v = static_cast<real_t>(strtod(begin, &q));
+      return q;
+    }
+    double x = static_cast<double>(m);
+    x = exp10 < 0 ? x / kPow10[-exp10] : x * kPow10[exp10];
+    *v = static_cast<real_t>(neg ? -x : x);
+    return p;
+  }
+
+ protected:
+  /**
+   * \brief parse the lines in [begin, end) into blk, which is cleared. the
+   * lines dropped by sampler are skipped, and the weights are pushed if
+   * sampling is enabled
+   */
+  virtual void ParseBlock(char *begin, char *end, NegSampler* sampler,
+                          dmlc::data::RowBlockContainer<feaid_t>* blk) const = 0;
+
+  /**
+   * \brief returns the last newline in [begin, bptr), or begin if not found
+   */
+  static char* BackFindEndLine(char *bptr, char *begin) {
+    for (; bptr != begin; --bptr) {
+      if (*(bptr-1) == '\n' || *(bptr-1) == '\r') return bptr - 1;
+    }
+    return begin;
+  }
+
+  /** \brief returns the first newline in [p, end), or end if not found */
+  static char* FindEndLine(char *p, char *end) {
+    char *q = static_cast<char*>(memchr(p, '\n', end - p));
+    return q ? q : end;
+  }
+
+ private:
+  /** \brief whether or not the 8 bytes are all digits */
+  static bool IsEightDigits(uint64_t w) {
+    return ((w & 0xF0F0F0F0F0F0F0F0ULL) |
+            (((w + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+        0x3333333333333333ULL;
+  }
+
+  /** \brief the value of 8 digits, the first one is in the lowest byte */
+  static uint64_t EightDigits(uint64_t w) {
+    w = ((w & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+    w = ((w & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+    return ((w & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32;
+  }
+
+  // number of bytes readed
+  size_t bytes_read_;
+  // source split that provides the data
+  dmlc::InputSplit *source_;
+  int nthreads_;
+  real_t neg_sampling_ = 1;
+  unsigned seed_ = 0;
+  // the number of chunks parsed, which seeds the samplers
+  uint64_t num_chunks_ = 0;
+};
+
+}  // namespace difacto
+#endif  // DIFACTO_READER_TEXT_PARSER_H_
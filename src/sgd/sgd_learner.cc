@@ -15,6 +15,7 @@
 #include "data/shared_row_block_container.h"
 #include "data/row_block.h"
 #include "data/localizer.h"
+#include "data/direct_index.h"
 #include "dmlc/timer.h"
 #include "difacto/node_id.h"
 #include "loss/bin_class_metric.h"
@@ -51,8 +52,8 @@ void SGDLearner::RunScheduler() {
                 << param_.stop_rel_objv << "]";
       break;
     }
-    if (val_prog.auc > 0) {
-      eps = (val_prog.auc - pre_val_auc) / val_prog.nrows;
+    if (val_prog.nrows > 0) {
+      eps = val_prog.auc.AUC() - pre_val_auc;
       if (eps < param_.stop_val_auc) {
         LOG(INFO) << "Change of validation AUC [" << eps << "] < stop_val_auc ["
                   << param_.stop_val_auc << "]";
@@ -63,7 +64,7 @@ void SGDLearner::RunScheduler() {
       LOG(INFO) << "Reach maximal number of epochs";
     }
     pre_loss = train_prog.loss;
-    pre_val_auc = val_prog.auc;
+    pre_val_auc = val_prog.auc.AUC();
   }
 }
 
@@ -84,6 +85,7 @@ void SGDLearner::RunEpoch(int epoch, int job_type, sgd::Progress* prog) {
     job.epoch = epoch;
     job.num_parts = n;
     job.part_idx = i;
+    job.auc = job_type == sgd::Job::kValidation || param_.train_auc;
     job.SerializeToString(&jobs[i].second);
   }
   tracker_->Issue(jobs);
@@ -136,29 +138,41 @@ void SGDLearner::IterateData(const sgd::Job& job, sgd::Progress* progress) {
         auto values = new SArray<real_t>();
         auto lengths = new SArray<int>();
         auto pull_callback = [this, batch, values, lengths, progress, on_complete]() {
+          SArray<int> w_pos, V_pos;
+          GetPos(*lengths, &w_pos, &V_pos);
+          // eval penalty
+          progress->penalty += EvaluatePenalty(*values, w_pos, V_pos);
+
           // eval loss
+          SharedRowBlockContainer<unsigned> direct;
           auto data = batch.data.GetBlock();
+          if (param_.direct_index) {
+            SArray<int> V_index;
+            DirectIndex(batch.data, w_pos, V_pos, &direct, &V_index, blk_nthreads_);
+            data = direct.GetBlock();
+            w_pos.clear();
+            V_pos = V_index;
+          }
           progress->nrows += data.size;
           SArray<real_t> pred(data.size);
-          SArray<int> w_pos, V_pos;
-          GetPos(*lengths, &w_pos, &V_pos);
           std::vector<SArray<char>> inputs = {
             SArray<char>(*values), SArray<char>(w_pos), SArray<char>(V_pos)};
-          CHECK_NOTNULL(loss_)->Predict(data, inputs, &pred);
-          progress->loss += loss_->Evaluate(batch.data.label.data(), pred);
-          // eval penalty
-          progress->penalty += EvaluatePenalty(*values, w_pos, V_pos);
+          // callbacks may run in parallel, each thread uses its own workspace
+          static thread_local LossWorkspace ws;
+          CHECK_NOTNULL(loss_)->Predict(data, inputs, &pred, &ws);
+          progress->loss += loss_->Evaluate(data.label, pred, data.weight);
 
           // auc, ...
-          BinClassMetric metric(batch.data.label.data(), pred.data(),
-                                pred.size(), blk_nthreads_);
-          progress->auc += metric.AUC();
+          if (progress->has_auc) {
+            progress->auc.Add(data.label, pred.data(), pred.size(),
+                              blk_nthreads_, data.weight);
+          }
 
           // calculate the gradients
           if (batch.type == sgd::Job::kTraining) {
             SArray<real_t> grads(values->size());
             inputs.push_back(SArray<char>(pred));
-            loss_->CalcGrad(data, inputs, &grads);
+            loss_->CalcGrad(data, inputs, &grads, &ws);
 
             // push the gradient, this task is done only if the push is complete
             store_->Push(batch.feaids,
@@ -185,13 +199,19 @@ void SGDLearner::IterateData(const sgd::Job& job, sgd::Progress* progress) {
                              job.num_parts,
                              param_.batch_size,
                              param_.batch_size * param_.shuffle,
-                             param_.neg_sampling);
+                             param_.neg_sampling,
+                             param_.data_chunk_size << 20,
+                             param_.data_num_readers,
+                             param_.data_read_ahead,
+                             param_.shuffle ? job.epoch : -1);
   } else {
     reader = new Reader(param_.data_val,
                         param_.data_format,
                         job.part_idx,
                         job.num_parts,
-                        256*1024*1024);
+                        param_.data_chunk_size << 20,
+                        param_.data_num_readers,
+                        param_.data_read_ahead);
   }
   while (reader->Next()) {
     // map feature id into continous index
@@ -239,6 +259,11 @@ KWArgs SGDLearner::Init(const KWArgs& kwargs) {
   store_->SetUpdater(std::shared_ptr<Updater>(updater));
   remain = store_->Init(remain);
   // init loss
+  if (param_.direct_index) {
+    // only FMLoss reads the direct indexed data
+    CHECK_EQ(param_.loss, "fm") << "direct_index requires loss=fm";
+    remain.push_back(std::make_pair("direct_index", "1"));
+  }
   loss_ = Loss::Create(param_.loss, blk_nthreads_);
   remain = loss_->Init(remain);
 
@@ -19,6 +19,15 @@ struct SGDLearnerParam : public dmlc::Parameter<SGDLearnerParam> {
   std::string data_val;
   /** \brief the data format. default is libsvm */
   std::string data_format;
+  /** \brief the size of data in MB read each time, in default 64 MB */
+  int data_chunk_size;
+  /**
+   * \brief the number of sub-parts of a worker's data read at the same time,
+   * should be the same for all workers
+   */
+  int data_num_readers;
+  /** \brief the maximal number of data chunks parsed in advance */
+  int data_read_ahead;
   /** \brief the model output for a training task */
   std::string model_out;
   /**
@@ -34,7 +43,16 @@ struct SGDLearnerParam : public dmlc::Parameter<SGDLearnerParam> {
    * \brief the minibatch size
    */
   int batch_size;
+  /**
+   * \brief if nonzero, shuffle the examples within a buffer of
+   * batch_size * shuffle examples. the rec data with index files is also read
+   * in a random order changing every epoch
+   */
   int shuffle;
+  /**
+   * \brief the probability to keep a negative example, which are dropped by
+   * the parsers. the kept ones are weighted by 1 / neg_sampling
+   */
   float neg_sampling;
 
   /** \brief issue num_jobs_per_epoch * num_workers per epoch */
@@ -46,10 +64,24 @@ struct SGDLearnerParam : public dmlc::Parameter<SGDLearnerParam> {
   real_t stop_rel_objv;
   /** \brief stop if val_auc_new - val_auc_old < threshold */
   real_t stop_val_auc;
+  /**
+   * \brief report the AUC on the training data as well, which adds a 16KB
+   * histogram to the progress of every job. the AUC on the validation data is
+   * always reported
+   */
+  int train_auc;
+  /**
+   * \brief rewrite the column indices of a batch into weight positions
+   * after pulling, so the loss reads weights without the position arrays
+   */
+  int direct_index;
   DMLC_DECLARE_PARAMETER(SGDLearnerParam) {
     DMLC_DECLARE_FIELD(data_format).set_default("libsvm");
     DMLC_DECLARE_FIELD(data_in);
     DMLC_DECLARE_FIELD(data_val).set_default("");
+    DMLC_DECLARE_FIELD(data_chunk_size).set_default(64);
+    DMLC_DECLARE_FIELD(data_num_readers).set_range(1, 64).set_default(1);
+    DMLC_DECLARE_FIELD(data_read_ahead).set_range(1, 1024).set_default(8);
     DMLC_DECLARE_FIELD(model_out).set_default("");
     DMLC_DECLARE_FIELD(model_in).set_default("");
     DMLC_DECLARE_FIELD(loss).set_default("fm");
@@ -60,6 +92,8 @@ struct SGDLearnerParam : public dmlc::Parameter<SGDLearnerParam> {
     DMLC_DECLARE_FIELD(neg_sampling).set_default(1);
     DMLC_DECLARE_FIELD(stop_rel_objv).set_default(1e-5);
     DMLC_DECLARE_FIELD(stop_val_auc).set_default(1e-5);
+    DMLC_DECLARE_FIELD(train_auc).set_range(0, 1).set_default(0);
+    DMLC_DECLARE_FIELD(direct_index).set_default(0);
   }
 };
 
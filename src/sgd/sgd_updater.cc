@@ -4,6 +4,7 @@
 #include <string.h>
 #include "./sgd_updater.h"
 #include "difacto/store.h"
+#include "common/cpu_dispatch.h"
 namespace difacto {
 
 KWArgs SGDUpdater::Init(const KWArgs& kwargs) {
@@ -128,13 +129,16 @@ void SGDUpdater::UpdateW(real_t gw, SGDEntry* e) {
 
 void SGDUpdater::UpdateV(real_t const* gV, SGDEntry* e) {
   int n = param_.V_dim;
-  for (int i = 0; i < n; ++i) {
-    real_t g = gV[i] + param_.V_l2 * e->V[i];
-    real_t cg = e->V[i+n];
-    e->V[i+n] = sqrt(cg * cg + g * g);
-    float eta = param_.V_lr / (e->V[i+n] + param_.V_lr_beta);
-    e->V[i] -= eta * g;
-  }
+  real_t* V = e->V;
+  Dispatch([&]() {
+      for (int i = 0; i < n; ++i) {
+        real_t g = gV[i] + param_.V_l2 * V[i];
+        real_t cg = V[i+n];
+        V[i+n] = sqrt(cg * cg + g * g);
+        float eta = param_.V_lr / (V[i+n] + param_.V_lr_beta);
+        V[i] -= eta * g;
+      }
+    });
 }
 
 void SGDUpdater::InitV(SGDEntry* e) {
@@ -7,6 +7,7 @@
 #include <vector>
 #include <sstream>
 #include "dmlc/memory_io.h"
+#include "loss/bin_class_metric.h"
 namespace difacto {
 namespace sgd {
 
@@ -26,6 +27,8 @@ struct Job {
   int part_idx;
   /** \brief the current epoch */
   int epoch;
+  /** \brief whether or not to return the AUC histogram in the progress */
+  int auc = 0;
   Job() { }
   void SerializeToString(std::string* str) const {
     *str = std::string(reinterpret_cast<char const*>(this), sizeof(Job));
@@ -40,24 +43,35 @@ struct Job {
 struct Progress {
   real_t loss = 0;  //
   real_t penalty = 0;  //
-  real_t auc = 0;   // auc
   real_t nnz_w = 0;  // |w|_0
   real_t nrows = 0;   // number of examples
+  AUCHistogram auc;   // for the AUC over all examples, valid if has_auc
+  bool has_auc = false;
 
   std::string TextString() {
     std::stringstream ss;
-    ss << "loss = " << loss << ", AUC = " << auc / nrows;
+    ss << "loss = " << loss;
+    if (has_auc) ss << ", AUC = " << auc.AUC();
     return ss.str();
   }
 
+  /** \brief the histogram is appended only if has_auc, it is 16KB */
   void SerializeToString(std::string* str) const {
-    *str = std::string(reinterpret_cast<char const*>(this), sizeof(Progress));
+    real_t head[4] = {loss, penalty, nnz_w, nrows};
+    str->assign(reinterpret_cast<char const*>(head), sizeof(head));
+    if (has_auc) {
+      str->append(reinterpret_cast<char const*>(&auc), sizeof(AUCHistogram));
+    }
   }
 
   void ParseFrom(char const* data, size_t size) {
     if (size == 0) return;
-    CHECK_EQ(size, sizeof(Progress));
-    memcpy(this, data, sizeof(Progress));
+    real_t head[4];
+    CHECK(size == sizeof(head) || size == sizeof(head) + sizeof(AUCHistogram));
+    memcpy(head, data, sizeof(head));
+    loss = head[0]; penalty = head[1]; nnz_w = head[2]; nrows = head[3];
+    has_auc = size > sizeof(head);
+    if (has_auc) memcpy(&auc, data + sizeof(head), sizeof(AUCHistogram));
   }
 
   void Merge(const std::string& str) {
@@ -67,10 +81,14 @@ struct Progress {
   }
 
   void Merge(const Progress& other) {
-    size_t n = sizeof(Progress) / sizeof(real_t);
-    auto a = reinterpret_cast<real_t*>(this);
-    auto b = reinterpret_cast<real_t const*>(&other);
-    for (size_t i = 0; i < n; ++i) a[i] += b[i];
+    loss += other.loss;
+    penalty += other.penalty;
+    nnz_w += other.nnz_w;
+    nrows += other.nrows;
+    if (other.has_auc) {
+      auc.Merge(other.auc);
+      has_auc = true;
+    }
   }
 };
 
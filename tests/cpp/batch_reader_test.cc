@@ -2,7 +2,15 @@
  *  Copyright (c) 2015 by Contributors
  */
 #include <gtest/gtest.h>
+#if DIFACTO_USE_ZLIB
+#include <zlib.h>
+#endif  // DIFACTO_USE_ZLIB
+#if DIFACTO_USE_LZ4
+#include <lz4frame.h>
+#endif  // DIFACTO_USE_LZ4
 #include "reader/batch_reader.h"
+#include "reader/compressed_split.h"
+#include "reader/converter.h"
 #include "./utils.h"
 
 using namespace difacto;
@@ -55,3 +63,375 @@ TEST(BatchReader, PartRead) {
   CHECK_LE(ttl, 60);
   CHECK_GE(ttl, 40);
 }
+
+TEST(BatchReader, NegSampling) {
+  for (unsigned shuf_buf : {0, 50}) {
+    BatchReader reader("../tests/data", "libsvm", 0, 1, batch_size, shuf_buf, .5);
+    real_t npos = 0, nneg = 0;
+    while (reader.Next()) {
+      auto batch = reader.Value();
+      ASSERT_TRUE(batch.weight != NULL);
+      for (size_t i = 0; i < batch.size; ++i) {
+        (batch.label[i] > 0 ? npos : nneg) += batch.weight[i];
+      }
+    }
+    EXPECT_EQ(npos, 68);
+    EXPECT_GT(nneg, 16);
+    EXPECT_LT(nneg, 48);
+  }
+}
+
+void read_rows(const std::string& uri, int num_readers, int read_ahead,
+               std::vector<std::vector<feaid_t>>* rows) {
+  Reader reader(uri, "libsvm", 0, 1, 1<<10, num_readers, read_ahead);
+  while (reader.Next()) {
+    auto blk = reader.Value();
+    for (size_t j = 0; j < blk.size; ++j) {
+      rows->push_back(std::vector<feaid_t>(blk.index + blk.offset[j],
+                                           blk.index + blk.offset[j+1]));
+    }
+  }
+}
+
+TEST(Reader, MultiReaders) {
+  // read the sub-parts in parallel, the blocks may be in any order
+  std::vector<std::vector<feaid_t>> rows[2];
+  for (int i = 0; i < 2; ++i) {
+    read_rows("../tests/data", i ? 3 : 1, i ? 2 : 8, &rows[i]);
+    std::sort(rows[i].begin(), rows[i].end());
+  }
+  EXPECT_EQ(rows[0].size(), 100);
+  EXPECT_EQ(rows[0], rows[1]);
+}
+
+TEST(Reader, LocalFile) {
+  std::vector<std::vector<feaid_t>> rows[2];
+  read_rows("../tests/data", 1, 8, &rows[0]);
+  read_rows("file://../tests/data", 1, 8, &rows[1]);
+  EXPECT_EQ(rows[0].size(), 100);
+  EXPECT_EQ(rows[0], rows[1]);
+}
+
+TEST(LocalSplit, BufferBudget) {
+  // a 64 KB budget caps the chunks to 32 KB, while all lines are read once in
+  // order
+  std::string file = "/tmp/difacto_test_local_split.txt", data;
+  for (int i = 0; i < 20000; ++i) data += std::to_string(i) + " 1:2\n";
+  {
+    std::unique_ptr<dmlc::Stream> fo(dmlc::Stream::Create(file.c_str(), "w"));
+    fo->Write(data.data(), data.size());
+  }
+  LocalSplit split(file, 0, 1, false, false, 4, 4, 64 << 10);
+  split.HintChunkSize(1 << 20);
+  std::string res;
+  dmlc::InputSplit::Blob chunk;
+  int nchunks = 0;
+  while (split.NextChunk(&chunk)) {
+    // plus the partial line left by the former chunk
+    EXPECT_LE(chunk.size, (32 << 10) + 16);
+    res.append(static_cast<char*>(chunk.dptr), chunk.size);
+    ++nchunks;
+  }
+  EXPECT_GT(nchunks, 5);
+  EXPECT_EQ(res, data);
+}
+
+#if DIFACTO_USE_ZLIB
+TEST(Reader, Gzip) {
+  std::string file = "/tmp/difacto_test_data.gz";
+  ASSERT_EQ(system(("gzip -c ../tests/data > " + file).c_str()), 0);
+  std::vector<std::vector<feaid_t>> rows[2];
+  read_rows("../tests/data", 1, 8, &rows[0]);
+  read_rows(file, 1, 8, &rows[1]);
+  EXPECT_EQ(rows[0].size(), 100);
+  EXPECT_EQ(rows[0], rows[1]);
+}
+#endif  // DIFACTO_USE_ZLIB
+
+/** \brief libsvm lines, which repeat every 997 lines */
+std::string gen_lines(int n) {
+  std::string text;
+  for (int i = 0; i < n; ++i) {
+    int k = i % 997;
+    text += std::to_string(k % 2) + " " + std::to_string(k) + ":1 " +
+        std::to_string(k * 31 + 7) + ":0.5\n";
+  }
+  return text;
+}
+
+/** \brief write data into file */
+void write_file(const std::string& file, const std::string& data) {
+  std::unique_ptr<dmlc::Stream> fo(dmlc::Stream::Create(file.c_str(), "w"));
+  fo->Write(data.data(), data.size());
+}
+
+/** \brief returns the concatenated chunks read by CompressedSplit */
+std::string read_split(const std::string& file) {
+  CompressedSplit split(file, 0, 1, 3);
+  split.HintChunkSize(1 << 20);
+  std::string res;
+  dmlc::InputSplit::Blob chunk;
+  while (split.NextChunk(&chunk)) {
+    res.append(static_cast<char*>(chunk.dptr), chunk.size);
+  }
+  return res;
+}
+
+#if DIFACTO_USE_LZ4
+/** \brief compress data into a lz4 frame with 64KB blocks */
+std::string lz4_frame(const std::string& data, bool independent,
+                      bool checksum) {
+  LZ4F_preferences_t pref;
+  memset(&pref, 0, sizeof(pref));
+  pref.frameInfo.blockSizeID = LZ4F_max64KB;
+  pref.frameInfo.blockMode = independent ? LZ4F_blockIndependent :
+                             LZ4F_blockLinked;
+  if (checksum) {
+    pref.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+    pref.frameInfo.blockChecksumFlag = LZ4F_blockChecksumEnabled;
+    pref.frameInfo.contentSize = data.size();
+  }
+  std::string out(LZ4F_compressFrameBound(data.size(), &pref), 0);
+  size_t n = LZ4F_compressFrame(&out[0], out.size(), data.data(), data.size(),
+                                &pref);
+  CHECK(!LZ4F_isError(n));
+  out.resize(n);
+  return out;
+}
+
+TEST(CompressedSplit, LZ4) {
+  std::string text = gen_lines(100000);
+  std::string file = "/tmp/difacto_test_split.lz4";
+  std::string independent = lz4_frame(text, true, true);
+  std::string linked = lz4_frame(text, false, false);
+  // the blocks refer to the former ones within the 64KB window
+  EXPECT_LT(linked.size(), independent.size());
+  std::string linked_checksum = lz4_frame(text, false, true);
+
+  write_file(file, independent);
+  EXPECT_EQ(read_split(file), text);
+  write_file(file, linked);
+  EXPECT_EQ(read_split(file), text);
+  write_file(file, linked_checksum);
+  EXPECT_EQ(read_split(file), text);
+
+  // several frames with a skippable one among them
+  std::string skippable("\x50\x2a\x4d\x18\x03\x00\x00\x00" "abc", 11);
+  write_file(file, independent + skippable + linked_checksum);
+  EXPECT_EQ(read_split(file), text + text);
+}
+#endif  // DIFACTO_USE_LZ4
+
+#if DIFACTO_USE_ZLIB
+/**
+ * \brief compress data into a gzip member, a bgzip one has the extra field BC
+ * with its size
+ */
+std::string gzip_member(const std::string& data, bool bgzip) {
+  z_stream z;
+  memset(&z, 0, sizeof(z));
+  CHECK_EQ(deflateInit2(&z, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY),
+           Z_OK);
+  unsigned char extra[6] = {'B', 'C', 2, 0, 0, 0};
+  gz_header head;
+  memset(&head, 0, sizeof(head));
+  head.os = 255;
+  if (bgzip) {
+    head.extra = extra;
+    head.extra_len = 6;
+  }
+  CHECK_EQ(deflateSetHeader(&z, &head), Z_OK);
+  std::string out(deflateBound(&z, data.size()) + 64, 0);
+  z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  z.avail_in = data.size();
+  z.next_out = reinterpret_cast<Bytef*>(&out[0]);
+  z.avail_out = out.size();
+  CHECK_EQ(deflate(&z, Z_FINISH), Z_STREAM_END);
+  out.resize(z.total_out);
+  deflateEnd(&z);
+  if (bgzip) {
+    // the member size - 1, after the 12-byte header and the subfield header
+    size_t bsize = out.size() - 1;
+    CHECK_LT(bsize, 1 << 16);
+    out[16] = static_cast<char>(bsize & 0xFF);
+    out[17] = static_cast<char>(bsize >> 8);
+  }
+  return out;
+}
+
+TEST(CompressedSplit, Gzip) {
+  std::string text = gen_lines(100000);
+  std::string file = "/tmp/difacto_test_split.gz";
+  for (bool bgzip : {true, false}) {
+    // members of 60000 bytes, which split the lines, followed by an empty
+    // member, which is the end of a bgzip file
+    std::string data;
+    for (size_t i = 0; i < text.size(); i += 60000) {
+      data += gzip_member(text.substr(i, 60000), bgzip);
+    }
+    data += gzip_member("", bgzip);
+    write_file(file, data);
+    EXPECT_EQ(read_split(file), text) << "bgzip = " << bgzip;
+  }
+}
+#endif  // DIFACTO_USE_ZLIB
+
+TEST(BatchReader, Slice) {
+  std::vector<std::vector<feaid_t>> rows;
+  read_rows("../tests/data", 1, 8, &rows);
+  // small chunks make batches straddle blocks, large chunks give slices
+  for (int chunk_size : {1<<10, 1<<26}) {
+    BatchReader reader("../tests/data", "libsvm", 0, 1, 7, 0, 1.0, chunk_size);
+    size_t n = 0;
+    while (reader.Next()) {
+      auto batch = reader.Value();
+      EXPECT_EQ(batch.offset[0], 0);
+      for (size_t j = 0; j < batch.size; ++j, ++n) {
+        ASSERT_LT(n, rows.size());
+        EXPECT_EQ(rows[n], std::vector<feaid_t>(batch.index + batch.offset[j],
+                                                batch.index + batch.offset[j+1]));
+      }
+    }
+    EXPECT_EQ(n, rows.size());
+  }
+}
+
+TEST(Reader, RecIndex) {
+  Converter conv;
+  conv.Init({{"data_in", "../tests/data"}, {"data_format", "libsvm"},
+             {"data_out", "/tmp/difacto_test_data.rec"},
+             {"data_out_format", "rec"}, {"chunk_size", "0.001"}});
+  conv.Run();
+  ASSERT_TRUE(RecIndexSplit::Match("/tmp/difacto_test_data.rec"));
+
+  std::vector<std::vector<feaid_t>> rows;
+  read_rows("../tests/data", 1, 8, &rows);
+  // the indices within a row are sorted in rec data
+  for (auto& row : rows) std::sort(row.begin(), row.end());
+  std::sort(rows.begin(), rows.end());
+  std::vector<std::vector<feaid_t>> first;
+  for (int seed : {-1, 0, 1}) {
+    std::vector<std::vector<feaid_t>> all;
+    for (int i = 0; i < 2; ++i) {
+      Reader reader("/tmp/difacto_test_data.rec", "rec", i, 2, 1<<10, 1, 8, seed);
+      while (reader.Next()) {
+        auto blk = reader.Value();
+        for (size_t j = 0; j < blk.size; ++j) {
+          std::vector<feaid_t> row(blk.index + blk.offset[j],
+                                   blk.index + blk.offset[j+1]);
+          std::sort(row.begin(), row.end());
+          all.push_back(row);
+        }
+      }
+    }
+    if (seed < 0) {
+      first = all;
+    } else {
+      // the records are read in a different order
+      EXPECT_NE(first, all);
+    }
+    std::sort(all.begin(), all.end());
+    EXPECT_EQ(rows, all);
+  }
+}
+
+/** \brief read all rows with their labels and values */
+void read_all(const std::string& uri, const std::string& format,
+              std::vector<real_t>* label,
+              std::vector<std::vector<std::pair<feaid_t, real_t>>>* rows) {
+  Reader reader(uri, format, 0, 1, 1<<10);
+  while (reader.Next()) {
+    auto blk = reader.Value();
+    for (size_t j = 0; j < blk.size; ++j) {
+      label->push_back(blk.label[j]);
+      std::vector<std::pair<feaid_t, real_t>> row;
+      for (size_t k = blk.offset[j]; k < blk.offset[j+1]; ++k) {
+        row.push_back(std::make_pair(blk.index[k], blk.value ? blk.value[k] : 1));
+      }
+      rows->push_back(row);
+    }
+  }
+}
+
+TEST(Converter, RoundTrip) {
+  // libsvm -> rec -> libsvm gives the same rows, the indices within a row
+  // are sorted by rec
+  std::string rec = "/tmp/difacto_test_conv.rec";
+  std::string libsvm = "/tmp/difacto_test_conv.libsvm";
+  Converter a, b;
+  a.Init({{"data_in", "../tests/data"}, {"data_format", "libsvm"},
+          {"data_out", rec}, {"data_out_format", "rec"},
+          {"chunk_size", "0.001"}, {"num_threads", "3"}});
+  a.Run();
+  b.Init({{"data_in", rec}, {"data_format", "rec"},
+          {"data_out", libsvm}, {"data_out_format", "libsvm"},
+          {"chunk_size", "0.001"}, {"num_threads", "3"}});
+  b.Run();
+
+  std::vector<real_t> label[2];
+  std::vector<std::vector<std::pair<feaid_t, real_t>>> rows[2];
+  read_all("../tests/data", "libsvm", &label[0], &rows[0]);
+  read_all(libsvm, "libsvm", &label[1], &rows[1]);
+  EXPECT_EQ(label[0].size(), 100);
+  EXPECT_EQ(label[0], label[1]);
+  ASSERT_EQ(rows[0].size(), rows[1].size());
+  for (size_t i = 0; i < rows[0].size(); ++i) {
+    auto& row = rows[0][i];
+    std::stable_sort(row.begin(), row.end(),
+                     [](const std::pair<feaid_t, real_t>& x,
+                        const std::pair<feaid_t, real_t>& y) {
+                       return x.first < y.first;
+                     });
+    ASSERT_EQ(row.size(), rows[1][i].size());
+    for (size_t j = 0; j < row.size(); ++j) {
+      EXPECT_EQ(row[j].first, rows[1][i][j].first);
+      // printed with 6 significant digits, as std::ostream does
+      EXPECT_NEAR(row[j].second, rows[1][i][j].second,
+                  1e-5 * fabs(row[j].second));
+    }
+  }
+}
+
+TEST(Converter, MultiPart) {
+  // every block goes to a new part if part_size is 0. the concatenated parts
+  // keep the input order and print the reals as std::ostream does
+  std::string in = "/tmp/difacto_test_conv_in.libsvm";
+  std::string out = "/tmp/difacto_test_conv_out";
+  std::string data, expected;
+  for (int i = 0; i < 200; ++i) {
+    data += std::to_string(i % 3 - 1) + " " + std::to_string(i) +
+        ":0.1 18446744073709551615:3.14159265 7:1e-07 8:1234567 9:-2.5 " +
+        "10:100\n";
+    expected += std::to_string(i % 3 - 1) + " " + std::to_string(i) +
+        ":0.1 18446744073709551615:3.14159 7:1e-07 8:1.23457e+06 9:-2.5 " +
+        "10:100 \n";
+  }
+  {
+    std::unique_ptr<dmlc::Stream> fo(dmlc::Stream::Create(in.c_str(), "w"));
+    fo->Write(data.data(), data.size());
+  }
+  // remove the parts of former runs
+  for (int i = 0; ; ++i) {
+    if (remove((out + "-part_" + std::to_string(i)).c_str())) break;
+  }
+  Converter conv;
+  conv.Init({{"data_in", in}, {"data_format", "libsvm"},
+             {"data_out", out}, {"data_out_format", "libsvm"},
+             {"part_size", "0"}, {"chunk_size", "0.001"},
+             {"num_threads", "3"}});
+  conv.Run();
+
+  std::string res;
+  int nparts = 0;
+  for (; ; ++nparts) {
+    std::string part = out + "-part_" + std::to_string(nparts);
+    FILE* fp = fopen(part.c_str(), "r");
+    if (fp == NULL) break;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) res.append(buf, n);
+    fclose(fp);
+  }
+  EXPECT_GT(nparts, 3);
+  EXPECT_EQ(res, expected);
+}
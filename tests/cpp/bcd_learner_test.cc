@@ -64,3 +64,96 @@ TEST(BCDLearer, Convergence) {
     EXPECT_LT(fabs(objv - 15.884923)/objv, 1e-3);
   }
 }
+
+TEST(BCDLearer, FM) {
+  // the same problem with and without the embeddings
+  std::vector<real_t> objv[2];
+  for (int V_dim : {0, 5}) {
+    BCDLearner learner;
+    KWArgs args = {{"data_in", "../tests/data"},
+                   {"l1", ".1"},
+                   {"lr", ".8"},
+                   {"V_dim", std::to_string(V_dim)},
+                   {"block_ratio", "1"},
+                   {"tail_feature_filter", "0"},
+                   {"max_num_epochs", "10"}};
+    auto remain = learner.Init(args);
+    EXPECT_EQ(remain.size(), 0);
+
+    auto& o = objv[V_dim > 0];
+    auto callback = [&o](int epoch, const std::vector<real_t>& prog) {
+      o.push_back(prog[1]);
+    };
+    learner.AddEpochEndCallback(callback);
+    learner.Run();
+  }
+
+  ASSERT_EQ(objv[1].size(), 10);
+  EXPECT_LT(objv[1].back(), objv[1].front());
+  // V is trained by FMLossDelta, so the FM fits the data better than the
+  // linear model
+  ASSERT_EQ(objv[0].size(), 10);
+  EXPECT_LT(objv[1].back(), objv[0].back());
+}
+
+TEST(BCDLearer, FastMath) {
+  // the approximated exp and log give almost the same objective
+  std::vector<real_t> objv[2];
+  for (int k = 0; k < 2; ++k) {
+    srand(0);
+    BCDLearner learner;
+    KWArgs args = {{"data_in", "../tests/data"},
+                   {"fast_math", std::to_string(k)},
+                   {"l1", ".1"},
+                   {"lr", ".8"},
+                   {"V_dim", "5"},
+                   {"block_ratio", "1"},
+                   {"tail_feature_filter", "0"},
+                   {"max_num_epochs", "5"}};
+    auto remain = learner.Init(args);
+    EXPECT_EQ(remain.size(), 0);
+    auto callback = [&objv, k](int epoch, const std::vector<real_t>& prog) {
+      objv[k].push_back(prog[1]);
+    };
+    learner.AddEpochEndCallback(callback);
+    learner.Run();
+  }
+  ASSERT_EQ(objv[0].size(), objv[1].size());
+  for (size_t i = 0; i < objv[0].size(); ++i) {
+    EXPECT_LT(fabs(objv[0][i] - objv[1][i]) / objv[0][i], 1e-4);
+  }
+}
+
+TEST(BCDLearer, ReuseDataCache) {
+  std::string cache = "/tmp/difacto_bcd_test_";
+  std::vector<real_t> objv;
+  // without the cache, then saving the cache, and then loading it
+  for (int k = 0; k < 3; ++k) {
+    // the same order of the feature blocks
+    srand(0);
+    BCDLearner learner;
+    KWArgs args = {{"data_in", "../tests/data"},
+                   {"data_cache", cache},
+                   {"reuse_data_cache", std::to_string(k > 0)},
+                   {"neg_sampling", ".5"},
+                   {"l1", ".1"},
+                   {"lr", ".8"},
+                   {"block_ratio", "1"},
+                   {"tail_feature_filter", "0"},
+                   {"max_num_epochs", "5"}};
+    auto remain = learner.Init(args);
+    EXPECT_EQ(remain.size(), 0);
+    int i = 0;
+    // the example weights are kept in the cache
+    auto callback = [&objv, &i, k](int epoch, const std::vector<real_t>& prog) {
+      if (k == 0) {
+        objv.push_back(prog[1]);
+      } else {
+        EXPECT_EQ(objv[i++], prog[1]);
+      }
+    };
+    learner.AddEpochEndCallback(callback);
+    learner.Run();
+  }
+  EXPECT_EQ(remove((cache + "tiles_0_1").c_str()), 0);
+}
@@ -0,0 +1,109 @@
+/**
+ *  Copyright (c) 2015 by Contributors
+ */
+#include <gtest/gtest.h>
+#include "./utils.h"
+#include "loss/bin_class_metric.h"
+
+using namespace difacto;
+
+TEST(AUCHistogram, AUC) {
+  int n = 100000;
+  SArray<real_t> label, pred;
+  gen_vals(n, -1, 1, &label);
+  gen_vals(n, -3, 3, &pred);
+  // make the prediction correlated with the label
+  for (int i = 0; i < n; ++i) pred[i] += label[i] > 0 ? .5 : -.5;
+
+  BinClassMetric metric(label.data(), pred.data(), n);
+  real_t auc = metric.AUC() / n;
+
+  AUCHistogram hist;
+  hist.Add(label.data(), pred.data(), n);
+  EXPECT_EQ(hist.Count(), n);
+  EXPECT_LT(fabs(hist.AUC() - auc), 1e-3);
+
+  // merge batches
+  AUCHistogram merged;
+  int nblk = 7;
+  for (int b = 0; b < nblk; ++b) {
+    auto rg = Range(0, n).Segment(b, nblk);
+    AUCHistogram batch;
+    batch.Add(label.data() + rg.begin, pred.data() + rg.begin, rg.Size());
+    merged.Merge(batch);
+  }
+  EXPECT_EQ(merged.AUC(), hist.AUC());
+
+  // merge the batches sent as real_t vectors
+  std::vector<real_t> vec(AUCHistogram::kVecSize);
+  for (int b = 0; b < nblk; ++b) {
+    auto rg = Range(0, n).Segment(b, nblk);
+    AUCHistogram batch;
+    batch.Add(label.data() + rg.begin, pred.data() + rg.begin, rg.Size());
+    std::vector<real_t> v(AUCHistogram::kVecSize);
+    batch.CopyTo(v.data());
+    for (size_t i = 0; i < v.size(); ++i) vec[i] += v[i];
+  }
+  AUCHistogram copied;
+  copied.CopyFrom(vec.data());
+  EXPECT_EQ(copied.Count(), n);
+  EXPECT_EQ(copied.AUC(), hist.AUC());
+}
+
+TEST(AUCHistogram, Weight) {
+  int n = 100000;
+  SArray<real_t> label, pred, weight(n);
+  gen_vals(n, -1, 1, &label);
+  gen_vals(n, -3, 3, &pred);
+  for (int i = 0; i < n; ++i) {
+    pred[i] += label[i] > 0 ? .5 : -.5;
+    weight[i] = label[i] > 0 ? 1 : 4;
+  }
+  // the weighted negative examples are the same as the duplicated ones
+  SArray<real_t> dup_label, dup_pred;
+  for (int i = 0; i < n; ++i) {
+    for (int k = 0; k < weight[i]; ++k) {
+      dup_label.push_back(label[i]);
+      dup_pred.push_back(pred[i]);
+    }
+  }
+  size_t m = dup_label.size();
+
+  BinClassMetric metric(label.data(), pred.data(), n, DEFAULT_NTHREADS, false,
+                        weight.data());
+  BinClassMetric dup_metric(dup_label.data(), dup_pred.data(), m);
+  EXPECT_LT(fabs(metric.AUC() - dup_metric.AUC()) / m, 1e-5);
+  EXPECT_EQ(metric.Accuracy(0), dup_metric.Accuracy(0));
+
+  AUCHistogram hist, dup_hist;
+  hist.Add(label.data(), pred.data(), n, DEFAULT_NTHREADS, weight.data());
+  dup_hist.Add(dup_label.data(), dup_pred.data(), m);
+  EXPECT_EQ(hist.Count(), m);
+  EXPECT_EQ(hist.AUC(), dup_hist.AUC());
+
+  // a bin keeps counting beyond 2^24
+  AUCHistogram big;
+  real_t y = 1, p = 0, w = 1 << 24;
+  big.Add(&y, &p, 1, 1, &w);
+  w = 1;
+  big.Add(&y, &p, 1, 1, &w);
+  EXPECT_EQ(big.Count(), (1 << 24) + 1);
+}
+
+TEST(AUCHistogram, Transport) {
+  // a bin beyond 2^24 on each of two nodes, summed as real_t vectors
+  real_t y = 1, p = 0;
+  AUCHistogram node;
+  for (real_t w : {real_t(1 << 24), real_t(3), real_t(.25)}) {
+    node.Add(&y, &p, 1, 1, &w);
+  }
+  std::vector<real_t> vec(AUCHistogram::kVecSize), v(AUCHistogram::kVecSize);
+  node.CopyTo(vec.data());
+  node.CopyTo(v.data());
+  for (size_t i = 0; i < v.size(); ++i) vec[i] += v[i];
+
+  AUCHistogram merged;
+  merged.CopyFrom(vec.data());
+  EXPECT_EQ(merged.Count(), 2 * ((1 << 24) + 3.25));
+  EXPECT_EQ(merged.pos[AUCHistogram::Bin(p)], merged.Count());
+}
@@ -0,0 +1,139 @@
+/**
+ *  Copyright (c) 2015 by Contributors
+ */
+#include "common/arg_parser.h"
+#include "common/cpu_dispatch.h"
+#include "common/delta_codec.h"
+#include "data/compressed_row_block.h"
+#include "dmlc/config.h"
+#include "dmlc/timer.h"
+#include "reader/reader.h"
+
+using namespace difacto;
+using namespace dmlc;
+
+struct Param : public Parameter<Param> {
+  std::string data;
+  std::string format;
+  int repeat;
+  DMLC_DECLARE_PARAMETER(Param) {
+    DMLC_DECLARE_FIELD(format).set_default("libsvm").describe("data format");;
+    DMLC_DECLARE_FIELD(data).describe("input data filename");;
+    DMLC_DECLARE_FIELD(repeat).set_default(20).describe("number of repeats");;
+  }
+};
+
+DMLC_REGISTER_PARAMETER(Param);
+
+#if DIFACTO_USE_LZ4
+/**
+ * \brief write a record in the former layout, which compresses the raw arrays
+ * by lz4, see CompressedRowBlock::DecompressV0
+ */
+template <typename T>
+void WriteLZ4(const T* data, size_t n, std::string* out) {
+  int size = 0;
+  std::vector<char> dst;
+  if (n) {
+    dst.resize(LZ4_compressBound(n * sizeof(T)));
+    size = LZ4_compress_default(reinterpret_cast<const char*>(data), dst.data(),
+                                n * sizeof(T), dst.size());
+  }
+  out->append(reinterpret_cast<const char*>(&size), sizeof(int));
+  out->append(dst.data(), size);
+}
+
+void CompressV0(const RowBlock<feaid_t>& blk, std::string* out) {
+  int header[3] = {1196140743, sizeof(feaid_t), static_cast<int>(blk.size)};
+  out->append(reinterpret_cast<const char*>(header), sizeof(header));
+  size_t base = blk.offset[0], nnz = blk.offset[blk.size] - base;
+  WriteLZ4(blk.label, blk.size, out);
+  WriteLZ4(blk.offset, blk.size + 1, out);
+  WriteLZ4(blk.index + base, nnz, out);
+  WriteLZ4(blk.value ? blk.value + base : NULL, blk.value ? nnz : 0, out);
+  WriteLZ4(blk.weight, blk.weight ? blk.size : 0, out);
+}
+#endif  // DIFACTO_USE_LZ4
+
+/**
+ * \brief decompress a record repeatedly, and report the throughput in the
+ * decoded bytes
+ */
+void Run(const std::string& name, const std::string& rec, int repeat) {
+  CompressedRowBlock crb;
+  data::RowBlockContainer<feaid_t> blk;
+  double start = 0;
+  for (int i = 0; i < repeat + 1; ++i) {
+    if (i == 1) start = GetTime();  // warmup when i == 0
+    blk.Clear();
+    crb.Decompress(rec, &blk);
+  }
+  double t = (GetTime() - start) / repeat;
+  LOG(INFO) << name << ": " << rec.size() / 1e6 << " MB record, "
+            << blk.MemCostBytes() / t / 1e6 << " MB/sec";
+}
+
+/**
+ * \brief unpack the bit packed gaps only, which is the part vectorized
+ */
+void RunUnpack(const std::string& name, const std::vector<feaid_t>& gaps,
+               int repeat) {
+  std::string buf;
+  DeltaCodec::Pack(gaps.data(), gaps.size(), &buf);
+  buf.append(DeltaCodec::kPadding, 0);
+  std::vector<feaid_t> res(gaps.size());
+  double start = 0;
+  for (int i = 0; i < repeat + 1; ++i) {
+    if (i == 1) start = GetTime();  // warmup when i == 0
+    DeltaCodec::Unpack(buf.data(), res.size(), res.data());
+  }
+  double t = (GetTime() - start) / repeat;
+  CHECK(res == gaps);
+  LOG(INFO) << name << ": " << res.size() * sizeof(feaid_t) / t / 1e6
+            << " MB/sec";
+}
+
+int main(int argc, char *argv[]) {
+  Param param;
+  if (argc < 2) {
+    LOG(ERROR) << "not enough input.. \n\nusage: ./difacto key1=val1 key2=val2 ...\n\n"
+               << param.__DOC__();
+    return 0;
+  }
+  ArgParser parser;
+  for (int i = 1; i < argc; ++i) parser.AddArg(argv[i]);
+  param.Init(parser.GetKWArgs());
+
+  Reader reader(param.data, param.format, 0, 1, 512<<20);
+  CHECK(reader.Next());
+  auto blk = reader.Value();
+  LOG(INFO) << "load " << blk.size << " rows and "
+            << blk.offset[blk.size] - blk.offset[0] << " nonzeros";
+
+  std::string rec;
+  CompressedRowBlock().Compress(blk, &rec);
+  ISA isa = ActiveISA();
+  SetISA(ISA::kGeneric);
+  Run("delta, generic", rec, param.repeat);
+  SetISA(isa);
+  Run(std::string("delta, ") + ISAName(isa), rec, param.repeat);
+#if DIFACTO_USE_LZ4
+  std::string rec_v0;
+  CompressV0(blk, &rec_v0);
+  Run("lz4", rec_v0, param.repeat);
+#endif  // DIFACTO_USE_LZ4
+
+  // the gaps between the sorted indices of each row
+  std::vector<feaid_t> gaps;
+  for (size_t i = 0; i < blk.size; ++i) {
+    std::vector<feaid_t> row(blk.index + blk.offset[i],
+                             blk.index + blk.offset[i+1]);
+    std::sort(row.begin(), row.end());
+    for (size_t j = 1; j < row.size(); ++j) gaps.push_back(row[j] - row[j-1]);
+  }
+  SetISA(ISA::kGeneric);
+  RunUnpack("unpack gaps, generic", gaps, param.repeat);
+  SetISA(isa);
+  RunUnpack(std::string("unpack gaps, ") + ISAName(isa), gaps, param.repeat);
+  return 0;
+}
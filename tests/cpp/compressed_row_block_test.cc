@@ -3,7 +3,10 @@
  */
 #include <gtest/gtest.h>
 #include "data/compressed_row_block.h"
+#include "dmlc/recordio.h"
 #include "reader/batch_reader.h"
+#include "reader/crb_parser.h"
+#include "reader/local_split.h"
 #include "./utils.h"
 
 using namespace difacto;
@@ -23,3 +26,78 @@ TEST(CompressedRowBlock, Basic) {
 
   check_equal(A, B);
 }
+
+TEST(CompressedRowBlock, SortedIndices) {
+  dmlc::data::RowBlockContainer<feaid_t> A;
+  A.Clear();
+  // rows: {5:1, 2:2, 9:3}, {}, {7:4, 1:5}
+  A.index = {5, 2, 9, 7, 1};
+  A.value = {1, 2, 3, 4, 5};
+  A.offset = {0, 3, 3, 5};
+  A.label = {1, 0, 1};
+
+  std::string out;
+  CompressedRowBlock crb;
+  crb.Compress(A.GetBlock(), &out);
+
+  dmlc::data::RowBlockContainer<feaid_t> B;
+  B.Clear();
+  crb.Decompress(out, &B);
+  std::vector<feaid_t> index = {2, 5, 9, 1, 7};
+  std::vector<real_t> value = {2, 1, 3, 5, 4};
+  EXPECT_EQ(B.offset, A.offset);
+  EXPECT_EQ(B.label, A.label);
+  EXPECT_EQ(B.index, index);
+  EXPECT_EQ(B.value, value);
+  EXPECT_TRUE(B.weight.empty());
+}
+
+TEST(CRBParser, Order) {
+  // the records in a chunk are decoded by several threads, while the blocks
+  // still come back in the file order
+  std::string file = "/tmp/difacto_test_crb_order.rec";
+  int nblks = 13;
+  {
+    std::unique_ptr<dmlc::Stream> out(dmlc::Stream::Create(file.c_str(), "w"));
+    dmlc::RecordIOWriter writer(out.get());
+    for (int i = 0; i < nblks; ++i) {
+      dmlc::data::RowBlockContainer<feaid_t> blk;
+      blk.Clear();
+      for (int j = 0; j <= i % 4; ++j) {
+        blk.label.push_back(i);
+        blk.index.push_back(i * 10 + j);
+        blk.index.push_back(i * 10 + j + 1);
+        blk.offset.push_back(blk.index.size());
+      }
+      std::string str;
+      CompressedRowBlock().Compress(blk.GetBlock(), &str);
+      writer.WriteRecord(str);
+    }
+  }
+
+  for (int nthreads : {1, 4}) {
+    auto in = new LocalSplit(file, 0, 1, true);
+    in->HintChunkSize(1 << 20);
+    CRBParser parser(in, nthreads);
+    std::vector<real_t> label;
+    std::vector<feaid_t> index;
+    while (parser.Next()) {
+      auto blk = parser.Value();
+      for (size_t j = 0; j < blk.size; ++j) label.push_back(blk.label[j]);
+      for (size_t k = blk.offset[0]; k < blk.offset[blk.size]; ++k) {
+        index.push_back(blk.index[k]);
+      }
+    }
+    std::vector<real_t> label_expected;
+    std::vector<feaid_t> index_expected;
+    for (int i = 0; i < nblks; ++i) {
+      for (int j = 0; j <= i % 4; ++j) {
+        label_expected.push_back(i);
+        index_expected.push_back(i * 10 + j);
+        index_expected.push_back(i * 10 + j + 1);
+      }
+    }
+    EXPECT_EQ(label, label_expected);
+    EXPECT_EQ(index, index_expected);
+  }
+}
@@ -2,6 +2,9 @@
  *  Copyright (c) 2015 by Contributors
  */
 #include <gtest/gtest.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <thread>
 #include "dmlc/memory_io.h"
 #include "data/data_store.h"
 #include "./utils.h"
@@ -77,3 +80,196 @@ TEST(DataStore, Meta) {
   EXPECT_EQ(store2.size("2"), n);
   EXPECT_EQ(store2.size("3"), n);
 }
+
+TEST(DataStore, Disk) {
+  // can keep about 3 of the 8 values in memory
+  DataStore store("/tmp/difacto_test_", 3 * 1000 * sizeof(real_t));
+  int n = 1000, m = 8;
+  std::vector<SArray<real_t>> vals(m);
+  for (int i = 0; i < m; ++i) {
+    gen_vals(n, -100, 100, &vals[i]);
+    store.Store(std::to_string(i), vals[i]);
+  }
+
+  for (int k = 0; k < 3; ++k) {
+    for (int i = 0; i < m; ++i) {
+      auto key = std::to_string(i);
+      store.Prefetch(key);
+      if (i + 1 < m) {
+        store.Prefetch(std::to_string(i+1));
+      }
+      SArray<real_t> ret;
+      store.Fetch(key, &ret, Range(10, 30));
+      EXPECT_EQ(norm2(vals[i].segment(10, 30)), norm2(ret));
+      store.Fetch(key, &ret);
+      EXPECT_EQ(norm2(vals[i]), norm2(ret));
+    }
+  }
+
+  // overwrite and remove
+  SArray<int> val;
+  gen_vals(n, -100, 100, &val);
+  store.Store("0", val);
+  store.Remove("1");
+  SArray<int> ret;
+  store.Fetch("0", &ret);
+  EXPECT_EQ(norm2(val), norm2(ret));
+}
+
+TEST(DataStore, DiskConcurrent) {
+  // several threads fetch while the others are written into files
+  DataStore store("/tmp/difacto_test_", 2 * 1000 * sizeof(real_t));
+  int n = 1000, m = 8, nt = 4;
+  std::vector<double> norms(m);
+  for (int i = 0; i < m; ++i) {
+    SArray<real_t> val;
+    gen_vals(n, -100, 100, &val);
+    norms[i] = norm2(val);
+    store.Store(std::to_string(i), val);
+  }
+  std::vector<std::thread> threads;
+  std::vector<int> errors(nt);
+  for (int t = 0; t < nt; ++t) {
+    threads.emplace_back([&, t]() {
+        for (int k = 0; k < 5; ++k) {
+          for (int i = t; i < m; i += nt) {
+            auto key = std::to_string(i);
+            store.Prefetch(std::to_string((i + 1) % m));
+            SArray<real_t> ret;
+            store.Fetch(key, &ret);
+            if (norm2(ret) != norms[i]) ++errors[t];
+          }
+        }
+      });
+  }
+  for (auto& t : threads) t.join();
+  for (int t = 0; t < nt; ++t) EXPECT_EQ(errors[t], 0);
+}
+
+TEST(DataStore, DiskPinned) {
+  // the caller holds all stored arrays, so the evicted ones stay in memory.
+  // the store still keeps half of the capacity, 4 of the 16 values, resident
+  std::string prefix = "/tmp/difacto_test_pinned_";
+  int n = 1000, m = 16;
+  DataStore store(prefix, 8 * n * sizeof(real_t));
+  std::vector<SArray<real_t>> vals(m);
+  for (int i = 0; i < m; ++i) {
+    gen_vals(n, -100, 100, &vals[i]);
+    store.Store(std::to_string(i), vals[i]);
+  }
+  // the evicted ones are written into files
+  std::string own = prefix.substr(5) + std::to_string(getpid()) + "_";
+  int nfiles = 0;
+  DIR* dir = opendir("/tmp");
+  while (auto ent = readdir(dir)) {
+    if (own.compare(0, own.size(), ent->d_name, own.size()) == 0) ++nfiles;
+  }
+  closedir(dir);
+  EXPECT_EQ(nfiles, m - 4);
+  for (int i = 0; i < m; ++i) {
+    SArray<real_t> ret;
+    store.Fetch(std::to_string(i), &ret);
+    EXPECT_EQ(norm2(vals[i]), norm2(ret));
+  }
+}
+
+TEST(DataStore, Mmap) {
+  DataStore store("/tmp/difacto_test_", 0, true);
+  int n = 10000, m = 4;
+  std::vector<SArray<real_t>> vals(m);
+  for (int i = 0; i < m; ++i) {
+    gen_vals(n, -100, 100, &vals[i]);
+    store.Store(std::to_string(i), vals[i]);
+  }
+
+  for (int i = 0; i < m; ++i) {
+    auto key = std::to_string(i);
+    store.Prefetch(key, Range(100, 3000));
+    SArray<real_t> ret;
+    store.Fetch(key, &ret, Range(100, 3000));
+    EXPECT_EQ(norm2(vals[i].segment(100, 3000)), norm2(ret));
+    store.Fetch(key, &ret);
+    EXPECT_EQ(norm2(vals[i]), norm2(ret));
+  }
+
+  // the fetched data is still valid after overwritten
+  SArray<real_t> ret;
+  store.Fetch("0", &ret);
+  store.Store("0", vals[1]);
+  EXPECT_EQ(norm2(vals[0]), norm2(ret));
+  store.Fetch("0", &ret);
+  EXPECT_EQ(norm2(vals[1]), norm2(ret));
+}
+
+TEST(DataStore, MmapConcurrent) {
+  // readers hit the per-thread caches while a writer changes other keys. the
+  // meta data of DataStore are not thread safe, so use the backend directly
+  DataStoreMmap store("/tmp/difacto_test_");
+  int n = 1000, m = 8, nt = 4;
+  std::vector<double> norms(m);
+  for (int i = 0; i < m; ++i) {
+    SArray<real_t> val;
+    gen_vals(n, -100, 100, &val);
+    norms[i] = norm2(val);
+    store.Store(std::to_string(i), SArray<char>(val));
+  }
+  std::vector<std::thread> threads;
+  std::vector<int> errors(nt);
+  for (int t = 0; t < nt; ++t) {
+    threads.emplace_back([&, t]() {
+        SArray<char> hold;
+        store.Fetch(std::to_string(t), Range(0, n * sizeof(real_t)), &hold);
+        for (int k = 0; k < 100; ++k) {
+          for (int i = 0; i < m; ++i) {
+            SArray<char> ret;
+            store.Fetch(std::to_string(i), Range(0, n * sizeof(real_t)), &ret);
+            if (norm2(SArray<real_t>(ret)) != norms[i]) ++errors[t];
+          }
+        }
+        if (norm2(SArray<real_t>(hold)) != norms[t]) ++errors[t];
+      });
+  }
+  for (int k = 0; k < 100; ++k) {
+    SArray<real_t> val;
+    gen_vals(n, -100, 100, &val);
+    store.Store("new", SArray<char>(val));
+    store.Remove("new");
+  }
+  for (auto& t : threads) t.join();
+  for (int t = 0; t < nt; ++t) EXPECT_EQ(errors[t], 0);
+}
+
+TEST(DataStore, MmapShared) {
+  std::string prefix = "/tmp/difacto_test_shared_";
+  SArray<real_t> val;
+  gen_vals(10000, -100, 100, &val);
+  auto shared_files = [&prefix]() {
+    std::vector<std::string> files;
+    DIR* dir = opendir("/tmp");
+    while (auto ent = readdir(dir)) {
+      std::string name = std::string("/tmp/") + ent->d_name;
+      if (name.compare(0, prefix.size() + 7, prefix + "shared_") == 0) {
+        files.push_back(name);
+      }
+    }
+    closedir(dir);
+    return files;
+  };
+
+  {
+    // two stores, such as two processes, storing the same data share a file
+    DataStore a(prefix, 0, true), b(prefix, 0, true);
+    a.Store("0", val);
+    b.Store("1", val);
+    auto files = shared_files();
+    ASSERT_EQ(files.size(), 1);
+    struct stat st;
+    ASSERT_EQ(stat(files[0].c_str(), &st), 0);
+    EXPECT_EQ(st.st_nlink, 3);
+
+    SArray<real_t> ret;
+    b.Fetch("1", &ret);
+    EXPECT_EQ(norm2(val), norm2(ret));
+  }
+  EXPECT_EQ(shared_files().size(), 0);
+}
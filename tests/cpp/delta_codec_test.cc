@@ -0,0 +1,82 @@
+/**
+ *  Copyright (c) 2015 by Contributors
+ */
+#include <gtest/gtest.h>
+#include "./utils.h"
+#include "common/delta_codec.h"
+
+using namespace difacto;
+
+template <typename T>
+void check_codec(const SArray<T>& data) {
+  std::string buf;
+  DeltaCodec::Encode(data.data(), data.size(), &buf);
+  size_t size = buf.size();
+  EXPECT_LE(size, DeltaCodec::MaxEncodedSize(data.size()));
+  buf.append(DeltaCodec::kPadding, 0);
+  SArray<T> res(data.size());
+  auto end = DeltaCodec::Decode(buf.data(), data.size(), res.data());
+  EXPECT_EQ(end, buf.data() + size);
+  check_equal(data, res);
+}
+
+TEST(DeltaCodec, Sorted) {
+  SArray<uint32_t> key;
+  gen_keys(1000, 100000, &key);
+  check_codec(key);
+  std::string buf;
+  DeltaCodec::Encode(key.data(), key.size(), &buf);
+  EXPECT_LT(buf.size(), key.size() * sizeof(uint32_t) / 2);
+}
+
+TEST(DeltaCodec, Unsorted) {
+  SArray<int> val;
+  gen_vals(1000, -100, 100000, &val);
+  val[0] = -1; val[10] = std::numeric_limits<int>::min();
+  val[11] = std::numeric_limits<int>::max();
+  check_codec(val);
+
+  SArray<uint64_t> val2;
+  gen_vals(300, 0, 1e18, &val2);
+  val2[5] = std::numeric_limits<uint64_t>::max();
+  check_codec(val2);
+
+  check_codec(SArray<size_t>());
+}
+
+TEST(DeltaCodec, Pack) {
+  SArray<uint64_t> val;
+  gen_vals(1000, 0, 100, &val);
+  val[7] = std::numeric_limits<uint64_t>::max();
+  std::string buf;
+  DeltaCodec::Pack(val.data(), val.size(), &buf);
+  buf.append(DeltaCodec::kPadding, 0);
+  SArray<uint64_t> res(val.size());
+  DeltaCodec::Unpack(buf.data(), val.size(), res.data());
+  check_equal(val, res);
+}
+
+TEST(DeltaCodec, Widths) {
+  // every bit width, with a partial tail block, under each ISA variant
+  ISA isa = ActiveISA();
+  for (ISA run : {ISA::kGeneric, ISA::kAVX2}) {
+    SetISA(run);
+    for (int width = 0; width <= 64; ++width) {
+      uint64_t max = width == 64 ? std::numeric_limits<uint64_t>::max() :
+                     (static_cast<uint64_t>(1) << width) - 1;
+      SArray<uint64_t> val(DeltaCodec::kBlockSize * 2 + 13);
+      for (size_t i = 0; i < val.size(); ++i) {
+        val[i] = max - (i * 2654435761u) % (max / 3 + 1);
+      }
+      std::string buf;
+      DeltaCodec::Pack(val.data(), val.size(), &buf);
+      size_t size = buf.size();
+      buf.append(DeltaCodec::kPadding, 0);
+      SArray<uint64_t> res(val.size());
+      auto end = DeltaCodec::Unpack(buf.data(), val.size(), res.data());
+      EXPECT_EQ(end, buf.data() + size);
+      check_equal(val, res);
+    }
+  }
+  SetISA(isa);
+}
@@ -0,0 +1,81 @@
+/**
+ *  Copyright (c) 2015 by Contributors
+ */
+#include <gtest/gtest.h>
+#include "./utils.h"
+#include "common/fast_math.h"
+#include "loss/logit_loss.h"
+#include "loss/bin_class_metric.h"
+
+using namespace difacto;
+
+TEST(FastMath, RelError) {
+  double err_exp = 0, err_sigmoid = 0, err_log1pexp = 0;
+  for (double x = -80; x <= 80; x += 1e-3) {
+    float f = x;
+    double e = exp(static_cast<double>(f));
+    err_exp = std::max(err_exp, fabs(fast_math::Exp(f) - e) / e);
+    double s = 1 / (1 + exp(- static_cast<double>(f)));
+    err_sigmoid = std::max(err_sigmoid, fabs(fast_math::Sigmoid(f) - s) / s);
+    double l = log1p(e);
+    err_log1pexp = std::max(err_log1pexp, fabs(fast_math::Log1pExp(f) - l) / l);
+  }
+  EXPECT_LT(err_exp, 1e-6);
+  EXPECT_LT(err_sigmoid, 1e-6);
+  EXPECT_LT(err_log1pexp, 1e-6);
+}
+
+TEST(FastMath, LogitLoss) {
+  dmlc::data::RowBlockContainer<unsigned> rowblk;
+  std::vector<feaid_t> uidx;
+  load_data(&rowblk, &uidx);
+  auto data = rowblk.GetBlock();
+
+  LogitLoss loss;
+  LogitLoss fast_loss; fast_loss.Init({{"fast_math", "1"}});
+
+  for (int i = 0; i < 5; ++i) {
+    SArray<real_t> w;
+    gen_vals(uidx.size(), -10, 10, &w);
+
+    SArray<real_t> pred(data.size), grad(w.size()), fast_grad(w.size());
+    loss.Predict(data, {SArray<char>(w)}, &pred);
+    loss.CalcGrad(data, {SArray<char>(pred)}, &grad);
+    fast_loss.CalcGrad(data, {SArray<char>(pred)}, &fast_grad);
+    EXPECT_LE(fabs(norm2(grad) - norm2(fast_grad)) / norm2(grad), 1e-6);
+  }
+}
+
+TEST(FastMath, BinClassMetric) {
+  int n = 10000;
+  SArray<real_t> label, pred;
+  gen_vals(n, -1, 1, &label);
+  gen_vals(n, -8, 8, &pred);
+
+  BinClassMetric metric(label.data(), pred.data(), n);
+  BinClassMetric fast_metric(label.data(), pred.data(), n,
+                             DEFAULT_NTHREADS, true);
+  real_t objv = metric.LogitObjv();
+  EXPECT_LE(fabs(objv - fast_metric.LogitObjv()) / objv, 1e-5);
+  real_t logloss = metric.LogLoss();
+  EXPECT_LE(fabs(logloss - fast_metric.LogLoss()) / logloss, 1e-5);
+}
+
+TEST(FastMath, BinClassMetricDispatch) {
+  int n = 10007;
+  SArray<real_t> label, pred;
+  gen_vals(n, -1, 1, &label);
+  gen_vals(n, -8, 8, &pred);
+
+  BinClassMetric metric(label.data(), pred.data(), n, DEFAULT_NTHREADS, true);
+  ISA orig = ActiveISA();
+  SetISA(ISA::kGeneric);
+  real_t objv = metric.LogitObjv();
+  real_t logloss = metric.LogLoss();
+  for (ISA isa : {ISA::kAVX2, ISA::kAVX512}) {
+    SetISA(isa);
+    EXPECT_EQ(objv, metric.LogitObjv());
+    EXPECT_EQ(logloss, metric.LogLoss());
+  }
+  SetISA(orig);
+}
@@ -0,0 +1,75 @@
+/**
+ *  Copyright (c) 2015 by Contributors
+ */
+#include <gtest/gtest.h>
+#include "common/spmt.h"
+#include "loss/fm_loss_delta.h"
+#include "./utils.h"
+
+using namespace difacto;
+
+TEST(FMLossDelta, Grad) {
+  // load and tranpose data
+  dmlc::data::RowBlockContainer<unsigned> rowblk, transposed;
+  std::vector<feaid_t> uidx;
+  load_data(&rowblk, &uidx);
+  SpMT::Transpose(rowblk.GetBlock(), &transposed, uidx.size());
+  size_t n = uidx.size();
+  int V_dim = 5, k = V_dim + 1;
+
+  // init loss
+  KWArgs args = {{"V_dim", std::to_string(V_dim)}};
+  FMLossDelta loss; loss.Init(args);
+  FMLoss ref_loss; ref_loss.Init(args);
+
+  SArray<real_t> w;
+  gen_vals(n * k, -.1, .1, &w);
+  SArray<int> ref_w_pos(n), ref_V_pos(n);
+  for (size_t i = 0; i < n; ++i) {
+    ref_w_pos[i] = i * k;
+    ref_V_pos[i] = i * k + 1;
+  }
+  SArray<real_t> ref_pred(100), ref_grad(w.size());
+  ref_loss.Predict(rowblk.GetBlock(), w, ref_w_pos, ref_V_pos, &ref_pred);
+  ref_loss.CalcGrad(rowblk.GetBlock(), w, ref_w_pos, ref_V_pos, ref_pred,
+                    &ref_grad);
+
+  // start from 0, add the weights block by block
+  int nblk = 10;
+  SArray<real_t> pred(100), XV(100 * V_dim);
+  for (int b = 0; b < nblk; ++b) {
+    auto rg = Range(0, n).Segment(b, nblk);
+    auto data = transposed.GetBlock().Slice(rg.begin, rg.end);
+    data.label = rowblk.GetBlock().label;
+    auto w_seg = w.segment(rg.begin * k, rg.end * k);
+    SArray<int> w_pos(rg.Size());
+    for (size_t i = 0; i < w_pos.size(); ++i) w_pos[i] = i * k;
+    loss.Predict(data, {SArray<char>(w_seg), SArray<char>(w_pos),
+            SArray<char>(XV), SArray<char>(w_seg)}, &pred);
+  }
+  for (size_t i = 0; i < pred.size(); ++i) {
+    EXPECT_NEAR(pred[i], ref_pred[i], 1e-4);
+  }
+
+  SArray<real_t> grad(n * 2 * k);
+  for (int b = 0; b < nblk; ++b) {
+    auto rg = Range(0, n).Segment(b, nblk);
+    auto data = transposed.GetBlock().Slice(rg.begin, rg.end);
+    data.label = rowblk.GetBlock().label;
+    auto w_seg = w.segment(rg.begin * k, rg.end * k);
+    SArray<int> w_pos(rg.Size()), grad_pos(rg.Size());
+    for (size_t i = 0; i < w_pos.size(); ++i) {
+      w_pos[i] = i * k;
+      grad_pos[i] = i * 2 * k;
+    }
+    auto grad_seg = grad.segment(rg.begin * 2 * k, rg.end * 2 * k);
+    loss.CalcGrad(data, {SArray<char>(pred), SArray<char>(grad_pos),
+            SArray<char>(XV), SArray<char>(w_seg), SArray<char>(w_pos)},
+      &grad_seg);
+  }
+  for (size_t i = 0; i < ref_grad.size(); ++i) {
+    real_t tol = 1e-4 * std::max<real_t>(1, fabs(ref_grad[i]));
+    EXPECT_NEAR(grad[i*2], ref_grad[i], tol);
+    EXPECT_GE(grad[i*2+1], 0);
+  }
+}
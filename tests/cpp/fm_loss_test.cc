@@ -2,9 +2,11 @@
  *  Copyright (c) 2015 by Contributors
  */
 #include <gtest/gtest.h>
+#include <thread>
 #include "./utils.h"
 #include "loss/fm_loss.h"
 #include "data/localizer.h"
+#include "data/direct_index.h"
 #include "loss/bin_class_metric.h"
 
 using namespace difacto;
@@ -81,3 +83,174 @@ TEST(FMLoss, HasV) {
   loss.CalcGrad(data, w, w_pos, V_pos, pred, &grad);
   EXPECT_LT(fabs(norm2(grad) - 1.2378e+03), 1e-1);
 }
+
+TEST(FMLoss, Weight) {
+  int V_dim = 5;
+  dmlc::data::RowBlockContainer<unsigned> rowblk, dup;
+  std::vector<feaid_t> uidx;
+  load_data(&rowblk, &uidx);
+  // an example with weight k is the same as k copies of it
+  rowblk.weight.resize(rowblk.Size());
+  auto data = rowblk.GetBlock();
+  for (size_t i = 0; i < data.size; ++i) {
+    rowblk.weight[i] = 1 + i % 3;
+    dmlc::RowBlock<unsigned> row;
+    row.size = 1;
+    row.offset = data.offset + i;
+    row.label = data.label + i;
+    row.weight = nullptr;
+    row.index = data.index + data.offset[i];
+    row.value = data.value ? data.value + data.offset[i] : nullptr;
+    for (size_t k = 0; k <= i % 3; ++k) dup.Push(row);
+  }
+  data = rowblk.GetBlock();
+  auto dup_data = dup.GetBlock();
+
+  SArray<real_t> w;
+  gen_vals(uidx.size() * (V_dim+1), -.1, .1, &w);
+  SArray<int> w_pos(uidx.size()), V_pos(uidx.size());
+  for (size_t i = 0; i < uidx.size(); ++i) {
+    w_pos[i] = i * (V_dim+1);
+    V_pos[i] = i * (V_dim+1) + 1;
+  }
+  KWArgs args = {{"V_dim", std::to_string(V_dim)}};
+  FMLoss loss; loss.Init(args);
+  // CalcGrad reuses the workspace of the last Predict
+  SArray<real_t> pred(data.size), dup_pred(dup_data.size);
+  SArray<real_t> grad(w.size()), dup_grad(w.size());
+  loss.Predict(data, w, w_pos, V_pos, &pred);
+  loss.CalcGrad(data, w, w_pos, V_pos, pred, &grad);
+  loss.Predict(dup_data, w, w_pos, V_pos, &dup_pred);
+  loss.CalcGrad(dup_data, w, w_pos, V_pos, dup_pred, &dup_grad);
+
+  BinClassMetric eval(data.label, pred.data(), data.size, DEFAULT_NTHREADS,
+                      false, data.weight);
+  BinClassMetric dup_eval(dup_data.label, dup_pred.data(), dup_data.size);
+  EXPECT_LT(fabs(eval.LogitObjv() - dup_eval.LogitObjv()), 1e-3);
+  EXPECT_LT(fabs(eval.AUC() - dup_eval.AUC()), 1e-3);
+  EXPECT_EQ(eval.Accuracy(0), dup_eval.Accuracy(0));
+  EXPECT_LT(fabs(loss.Evaluate(data.label, pred, data.weight) -
+                 loss.Evaluate(dup_data.label, dup_pred)), 1e-3);
+
+  for (size_t i = 0; i < grad.size(); ++i) {
+    EXPECT_LT(fabs(grad[i] - dup_grad[i]), 1e-4);
+  }
+}
+
+TEST(FMLoss, DirectIndex) {
+  int V_dim = 5;
+  dmlc::data::RowBlockContainer<unsigned> rowblk;
+  std::vector<feaid_t> uidx;
+  load_data(&rowblk, &uidx);
+
+  // some features have no V, and some are filtered
+  size_t n = uidx.size();
+  SArray<int> w_pos(n), V_pos(n);
+  int p = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (i % 7 == 0) {
+      w_pos[i] = -1; V_pos[i] = -1; continue;
+    }
+    w_pos[i] = p;
+    V_pos[i] = i % 3 ? p+1 : -1;
+    p += i % 3 ? V_dim + 1 : 1;
+  }
+  SArray<real_t> w(p);
+  for (int i = 0; i < p; ++i) w[i] = (i % 13) / 5e2;
+
+  KWArgs args = {{"V_dim", std::to_string(V_dim)}};
+  FMLoss loss; loss.Init(args);
+  auto data = rowblk.GetBlock();
+  SArray<real_t> pred(data.size);
+  loss.Predict(data, w, w_pos, V_pos, &pred);
+  SArray<real_t> grad(w.size());
+  loss.CalcGrad(data, w, w_pos, V_pos, pred, &grad);
+
+  SharedRowBlockContainer<unsigned> direct;
+  SArray<int> V_index;
+  DirectIndex(SharedRowBlockContainer<unsigned>(data), w_pos, V_pos,
+              &direct, &V_index);
+  args.push_back({"direct_index", "1"});
+  FMLoss loss2; loss2.Init(args);
+  auto data2 = direct.GetBlock();
+  SArray<real_t> pred2(data2.size);
+  loss2.Predict(data2, w, {}, V_index, &pred2);
+  SArray<real_t> grad2(w.size());
+  loss2.CalcGrad(data2, w, {}, V_index, pred2, &grad2);
+
+  for (size_t i = 0; i < pred.size(); ++i) {
+    EXPECT_NEAR(pred[i], pred2[i], 1e-5);
+  }
+  for (size_t i = 0; i < grad.size(); ++i) {
+    EXPECT_NEAR(grad[i], grad2[i], 1e-4);
+  }
+}
+
+TEST(FMLoss, EmptyWPos) {
+  int V_dim = 5;
+  dmlc::data::RowBlockContainer<unsigned> rowblk;
+  std::vector<feaid_t> uidx;
+  load_data(&rowblk, &uidx);
+  // an empty w_pos means w is indexed by the columns
+  size_t n = uidx.size();
+  SArray<int> w_pos(n), V_pos(n);
+  for (size_t i = 0; i < n; ++i) {
+    w_pos[i] = i;
+    V_pos[i] = n + i * V_dim;
+  }
+  SArray<real_t> w;
+  gen_vals(n * (V_dim + 1), -.1, .1, &w);
+
+  KWArgs args = {{"V_dim", std::to_string(V_dim)}};
+  FMLoss loss; loss.Init(args);
+  auto data = rowblk.GetBlock();
+  SArray<real_t> pred(data.size), grad(w.size());
+  loss.Predict(data, w, w_pos, V_pos, &pred);
+  loss.CalcGrad(data, w, w_pos, V_pos, pred, &grad);
+  SArray<real_t> pred2(data.size), grad2(w.size());
+  loss.Predict(data, w, {}, V_pos, &pred2);
+  loss.CalcGrad(data, w, {}, V_pos, pred2, &grad2);
+  EXPECT_EQ(norm2(pred), norm2(pred2));
+  EXPECT_EQ(norm2(grad), norm2(grad2));
+}
+
+TEST(FMLoss, Workspace) {
+  int V_dim = 5;
+  dmlc::data::RowBlockContainer<unsigned> rowblk;
+  std::vector<feaid_t> uidx;
+  load_data(&rowblk, &uidx);
+  size_t n = uidx.size();
+  SArray<int> w_pos(n), V_pos(n);
+  for (size_t i = 0; i < n; ++i) {
+    w_pos[i] = i * (V_dim + 1);
+    V_pos[i] = i * (V_dim + 1) + 1;
+  }
+
+  KWArgs args = {{"V_dim", std::to_string(V_dim)}};
+  FMLoss loss; loss.Init(args);
+  auto data = rowblk.GetBlock();
+
+  // one loss is shared by several threads, each with its own workspace
+  int nt = 4;
+  std::vector<SArray<real_t>> w(nt), pred(nt), grad(nt);
+  std::vector<LossWorkspace> ws(nt);
+  for (int k = 0; k < nt; ++k) gen_vals(n * (V_dim + 1), -.1, .1, &w[k]);
+  std::vector<std::thread> threads;
+  for (int k = 0; k < nt; ++k) {
+    threads.emplace_back([&, k]() {
+        pred[k].resize(data.size);
+        grad[k].resize(w[k].size());
+        loss.Predict(data, w[k], w_pos, V_pos, &pred[k], {}, &ws[k]);
+        loss.CalcGrad(data, w[k], w_pos, V_pos, pred[k], &grad[k], {}, &ws[k]);
+      });
+  }
+  for (auto& t : threads) t.join();
+
+  for (int k = 0; k < nt; ++k) {
+    SArray<real_t> pred2(data.size), grad2(w[k].size());
+    loss.Predict(data, w[k], w_pos, V_pos, &pred2);
+    loss.CalcGrad(data, w[k], w_pos, V_pos, pred2, &grad2);
+    EXPECT_EQ(norm2(pred[k]), norm2(pred2));
+    EXPECT_EQ(norm2(grad[k]), norm2(grad2));
+  }
+}
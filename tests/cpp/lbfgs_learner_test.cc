@@ -2,6 +2,9 @@
  *  Copyright (c) 2015 by Contributors
  */
 #include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <utime.h>
+#include <fstream>
 #include "lbfgs/lbfgs_learner.h"
 
 using namespace difacto;
@@ -144,3 +147,76 @@ TEST(LBFGSLearner, WithV) {
   learner.AddEpochEndCallback(callback);
   learner.Run();
 }
+
+TEST(LBFGSLearner, ReuseDataCache) {
+  std::string cache = "/tmp/difacto_lbfgs_test_";
+  std::string data = cache + "data";
+  {
+    std::ifstream in("../tests/data", std::ios::binary);
+    std::ofstream out(data, std::ios::binary);
+    out << in.rdbuf();
+  }
+  std::vector<real_t> objv;
+  for (int k = 0; k < 2; ++k) {
+    if (k == 1) {
+      // blank the input but keep its size and mtime, so the signature is
+      // unchanged and only a loaded cache gives the same results
+      struct stat st;
+      ASSERT_EQ(stat(data.c_str(), &st), 0);
+      {
+        std::ofstream out(data, std::ios::binary | std::ios::trunc);
+        out << std::string(st.st_size, '\n');
+      }
+      struct utimbuf times = {st.st_atime, st.st_mtime};
+      ASSERT_EQ(utime(data.c_str(), &times), 0);
+    }
+    LBFGSLearner learner;
+    KWArgs args = {{"data_in", data},
+                   {"data_cache", cache},
+                   {"reuse_data_cache", "1"},
+                   {"V_dim", "2"},
+                   {"max_num_epochs", "5"}};
+    auto remain = learner.Init(args);
+    EXPECT_EQ(remain.size(), 0);
+    int i = 0;
+    // the second run loads the tiles saved by the first one
+    auto callback = [&objv, &i, k](int epoch, const lbfgs::Progress& prog) {
+      if (k == 0) {
+        objv.push_back(prog.objv);
+      } else {
+        EXPECT_EQ(objv[i++], prog.objv);
+      }
+    };
+    learner.AddEpochEndCallback(callback);
+    learner.Run();
+    if (k == 1) {
+      EXPECT_EQ(static_cast<size_t>(i), objv.size());
+    }
+  }
+  EXPECT_EQ(remove((cache + "tiles_0_1").c_str()), 0);
+  EXPECT_EQ(remove(data.c_str()), 0);
+}
+
+TEST(LBFGSLearner, CompactTiles) {
+  std::vector<real_t> objv;
+  for (int k = 0; k < 2; ++k) {
+    LBFGSLearner learner;
+    KWArgs args = {{"data_in", "../tests/data"},
+                   {"compact_tiles", std::to_string(k)},
+                   {"V_dim", "0"},
+                   {"max_num_epochs", "5"}};
+    auto remain = learner.Init(args);
+    EXPECT_EQ(remain.size(), 0);
+    int i = 0;
+    // the compact tiles give the same results
+    auto callback = [&objv, &i, k](int epoch, const lbfgs::Progress& prog) {
+      if (k == 0) {
+        objv.push_back(prog.objv);
+      } else {
+        EXPECT_EQ(objv[i++], prog.objv);
+      }
+    };
+    learner.AddEpochEndCallback(callback);
+    learner.Run();
+  }
+}
@@ -89,3 +89,23 @@ TEST(Twoloop, basic) {
     EXPECT_LE(fabs(norm2(p0) - norm2(p1)) / norm2(p1), 1e-5);
   }
 }
+
+TEST(Twoloop, InnerDispatch) {
+  // the sum order is fixed, so the results are identical among the ISAs
+  SArray<real_t> a, b;
+  gen_vals(100003, -10, 10, &a);
+  gen_vals(100003, -10, 10, &b);
+  ISA orig = ActiveISA();
+  for (int nthreads : {1, 3}) {
+    SetISA(ISA::kGeneric);
+    double res = Inner(a, b, nthreads);
+    double sum = 0;
+    for (size_t i = 0; i < a.size(); ++i) sum += a[i] * b[i];
+    EXPECT_LT(fabs(res - sum), 1e-6 * fabs(sum));
+    for (ISA isa : {ISA::kAVX2, ISA::kAVX512}) {
+      SetISA(isa);
+      EXPECT_EQ(res, Inner(a, b, nthreads));
+    }
+  }
+  SetISA(orig);
+}
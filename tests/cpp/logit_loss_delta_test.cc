@@ -105,3 +105,37 @@ TEST(LogitLossDelta, Hessien) {
   EXPECT_LT(fabs(norm2(G) - 90.5817), 1e-4);
   EXPECT_LT(fabs(norm2(H) - 0.0424518), 1e-6);
 }
+
+TEST(LogitLossDelta, SquaredValue) {
+  dmlc::data::RowBlockContainer<unsigned> rowblk, transposed;
+  std::vector<feaid_t> uidx;
+  load_data(&rowblk, &uidx);
+  SpMT::Transpose(rowblk.GetBlock(), &transposed, uidx.size());
+  ASSERT_FALSE(transposed.value.empty());
+  SArray<dmlc::real_t> xx_value(transposed.value.size());
+  for (size_t i = 0; i < xx_value.size(); ++i) {
+    xx_value[i] = transposed.value[i] * transposed.value[i];
+  }
+
+  KWArgs args = {{"compute_hession", "1"}};
+  LogitLossDelta loss; loss.Init(args);
+  SArray<real_t> pred;
+  gen_vals(100, -2, 2, &pred);
+
+  // the hessian with the precomputed squared values is the same
+  int nblk = 10;
+  SArray<real_t> grad(uidx.size()*2), grad2(uidx.size()*2);
+  for (int b = 0; b < nblk; ++b) {
+    auto rg = Range(0, uidx.size()).Segment(b, nblk);
+    auto data = transposed.GetBlock().Slice(rg.begin, rg.end);
+    data.label = rowblk.GetBlock().label;
+    SArray<int> grad_pos(rg.Size());
+    for (size_t i = 0; i < grad_pos.size(); ++i) grad_pos[i] = 2*i;
+    auto grad_seg = grad.segment(rg.begin*2, rg.end*2);
+    loss.CalcGrad(data, {SArray<char>(pred), SArray<char>(grad_pos)}, &grad_seg);
+    auto grad2_seg = grad2.segment(rg.begin*2, rg.end*2);
+    loss.CalcGrad(data, {SArray<char>(pred), SArray<char>(grad_pos), {},
+            SArray<char>(xx_value)}, &grad2_seg);
+  }
+  for (size_t i = 0; i < grad.size(); ++i) EXPECT_EQ(grad[i], grad2[i]);
+}
@@ -0,0 +1,74 @@
+/**
+ *  Copyright (c) 2015 by Contributors
+ */
+#include "common/arg_parser.h"
+#include "dmlc/config.h"
+#include "dmlc/timer.h"
+#include "data/libsvm_parser.h"
+#include "reader/adfea_parser.h"
+#include "reader/criteo_parser.h"
+#include "reader/libsvm_parser.h"
+
+using namespace difacto;
+using namespace dmlc;
+
+struct Param : public Parameter<Param> {
+  std::string data;
+  std::string format;
+  int nthreads;
+  int chunk_size;
+  DMLC_DECLARE_PARAMETER(Param) {
+    DMLC_DECLARE_FIELD(format).set_default("libsvm").describe("data format");;
+    DMLC_DECLARE_FIELD(data).describe("input data filename");;
+    DMLC_DECLARE_FIELD(nthreads).set_default(0).describe("number of threads");;
+    DMLC_DECLARE_FIELD(chunk_size).set_default(64).describe("chunk size in MB");;
+  }
+};
+
+DMLC_REGISTER_PARAMETER(Param);
+
+/**
+ * \brief parse all data, and report the throughput
+ */
+void Run(const std::string& name, data::ParserImpl<feaid_t>* parser) {
+  double start = GetTime();
+  size_t nrows = 0, nnz = 0;
+  while (parser->Next()) {
+    nrows += parser->Value().size;
+    nnz += parser->Value().offset[parser->Value().size] - parser->Value().offset[0];
+  }
+  double t = GetTime() - start;
+  LOG(INFO) << name << ": parsed " << nrows << " rows and " << nnz
+            << " nonzeros in " << t << " sec, "
+            << parser->BytesRead() / t / 1e6 << " MB/sec";
+  delete parser;
+}
+
+int main(int argc, char *argv[]) {
+  Param param;
+  if (argc < 2) {
+    LOG(ERROR) << "not enough input.. \n\nusage: ./difacto key1=val1 key2=val2 ...\n\n"
+               << param.__DOC__();
+    return 0;
+  }
+  ArgParser parser;
+  for (int i = 1; i < argc; ++i) parser.AddArg(argv[i]);
+  param.Init(parser.GetKWArgs());
+
+  auto input = [&param]() {
+    InputSplit* in = InputSplit::Create(param.data.c_str(), 0, 1, "text");
+    in->HintChunkSize(param.chunk_size << 20);
+    return in;
+  };
+  if (param.format == "libsvm") {
+    Run("dmlc libsvm", new data::LibSVMParser<feaid_t>(input(), 1));
+    Run("libsvm", new LibSVMParser(input(), param.nthreads));
+  } else if (param.format == "criteo") {
+    Run("criteo", new CriteoParser(input(), true, param.nthreads));
+  } else if (param.format == "adfea") {
+    Run("adfea", new AdfeaParser(input(), param.nthreads));
+  } else {
+    LOG(FATAL) << "unknown format " << param.format;
+  }
+  return 0;
+}
@@ -87,3 +87,24 @@ TEST(SpMM, TransTimesPosVec) {
   SpMV::TransTimes(D, x_val, &y_val, DEFAULT_NTHREADS, x_pos, y_pos);
   EXPECT_EQ(norm2(y_val), norm2(y_val2));
 }
+
+TEST(SpMM, Dispatch) {
+  load_data(&data, &uidx);
+  auto D = data.GetBlock();
+  int k = 10;
+  SArray<real_t> x;
+  gen_vals(uidx.size()*k, -10, 10, &x);
+
+  ISA orig = ActiveISA();
+  SetISA(ISA::kGeneric);
+  SArray<real_t> y1(D.size*k);
+  SpMM::Times(D, x, k, &y1);
+
+  for (ISA isa : {ISA::kAVX2, ISA::kAVX512}) {
+    SetISA(isa);
+    SArray<real_t> y2(D.size*k);
+    SpMM::Times(D, x, k, &y2);
+    for (size_t i = 0; i < y1.size(); ++i) EXPECT_EQ(y1[i], y2[i]);
+  }
+  SetISA(orig);
+}
@@ -4,6 +4,7 @@
 #include <gtest/gtest.h>
 #include "./utils.h"
 #include "common/spmv.h"
+#include "difacto/loss.h"
 #include "dmlc/timer.h"
 #include "./spmv_test.h"
 
@@ -91,3 +92,30 @@ TEST(SpMV, TransTimesPos) {
   test::slice_vec(y_val, y_pos, &y2);
   EXPECT_EQ(norm2(y), norm2(y2));
 }
+
+TEST(SpMV, Compact) {
+  load_data(&data, &uidx);
+  auto D = data.GetBlock();
+  ASSERT_LE(uidx.size(), 1 << 16);
+  std::vector<uint32_t> offset(D.offset, D.offset + D.size + 1);
+  std::vector<uint16_t> index(D.index, D.index + D.offset[D.size]);
+  CompactRowBlock<uint16_t> C;
+  C.size = D.size;
+  C.offset = offset.data();
+  C.label = D.label;
+  C.weight = D.weight;
+  C.index = index.data();
+  C.value = D.value;
+
+  SArray<real_t> x;
+  gen_vals(uidx.size(), -10, 10, &x);
+  SArray<real_t> y1(D.size), y2(D.size);
+  SpMV::Times(D, x, &y1);
+  SpMV::Times(C, x, &y2);
+  EXPECT_EQ(norm2(y1), norm2(y2));
+
+  SArray<real_t> z1(uidx.size()), z2(uidx.size());
+  SpMV::TransTimes(D, y1, &z1);
+  SpMV::TransTimes(C, y1, &z2);
+  EXPECT_EQ(norm2(z1), norm2(z2));
+}
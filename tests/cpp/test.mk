@@ -12,7 +12,7 @@ build/difacto_tests: $(CPPTEST_OBJ) build/tests/main.o build/libdifacto.a $(DMLC
 	$(CXX) $(CFLAGS) -I$(GTEST_PATH)/include -o $@ $^ $(LDFLAGS) -L$(GTEST_PATH)/lib -lgtest
 
 CPPPERF_SRC = $(wildcard tests/cpp/*_perf.cc)
-CPPPERF = $(patsubst tests/cpp/%_perf.cc, build/%_perf, $(CPPTEST_SRC))
+CPPPERF = $(patsubst tests/cpp/%_perf.cc, build/%_perf, $(CPPPERF_SRC))
 
 
 build/%_perf : tests/cpp/%_perf.cc build/libdifacto.a $(DMLC_DEPS) ${DEPS}
@@ -0,0 +1,239 @@
+/**
+ *  Copyright (c) 2015 by Contributors
+ */
+#include <gtest/gtest.h>
+#include <functional>
+#include <memory>
+#include "./utils.h"
+#include "data/libsvm_parser.h"
+#include "reader/adfea_parser.h"
+#include "reader/criteo_parser.h"
+#include "reader/libsvm_parser.h"
+
+using namespace difacto;
+
+TEST(TextParser, ParseNumber) {
+  std::vector<std::string> reals = {
+    "0", "1", "-1", "+2.5", "0.000123", "1e5", "1.5E-3", "3.14159265358979323846",
+    "123456789012345678901234", "1e30", "1e-30", ".5", "5.", "0.1", "7e+2"};
+  for (auto s : reals) {
+    s += ' ';
+    real_t v;
+    auto end = TextParser::ParseReal(s.data(), s.data() + s.size(), &v);
+    EXPECT_EQ(v, strtof(s.c_str(), NULL)) << s;
+    EXPECT_EQ(end, s.data() + s.size() - 1) << s;
+  }
+
+  std::vector<std::string> uints = {
+    "0", "12345678", "123456789", "18446744073709551615"};
+  for (auto s : uints) {
+    s += ':';
+    uint64_t v;
+    auto end = TextParser::ParseUInt(s.data(), s.data() + s.size(), &v);
+    EXPECT_EQ(v, strtoull(s.c_str(), NULL, 10)) << s;
+    EXPECT_EQ(end, s.data() + s.size() - 1) << s;
+  }
+}
+
+TEST(TextParser, LibSVM) {
+  auto create = []() {
+    auto in = dmlc::InputSplit::Create("../tests/data", 0, 1, "text");
+    in->HintChunkSize(1 << 10);
+    return in;
+  };
+  dmlc::data::LibSVMParser<feaid_t> a(create(), 1);
+  LibSVMParser b(create(), 3);
+  std::vector<real_t> label[2], value[2];
+  std::vector<feaid_t> index[2];
+  std::vector<size_t> rowsize[2];
+  dmlc::data::ParserImpl<feaid_t>* parsers[2] = {&a, &b};
+  for (int i = 0; i < 2; ++i) {
+    while (parsers[i]->Next()) {
+      auto blk = parsers[i]->Value();
+      for (size_t j = 0; j < blk.size; ++j) {
+        label[i].push_back(blk.label[j]);
+        rowsize[i].push_back(blk.offset[j+1] - blk.offset[j]);
+        for (size_t k = blk.offset[j]; k < blk.offset[j+1]; ++k) {
+          index[i].push_back(blk.index[k]);
+          value[i].push_back(blk.value[k]);
+        }
+      }
+    }
+  }
+  EXPECT_EQ(label[0].size(), 100);
+  EXPECT_EQ(label[0], label[1]);
+  EXPECT_EQ(rowsize[0], rowsize[1]);
+  EXPECT_EQ(index[0], index[1]);
+  // dmlc::data::strtof may differ in the last bit
+  ASSERT_EQ(value[0].size(), value[1].size());
+  for (size_t i = 0; i < value[0].size(); ++i) {
+    EXPECT_NEAR(value[0][i], value[1][i], 1e-6 * fabs(value[0][i]));
+  }
+}
+
+TEST(TextParser, NegSampling) {
+  auto in = dmlc::InputSplit::Create("../tests/data", 0, 1, "text");
+  LibSVMParser parser(in, 2);
+  parser.SetNegSampling(.5, 0);
+  size_t npos = 0, nneg = 0;
+  while (parser.Next()) {
+    auto blk = parser.Value();
+    ASSERT_TRUE(blk.weight != NULL);
+    for (size_t i = 0; i < blk.size; ++i) {
+      if (blk.label[i] > 0) {
+        ++npos;
+        EXPECT_EQ(blk.weight[i], 1);
+      } else {
+        ++nneg;
+        EXPECT_EQ(blk.weight[i], 2);
+      }
+    }
+  }
+  // all 68 positive examples are kept, and about half of the 32 negative ones
+  EXPECT_EQ(npos, 68);
+  EXPECT_GT(nneg, 8);
+  EXPECT_LT(nneg, 24);
+}
+
+/** \brief parse the text by the parser created on the input */
+void parse_text(
+    const std::string& text,
+    const std::function<dmlc::data::ParserImpl<feaid_t>*(dmlc::InputSplit*)>& create,
+    std::vector<real_t>* label, std::vector<std::vector<feaid_t>>* rows) {
+  std::string file = "/tmp/difacto_test_parser.txt";
+  {
+    std::unique_ptr<dmlc::Stream> fo(dmlc::Stream::Create(file.c_str(), "w"));
+    fo->Write(text.data(), text.size());
+  }
+  std::unique_ptr<dmlc::data::ParserImpl<feaid_t>> parser(
+      create(dmlc::InputSplit::Create(file.c_str(), 0, 1, "text")));
+  while (parser->Next()) {
+    auto blk = parser->Value();
+    // binary features only
+    EXPECT_TRUE(blk.value == NULL);
+    for (size_t j = 0; j < blk.size; ++j) {
+      label->push_back(blk.label[j]);
+      rows->push_back(std::vector<feaid_t>(blk.index + blk.offset[j],
+                                           blk.index + blk.offset[j+1]));
+    }
+  }
+}
+
+/** \brief expose the hash of the fields */
+class CriteoHash : public CriteoParser {
+ public:
+  using CriteoParser::Hash;
+};
+
+TEST(CriteoParser, Inline) {
+  // a label, 13 integer and 26 categorical fields a line, some are empty. the
+  // lines end with LF, CRLF, or nothing at the end of a truncated file
+  std::vector<std::vector<std::string>> lines(3);
+  lines[0] = {"1", "5", "", "0", "-3"};
+  for (int i = 4; i < 13; ++i) lines[0].push_back(std::to_string(i * 11));
+  lines[0].insert(lines[0].end(), {"68fd1e64", "", "a"});
+  for (int i = 3; i < 25; ++i) lines[0].push_back("c" + std::to_string(i));
+  lines[0].push_back("");
+  lines[1] = {"0"};
+  lines[1].resize(14);
+  for (int i = 0; i < 26; ++i) lines[1].push_back("x" + std::to_string(i));
+  lines[2] = {"1", "7", "8"};
+  const char* ends[] = {"\n", "\r\n", ""};
+
+  std::string text = "\r\n";
+  std::vector<real_t> label_expected;
+  std::vector<std::vector<feaid_t>> rows_expected;
+  for (size_t i = 0; i < lines.size(); ++i) {
+    const auto& fields = lines[i];
+    label_expected.push_back(atoi(fields[0].c_str()));
+    std::vector<feaid_t> row;
+    for (size_t j = 0; j < fields.size(); ++j) {
+      text += (j ? "\t" : "") + fields[j];
+      if (j > 0 && !fields[j].empty()) {
+        auto hash = CriteoHash::Hash(fields[j].data(), fields[j].size());
+        row.push_back(EncodeFeaGrpID(hash, j - 1, 12));
+      }
+    }
+    text += ends[i];
+    rows_expected.push_back(row);
+  }
+  EXPECT_EQ(rows_expected[0].size(), 36);
+  EXPECT_EQ(rows_expected[1].size(), 26);
+  EXPECT_EQ(rows_expected[2].size(), 2);
+
+  for (int nthreads : {1, 3}) {
+    std::vector<real_t> label;
+    std::vector<std::vector<feaid_t>> rows;
+    parse_text(text, [nthreads](dmlc::InputSplit* in) {
+        return new CriteoParser(in, true, nthreads);
+      }, &label, &rows);
+    EXPECT_EQ(label, label_expected);
+    EXPECT_EQ(rows, rows_expected);
+  }
+}
+
+TEST(AdfeaParser, Inline) {
+  // "lineid count label feaid:gid ...", the label is 1 iff it starts with 1.
+  // the lines end with LF, CRLF, or nothing at the end of the file
+  std::string text =
+      "123 1 1 5:1 18446744073709551615:2 7:4095\n"
+      "124 1 0 9:3\r\n"
+      "\n"
+      "125 2 0\n"
+      "126 1 1 3:0\t4:1";
+  std::vector<real_t> label_expected = {1, 0, 0, 1};
+  std::vector<std::vector<feaid_t>> rows_expected = {
+    {EncodeFeaGrpID(5, 1, 12), EncodeFeaGrpID(18446744073709551615ULL, 2, 12),
+     EncodeFeaGrpID(7, 4095, 12)},
+    {EncodeFeaGrpID(9, 3, 12)},
+    {},
+    {EncodeFeaGrpID(3, 0, 12), EncodeFeaGrpID(4, 1, 12)}};
+  for (int nthreads : {1, 3}) {
+    std::vector<real_t> label;
+    std::vector<std::vector<feaid_t>> rows;
+    parse_text(text, [nthreads](dmlc::InputSplit* in) {
+        return new AdfeaParser(in, nthreads);
+      }, &label, &rows);
+    EXPECT_EQ(label, label_expected);
+    EXPECT_EQ(rows, rows_expected);
+  }
+}
+
+TEST(AdfeaParser, NegSampling) {
+  // the dropped lines are skipped, the kept negative ones are weighted by 2,
+  // and the features of each kept line are its own
+  std::string text;
+  for (int i = 0; i < 200; ++i) {
+    text += std::to_string(i) + " 1 " + (i % 3 ? "0 " : "1 ") +
+        std::to_string(i) + ":1 " + std::to_string(i + 1000) + ":2\n";
+  }
+  std::string file = "/tmp/difacto_test_parser.txt";
+  {
+    std::unique_ptr<dmlc::Stream> fo(dmlc::Stream::Create(file.c_str(), "w"));
+    fo->Write(text.data(), text.size());
+  }
+  AdfeaParser parser(dmlc::InputSplit::Create(file.c_str(), 0, 1, "text"), 3);
+  parser.SetNegSampling(.5, 0);
+  size_t npos = 0, nneg = 0;
+  while (parser.Next()) {
+    auto blk = parser.Value();
+    ASSERT_TRUE(blk.weight != NULL);
+    for (size_t i = 0; i < blk.size; ++i) {
+      ASSERT_EQ(blk.offset[i+1] - blk.offset[i], 2);
+      feaid_t id = blk.index[blk.offset[i]];
+      int line = -1;
+      for (int j = 0; j < 200; ++j) {
+        if (EncodeFeaGrpID(j, 1, 12) == id) line = j;
+      }
+      ASSERT_GE(line, 0);
+      EXPECT_EQ(blk.index[blk.offset[i] + 1], EncodeFeaGrpID(line + 1000, 2, 12));
+      EXPECT_EQ(blk.label[i], line % 3 ? 0 : 1);
+      EXPECT_EQ(blk.weight[i], line % 3 ? 2 : 1);
+      ++(line % 3 ? nneg : npos);
+    }
+  }
+  // all 67 positive lines are kept, and about half of the 133 negative ones
+  EXPECT_EQ(npos, 67);
+  EXPECT_GT(nneg, 40);
+  EXPECT_LT(nneg, 93);
+}
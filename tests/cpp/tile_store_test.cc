@@ -0,0 +1,231 @@
+/**
+ *  Copyright (c) 2015 by Contributors
+ */
+#include <gtest/gtest.h>
+#include "./utils.h"
+#include "data/tile_store.h"
+#include "data/tile_builder.h"
+#include "data/tile_cache.h"
+
+using namespace difacto;
+
+void build_tiles(const KWArgs& args, TileStore* store,
+                 std::vector<Range>* feapos) {
+  store->Init(args);
+  TileBuilder builder(store, 2, true, true);
+  BatchReader reader("../tests/data", "libsvm", 0, 1, 20);
+  SArray<feaid_t> feaids;
+  SArray<real_t> feacnts;
+  while (reader.Next()) builder.Add(reader.Value(), &feaids, &feacnts);
+  builder.Wait();
+  size_t n = feaids.size();
+  std::vector<Range> feablks = {Range(0, feaids[n/3]),
+                                Range(feaids[n/3], feaids[n/2]),
+                                Range(feaids[n/2], feaids[n-1]+1)};
+  builder.BuildColmap(feaids, feablks, feapos);
+}
+
+TEST(TileStore, MultiColumns) {
+  // in memory, and spilled to disk
+  TileStore mem, disk;
+  std::vector<Range> feapos;
+  build_tiles({}, &mem, &feapos);
+  build_tiles({{"data_cache", "/tmp/difacto_test_"},
+               {"max_mem_capacity", "1"}}, &disk, &feapos);
+  EXPECT_EQ(feapos.size(), 3);
+
+  for (int i = 0; i < 5; ++i) {
+    size_t nnz = 0, nrows = 0;
+    for (int j = 0; j < 3; ++j) {
+      Tile a, b;
+      mem.Prefetch(i, j);
+      mem.Fetch(i, j, &a);
+      disk.Prefetch(i, j);
+      disk.Fetch(i, j, &b);
+      // the offsets start from 0 for every tile
+      EXPECT_EQ(a.data.offset[0], 0);
+      EXPECT_EQ(a.data.offset.back(), a.data.index.size());
+      EXPECT_EQ(a.colmap.size() + 1, a.data.offset.size());
+      EXPECT_EQ(a.data.value.size(), a.xx_value.size());
+      for (size_t k = 0; k < a.xx_value.size(); ++k) {
+        EXPECT_EQ(a.data.value[k] * a.data.value[k], a.xx_value[k]);
+      }
+      check_equal(a.data.label, b.data.label);
+      check_equal(a.data.offset, b.data.offset);
+      check_equal(a.data.index, b.data.index);
+      check_equal(a.data.value, b.data.value);
+      check_equal(a.colmap, b.colmap);
+      nnz += a.data.index.size();
+      nrows = a.data.label.size();
+    }
+    EXPECT_GT(nnz, nrows);
+  }
+}
+
+TEST(TileStore, Compress) {
+  TileStore mem, comp;
+  std::vector<Range> feapos;
+  build_tiles({}, &mem, &feapos);
+  build_tiles({{"compress_tiles", "1"}}, &comp, &feapos);
+
+  // fetch twice to hit the decoded tile cache
+  for (int k = 0; k < 2; ++k) {
+    for (int i = 0; i < 5; ++i) {
+      for (int j = 0; j < 3; ++j) {
+        Tile a, b;
+        mem.Fetch(i, j, &a);
+        comp.Fetch(i, j, &b);
+        check_equal(a.data.label, b.data.label);
+        check_equal(a.data.offset, b.data.offset);
+        check_equal(a.data.index, b.data.index);
+        check_equal(a.data.value, b.data.value);
+        check_equal(a.xx_value, b.xx_value);
+        check_equal(a.colmap, b.colmap);
+      }
+    }
+  }
+}
+
+TEST(TileStore, Compact) {
+  TileStore mem, comp;
+  std::vector<Range> feapos;
+  build_tiles({}, &mem, &feapos);
+  build_tiles({{"compact_tiles", "1"}}, &comp, &feapos);
+
+  for (int i = 0; i < 5; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      Tile a, b, c;
+      mem.Fetch(i, j, &a);
+      comp.Fetch(i, j, &b);
+      comp.Fetch(i, j, &c, true);
+      // widened
+      EXPECT_TRUE(b.offset32.empty());
+      check_equal(a.data.label, b.data.label);
+      check_equal(a.data.offset, b.data.offset);
+      check_equal(a.data.index, b.data.index);
+      check_equal(a.data.value, b.data.value);
+      check_equal(a.colmap, b.colmap);
+      // compact
+      EXPECT_TRUE(c.data.offset.empty());
+      check_equal(a.data.label, c.data.label);
+      ASSERT_EQ(a.data.offset.size(), c.offset32.size());
+      for (size_t k = 0; k < c.offset32.size(); ++k) {
+        EXPECT_EQ(a.data.offset[k], c.offset32[k]);
+      }
+      ASSERT_EQ(a.data.index.size(), c.index16.size());
+      for (size_t k = 0; k < c.index16.size(); ++k) {
+        EXPECT_EQ(a.data.index[k], c.index16[k]);
+      }
+    }
+  }
+}
+
+TEST(TileStore, CompactWideIndex) {
+  // a row-major tile with more than 2^16 columns: 32-bit offsets with 32-bit
+  // indices
+  dmlc::data::RowBlockContainer<feaid_t> rowblk;
+  rowblk.Clear();
+  int ncols = 70000;
+  for (int i = 0; i < 3; ++i) {
+    for (int j = i; j < ncols; j += 2) {
+      rowblk.index.push_back(j);
+      rowblk.value.push_back(j % 7 + 1);
+    }
+    rowblk.offset.push_back(rowblk.index.size());
+    rowblk.label.push_back(i % 2);
+  }
+  TileStore mem, comp;
+  mem.Init({});
+  comp.Init({{"compact_tiles", "1"}});
+  for (TileStore* store : {&mem, &comp}) {
+    TileBuilder builder(store, 1);
+    SArray<feaid_t> feaids;
+    SArray<real_t> feacnts;
+    builder.Add(rowblk.GetBlock(), &feaids, &feacnts);
+    builder.Wait();
+    EXPECT_EQ(feaids.size(), ncols);
+    builder.BuildColmap(feaids);
+  }
+
+  Tile a, b, c;
+  mem.Fetch(0, 0, &a);
+  comp.Fetch(0, 0, &b);
+  comp.Fetch(0, 0, &c, true);
+  check_equal(a.data.offset, b.data.offset);
+  check_equal(a.data.index, b.data.index);
+  check_equal(a.data.label, c.data.label);
+  check_equal(a.data.value, c.data.value);
+  EXPECT_TRUE(c.data.offset.empty());
+  ASSERT_EQ(a.data.offset.size(), c.offset32.size());
+  for (size_t k = 0; k < c.offset32.size(); ++k) {
+    EXPECT_EQ(a.data.offset[k], c.offset32[k]);
+  }
+  // the indices do not fit into 16 bits, so they are kept as is
+  EXPECT_TRUE(c.index16.empty());
+  check_equal(a.data.index, c.data.index);
+}
+
+TEST(TileStore, Narrow) {
+  // offsets beyond 2^32 stay 64-bit, independent of the indices
+  SArray<size_t> offset = {0, 5, 1ull << 32};
+  SArray<uint32_t> offset32;
+  EXPECT_FALSE(TileStore::Narrow(offset, &offset32));
+  EXPECT_TRUE(offset32.empty());
+  offset[offset.size() - 1] = (1ull << 32) - 1;
+  EXPECT_TRUE(TileStore::Narrow(offset, &offset32));
+  EXPECT_EQ(offset32.back(), (1ull << 32) - 1);
+
+  SArray<unsigned> index = {3, 65535};
+  SArray<uint16_t> index16;
+  EXPECT_TRUE(TileStore::Narrow(index, &index16));
+  EXPECT_EQ(index16.back(), 65535);
+  index.push_back(65536);
+  index16.clear();
+  EXPECT_FALSE(TileStore::Narrow(index, &index16));
+  EXPECT_TRUE(index16.empty());
+}
+
+TEST(TileStore, Cache) {
+  // the weights given by negative sampling are kept in the cache
+  std::string filename = "/tmp/difacto_test_tile_cache";
+  TileStore store, loaded;
+  store.Init({});
+  loaded.Init({});
+  TileBuilder builder(&store, 2, true, true);
+  TileBuilder loaded_builder(&loaded, 2, true, true);
+  BatchReader reader("../tests/data", "libsvm", 0, 1, 20, 0, .5);
+  SArray<feaid_t> feaids, loaded_feaids;
+  SArray<real_t> feacnts, loaded_feacnts;
+  while (reader.Next()) builder.Add(reader.Value(), &feaids, &feacnts);
+  builder.Wait();
+  // the counts beyond 2^24 are kept exactly
+  std::vector<uint64_t> counts = {(1 << 24) + 1, 3}, loaded_counts;
+  std::vector<real_t> info = {1, 2}, loaded_info;
+  TileCache(filename, "sig").Save(builder, feaids, feacnts, counts, info);
+  EXPECT_FALSE(TileCache(filename, "other").Load(
+      &loaded_builder, &loaded_feaids, &loaded_feacnts, &loaded_counts,
+      &loaded_info));
+  ASSERT_TRUE(TileCache(filename, "sig").Load(
+      &loaded_builder, &loaded_feaids, &loaded_feacnts, &loaded_counts,
+      &loaded_info));
+  check_equal(feaids, loaded_feaids);
+  EXPECT_EQ(counts, loaded_counts);
+  EXPECT_EQ(info, loaded_info);
+  std::vector<Range> feablks = {Range(0, feaids.back() + 1)}, feapos;
+  builder.BuildColmap(feaids, feablks, &feapos);
+  loaded_builder.BuildColmap(loaded_feaids, feablks, &feapos);
+
+  size_t nweights = 0;
+  for (int i = 0; i < 5; ++i) {
+    Tile a, b;
+    store.Fetch(i, 0, &a);
+    loaded.Fetch(i, 0, &b);
+    EXPECT_EQ(a.data.weight.size(), a.data.label.size());
+    check_equal(a.data.label, b.data.label);
+    check_equal(a.data.weight, b.data.weight);
+    check_equal(a.data.index, b.data.index);
+    nweights += a.data.weight.size();
+  }
+  EXPECT_GT(nweights, 0);
+  remove(filename.c_str());
+}